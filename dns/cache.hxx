@@ -2,7 +2,10 @@
 #define _DNS_CACHE_HXX_ 1
 
 #include <cinttypes>
-#include <unordered_set>
+#include <array>
+#include <deque>
+#include <memory>
+#include <string>
 #include <vector>
 #include <ctime>
 
@@ -11,38 +14,79 @@
 
 namespace dns {
 
-typedef std::pair<std::string,std::uint16_t> k_t;
-// typedef std::string cache_key;
-typedef k_t cache_key;
-
-namespace detail {
-// from boost/functional/hash/hash.hpp
-inline void hash_combine (std::size_t& seed, std::size_t value) noexcept
+//! One cached answer. The name and answers up to inline_size bytes share the
+//! entry, larger answers take a separate block. The header and short names
+//! fit the first cache line.
+class DNS_API cache_entry
 {
-	seed ^= value + 0x9e3779b9 + (seed<<6) + (seed>>2);
-}
+public:
 
-} // namespace dns::detail
+	static constexpr const std::size_t inline_size = 272u;
 
-struct su_hash
-{
-	std::size_t operator() (const cache_key &h) const noexcept
+	std::time_t deadline = 0;
+
+	//! lower case
+	const char *name() const noexcept
 	{
-		std::size_t seed = 0;
-		detail::hash_combine (seed, std::hash <std::string>() (h.first));
-		detail::hash_combine (seed, std::hash <std::uint16_t>() (h.second));
-		return seed;
+		return reinterpret_cast <const char *> (&inline_[0]);
 	}
-};
 
-struct cache_entry : public cache_key
-{
-	mutable std::time_t deadline;
-	mutable std::vector<std::uint8_t> response;
-};
+	std::size_t name_size() const noexcept {return name_size_;}
+
+	rr_type type() const noexcept {return static_cast <rr_type> (qtype_);}
+
+	const std::uint8_t *response() const noexcept
+	{
+		return large_ ? large_.get() : &inline_[name_size_];
+	}
+
+	std::size_t response_size() const noexcept {return response_size_;}
+
+	//! since stored or refreshed
+	unsigned hits() const noexcept {return hits_;}
+
+	//! NXDOMAIN or NODATA, kept in a partition of its own
+	bool negative() const noexcept {return negative_;}
+
+private:
+
+	friend class cache;
+
+	//! name is lower cased
+	void assign (std::uint32_t hash, const char *name, std::size_t size,
+		std::uint16_t qtype);
+
+	//! with the TTL offsets of the answer, or raw if it was not parsed
+	void set_response (const std::uint8_t *, std::size_t,
+		const std::vector <std::uint16_t> &ttl_offsets, bool raw);
+
+	//! answer, then its TTL offsets
+	std::size_t block_size() const noexcept
+	{
+		return response_size_ + (raw != ttls_ ? ttls_ * sizeof (std::uint16_t) : 0u);
+	}
+
+	//! memory outside of the entry
+	std::size_t spilled() const noexcept {return large_ ? block_size() : 0u;}
+
+	//! copies the answer into the message, patches the ID and the TTLs
+	void write_answer (query &, std::uint16_t id, std::int32_t ttl) const;
 
-typedef std::unordered_set<cache_entry, su_hash> cache_list_t;
-// typedef std::unordered_map<cache_key,cache_response, su_hash> cache_list_t;
+	static constexpr const std::uint16_t raw = 0xffffu; //!< TTLs not found
+
+	std::time_t renewed_ = 0; //!< deadline before a refresh ahead, until hit past it
+	std::uint32_t hash_ = 0, ttl_ = 0;
+	std::uint32_t heap_ = 0; //!< position in the expiry heap
+	std::uint16_t qtype_ = 0, response_size_ = 0, hits_ = 0;
+	std::uint16_t ttls_ = raw; //!< TTL fields in the answer
+	std::uint8_t name_size_ = 0;
+	bool used_ = false;
+	bool refreshing_ = false; //!< refresh ahead asked for, answer not stored yet
+	bool negative_ = false;
+	mutable bool referenced_ = false; //!< second chance on the eviction clock
+	std::unique_ptr <std::uint8_t[]> large_;
+	std::array <std::uint8_t, inline_size> inline_;
+};
 
 class DNS_API cache
 {
@@ -53,15 +97,111 @@ public:
 		// DNS_NO_EXPORT static constexpr const int max_ttl = 86400, min_ttl = 60;
 		static inline constexpr int max_ttl() noexcept {return 86400;}
 		static inline constexpr int min_ttl() noexcept {return 60;}
-		static inline constexpr unsigned max_size() noexcept {return 50;}
+		static inline constexpr std::size_t max_entries() noexcept {return 100000u;}
+		static inline constexpr std::size_t max_bytes() noexcept {return 64u << 20;}
+		static inline constexpr unsigned prefetch_hits() noexcept {return 8u;}
+		static inline constexpr unsigned prefetch_percent() noexcept {return 10u;}
+		//! TTL of stale answers, RFC 8767
+		static inline constexpr int stale_answer_ttl() noexcept {return 30;}
+		//! RFC 2308 suggests at most a few hours
+		static inline constexpr int max_negative_ttl() noexcept {return 10800;}
+		static inline constexpr std::size_t max_negative_entries() noexcept
+		{
+			return 20000u;
+		}
+		static inline constexpr std::size_t max_negative_bytes() noexcept
+		{
+			return 8u << 20;
+		}
+	};
+
+	//! Cache size is kept within both, for positive and negative entries apart
+	struct limits
+	{
+		std::size_t entries, bytes;
+	};
+
+	//! Refresh ahead: entries hit at least hits times since stored, with at most
+	//! percent of their TTL left, are asked for again before they expire
+	struct prefetch
+	{
+		unsigned hits, percent; //!< no refresh ahead with 0 hits
+	};
+
+	//! What retrieve found, besides an answer
+	struct hint
+	{
+		bool refresh = false; //!< time to refresh ahead, given once per entry
+		bool stale = false; //!< expired, but can still be served stale
 	};
 
-	explicit cache (unsigned short minttl);
+	explicit cache (unsigned short minttl, const limits & = limits
+		{defaults::max_entries(), defaults::max_bytes()});
+
+	cache (cache &&) = default;
+	cache &operator= (cache &&) = default;
 
 	time_t min_ttl() const noexcept {return min_ttl_;}
 
-	std::size_t size() const {return cache_entries_.size();}
+	std::size_t size() const noexcept {return size_;}
+
+	//! memory taken by the entries, names and answers included
+	std::size_t bytes() const noexcept {return bytes_;}
+
+	//! of positive entries
+	const limits &size_limits() const noexcept {return limits_;}
+
+	//! throws what set_limits and set_negative_limits would throw
+	static void check (const limits &);
+
+	//! throws what set_prefetch would throw
+	static void check (const prefetch &);
+
+	//! evicts entries right away, if over the new limits
+	void set_limits (const limits &);
+
+	//! NXDOMAIN and NODATA entries, within size() and bytes()
+	std::size_t negative_size() const noexcept {return negative_size_;}
+
+	std::size_t negative_bytes() const noexcept {return negative_bytes_;}
+
+	const limits &negative_limits() const noexcept {return negative_limits_;}
+
+	void set_negative_limits (const limits &);
+
+	//! entries dropped to stay within the limits
+	std::size_t evictions() const noexcept {return evictions_;}
+
+	//! entries dropped after their TTL
+	std::size_t expirations() const noexcept {return expirations_;}
 
+	const prefetch &prefetch_policy() const noexcept {return prefetch_;}
+
+	void set_prefetch (const prefetch &);
+
+	//! refreshes ahead asked for by retrieve
+	std::size_t prefetches() const noexcept {return prefetches_;}
+
+	//! questions answered by refreshed entries, which would have expired
+	std::size_t prefetch_hits() const noexcept {return prefetch_hits_;}
+
+	//! seconds expired entries are kept to be served stale
+	unsigned stale_period() const noexcept {return stale_;}
+
+	void set_stale_period (unsigned seconds) noexcept {stale_ = seconds;}
+
+	//! questions answered with stale entries
+	std::size_t stale_answers() const noexcept {return stale_answers_;}
+
+	//! questions looked up by retrieve
+	std::size_t lookups() const noexcept {return lookups_;}
+
+	//! of them answered with positive and with negative entries
+	std::size_t hits() const noexcept {return hits_;}
+
+	std::size_t negative_hits() const noexcept {return negative_hits_;}
+
+	//! qname in any case, the entry is valid until the cache changes
 	const cache_entry * find(const std::string &qname, rr_type qtype) const;
 
 	void replace_entry(const std::string &wire_qname,
@@ -71,21 +211,149 @@ public:
 	 */
 	bool retrieve(query &q);
 
-	//! Store DNS query in cache if necessary
-	void store(const query &q);
+	bool retrieve(query &q, hint &);
+
+	//! answers with an entry expired less than the stale period ago, or a fresh one
+	bool retrieve_stale(query &q);
+
+	//! Store DNS query in cache if necessary, negative answers for the
+	//! negative_ttl of the response, not cached without SOA
+	//! @return the stored entry, valid until the cache changes
+	const cache_entry *store(const query &q);
 
-	static cache load (const std::string & file_name, unsigned short minttl);
+	//! Files hold a header and records of entries, each padded to 8 bytes.
+	//! Snapshots hold all entries, journals are appended to, later records of
+	//! an entry replace earlier ones.
+	static constexpr const std::uint32_t file_version = 2u;
+
+	static void write_header (std::vector<std::uint8_t> &, bool journal,
+		std::uint64_t records);
+
+	static void write_record (std::vector<std::uint8_t> &, const cache_entry &);
+
+	//! snapshot of all entries
+	std::vector<std::uint8_t> image() const;
+
+	//! Appends the records of `budget` entries at most, from the `next` one on,
+	//! to a snapshot image started by write_header. The cache may change
+	//! between slices, journaled entries replace what the image holds.
+	//! @return true if entries are left
+	bool image_slice (std::vector<std::uint8_t> &, std::size_t &next,
+		std::size_t budget, std::uint64_t &records) const;
+
+	//! number of records in the header of a snapshot image
+	static void set_records (std::vector<std::uint8_t> &, std::uint64_t records);
+
+	//! Adds the entries of a snapshot or journal, an incomplete record at the
+	//! end of a journal is ignored
+	//! @return records read
+	std::size_t merge (const std::uint8_t *bytes, std::size_t size,
+		const std::string &file_name);
+
+	//! maps the snapshot
+	static cache load (const std::string & file_name, unsigned short minttl,
+		const limits & = limits {defaults::max_entries(),
+		defaults::max_bytes()});
 
 	void save_as (const std::string & file_name) const;
 
+	//! Removes at most budget entries expired by now, and past the stale
+	//! period, earliest first
+	//! @return true if more expired entries remain
+	bool expire (std::time_t now, std::size_t budget);
+
+	//! when the first entry is to be removed, the cache must not be empty
+	std::time_t next_expiry() const noexcept;
+
 	//! Remove expired entries
 	void collect_garbage();
 
 private:
 
-	cache_list_t cache_entries_;
-	//! @todo unused
-	std::size_t cache_entries_max;
+	//! Open addressing with Robin Hood probing, kept at most 7/8 full
+	struct slot
+	{
+		std::uint32_t hash, entry;
+	};
+
+	static constexpr const std::uint32_t none = ~std::uint32_t {0};
+
+	static std::uint32_t hash (const char *name, std::size_t size, std::uint16_t qtype)
+		noexcept;
+
+	static std::size_t footprint (const cache_entry &) noexcept;
+
+	//! walks the probe sequence of the hash
+	//! @return entry index or none
+	template <class Equal>
+	std::uint32_t probe (std::uint32_t hash, std::uint16_t qtype, std::size_t size,
+		Equal &&same) const noexcept;
+
+	//! @return entry index or none
+	std::uint32_t lookup (std::uint32_t hash, const char *name, std::size_t size,
+		std::uint16_t qtype) const noexcept;
+
+	//! by the name as sent
+	std::uint32_t lookup (const question_view &) const noexcept;
+
+	std::uint32_t insert (std::uint32_t hash, const char *name, std::size_t name_size,
+		std::uint16_t qtype, const std::uint8_t *response, std::size_t size,
+		std::time_t deadline);
+
+	//! adds or replaces the entry, the name in any case
+	//! @return nullptr if evicted right away
+	const cache_entry *put (const char *name, std::size_t name_size,
+		std::uint16_t qtype, const std::uint8_t *response, std::size_t size,
+		std::time_t deadline);
+
+	void erase (std::uint32_t entry);
+
+	//! counts the entry in its partition
+	void charge (const cache_entry &) noexcept;
+
+	void discharge (const cache_entry &) noexcept;
+
+	//! partition over its limits
+	bool over_limits (bool negative) const noexcept;
+
+	//! links into the index, the entry is not there yet
+	void link (std::uint32_t hash, std::uint32_t entry) noexcept;
+
+	void unlink (std::uint32_t hash, std::uint32_t entry) noexcept;
+
+	void grow();
+
+	//! min-heap of entries by deadline, swaps keep entry positions
+	void heap_push (std::uint32_t entry);
+
+	void heap_remove (std::uint32_t entry) noexcept;
+
+	//! after the deadline of the entry changed
+	void heap_update (std::uint32_t entry) noexcept;
+
+	bool heap_sift_up (std::size_t position) noexcept;
+
+	void heap_sift_down (std::size_t position) noexcept;
+
+	void heap_set (std::size_t position, std::uint32_t entry) noexcept;
+
+	//! CLOCK: skips and clears referenced entries, evicts the first other one,
+	//! of a partition over its limits
+	void evict_over_limits();
+
+	std::vector <slot> index_;
+	std::deque <cache_entry> entries_; //!< never move, unused ones are reused
+	std::vector <std::uint32_t> free_, expiry_;
+	std::vector <std::uint16_t> offsets_; //!< TTL offsets of the answer being stored
+	std::size_t size_ = 0, hand_ = 0, bytes_ = 0, evictions_ = 0, expirations_ = 0;
+	std::size_t negative_size_ = 0, negative_bytes_ = 0;
+	std::size_t prefetches_ = 0, prefetch_hits_ = 0, stale_answers_ = 0;
+	std::size_t lookups_ = 0, hits_ = 0, negative_hits_ = 0;
+	unsigned stale_ = 0;
+	limits limits_;
+	limits negative_limits_ {defaults::max_negative_entries(),
+		defaults::max_negative_bytes()};
+	prefetch prefetch_ {defaults::prefetch_hits(), defaults::prefetch_percent()};
 	time_t min_ttl_, now_;
 };
 
@@ -0,0 +1,108 @@
+#ifndef DNS_CACHE_STORE_HXX
+#define DNS_CACHE_STORE_HXX
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <fstream>
+#include <cstdint>
+#include <cstddef>
+
+#include <ev++.h>
+
+#include <dns/dll.hxx>
+
+namespace dns {
+
+class cache;
+class cache_entry;
+
+//! Keeps the cache on disk, in a snapshot and a journal of entries stored
+//! since. New entries are appended to the journal in batches. Once the
+//! journal outgrows the snapshot, the journal starts over and the snapshot is
+//! rewritten: its image is built in slices, one per loop iteration however
+//! busy the loop is, then written by a background thread.
+class DNS_API cache_store
+{
+public:
+
+	//! journal bytes written at once
+	static constexpr const std::size_t batch_bytes = 4096u;
+
+	//! seconds a batch may wait
+	static constexpr const double batch_seconds = 5.;
+
+	//! journal bytes not worth compacting, whatever the snapshot size
+	static constexpr const std::size_t min_journal_bytes = 1u << 20;
+
+	//! cache entries put into the snapshot image per loop iteration
+	static constexpr const std::size_t slice_entries = 256u;
+
+	cache_store (const std::string &directory, ev::loop_ref);
+
+	//! waits for the snapshot thread, writes the pending batch
+	~cache_store();
+
+	cache_store (const cache_store &) = delete;
+	cache_store &operator= (const cache_store &) = delete;
+
+	//! snapshot, then journals, in the order written
+	//! @return records read
+	std::size_t load (cache &);
+
+	//! journals the entry, the cache is read later on while compacting, it
+	//! must outlive the store
+	void append (const cache_entry &, const cache &);
+
+	//! writes the pending batch
+	void flush();
+
+	//! writes the whole cache as the snapshot now and empties the journal
+	void save (const cache &);
+
+	const std::string &snapshot_name() const noexcept {return snapshot_;}
+
+	const std::string &journal_name() const noexcept {return journal_;}
+
+	std::size_t journal_bytes() const noexcept {return journal_bytes_;}
+
+	std::size_t compactions() const noexcept {return compactions_;}
+
+	//! the snapshot image is being built
+	bool compacting() const noexcept {return nullptr != imaged_;}
+
+private:
+
+	static void timer_callback (ev::timer &, int);
+
+	static void slice_callback (ev::timer &, int);
+
+	//! new journal, starts with the header
+	void open_journal();
+
+	//! journal moves aside, the snapshot image is built in slices
+	void compact (const cache &);
+
+	//! @return true once the image is complete and handed to the thread
+	bool write_slice();
+
+	//! the journals on disk still hold what the image would have
+	void abandon_image() noexcept;
+
+	void join() noexcept;
+
+	std::string snapshot_, journal_, old_journal_;
+	std::ofstream journal_file_;
+	std::vector<std::uint8_t> batch_;
+	std::size_t journal_bytes_ = 0, snapshot_bytes_ = 0, compactions_ = 0;
+	std::thread compactor_;
+	ev::timer timer_;
+	ev::timer slicer_; //!< zero delay, started again until the image is built
+	const cache *imaged_ = nullptr;
+	std::vector<std::uint8_t> image_;
+	std::size_t image_next_ = 0;
+	std::uint64_t image_records_ = 0;
+};
+
+} // namespace dns
+#endif
@@ -2,6 +2,7 @@
 #define __DNS_CRYPT_CERTIFIER_HXX__ 1
 
 #include <memory>
+#include <functional>
 
 #include <ev++.h>
 
@@ -20,7 +21,7 @@ public:
 
 	//! @todo unused constexpr static const unsigned  test_cert_margin = -1;
 
-	certifier(resolver &&, network::proto, double tout);
+	certifier(resolver &&, network::proto, double tout, ev::loop_ref);
 
 	const resolver &provider() const {return *resolver_;}
 
@@ -32,6 +33,9 @@ public:
 
 	void process_response(query &q);
 
+	//! called when the provider becomes ready or stops being ready
+	void on_ready_changed (std::function <void()> &&f) {ready_changed_ = std::move (f);}
+
 private:
 	// template<bool T> friend class request;
 
@@ -64,6 +68,7 @@ private:
 	std::unique_ptr<network::upstream> upstream_;
 	double timeout_seconds_ = 10.5;
 	std::size_t attempts_ = 0;
+	std::function <void()> ready_changed_;
 };
 
 }} // namespace dns::crypt
@@ -23,7 +23,8 @@ public:
 
 	cresponder (const dns::responder::parameters &,
 		const std::string &dnscrypt_resolvers,
-		std::unique_ptr<server::responder> s = nullptr);
+		std::unique_ptr<server::responder> s = nullptr,
+		ev::loop_ref = ev::get_default_loop());
 
 	void process(std::shared_ptr<network::incoming> &&) override;
 
@@ -33,11 +34,16 @@ public:
 
 	void update_certificates();
 
+	//! the DNSCrypt resolvers file is read in the thread of the event loop
 	void reload(const dns::responder::parameters &,
+		std::shared_ptr<const configuration> &&,
 		const std::string &dnscrypt_resolvers_file);
 
 	void save_providers (const std::string &filename) const;
 
+	//! ready DNSCrypt providers and plain DNS ones
+	std::vector<std::shared_ptr<network::provider>> providers() const override;
+
 private:
 
 	void load (const std::string &dnscrypt_resolvers_file, bool noipv6,
@@ -46,16 +52,22 @@ private:
 	std::shared_ptr <network::provider> random_provider (const query &) const
 		override;
 
-	void select_random_provider() const;
+	//! collects DNSCrypt providers with a valid certificate, after a change
+	void update_ready();
 
 	std::map <std::string, std::shared_ptr <certifier>> dnscrypt_providers_;
 
+	//! DNSCrypt providers with a valid certificate, upstream is picked from them
+	std::vector<std::shared_ptr<network::provider>> ready_;
+
+	//! questions without a ready provider since the last warning
+	mutable std::size_t unready_ = 0;
+	mutable ev::tstamp unready_warned_ = 0.;
+
 	std::unique_ptr< server::responder > server_ptr_;
 
 	// copy constructor is deleted in ev::timer, and move does not work
 	ev::timer random_timer_;
-
-	mutable std::string random_dnscrypt_provider_;
 };
 
 }}
@@ -26,10 +26,18 @@ public:
 
 	void execute();
 
-	void reload() override;
+protected:
+
+	std::shared_ptr<dns::responder> make_responder (ev::loop_ref) override;
+
+	void start_responder (dns::responder &) override;
+
+	void reload_responder (dns::responder &,
+		std::shared_ptr<const responder_configuration>) override;
 
 private:
 
+	std::unique_ptr<server::responder> make_server() const;
 };
 
 }}
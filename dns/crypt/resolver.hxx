@@ -70,8 +70,14 @@ public:
 
 	void fold(network::packet &q) override;
 
-	std::unique_ptr <network::packet> adapt_message (const std::unique_ptr
-		<network::packet> &other) const override;
+	std::unique_ptr <network::packet> adapt_message (std::unique_ptr
+		<network::packet> &&other) const override;
+
+	//! client nonce, the first half of it is random
+	echo_field echo() const noexcept override
+	{
+		return {magic_size + ::crypt::pubkey::size, magic_size, 8u, false};
+	}
 
 private:
 	::crypt::pubkey pubkey_, // provider public key
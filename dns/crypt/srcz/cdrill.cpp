@@ -55,8 +55,8 @@ class cert_request : public std::conditional<static_cast<bool>(TCP),
 			this->message_mod().set_size(0);
 			// this->message_ptr();
 			auto qptr = std::make_unique <dns::query> (this->question_);
-			this->dns_request_ = std::make_unique<base_t> (this->crypt_provider_ptr_,
-				std::move (qptr), 5.5);
+			this->dns_request_ = std::make_unique<base_t> (this->event_loop(),
+				this->crypt_provider_ptr_, std::move (qptr), 5.5);
 		}
 		else
 			logg::error ("certificate request failed");
@@ -76,7 +76,7 @@ public:
 	// pass network::provider copy of dns::crypt::resolver
 	// because certifier should not encrypt and decrypt DNS queries
 	cert_request(std::shared_ptr<dns::crypt::resolver> &&c, const dns::query &q)
-		: base_t (std::make_shared<network::provider>(*c),
+		: base_t (ev::get_default_loop(), std::make_shared<network::provider>(*c),
 			std::make_unique <dns::query> (c->hostname().c_str(), true), 5.5),
 		crypt_provider_ptr_ (std::move(c)), question_ (q) {}
 };
@@ -177,14 +177,14 @@ void run(int argc, char *argv[])
 			auto prov = std::make_shared<network::provider>(addr, tt);
 			if( network::proto::tcp == tt )
 			{
-				auto t = std::make_unique<network::tcp::upstream> (std::move(prov),
-					std::move (msgptr), 5.5);
+				auto t = std::make_unique<network::tcp::upstream>
+					(ev::get_default_loop(), std::move(prov), std::move (msgptr), 5.5);
 				req = std::move(t);
 			}
 			else
 			{
-				auto u = std::make_unique<network::udp::out>( std::move(prov),
-					std::move (msgptr), 5.5);
+				auto u = std::make_unique<network::udp::out> (ev::get_default_loop(),
+					std::move(prov), std::move (msgptr), 5.5);
 				req = std::move(u);
 			}
 		}
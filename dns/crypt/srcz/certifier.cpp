@@ -58,7 +58,21 @@ void certifier::process_response(query &q)
 	std::vector<std::vector<std::uint8_t> > txt_data;
 	q.get_txt_answer(txt_data);
 	auto &provider = this->modify_provider();
-	if( provider.find_valid_certificate( txt_data ) )
+	const bool was_ready = provider.is_ready();
+	bool valid = false;
+	try
+	{
+		valid = provider.find_valid_certificate (txt_data);
+	}
+	catch (...)
+	{
+		if (was_ready && ready_changed_)
+			ready_changed_(); // not ready any more
+		throw;
+	}
+	if (was_ready != provider.is_ready() && ready_changed_)
+		ready_changed_();
+	if( valid )
 	{   // success
 		this->reset_query_retry_step();
 		this->reschedule_query_after_success();
@@ -89,8 +103,9 @@ public:
 
 	// pass dns::provider copy of dns::crypt::resolver
 	// because certifier should not encrypt and decrypt DNS queries
-	request(std::weak_ptr<certifier> &&c, std::unique_ptr <query> &&q, double tsec)
-		: base_t (std::make_shared<network::provider>(*c.lock()->provider_ptr()),
+	request(ev::loop_ref loop, std::weak_ptr<certifier> &&c,
+		std::unique_ptr <query> &&q, double tsec)
+		: base_t (loop, std::make_shared<network::provider>(*c.lock()->provider_ptr()),
 			std::move (q), tsec),
 		certifier_ (std::move(c)) {}
 };
@@ -121,11 +136,11 @@ void certifier::update()
 		std::shared_ptr<certifier> nptr = this->shared_from_this();
 		this->upstream_ = (network::proto::tcp == this->tcp_only()) ?
 			static_cast<std::unique_ptr<network::upstream> >(
-				std::make_unique< request<network::proto::tcp> >(nptr, std::move (q),
-					timeout_seconds_))
+				std::make_unique< request<network::proto::tcp> >(timer_.loop, nptr,
+					std::move (q), timeout_seconds_))
 			: static_cast<std::unique_ptr<network::upstream> >(
-				std::make_unique< request<network::proto::udp> >(nptr, std::move (q),
-					timeout_seconds_));
+				std::make_unique< request<network::proto::udp> >(timer_.loop, nptr,
+					std::move (q), timeout_seconds_));
 		assert( this->upstream_ );
 		++attempts_;
 		return;
@@ -158,12 +173,12 @@ void certifier::retry_timer_callback(ev::timer &t, int)
 	}
 }
 
-certifier::certifier (resolver &&r, network::proto tcp, double tsec)
+certifier::certifier (resolver &&r, network::proto tcp, double tsec,
+	ev::loop_ref loop)
 	: query_retry_step_ (0U), resolver_ (std::make_shared <resolver> (std::move(r))),
 	tcp_only_ (tcp), timeout_seconds_ (tsec)
 {
-	auto dl = ev::get_default_loop();
-	timer_.set(dl);
+	timer_.set (loop);
 	timer_.set<certifier::retry_timer_callback>();
 	ev::tstamp after = retry::min_delay;
 	timer_.set(after, after);
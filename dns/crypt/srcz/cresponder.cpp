@@ -20,7 +20,7 @@ namespace log = process::log;
 void random_callback(ev::timer &t, int)
 {
 	assert (nullptr != t.data);
-	const auto &cr = *reinterpret_cast <const cresponder *> (t.data);
+	auto &cr = *reinterpret_cast <cresponder *> (t.data);
 	log::notice ("RND! processed: ", cr.processed_count(), ", cached: ",
 		cr.cached_count(), ", queued: ", cr.q_count(), ", blacklisted: ",
 		cr.blacklisted_count());
@@ -28,22 +28,21 @@ void random_callback(ev::timer &t, int)
 	{
 		const std::string fn1 = cr.cache_dir() + "/ready_dnscrypt_providers.csv";
 		cr.save_providers (fn1);
-		const std::string fn2 =  cr.cache_dir() + "/dnscache.bin";
-		cr.cache().save_as (fn2);
-		log::notice ("Saved providers: ", fn1, ", cache: ", fn2);
+		cr.flush_cache();
+		log::notice ("Saved providers: ", fn1);
 	}
 	// cr.select_random_provider();
 }
 
 cresponder::cresponder (const dns::responder::parameters &params,
 	const std::string &dnscrypt_resolvers_file,
-	std::unique_ptr<server::responder> srv)
-	: dns::responder (params), server_ptr_ (std::move(srv))
+	std::unique_ptr<server::responder> srv, ev::loop_ref loop)
+	: dns::responder (params, loop), server_ptr_ (std::move(srv))
 {
 	this->load (dnscrypt_resolvers_file, params.noipv6, params.net_proto,
 		params.timeout);
 	this->random_timer_.set <random_callback>();
-	this->random_timer_.set (ev::get_default_loop());
+	this->random_timer_.set (this->event_loop());
 	this->random_timer_.data = this;
 	constexpr const unsigned update = 7U; // minutes
 	this->random_timer_.repeat = update*60.; // seconds
@@ -77,9 +76,12 @@ void cresponder::load(const std::string &dnscrypt_resolvers_file, bool noipv6,
 				const bool found = (this->dnscrypt_providers_.end() != it);
 				used += use;
 				if (use && !found)
-					this->dnscrypt_providers_.emplace (ipp,
-						std::make_shared<certifier> (std::move (resolver),
-							tcponly, timeout));
+				{
+					auto cert = std::make_shared<certifier> (std::move (resolver),
+						tcponly, timeout, this->event_loop());
+					cert->on_ready_changed ([this] {this->update_ready();});
+					this->dnscrypt_providers_.emplace (ipp, std::move (cert));
+				}
 				if (!use && found)
 					this->dnscrypt_providers_.erase (it);
 			}
@@ -106,6 +108,7 @@ void cresponder::load(const std::string &dnscrypt_resolvers_file, bool noipv6,
 			log::error (e.what());
 		}
 		log::info ("DNScrypt resolvers: ", this->dnscrypt_providers_.size());
+		this->update_ready();
 	}
 	catch(std::exception &e)
 	{
@@ -120,9 +123,10 @@ void cresponder::load(const std::string &dnscrypt_resolvers_file, bool noipv6,
 }
 
 void cresponder::reload(const dns::responder::parameters &p,
+	std::shared_ptr<const configuration> &&config,
 	const std::string &dnscrypt_resolvers_file)
 {
-	this->dns::responder::reload (p);
+	this->dns::responder::reload (p, std::move (config));
 	this->load (dnscrypt_resolvers_file, p.noipv6, p.net_proto, p.timeout);
 }
 
@@ -243,36 +247,27 @@ void cresponder::process(std::shared_ptr<network::incoming> &&q)
 	this->dns::responder::process(std::move(q));
 }
 
-void cresponder::select_random_provider() const
+void cresponder::update_ready()
 {
 	const auto &providers = this->dnscrypt_providers_;
-	std::vector <std::string> ready;
+	auto &ready = this->ready_;
+	ready.clear();
 	ready.reserve (providers.size());
 	for(const auto &pp : providers)
 	{
-		const auto &r = *pp.second->provider_ptr();
-		if( r.is_ready() )
-			ready.emplace_back (pp.first);
-	}
-	if( !ready.empty() )
-	{
-		//! @todo numeric_cast
-		unsigned mx = static_cast<unsigned>(ready.size());
-		if( mx > RAND_MAX )
-			mx = RAND_MAX;
-		if( 0==mx )
-			mx = 1;
-		//! @todo numeric_cast
-		this->random_dnscrypt_provider_ = ready.at (static_cast<unsigned>
-			(std::rand()) % mx);
+		auto r = pp.second->provider_ptr();
+		if( r->is_ready() )
+			ready.emplace_back (std::move (r));
 	}
-	else
-	{
-		this->random_dnscrypt_provider_.clear();
-		log::warning ("No ready DNScrypt providers");
-	}
-	log::debug ("Random DNScrypt provider: ", this->random_dnscrypt_provider_,
-		"  (", ready.size(), '/', providers.size(), ')');
+	log::debug ("DNScrypt providers ready: ", ready.size(), '/', providers.size());
+}
+
+std::vector <std::shared_ptr <network::provider>> cresponder::providers() const
+{
+	auto result = this->ready_;
+	const auto plain = this->responder::providers();
+	result.insert (result.end(), plain.begin(), plain.end());
+	return result;
 }
 
 //! @todo: code duplication, dns::responder::random_provider
@@ -286,14 +281,25 @@ std::shared_ptr <network::provider> cresponder::random_provider (const query &in
 	}
 	if( this->dnscrypt_providers_.empty() )
 		return this->responder::random_provider (inmsg);
-	this->select_random_provider();
-	if (this->random_dnscrypt_provider_.empty())
-		return std::shared_ptr <network::provider> (nullptr);
-	const auto it = this->dnscrypt_providers_.find (this->random_dnscrypt_provider_);
-	if (this->dnscrypt_providers_.end() != it)
-		return it->second->provider_ptr();
-	else
+	const auto &ready = this->ready_;
+	if (ready.empty())
+	{
+		// once a minute, while certificates are not there yet
+		constexpr const ev::tstamp warn_every = 60.; // seconds
+		++unready_;
+		const ev::tstamp now = this->event_loop().now();
+		if (0. >= unready_warned_ || warn_every <= now - unready_warned_)
+		{
+			log::warning ("No ready DNScrypt providers, questions: ", unready_);
+			unready_warned_ = now;
+			unready_ = 0;
+		}
 		return std::shared_ptr <network::provider> (nullptr);
+	}
+	const std::size_t i = this->selector().pick (ready);
+	log::debug ("DNScrypt provider: ", ready[i]->address().ip_port(), "  (",
+		ready.size(), '/', this->dnscrypt_providers_.size(), ')');
+	return ready[i];
 }
 
 //! @todo code duplication?, see resolver.cpp:save_resolvers
@@ -65,45 +65,62 @@ cdaemon::cdaemon (int argc, char *argv[])
 	if( o->parse(argc, argv) )
 	{
 		this->setup0();
-		std::unique_ptr<server::responder> srv;
-		if( !o->server_pubkey_file.empty() )
-		{
-			::crypt::pubkey pk = ::crypt::pubkey::load_binary_file(
-				o->server_pubkey_file);
-			log::debug ("pubkey: ", pk.fingerprint());
-			::crypt::secretkey sk = ::crypt::secretkey::load_binary_file(
-				o->server_secretkey_file);
-			log::debug ("seckey: ", sk.fingerprint());
-			certificate bc = certificate::load_binary_file
-				(o->server_certificate_file, pk);
-			bc.print_info();
-			log::debug ("server key: ", bc.server_public_key().fingerprint(),
-				", cipher: ", bc.cipher());
-			srv = std::make_unique<server::responder>(
-				std::string(o->server_hostname),
-				std::move(pk), std::move(sk), std::move(bc));
-		}
 		auto r = std::make_shared<cresponder> (*o, o->dnscrypt_resolvers_file,
-			std::move(srv));
+			this->make_server());
 		this->setup(std::move(r));
 		this->execute();
 	}
 }
 
+std::unique_ptr<server::responder> cdaemon::make_server() const
+{
+	const auto o = std::dynamic_pointer_cast<crypt::options>(this->options_ptr());
+	assert (o);
+	std::unique_ptr<server::responder> srv;
+	if( !o->server_pubkey_file.empty() )
+	{
+		::crypt::pubkey pk = ::crypt::pubkey::load_binary_file(
+			o->server_pubkey_file);
+		log::debug ("pubkey: ", pk.fingerprint());
+		::crypt::secretkey sk = ::crypt::secretkey::load_binary_file(
+			o->server_secretkey_file);
+		log::debug ("seckey: ", sk.fingerprint());
+		certificate bc = certificate::load_binary_file
+			(o->server_certificate_file, pk);
+		bc.print_info();
+		log::debug ("server key: ", bc.server_public_key().fingerprint(),
+			", cipher: ", bc.cipher());
+		srv = std::make_unique<server::responder>(
+			std::string(o->server_hostname),
+			std::move(pk), std::move(sk), std::move(bc));
+	}
+	return srv;
+}
+
+std::shared_ptr<dns::responder> cdaemon::make_responder (ev::loop_ref loop)
+{
+	const auto o = std::dynamic_pointer_cast<crypt::options>(this->options_ptr());
+	assert (o);
+	// cache file and providers list are saved by the main thread only
+	crypt::options opts (*o);
+	opts.cachedir.clear();
+	auto r = std::make_shared<cresponder> (opts, o->dnscrypt_resolvers_file,
+		this->make_server(), loop);
+	return r; // certificates are requested by the worker, see start_responder
+}
+
+void cdaemon::start_responder (dns::responder &r)
+{
+	dynamic_cast <cresponder &> (r).update_certificates();
+}
 
-void cdaemon::reload()
+void cdaemon::reload_responder (dns::responder &r,
+	std::shared_ptr<const responder_configuration> config)
 {
-#ifdef HAVE_LIBSYSTEMD
-	sys::systemd_notify ("RELOADING=1");
-#endif
-	log::notice ("Reloading " PACKAGE_STRING " ...");
 	const auto o = std::dynamic_pointer_cast <crypt::options> (this->options_ptr());
-	auto cr = std::dynamic_pointer_cast <cresponder> (this->responder_ptr());
-	assert (o && cr);
-	cr->reload (*o, o->dnscrypt_resolvers_file);
-#ifdef HAVE_LIBSYSTEMD
-	sys::systemd_notify ("READY=1");
-#endif
+	auto &cr = dynamic_cast <cresponder &> (r);
+	assert (o);
+	cr.reload (*o, std::move (config), o->dnscrypt_resolvers_file);
 }
 
 }} // namespace dns::crypt
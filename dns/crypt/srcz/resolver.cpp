@@ -178,18 +178,19 @@ public:
 
 	message() = default;
 
-	//! @todo numeric_cast
-	explicit message (const network::packet &other) : query (other.bytes(),
-		other.size()) {}
+	//! takes over the buffer of other
+	explicit message (query &&other) noexcept : query (std::move (other)) {}
 
 	nonce session_nonce_;
 };
 
-std::unique_ptr<network::packet> resolver::adapt_message (const std::unique_ptr
-	<network::packet> &other) const
+std::unique_ptr<network::packet> resolver::adapt_message (std::unique_ptr
+	<network::packet> &&other) const
 {
 	assert (other);
-	return std::make_unique <message> (*other);
+	assert (typeid (*other).before (typeid (query)) || typeid (*other)
+		== typeid (query));
+	return std::make_unique <message> (std::move (dynamic_cast <query&> (*other)));
 }
 
 void resolver::unfold(network::packet &q)
@@ -63,19 +63,19 @@ void tst_udp_main(int argc, char *argv[])
 		constexpr double timeout = 5.5; // seconds
 		if( tt )
 		{
-			auto t = std::make_unique <network::tcp::upstream> (std::move(prov),
-				std::move (pkt), timeout);
+			auto t = std::make_unique <network::tcp::upstream>
+				(ev::get_default_loop(), std::move(prov), std::move (pkt), timeout);
 			assert( t );
 			req = std::move(t);
 		}
 		else
 		{
-			auto u = std::make_unique <network::udp::out> (std::move (prov),
-				std::move (pkt), timeout);
+			auto u = std::make_unique <network::udp::out> (ev::get_default_loop(),
+				std::move (prov), std::move (pkt), timeout);
 			assert (u);
-			std::cout << "UDP upstream socket, fd: " << u->file_descriptor()
-				<< ", handle: " << u->sys_socket().to_string()
-				<< ", connected: " << u->sys_socket().is_connected()
+			std::cout << "UDP upstream socket, fd: " << u->udp_channel().file_descriptor()
+				<< ", handle: " << u->udp_channel().udp_socket().to_string()
+				<< ", connected: " << u->udp_channel().udp_socket().is_connected()
 				<< ", active: " << u->is_active()
 				<< std::endl;
 			req = std::move(u);
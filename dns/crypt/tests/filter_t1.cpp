@@ -8,6 +8,8 @@
 #include <cassert>
 #include <sstream>
 #include <fstream>
+#include <cstdio>
+#include <stdexcept>
 
 #include "backtrace/catch.hxx"
 #include "dns/filter.hxx"
@@ -238,9 +240,77 @@ void tst_n()
 		assert (black.match ("bla-bla-bla.stats.esomniture.com"));
 		assert (black.match ("stats.esomniture.com"));
 		assert (black.match ("stats.whatever"));
+		const string ifn = "filter_t1_black.img";
+		black.save_as (ifn);
+		const dns::filter mapped (ifn);
+		remove (ifn.c_str());
+		assert (black.count() == mapped.count());
+		assert (mapped.match ("host.apis.google.com") && !mapped.match ("google.com"));
+		assert (mapped.match ("www.google----xx.com") && mapped.match ("stats.whatever"));
 	}
 }
 
+void tst_image()
+{
+	cout << "\n=== Filter image test\n";
+	const string fn = "filter_t1.img";
+	stringstream str;
+	str << "prefix1.prefix2.* .suffix2.suffix1 exact2.exact1 *substr1* *sub+str*"
+		" *notexact*";
+	const dns::filter filter (move (str));
+	filter.save_as (fn);
+	const auto image = filter.image();
+	assert (dns::filter::is_image (image.data(), image.size()));
+	{
+		const dns::filter mapped (fn);
+		cout << "image: " << image.size() << ", count: " << mapped.count() << nl;
+		assert (filter.count() == mapped.count());
+		assert (image == mapped.image());
+		assert (mapped.match ("prefix1.prefix2.site"));
+		assert (mapped.match ("host.suffix2.Suffix1"));
+		assert (mapped.match ("exact2.exact1"));
+		assert (!mapped.match ("x.exact2.exact1"));
+		assert (mapped.match ("z.Xsubstr1x.site"));
+		assert (mapped.match ("z.asub+strb.site"));
+		assert (mapped.match ("cc.a-notexactament.site"));
+		assert (!mapped.match ("site.prefix1"));
+		// mapped filters merge
+		stringstream more;
+		more << "exact3.exact1";
+		dns::filter merged (move (more));
+		merged.merge (dns::filter (fn));
+		assert (filter.count() + 1u == merged.count());
+		assert (merged.match ("exact3.exact1") && merged.match ("a.suffix2.suffix1"));
+	}
+	{
+		// one byte off
+		auto bad = image;
+		bad[bad.size() / 2u] ^= 0x10u;
+		ofstream ofile (fn, ios::binary | ios::trunc);
+		ofile.write (reinterpret_cast <const char *> (bad.data()), static_cast
+			<streamsize> (bad.size()));
+	}
+	bool thrown = false;
+	try
+	{
+		dns::filter corrupt (fn);
+	}
+	catch (const runtime_error &e)
+	{
+		cout << "expected: " << e.what() << nl;
+		thrown = true;
+	}
+	assert (thrown);
+	remove (fn.c_str());
+	// text rules still load from files
+	{
+		ofstream ofile (fn);
+		ofile << "exact2.exact1\n";
+	}
+	assert (1u == dns::filter (fn).count());
+	remove (fn.c_str());
+}
+
 void run()
 {
 	tst_0();
@@ -248,6 +318,7 @@ void run()
 	tst_2();
 	tst_3();
 	tst_5 (tst_4());
+	tst_image();
 	tst_n();
 }
 
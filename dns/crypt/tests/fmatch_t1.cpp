@@ -0,0 +1,133 @@
+#undef NDEBUG
+
+#include <iostream>
+#include <cassert>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <new>
+
+#include "backtrace/catch.hxx"
+#include "dns/filter.hxx"
+#include "dns/query.hxx"
+#include "dns/constants.hxx"
+#include "dns/options.hxx"
+#include "dns/responder.hxx"
+#include "sys/logger.hxx"
+
+static std::size_t allocations = 0;
+
+void *operator new (std::size_t n)
+{
+	++allocations;
+	if (void *p = std::malloc (0u < n ? n : 1u))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete (void *p) noexcept
+{
+	std::free (p);
+}
+
+void operator delete (void *p, std::size_t) noexcept
+{
+	std::free (p);
+}
+
+namespace {
+
+//! names as the responder gives them, hits and misses of every stage
+const std::vector <std::string> names {"www.Google.com", "host.apis.google.com",
+	"down.hit020.com", "w.down.hit020.com", "www.google----xx.com",
+	"no.such.uTelemetry-site.com", "stats.whatever", "ad.some.site.com",
+	"a-very-long-label-of-a-host.sub.domain.example.org.", "twitter.com",
+	"120.mBN.com.ua", "cclassic.mbn.com.ua", "x"};
+
+//! calls of both lists per name, as for queries
+void bench (const dns::filter &white, const dns::filter &black)
+{
+	constexpr const unsigned rounds = 5000u;
+	std::vector <dns::query> queries;
+	for (const auto &n : names)
+		queries.emplace_back (n, dns::rr_type::a);
+	std::vector <const std::uint8_t *> wire;
+	for (const auto &q : queries)
+	{
+		dns::question_view v;
+		assert (q.get_question (v));
+		wire.push_back (v.qname);
+	}
+	for (std::size_t i = 0; i < names.size(); ++i)
+		assert (black.match (names[i]) == black.match_wire (wire[i]));
+
+	std::size_t hits = 0;
+	std::size_t before = allocations;
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned r = 0; r < rounds; ++r)
+		for (const auto &n : names)
+			hits += white.match (n) || black.match (n);
+	const auto text = std::chrono::steady_clock::now() - start;
+	const std::size_t text_allocations = allocations - before;
+
+	before = allocations;
+	start = std::chrono::steady_clock::now();
+	for (unsigned r = 0; r < rounds; ++r)
+		for (const auto *w : wire)
+			hits += white.match_wire (w) || black.match_wire (w);
+	const auto wire_time = std::chrono::steady_clock::now() - start;
+	const std::size_t wire_allocations = allocations - before;
+
+	const double calls = 2.0 * rounds * static_cast <double> (names.size());
+	using ns = std::chrono::duration <double, std::nano>;
+	std::cout << "calls: " << calls << ", hits: " << hits
+		<< "\ndotted: " << ns (text).count() / calls << " ns/call, allocations: "
+		<< text_allocations << "\nwire: " << ns (wire_time).count() / calls
+		<< " ns/call, allocations: " << wire_allocations << std::endl;
+	assert (0u == text_allocations && 0u == wire_allocations);
+}
+
+//! the responder filters questions in place, without the text of the name
+//! when it is not logged
+void pre_filter (const std::string &dir)
+{
+	dns::detail::options opts;
+	opts.resolvers = "none";
+	opts.whitelists = {dir + "/whitelist.txt"};
+	opts.blacklists = {dir + "/blacklist.txt"};
+	dns::responder r (opts);
+	std::vector <dns::query> queries;
+	for (const auto &n : names)
+		queries.emplace_back (n, dns::rr_type::a);
+	const auto severity = process::log::get_severity();
+	process::log::set_severity (process::log::severity::notice);
+	std::size_t blacklisted = 0;
+	const std::size_t before = allocations;
+	for (auto &q : queries)
+		blacklisted += 1 == r.pre_filter (q);
+	const std::size_t filter_allocations = allocations - before;
+	process::log::set_severity (severity);
+	std::cout << "pre_filter blacklisted: " << blacklisted << ", allocations: "
+		<< filter_allocations << std::endl;
+	assert (0u < blacklisted && blacklisted == r.blacklisted_count());
+	assert (0u == filter_allocations);
+}
+
+} // namespace
+
+void run()
+{
+	const char *const dirn = std::getenv ("DNS_TEST_DIR");
+	assert (nullptr != dirn);
+	const dns::filter white (std::string (dirn) + "/whitelist.txt");
+	const dns::filter black (std::string (dirn) + "/blacklist.txt");
+	assert (black.match ("host.apis.google.com") && !black.match ("google.com"));
+	bench (white, black);
+	pre_filter (dirn);
+}
+
+int main()
+{
+	return trace::catch_all_errors (run);
+}
@@ -0,0 +1,217 @@
+#ifdef NDEBUG
+#  undef NDEBUG
+#endif
+
+#include <iostream>
+#include <vector>
+#include <cassert>
+#include <memory>
+#include <utility>
+
+#include <ev++.h>
+
+#include "backtrace/catch.hxx"
+#include "dns/query.hxx"
+#include "dns/constants.hxx"
+#include "dns/options.hxx"
+#include "dns/responder.hxx"
+#include "dns/crypt/resolver.hxx"
+#include "dns/crypt/server_crypt.hxx"
+#include "network/socket.hxx"
+#include "network/address.hxx"
+#include "network/tcp/listener.hxx"
+
+#include "data/test_signed_certificate.h"
+#include "data/test_public_key.h"
+#include "data/test_secret_key.h"
+
+using namespace std;
+
+namespace {
+
+constexpr const unsigned count = 3u; // questions in one write
+
+typedef vector <uint8_t> bytes;
+
+//! Length prefixed messages of a TCP stream
+struct frames
+{
+	bytes input;
+
+	void add (const uint8_t *b, size_t n) {input.insert (input.end(), b, b + n);}
+
+	bool next (bytes &msg)
+	{
+		if (2u > input.size())
+			return false;
+		const size_t sz = (size_t (input[0]) << 8) | input[1];
+		if (input.size() < 2u + sz)
+			return false;
+		const auto end = input.begin() + 2 + static_cast <ptrdiff_t> (sz);
+		msg.assign (input.begin() + 2, end);
+		input.erase (input.begin(), end);
+		return true;
+	}
+};
+
+void push_frame (bytes &out, const uint8_t *b, size_t n)
+{
+	out.push_back (static_cast <uint8_t> (n >> 8));
+	out.push_back (static_cast <uint8_t> (n & 0xffu));
+	out.insert (out.end(), b, b + n);
+}
+
+//! DNSCrypt resolver over TCP, answers with the question marked as an answer
+struct upstream
+{
+	network::tcp::socket_t listener {network::inet::ipv4};
+	network::tcp::socket_t conn {network::inet::ipv4};
+	ev::io accept_event, read_event;
+	dns::crypt::server::encryptor decryptor {crypt::pubkey (test_public_key),
+		crypt::secretkey (test_secret_key)};
+	frames in;
+	unsigned got = 0;
+
+	upstream()
+	{
+		network::bind_listener (listener, network::address ("127.0.0.1", 0));
+		network::tcp::listen (listener, 8);
+		accept_event.set <upstream, &upstream::on_accept> (this);
+		accept_event.start (listener.file_descriptor(), ev::READ);
+	}
+
+	void on_accept (ev::io &w, int)
+	{
+		w.stop(); // the pool keeps one connection
+		conn = network::tcp::accept_new (listener).first;
+		read_event.set <upstream, &upstream::on_read> (this);
+		read_event.start (conn.file_descriptor(), ev::READ);
+	}
+
+	void on_read (ev::io &w, int)
+	{
+		uint8_t buf[4096];
+		const auto n = network::tcp::receive (conn, buf, sizeof (buf), 0);
+		if (0 >= n)
+		{
+			w.stop();
+			return;
+		}
+		in.add (buf, static_cast <size_t> (n));
+		bytes msg, out;
+		while (in.next (msg))
+		{
+			++got;
+			dns::query q (msg.data(), static_cast <dns::query::size_type> (msg.size()));
+			const auto keys = decryptor.uncurve (q);
+			assert (q.is_dns());
+			q.modify_bytes()[2] |= 0x80u; // QR
+			decryptor.curve (keys.second, keys.first, q);
+			push_frame (out, q.bytes(), q.size());
+		}
+		if (!out.empty())
+			network::tcp::send (conn, out.data(), static_cast <unsigned short>
+				(out.size()), 0);
+	}
+};
+
+//! Sends plain DNS questions in one write, reads their answers
+struct client
+{
+	network::tcp::socket_t sock {network::inet::ipv4};
+	ev::io read_event;
+	frames in;
+	vector <bytes> answers;
+
+	explicit client (const network::address &to)
+	{
+		network::tcp::connect (sock, to);
+		bytes out;
+		for (unsigned i = 0; i < count; ++i)
+		{
+			const dns::query q (string ("pipelined") + to_string (i) + ".example.org",
+				dns::rr_type::a, static_cast <uint16_t> (100u + i));
+			push_frame (out, q.bytes(), q.size());
+		}
+		const auto sent = network::tcp::send (sock, out.data(),
+			static_cast <unsigned short> (out.size()), 0);
+		assert (static_cast <ssize_t> (out.size()) == sent);
+		read_event.set <client, &client::on_read> (this);
+		read_event.start (sock.file_descriptor(), ev::READ);
+	}
+
+	void on_read (ev::io &w, int)
+	{
+		uint8_t buf[4096];
+		const auto n = network::tcp::receive (sock, buf, sizeof (buf), 0);
+		if (0 < n)
+			in.add (buf, static_cast <size_t> (n));
+		bytes msg;
+		while (in.next (msg))
+			answers.emplace_back (std::move (msg));
+		if (0 >= n || count <= answers.size())
+		{
+			w.stop();
+			w.loop.break_loop (ev::ALL);
+		}
+	}
+};
+
+void stop_loop (ev::timer &w, int)
+{
+	w.loop.break_loop (ev::ALL);
+}
+
+//! questions read from a TCP client connection are folded by a DNSCrypt
+//! provider in place, in the buffer the listener reserved for them
+void run()
+{
+	upstream srv;
+	const bytes cert (test_signed_certificate, test_signed_certificate
+		+ sizeof (test_signed_certificate));
+	auto provider = make_shared <dns::crypt::resolver> (string ("name"),
+		string ("2.dnscrypt-cert"), crypt::pubkey (test_public_key),
+		srv.listener.get_address(), network::proto::tcp);
+	vector <bytes> certs {cert};
+	assert (provider->find_valid_certificate (certs));
+
+	dns::detail::options opts;
+	opts.resolvers = "none"; // the provider is added
+	auto responder = make_shared <dns::responder> (opts);
+	responder->add_provider (std::move (provider));
+	auto listener = network::tcp::listener::make_new (shared_ptr <dns::responder>
+		(responder), network::address ("127.0.0.1", 0));
+
+	client cli (listener->tcp_socket().get_address());
+	ev::timer timeout;
+	timeout.set <stop_loop>();
+	timeout.start (2., 0.);
+	ev::get_default_loop().run();
+	assert (count == srv.got);
+	assert (count == cli.answers.size());
+	vector <bool> answered (count, false);
+	for (const auto &a : cli.answers)
+	{
+		const dns::query answer (a.data(), static_cast <dns::query::size_type>
+			(a.size()));
+		assert (answer.is_dns() && 0 != (a[2] & 0x80u));
+		const unsigned i = ((unsigned (a[0]) << 8) | a[1]) - 100u;
+		assert (i < count && !answered[i]);
+		answered[i] = true;
+	}
+	// the connection is dropped by the listener once the client is done
+	assert (1u == listener->sessions_count());
+	cli.sock.close();
+	for (unsigned i = 0; 0u < listener->sessions_count() && 100u > i; ++i)
+		ev::get_default_loop().run (ev::ONCE);
+	assert (0u == listener->sessions_count());
+	cout << "Answers: " << cli.answers.size() << ", upstream: "
+		<< responder->upstream_count() << endl;
+}
+
+} // namespace
+
+int main()
+{
+	return trace::catch_all_errors (run);
+}
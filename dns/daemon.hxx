@@ -4,6 +4,7 @@
 #include <vector>
 #include <deque>
 #include <memory>
+#include <future>
 #include <cstdint>
 #include <cstdio>
 #include <ctime>
@@ -20,6 +21,7 @@
 namespace dns {
 
 class responder;
+struct responder_configuration;
 
 class DNS_API daemon
 {
@@ -31,6 +33,8 @@ public:
 
 	virtual ~daemon();
 
+	//! Reads the lists on a background thread, the responders swap them in
+	//! once they are ready, on their own loops
 	virtual void reload();
 
 	bool set_options(int argc, char *argv[]);
@@ -43,8 +47,22 @@ public:
 
 	void report_stats() const;
 
+	//! Event loop threads in addition to the main one
+	std::size_t workers_count() const {return workers_.size();}
+
 protected:
 
+	//! Responder for a worker thread, which runs the given event loop
+	virtual std::shared_ptr<responder> make_responder (ev::loop_ref);
+
+	//! Called in the thread running the loop of the responder, before it runs.
+	//! Upstream pools and timers of a loop are kept by that thread.
+	virtual void start_responder (responder &);
+
+	//! Called in the thread owning the responder
+	virtual void reload_responder (responder &,
+		std::shared_ptr<const responder_configuration>);
+
 	void setup(std::shared_ptr<responder> &&);
 
 	void setup0();
@@ -79,6 +97,20 @@ private:
 
 	void start_listeners();
 
+	struct worker;
+
+	//! SO_REUSEPORT listeners with their own loop, responder and thread
+	void start_workers();
+
+	void stop_workers();
+
+	static void run_worker (worker &);
+
+	//! the lists read for reload are ready, in the main loop
+	static void reloaded_callback (ev::async &, int);
+
+	void finish_reload();
+
 private:
 
 	std::shared_ptr<detail::options> options_ptr_;
@@ -95,6 +127,13 @@ private:
 	std::shared_ptr<network::udp::udplistener> udp_listener_;
 	std::shared_ptr<network::tcp::tcplistener> tcp_listener_;
 	int udp_listener_systemd_handle_, tcp_listener_systemd_handle_;
+
+	std::vector <std::unique_ptr <worker>> workers_;
+
+	ev::async reloaded_; //!< sent by the reload thread
+	//! lists being read, declared after the watcher it sends to
+	std::future <std::shared_ptr<const responder_configuration>> reloading_;
+	bool reload_again_ = false; //!< signalled while reading
 };
 
 } // namespace dns
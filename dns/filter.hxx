@@ -3,30 +3,67 @@
 
 #include <iosfwd>
 #include <set>
-#include <unordered_set>
 #include <string>
-
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+#include <dns/label_trie.hxx>
+#include <dns/substring_automaton.hxx>
 #include <dns/dll.hxx>
 
+namespace sys {class mapped_file;}
+
 namespace dns {
 
+//! Name as the prefix rules are looked up with, without copying it: in
+//! lower case, with a dot appended unless it ends with one
+struct folded_name
+{
+	const char *data;
+	std::size_t size;
+	bool dot; //!< appended
+
+	std::size_t length() const noexcept {return size + dot;}
+
+	char operator[] (std::size_t i) const noexcept
+	{
+		const char c = (i == size) ? '.' : data[i];
+		return ('A' <= c && c <= 'Z') ? static_cast <char> (c - 'A' + 'a') : c;
+	}
+};
+
 struct comp
 {
+	using is_transparent = void;
+
 	bool operator() (const std::string &a, const std::string &b) const
 	{
 		// ads.* < ads.bla.bla.
 		return std::lexicographical_compare (a.cbegin(), a.cend(), b.cbegin(),
 			b.cend());
 	}
-};
 
-struct rev_comp
-{
-	bool operator() (const std::string &a, const std::string &b) const
+	bool operator() (const std::string &a, const folded_name &b) const noexcept
+	{
+		return 0 > compare (a, b);
+	}
+
+	bool operator() (const folded_name &a, const std::string &b) const noexcept
 	{
-		// *.ads.com < bla.bla.ads.com
-		return std::lexicographical_compare (a.crbegin(), a.crend(), b.crbegin(),
-			b.crend());
+		return 0 < compare (b, a);
+	}
+
+	static int compare (const std::string &a, const folded_name &b) noexcept
+	{
+		const std::size_t n = std::min (a.size(), b.length());
+		for (std::size_t i = 0; i < n; ++i)
+			if (a[i] != b[i])
+				return (static_cast <unsigned char> (a[i]) < static_cast <unsigned char>
+					(b[i])) ? -1 : 1;
+		return (a.size() < b.length()) ? -1 : ((b.length() < a.size()) ? 1 : 0);
 	}
 };
 
@@ -34,23 +71,34 @@ class DNS_API filter
 {
 public:
 
+	//! Text rules, or the image of a compiled filter, which is mapped and used
+	//! as it is
 	explicit filter (const std::string &file_name);
 
 	filter() = default;
 
 	explicit filter (std::istream &&text_stream);
 
-	bool match (const std::string &hostname) const;
+	//! Dotted name in any case, the trailing dot is optional. Neither
+	//! allocates nor copies the name.
+	bool match (const char *hostname, std::size_t size) const;
+
+	bool match (const std::string &hostname) const
+	{
+		return this->match (hostname.data(), hostname.size());
+	}
+
+	//! name in wire format, not compressed, e.g. question_view::qname
+	bool match_wire (const std::uint8_t *qname) const;
 
 	std::size_t count() const
 	{
-		return suffix_.size() + prefix_.size() + substrings_.size() + exact_.size();
+		return domains_.size() + prefix_.size() + substrings_.size();
 	}
 
 	bool empty() const
 	{
-		return suffix_.empty() && prefix_.empty() && substrings_.empty()
-			&& exact_.empty();
+		return domains_.empty() && prefix_.empty() && substrings_.empty();
 	}
 
 	void merge (filter &&);
@@ -59,11 +107,27 @@ public:
 
 	void optimize (void);
 
+	//! match structures, versioned and checksummed
+	std::vector<std::uint8_t> image() const;
+
+	//! writes the image aside and replaces the file, mapped images stay intact
+	void save_as (const std::string &file_name) const;
+
+	//! the bytes start as an image does
+	static bool is_image (const std::uint8_t *bytes, std::size_t size) noexcept;
+
 private:
 
+	//! checks the image and uses its tables in place
+	void map (std::shared_ptr<const sys::mapped_file> &&, const std::string
+		&file_name);
+
+	//! drops exact and suffix names covered by the other rules, builds the trie
+	void optimize (std::vector<std::string> &&domains);
+
 	std::set <std::string, comp> prefix_;
-	std::set <std::string, rev_comp> suffix_;
-	std::unordered_set <std::string> substrings_, exact_;
+	substring_automaton substrings_;
+	label_trie domains_; //!< exact and suffix names
 };
 
 inline std::ostream& operator<< (std::ostream &text_stream, const filter &f)
@@ -3,6 +3,7 @@
 namespace dns
 {
 class query;
+struct question_view;
 enum class rr_class : std::uint16_t;
 enum class rr_type : std::uint16_t;
 enum class pkt_rcode : std::uint8_t;
@@ -0,0 +1,99 @@
+#ifndef DNS_LABEL_TRIE_HXX_
+#define DNS_LABEL_TRIE_HXX_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include <dns/dll.hxx>
+
+namespace dns {
+
+//! Exact and suffix domain names in a trie of labels, from the top level
+//! label down. Children of a node are consecutive in one flat array, sorted
+//! by label, and labels are kept in one string. A name is matched in one
+//! walk over its labels, from the last one, with a binary search per label.
+//! Nodes and labels are immutable, built or mapped from a file, and shared by
+//! copies.
+class DNS_API label_trie
+{
+public:
+
+	enum : std::uint8_t
+	{
+		exact = 1u,
+		suffix = 2u //!< the domain and all its subdomains
+	};
+
+	//! Children of a node end where the children of the next node begin, the
+	//! last node is a sentinel
+	struct node
+	{
+		std::uint32_t label; //!< offset in labels
+		std::uint32_t first; //!< index of the first child
+		std::uint16_t label_size;
+		std::uint8_t flags;
+		std::uint8_t reserved; //!< zero
+	};
+
+	label_trie();
+
+	//! Names in lower case, suffixes start with a dot: '.ads.com'. Names
+	//! covered by a suffix are dropped.
+	explicit label_trie (std::vector<std::string> &&names);
+
+	//! Nodes and labels kept by the storage, e.g. a mapped file, as written
+	//! from nodes() and labels(). Throws std::runtime_error if they do not make
+	//! a trie.
+	label_trie (const node *, std::size_t node_count, const char *labels,
+		std::size_t labels_size, std::shared_ptr<const void> &&storage);
+
+	//! Name in any case, without the trailing dot. A leading dot is an empty
+	//! label, so it only matches suffixes.
+	bool match (const char *name, std::size_t size) const noexcept;
+
+	bool match (const std::string &name) const noexcept
+	{
+		return this->match (name.data(), name.size());
+	}
+
+	//! names as given to the constructor, in the order of the trie
+	std::vector<std::string> names() const;
+
+	//! exact names and suffixes
+	std::size_t size() const noexcept {return size_;}
+
+	bool empty() const noexcept {return 0u == size_;}
+
+	const node *nodes() const noexcept {return nodes_;}
+
+	std::size_t node_count() const noexcept {return node_count_;}
+
+	const char *labels() const noexcept {return labels_;}
+
+	std::size_t labels_size() const noexcept {return labels_size_;}
+
+	//! bytes of the nodes and labels
+	std::size_t memory() const noexcept
+	{
+		return node_count_ * sizeof (node) + labels_size_;
+	}
+
+private:
+
+	//! child of the node with the label, or nullptr
+	const node *find (const node &, const char *label, std::size_t size) const
+		noexcept;
+
+	const node *nodes_; //!< the root is first, the sentinel last
+	std::size_t node_count_;
+	const char *labels_;
+	std::size_t labels_size_ = 0;
+	std::size_t size_ = 0;
+	std::shared_ptr<const void> storage_; //!< of the nodes and labels
+};
+
+} // namespace dns
+#endif
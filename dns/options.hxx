@@ -16,6 +16,8 @@ class flags;
 struct DNS_API options : public responder_parameters
 {
 	unsigned int  connections_count_max;
+	unsigned int udp_batch_size; //!< 0 for the listener default
+	unsigned int workers; //!< threads with own event loop and listeners
 
 	unsigned short max_log_level;
 	bool syslog;
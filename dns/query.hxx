@@ -40,6 +40,39 @@ enum class pkt_opcode : std::uint8_t
 std::ostream &operator<< (std::ostream &text_stream, rr_class);
 std::ostream &operator<< (std::ostream &text_stream, rr_type);
 
+//! FNV-1a of a dotted name, case insensitive, fed a byte at a time
+class name_hash
+{
+public:
+
+	void add (std::uint8_t c) noexcept
+	{
+		h_ ^= ('A' <= c && c <= 'Z') ? static_cast <std::uint8_t> (c - 'A' + 'a') : c;
+		h_ *= 1099511628211u;
+	}
+
+	//! mixes in the type, folded to 32 bits
+	std::uint32_t finish (std::uint16_t qtype) const noexcept
+	{
+		const std::uint64_t h = (h_ ^ qtype) * 1099511628211u;
+		return static_cast <std::uint32_t> (h ^ (h >> 32));
+	}
+
+private:
+
+	std::uint64_t h_ = 14695981039346656037u;
+};
+
+//! Question of a message in place, the name as sent
+struct question_view
+{
+	const std::uint8_t *qname = nullptr; //!< wire format, not compressed
+	std::size_t text_size = 0; //!< of the dotted name, as get_question gives it
+	name_hash hash; //!< of the dotted name
+	rr_type type {};
+	rr_class class_ {};
+};
+
 class DNS_API query : public network::packet
 {
 public:
@@ -50,6 +83,10 @@ public:
 	static constexpr const unsigned max_size = -10000U + std::max (tcp_max_size,
 		udp_edns_max_size);
 
+	//! header, owner name of at most 255 bytes, type and class
+	static constexpr const unsigned max_question_size = sizeof (message_header)
+		+ 255u + sizeof (rr_question_header);
+
 	virtual const char *dummy() const override {return "dns";}
 
 	virtual std::unique_ptr <packet> clone() const override
@@ -64,16 +101,14 @@ private:
 
 public:
 
+	//! buffer comes from network::packet_pool, its content is not initialized
 	query()
 	{
 		this->reserve (max_size);
-		std::memset (this->modify_bytes(), 0, this->reserved_size() * sizeof
-			(std::uint8_t));
 	}
 
-	query (const std::uint8_t *b, size_type l) : network::packet (b, l)
+	query (const std::uint8_t *b, size_type l) : network::packet (b, l, max_size)
 	{
-		this->reserve (max_size);
 		assert( max_size >= this->size() );
 	}
 
@@ -109,6 +144,12 @@ public:
 
 	void mark_truncated();
 
+	//! size of the header and the question section
+	size_type question_size() const;
+
+	//! drops answer, authority and additional sections, including EDNS
+	void truncate_to_question();
+
 	bool has_flags_tc() const;
 
 	std::size_t add_edns(std::size_t payload_size);
@@ -152,14 +193,31 @@ public:
 
 	std::tuple<std::string, rr_class, rr_type> get_question() const;
 
+	//! Parses the single question without copies, hashing the name on the way
+	//! @return false if malformed, or if the name is compressed or has dots in
+	//! labels
+	bool get_question (question_view &) const noexcept;
+
 	std::int32_t answer_min_ttl() const;
 
+	//! NXDOMAIN, or NOERROR without answers (NODATA)
+	bool is_negative() const;
+
+	//! TTL of a negative response, RFC 2308: the lesser of the authority SOA TTL
+	//! and its MINIMUM field, -1 without SOA
+	std::int32_t negative_ttl() const;
+
 	message_header header() const;
 
 	void set_header(const message_header &);
 
 	void adjust_id_and_ttl (const std::uint16_t tid, const std::int32_t ttl);
 
+	//! Offsets of the TTL fields of all records but OPT, in a whole message
+	//! @return false if malformed
+	static bool ttl_offsets (const std::uint8_t *message, std::size_t size,
+		std::vector <std::uint16_t> &offsets);
+
 	void write (std::ostream &binary_stream) const;
 
 	void save (const std::string &file_name) const;
@@ -173,6 +231,9 @@ private:
 		std::string &owner) const;
 
 	unsigned short get_rr_name (unsigned short off, std::string &owner) const;
+
+	//! @return offset after the name
+	std::size_t skip_name (std::size_t off) const;
 };
 
 } // namespace dns
@@ -2,34 +2,54 @@
 #define DNS_RESPONDER_HXX
 
 #include <iosfwd>
+#include <string>
 #include <vector>
 #include <memory>
+#include <unordered_map>
 #include <cassert>
+#include <ctime>
 
 #include <network/responder.hxx>
 #include <network/constants.hxx>
+#include <network/slab.hxx>
+#include <network/selector.hxx>
+#include <network/provider.hxx>
 #include <network/fwd.hxx>
 #include <dns/dll.hxx>
+#include <dns/fwd.hxx>
 
 namespace dns {
 
 class query;
 class filter;
 class cache;
+class cache_store;
 class hosts;
 class responder_parameters;
 
+//! Lists read from the files of the parameters. Immutable once built, away
+//! from the event loops, and shared by the responders of all threads.
+struct responder_configuration
+{
+	std::vector<network::provider> providers;
+	bool providers_failed = false; //!< the resolvers file, the old list is kept
+	std::shared_ptr<const filter> whitelist, blacklist;
+	std::shared_ptr<const hosts> known_hosts;
+};
+
 class DNS_API responder : public network::responder
 {
 public:
 
 	typedef ::dns::responder_parameters parameters;
 
+	typedef ::dns::responder_configuration configuration;
+
 	responder();
 
-	explicit responder (const parameters &);
+	explicit responder (const parameters &, ev::loop_ref = ev::get_default_loop());
 
-	virtual ~responder() = default; // because of virtual functions
+	virtual ~responder(); // because of virtual functions
 
 	static std::vector<network::provider> from_file (std::istream &text_stream,
 		bool noipv6, network::proto);
@@ -40,6 +60,12 @@ public:
 
 	void store(const query &msg);
 
+	//! see cache::retrieve_stale
+	bool retrieve_stale (query &msg);
+
+	//! seconds to wait for upstream, before answering from the stale cache
+	double stale_wait() const noexcept {return stale_wait_;}
+
 	void add_provider(std::shared_ptr<network::provider> &&p)
 	{
 		assert( p );
@@ -48,42 +74,114 @@ public:
 
 	std::size_t q_count() const {return upstream_requests_.size();}
 
+	//! queues the upstream request until it is closed
+	network::slab_handle track_upstream (std::shared_ptr<network::upstream> &&);
+
+	//! forgets a closed upstream request, used by upstream requests
+	void release_upstream (network::slab_handle);
+
 	std::size_t processed_count() const {return processed_count_;}
 	std::size_t blacklisted_count() const {return blacklisted_count_;}
 	std::size_t cached_count() const {return cached_count_;}
 
+	//! questions of clients sent upstream
+	std::size_t upstream_count() const {return upstream_count_;}
+
+	//! clients which waited for the same question already sent upstream
+	std::size_t coalesced_count() const {return coalesced_count_;}
+
+	//! questions in flight, which others may wait for
+	std::size_t flights_count() const {return flights_.size();}
+
+	//! Answers the clients waiting for the question in flight, with their IDs,
+	//! from the stale cache if the answer failed or did not come (nullptr)
+	void land_flight (const std::string &key, const query *answer);
+
 	void process(std::shared_ptr <network::incoming> &&) override;
 
 	std::unique_ptr <network::packet> new_packet() const override;
 
-	void reload(const parameters &);
+	//! Reads the files of the parameters, on any thread. Throws
+	//! std::runtime_error if a filter can not be read.
+	static std::shared_ptr<const configuration> load_configuration (const
+		parameters &);
 
-	//! Remove closed upstream requests
-	void collect_garbage();
+	//! Swaps the configuration in, in the thread of the event loop. Providers
+	//! still listed keep their scores.
+	void reload (const parameters &, std::shared_ptr<const configuration> &&);
+
+	void reload (const parameters &params)
+	{
+		this->reload (params, load_configuration (params));
+	}
+
+	//! Destroys upstream requests released since the last call
+	void collect_garbage() noexcept {retired_upstream_.clear();}
 
 	const std::string &cache_dir() const {return cache_dir_;}
 
 	const class cache &cache() const {return *cache_ptr_;}
 
+	//! writes journaled cache entries still pending, if the cache is kept
+	void flush_cache();
+
+	//! writes the whole cache, if it is kept
+	void save_cache();
+
+	//! upstream providers, for their statistics
+	virtual std::vector<std::shared_ptr<network::provider>> providers() const
+	{
+		return dns_providers_;
+	}
+
 protected:
 
 	std::shared_ptr<network::provider> zone_provider (const query &) const;
 
 	virtual std::shared_ptr<network::provider> random_provider (const query &) const;
 
+	network::provider_selector &selector() const noexcept {return selector_;}
+
 private:
 
-	void select_random_provider() const;
+	//! asks upstream again for a popular cached answer, before it expires
+	void refresh_ahead (const std::string &owner, rr_type);
+
+	//! the question section in lower case, and whether EDNS is there
+	static std::string flight_key (const query &);
+
+	void init_expiry();
+
+	//! arms the timer for the earliest deadline in the cache
+	void schedule_expiry();
+
+	static void expiry_callback (ev::timer &, int);
+
+	//! expires cache entries in slices, while the loop has nothing else to do
+	static void sweep_callback (ev::idle &, int);
 
-	std::shared_ptr<filter> whitelist_ptr_, blacklist_ptr_;
+	std::shared_ptr<const filter> whitelist_ptr_, blacklist_ptr_;
 	std::shared_ptr<class cache> cache_ptr_;
-	std::shared_ptr<hosts> hosts_ptr_;
+	std::unique_ptr<cache_store> store_ptr_; //!< with a cache directory
+	std::shared_ptr<const hosts> hosts_ptr_;
 	std::vector< std::shared_ptr<network::provider> > dns_providers_;
-	std::vector< std::shared_ptr<network::upstream> > upstream_requests_;
+	network::slab< std::shared_ptr<network::upstream> > upstream_requests_;
+	std::vector< std::shared_ptr<network::upstream> > retired_upstream_;
 	std::shared_ptr<network::provider> onion_provider_ptr_;
-	mutable unsigned random_provider_ = 99999999U;
+	mutable network::provider_selector selector_;
 	std::size_t blacklisted_count_, processed_count_, cached_count_;
+	std::size_t upstream_count_ = 0, coalesced_count_ = 0;
+	//! clients waiting for questions in flight, besides the one which asked first
+	std::unordered_map< std::string,
+		std::vector< std::shared_ptr<network::incoming> > > flights_;
 	std::string cache_dir_;
+	std::string refresh_owner_; //!< refreshed ahead once the client is answered
+	rr_type refresh_type_ {};
+	double stale_wait_ = 1.8;
+	bool stale_ = false; //!< the question has a stale answer in the cache
+	ev::timer expiry_timer_;
+	ev::idle sweep_;
+	std::time_t expiry_at_ = 0;
 	bool noipv6_ = false;
 };
 
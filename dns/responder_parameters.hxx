@@ -15,6 +15,11 @@ public:
 	bool noipv6;
 	network::proto net_proto;
 	unsigned short min_ttl;
+	std::size_t cache_entries, cache_bytes; //!< cache limits
+	std::size_t negative_entries; //!< NXDOMAIN and NODATA, apart from the others
+	unsigned prefetch_hits, prefetch_percent; //!< refresh ahead, see cache::prefetch
+	unsigned stale_period; //!< seconds, no stale answers if 0
+	double stale_wait; //!< seconds
 	double timeout;
 	std::unordered_set <std::string> whitelists, blacklists;
 };
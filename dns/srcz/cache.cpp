@@ -1,79 +1,516 @@
 #include <fstream>
+#include <array>
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
 
 #include "dns/cache.hxx"
 #include "dns/query.hxx"
 #include "dns/constants.hxx"
 #include "sys/logger.hxx"
 #include "sys/str.hxx"
+#include "sys/mapped_file.hxx"
 
 namespace dns {
 
-cache::cache(unsigned short minttl)
-	: cache_entries_max (defaults::max_size()), min_ttl_ (minttl)
-{}
+namespace {
+
+inline char lower (char c) noexcept
+{
+	return ('A' <= c && c <= 'Z') ? static_cast <char> (c - 'A' + 'a') : c;
+}
+
+//! NXDOMAIN, or NOERROR without answers
+bool negative_response (const std::uint8_t *data, std::size_t size) noexcept
+{
+	if (12u > size || 0 == (data[2] & 0x80)) // not a response
+		return false;
+	const unsigned rcode = data[3] & 0xfu;
+	return static_cast <unsigned> (pkt_rcode::nxdomain) == rcode
+		|| (static_cast <unsigned> (pkt_rcode::noerror) == rcode
+		&& 0 == data[6] && 0 == data[7]);
+}
+
+} // namespace
+
+void cache_entry::assign (std::uint32_t h, const char *name, std::size_t size,
+	std::uint16_t qtype)
+{
+	if (0u == size || std::numeric_limits <std::uint8_t>::max() < size)
+		throw std::runtime_error ("Invalid DNS name to cache, size: "
+			+ std::to_string (size));
+	hash_ = h;
+	qtype_ = qtype;
+	name_size_ = static_cast <std::uint8_t> (size);
+	for (std::size_t i = 0; i < size; ++i)
+		inline_[i] = static_cast <std::uint8_t> (lower (name[i]));
+}
+
+void cache_entry::set_response (const std::uint8_t *data, std::size_t size,
+	const std::vector <std::uint16_t> &offsets, bool not_parsed)
+{
+	if (std::numeric_limits <std::uint16_t>::max() < size)
+		throw std::runtime_error ("Too large DNS answer to cache: "
+			+ std::to_string (size));
+	const std::size_t old_block = large_ ? this->block_size() : 0u;
+	const std::size_t tail = not_parsed ? 0u : offsets.size() * sizeof (std::uint16_t);
+	std::uint8_t *block = &inline_[name_size_];
+	if (name_size_ + size + tail > inline_size)
+	{
+		if (old_block < size + tail)
+			large_.reset (new std::uint8_t[size + tail]);
+		block = large_.get();
+	}
+	else
+		large_.reset();
+	std::memcpy (block, data, size);
+	if (0u < tail)
+		std::memcpy (block + size, offsets.data(), tail);
+	response_size_ = static_cast <std::uint16_t> (size);
+	ttls_ = not_parsed ? raw : static_cast <std::uint16_t> (offsets.size());
+	negative_ = negative_response (data, size);
+}
+
+namespace {
+
+//! bytes of the name of the question, as it was sent, 0 if it is not there
+std::size_t question_name_size (const std::uint8_t *b, std::size_t size) noexcept
+{
+	std::size_t off = sizeof (message_header);
+	while (off < size && 0u != b[off])
+	{
+		if (64u <= b[off])
+			return 0;
+		off += b[off] + 1u;
+	}
+	return (off < size) ? off + 1u - sizeof (message_header) : 0;
+}
+
+} // namespace
+
+void cache_entry::write_answer (query &msg, std::uint16_t id, std::int32_t ttl) const
+{
+	// the name in the case it was asked, e.g. with 0x20 randomization
+	std::array <std::uint8_t, max_host_name_length + 2u> name;
+	const std::size_t name_size = std::min (name.size(), question_name_size
+		(msg.bytes(), msg.size()));
+	std::copy_n (msg.bytes() + sizeof (message_header), name_size, name.begin());
+	msg.set_size (0);
+	msg.append (this->response(), static_cast <query::size_type> (response_size_));
+	if (0u < name_size && name_size == question_name_size (msg.bytes(), msg.size()))
+		std::copy_n (name.begin(), name_size, msg.modify_bytes()
+			+ sizeof (message_header));
+	if (raw == ttls_)
+	{
+		msg.adjust_id_and_ttl (id, ttl);
+		return;
+	}
+	// nothing parsed again, whatever the size of the answer
+	std::uint8_t *const b = msg.modify_bytes();
+	b[0] = static_cast <std::uint8_t> (id >> 8);
+	b[1] = static_cast <std::uint8_t> (id);
+	const auto t = static_cast <std::uint32_t> (ttl);
+	const std::uint8_t be[4] = {static_cast <std::uint8_t> (t >> 24),
+		static_cast <std::uint8_t> (t >> 16), static_cast <std::uint8_t> (t >> 8),
+		static_cast <std::uint8_t> (t)};
+	const std::uint8_t *const offsets = this->response() + response_size_;
+	for (std::size_t i = 0; i < ttls_; ++i)
+	{
+		std::uint16_t off;
+		std::memcpy (&off, offsets + i * sizeof (off), sizeof (off));
+		std::memcpy (b + off, be, sizeof (be));
+	}
+}
+
+cache::cache (unsigned short minttl, const limits &l) : limits_ (l),
+	min_ttl_ (minttl)
+{
+	index_.resize (64u, slot {0u, none});
+	this->set_limits (l);
+}
+
+void cache::check (const limits &l)
+{
+	if (0u == l.entries || 0u == l.bytes)
+		throw std::runtime_error ("DNS cache limits must be positive");
+}
+
+void cache::check (const prefetch &p)
+{
+	if (100u < p.percent)
+		throw std::runtime_error ("Invalid share of TTL to refresh ahead: "
+			+ std::to_string (p.percent) + '%');
+}
+
+void cache::set_limits (const limits &l)
+{
+	check (l);
+	this->limits_ = l;
+	this->evict_over_limits();
+}
+
+void cache::set_negative_limits (const limits &l)
+{
+	check (l);
+	this->negative_limits_ = l;
+	this->evict_over_limits();
+}
+
+std::uint32_t cache::hash (const char *name, std::size_t size, std::uint16_t qtype)
+	noexcept
+{
+	// same as while parsing questions, see query::get_question
+	name_hash h;
+	for (std::size_t i = 0; i < size; ++i)
+		h.add (static_cast <std::uint8_t> (name[i]));
+	return h.finish (qtype);
+}
+
+std::size_t cache::footprint (const cache_entry &e) noexcept
+{
+	// index is kept at least 1/8 empty
+	return sizeof (cache_entry) + sizeof (slot) + sizeof (slot) / 7u + e.spilled();
+}
+
+template <class Equal>
+std::uint32_t cache::probe (std::uint32_t h, std::uint16_t qtype, std::size_t size,
+	Equal &&same) const noexcept
+{
+	const std::size_t mask = index_.size() - 1u;
+	for (std::size_t i = h & mask, d = 0;; i = (i + 1u) & mask, ++d)
+	{
+		const slot &s = index_[i];
+		// Robin Hood: entries of the key can't be farther than poorer ones
+		if (none == s.entry || ((i - s.hash) & mask) < d)
+			return none;
+		if (h != s.hash)
+			continue;
+		const cache_entry &e = entries_[s.entry];
+		if (qtype == e.qtype_ && size == e.name_size_ && same (e))
+			return s.entry;
+	}
+}
+
+std::uint32_t cache::lookup (std::uint32_t h, const char *name, std::size_t size,
+	std::uint16_t qtype) const noexcept
+{
+	return this->probe (h, qtype, size, [name, size] (const cache_entry &e)
+	{
+		std::size_t k = 0;
+		while (k < size && lower (name[k]) == static_cast <char> (e.inline_[k]))
+			++k;
+		return k == size;
+	});
+}
+
+std::uint32_t cache::lookup (const question_view &q) const noexcept
+{
+	const auto t = static_cast <std::uint16_t> (q.type);
+	if (0u == q.text_size)
+		return none; // root is never cached
+	return this->probe (q.hash.finish (t), t, q.text_size, [&q] (const cache_entry &e)
+	{
+		// labels against the dotted name
+		const std::uint8_t *w = q.qname;
+		for (std::size_t k = 0; 0u != *w; ++w)
+		{
+			const std::size_t n = *w;
+			for (std::size_t j = 1; j <= n; ++j)
+				if (lower (static_cast <char> (w[j])) != static_cast <char>
+					(e.inline_[k++]))
+					return false;
+			if ('.' != e.inline_[k++])
+				return false;
+			w += n;
+		}
+		return true;
+	});
+}
+
+void cache::link (std::uint32_t h, std::uint32_t entry) noexcept
+{
+	const std::size_t mask = index_.size() - 1u;
+	slot moving {h, entry};
+	for (std::size_t i = h & mask, d = 0;; i = (i + 1u) & mask, ++d)
+	{
+		slot &s = index_[i];
+		if (none == s.entry)
+		{
+			s = moving;
+			return;
+		}
+		// the richer one moves on
+		const std::size_t sd = (i - s.hash) & mask;
+		if (sd < d)
+		{
+			std::swap (s, moving);
+			d = sd;
+		}
+	}
+}
+
+void cache::unlink (std::uint32_t h, std::uint32_t entry) noexcept
+{
+	const std::size_t mask = index_.size() - 1u;
+	std::size_t i = h & mask;
+	while (index_[i].entry != entry)
+	{
+		assert (none != index_[i].entry);
+		i = (i + 1u) & mask;
+	}
+	// backward shift, no tombstones
+	for (std::size_t n = (i + 1u) & mask; none != index_[n].entry
+		&& 0u != ((n - index_[n].hash) & mask); n = (n + 1u) & mask)
+	{
+		index_[i] = index_[n];
+		i = n;
+	}
+	index_[i] = slot {0u, none};
+}
+
+void cache::grow()
+{
+	std::vector <slot> old (2u * index_.size(), slot {0u, none});
+	old.swap (index_);
+	for (const slot &s : old)
+		if (none != s.entry)
+			this->link (s.hash, s.entry);
+}
+
+void cache::heap_set (std::size_t position, std::uint32_t entry) noexcept
+{
+	expiry_[position] = entry;
+	entries_[entry].heap_ = static_cast <std::uint32_t> (position);
+}
+
+bool cache::heap_sift_up (std::size_t p) noexcept
+{
+	const std::uint32_t entry = expiry_[p];
+	const std::time_t d = entries_[entry].deadline;
+	const std::size_t start = p;
+	while (0u < p && d < entries_[expiry_[(p - 1u) / 2u]].deadline)
+	{
+		this->heap_set (p, expiry_[(p - 1u) / 2u]);
+		p = (p - 1u) / 2u;
+	}
+	this->heap_set (p, entry);
+	return start != p;
+}
+
+void cache::heap_sift_down (std::size_t p) noexcept
+{
+	const std::uint32_t entry = expiry_[p];
+	const std::time_t d = entries_[entry].deadline;
+	for (;;)
+	{
+		std::size_t c = 2u * p + 1u;
+		if (c >= expiry_.size())
+			break;
+		if (c + 1u < expiry_.size() && entries_[expiry_[c + 1u]].deadline
+			< entries_[expiry_[c]].deadline)
+			++c;
+		if (!(entries_[expiry_[c]].deadline < d))
+			break;
+		this->heap_set (p, expiry_[c]);
+		p = c;
+	}
+	this->heap_set (p, entry);
+}
+
+void cache::heap_push (std::uint32_t entry)
+{
+	expiry_.push_back (entry);
+	this->heap_sift_up (expiry_.size() - 1u);
+}
+
+void cache::heap_remove (std::uint32_t entry) noexcept
+{
+	const std::size_t p = entries_[entry].heap_;
+	assert (p < expiry_.size() && entry == expiry_[p]);
+	const std::uint32_t last = expiry_.back();
+	expiry_.pop_back();
+	if (entry == last)
+		return;
+	this->heap_set (p, last);
+	this->heap_update (last);
+}
+
+void cache::heap_update (std::uint32_t entry) noexcept
+{
+	const std::size_t p = entries_[entry].heap_;
+	if (!this->heap_sift_up (p))
+		this->heap_sift_down (p);
+}
+
+std::uint32_t cache::insert (std::uint32_t h, const char *name,
+	std::size_t name_size, std::uint16_t qtype, const std::uint8_t *response,
+	std::size_t size, std::time_t deadline)
+{
+	if (7u * index_.size() <= 8u * (size_ + 1u))
+		this->grow();
+	if (free_.empty())
+	{
+		if (none - 1u <= entries_.size())
+			throw std::length_error ("DNS cache is full");
+		free_.push_back (static_cast <std::uint32_t> (entries_.size()));
+		entries_.emplace_back();
+	}
+	const std::uint32_t i = free_.back();
+	cache_entry &e = entries_[i];
+	e.assign (h, name, name_size, qtype);
+	const bool not_parsed = !query::ttl_offsets (response, size, offsets_);
+	e.set_response (response, size, offsets_, not_parsed);
+	e.deadline = deadline;
+	const std::time_t now = std::time (nullptr);
+	e.ttl_ = static_cast <std::uint32_t> (now < deadline ? deadline - now : 0);
+	e.renewed_ = 0;
+	e.hits_ = 0;
+	e.refreshing_ = false;
+	e.referenced_ = false;
+	this->heap_push (i); // may throw, before anything else changes
+	e.used_ = true;
+	free_.pop_back();
+	this->link (h, i);
+	this->charge (e);
+	this->evict_over_limits();
+	return i;
+}
+
+void cache::erase (std::uint32_t i)
+{
+	cache_entry &e = entries_[i];
+	assert (e.used_ && 0u < size_);
+	this->unlink (e.hash_, i);
+	this->heap_remove (i);
+	this->discharge (e);
+	e.large_.reset();
+	e.used_ = false;
+	free_.push_back (i);
+}
+
+void cache::charge (const cache_entry &e) noexcept
+{
+	const std::size_t b = footprint (e);
+	++size_;
+	bytes_ += b;
+	if (e.negative_)
+	{
+		++negative_size_;
+		negative_bytes_ += b;
+	}
+}
+
+void cache::discharge (const cache_entry &e) noexcept
+{
+	const std::size_t b = footprint (e);
+	assert (0u < size_ && b <= bytes_);
+	--size_;
+	bytes_ -= b;
+	if (e.negative_)
+	{
+		assert (0u < negative_size_ && b <= negative_bytes_);
+		--negative_size_;
+		negative_bytes_ -= b;
+	}
+}
+
+bool cache::over_limits (bool negative) const noexcept
+{
+	if (negative)
+		return negative_size_ > negative_limits_.entries
+			|| negative_bytes_ > negative_limits_.bytes;
+	return size_ - negative_size_ > limits_.entries
+		|| bytes_ - negative_bytes_ > limits_.bytes;
+}
+
+void cache::evict_over_limits()
+{
+	bool positive = this->over_limits (false), negative = this->over_limits (true);
+	while (positive || negative)
+	{
+		if (hand_ >= entries_.size())
+			hand_ = 0;
+		cache_entry &e = entries_[hand_];
+		// the other partition keeps its reference bits
+		if (!e.used_ || (e.negative_ ? !negative : !positive))
+		{
+			++hand_;
+			continue;
+		}
+		if (e.referenced_)
+		{
+			e.referenced_ = false;
+			++hand_;
+			continue;
+		}
+		if (process::log::severity::debug <= process::log::get_severity())
+			process::log::debug ("Evicting: ", std::string (e.name(), e.name_size()),
+				", size: ", size_, ", bytes: ", bytes_);
+		this->erase (static_cast <std::uint32_t> (hand_++));
+		++evictions_;
+		positive = this->over_limits (false);
+		negative = this->over_limits (true);
+	}
+}
 
 const cache_entry * cache::find(const std::string &qname, const rr_type qtype) const
 {
-	// cache_key k;
-	cache_entry k;
 	//! @todo DNS uses limited ASCI encoding: letter, number, dash: [a-z,0-9,-],
 	//! libidn, punycode
-	std::string lower_qname = sys::ascii_tolower_copy (qname);
 	//! @todo: adjust byte preceding the last one back to UPPERCASE
 	//! in some wheired OPT ttl case? But it is not done during cache::store
-#if 0
-	if (wire_data[11] == 1)
-	{
-		uint16_t opt_type;
-		uint32_t opt_ttl;
+	const auto t = static_cast <std::uint16_t> (qtype);
+	const std::uint32_t i = this->lookup (hash (qname.data(), qname.size(), t),
+		qname.data(), qname.size(), t);
+	if (none == i)
+		return nullptr;
+	const cache_entry &e = entries_[i];
+	e.referenced_ = true;
+	return &e;
+}
 
-		if (next_rr(wire_data, wire_data_len, 0, NULL, &i,
-					&opt_type, NULL, &opt_ttl) != 0) {
-			throw std::runtime_error ("bad dns query");
-		}
-		if (opt_type != DNS_TYPE_OPT)
-			return false; // query not found
-		if ((opt_ttl & 0x8000) == 0x8000) {
-			if (qname_len >= 2) {
-				qname[qname_len - 2] = static_cast <uint8_t>
-					(std::toupper(qname[qname_len - 2]));
-			}
-		}
+const cache_entry *cache::put (const char *name, std::size_t name_size,
+	std::uint16_t qtype, const std::uint8_t *response, std::size_t size,
+	std::time_t deadline)
+{
+	const std::uint32_t h = hash (name, name_size, qtype);
+	std::uint32_t i = this->lookup (h, name, name_size, qtype);
+	const std::time_t now = std::time (nullptr);
+	if (none != i)
+	{
+		cache_entry &e = entries_[i];
+		this->discharge (e); // may move to the other partition
+		const bool not_parsed = !query::ttl_offsets (response, size, offsets_);
+		e.set_response (response, size, offsets_, not_parsed);
+		// answers after the old deadline are counted as misses saved
+		e.renewed_ = (e.refreshing_ && now < e.deadline) ? e.deadline : 0;
+		e.refreshing_ = false;
+		e.hits_ = 0;
+		e.ttl_ = static_cast <std::uint32_t> (now < deadline ? deadline - now : 0);
+		e.deadline = deadline;
+		e.referenced_ = true;
+		this->heap_update (i);
+		this->charge (e);
+		this->evict_over_limits();
 	}
-#endif
-	k.first = std::move(lower_qname);
-	assert (lower_qname.empty());
-	k.second = static_cast <std::uint16_t> (qtype);
-	const auto itr = cache_entries_.find(k);
-	if( cache_entries_.end() != itr )
-		return &*itr;
-	return nullptr;
+	else
+		i = this->insert (h, name, name_size, qtype, response, size, deadline);
+	// evicted right away, if too large
+	return entries_[i].used_ ? &entries_[i] : nullptr;
 }
 
 void cache::replace_entry(const std::string &wire_qname,
 	const std::vector<uint8_t>  &wire_data, const std::int32_t ttl,
 	const rr_type qtype)
 {
-	const cache_entry *scanned_cache_entry = this->find(wire_qname, qtype);
-	std::time_t tnow = std::time (nullptr);
-	if (scanned_cache_entry != nullptr)
-	{
-		scanned_cache_entry->response = wire_data;
-		scanned_cache_entry->deadline = tnow + static_cast <std::time_t> (ttl);
-	}
-	else
-	{
-		cache_entry cache_entry;
-		cache_entry.first = wire_qname;
-		cache_entry.second = static_cast <std::uint16_t> (qtype);
-		cache_entry.response = wire_data;
-		cache_entry.deadline = tnow + static_cast <std::time_t> (ttl);
-		this->cache_entries_.insert (std::move (cache_entry));
-	}
+	this->put (wire_qname.data(), wire_qname.size(), static_cast <std::uint16_t>
+		(qtype), wire_data.data(), wire_data.size(), std::time (nullptr)
+		+ static_cast <std::time_t> (ttl));
 }
 
-void cache::store(const query &msg)
+const cache_entry *cache::store(const query &msg)
 {
 	assert (msg.is_dns());
 	//! @todo is TTL time_t or uint32 ?
@@ -84,174 +521,301 @@ void cache::store(const query &msg)
 		const auto qq = msg.get_question();
 		if( rr_class::internet == std::get <rr_class> (qq) )
 		{
-			const std::int32_t min_ttl = std::min (defaults::max_ttl(), std::max
-				(msg.answer_min_ttl(), static_cast<std::int32_t> (this->min_ttl())));
-			const std::vector <std::uint8_t> wire (msg.bytes(), msg.bytes()
-				+ msg.size());
-			auto hostname = sys::ascii_tolower_copy (std::get <std::string> (qq));
+			std::int32_t min_ttl = 0;
+			if (msg.is_negative())
+			{
+				// the SOA says how long, not the clamp for answers
+				min_ttl = std::min (defaults::max_negative_ttl(), msg.negative_ttl());
+				if (0 >= min_ttl)
+					return nullptr;
+			}
+			else
+				min_ttl = std::min (defaults::max_ttl(), std::max (msg.answer_min_ttl(),
+					static_cast<std::int32_t> (this->min_ttl())));
+			const auto &hostname = std::get <std::string> (qq);
 			process::log::info ("Caching: ", hostname, " size: ", msg.size(),
 				", TTL: ", min_ttl);
 			//! @todo not adjusting here byte preceding the last one?
 			//! see cache::find
-			this->replace_entry (hostname, wire, min_ttl, std::get <rr_type> (qq));
+			return this->put (hostname.data(), hostname.size(), static_cast
+				<std::uint16_t> (std::get <rr_type> (qq)), msg.bytes(), msg.size(),
+				std::time (nullptr) + min_ttl);
 		}
 	}
+	return nullptr;
+}
+
+void cache::set_prefetch (const prefetch &p)
+{
+	check (p);
+	prefetch_ = p;
 }
 
 bool cache::retrieve(query &msg)
 {
-	auto q = msg.get_question();
-	const auto hn = std::get<std::string>(q);
-	const cache_entry *ent = this->find (hn, std::get <rr_type> (q));
+	hint h;
+	return this->retrieve (msg, h);
+}
+
+bool cache::retrieve(query &msg, hint &h)
+{
+	h = hint();
+	// straight from the message, a hit allocates nothing
+	question_view q;
+	if (!msg.get_question (q))
+		return false;
+	const std::uint32_t i = this->lookup (q);
 	std::time_t tnow = std::time (nullptr);
-	process::log::debug ("CACHE size: ", this->cache_entries_.size(), ", entry: ",
-		ent);
-	if (nullptr != ent && ent->response.size() <= msg.max_size &&
-		tnow < ent->deadline)
+	process::log::debug ("CACHE size: ", size_, ", entry: ", i);
+	++lookups_;
+	if (none == i)
+		return false;
+	cache_entry &ent = entries_[i];
+	if (ent.deadline <= tnow)
 	{
-		const std::uint16_t tid = msg.header().id;
-		std::int32_t ttl = static_cast <std::int32_t> (ent->deadline - tnow);
-		//! @todo numeric_cast
-		msg = query (ent->response.data(), static_cast <query::size_type>
-			(ent->response.size()));
-		//! @todo replace query with the one from the question
-		//! or merge question and answer
-		msg.adjust_id_and_ttl (tid, ttl);
-		return true;
+		if (tnow < ent.deadline + static_cast <std::time_t> (stale_))
+		{
+			h.stale = true;
+			return false;
+		}
+		this->erase (i);
+		++expirations_;
+		return false;
 	}
-	return false;
+	if (ent.response_size() > msg.max_size)
+		return false;
+	ent.referenced_ = true;
+	++(ent.negative_ ? negative_hits_ : hits_);
+	if (std::numeric_limits <std::uint16_t>::max() > ent.hits_)
+		++ent.hits_;
+	if (0 != ent.renewed_ && ent.renewed_ <= tnow)
+	{
+		++prefetch_hits_;
+		ent.renewed_ = 0;
+	}
+	if (0u < prefetch_.hits && !ent.refreshing_ && prefetch_.hits <= ent.hits_
+		&& static_cast <std::uint64_t> (ent.deadline - tnow) * 100u
+		<= std::uint64_t {prefetch_.percent} * ent.ttl_)
+	{
+		ent.refreshing_ = true; // until the answer is stored or the entry expires
+		h.refresh = true;
+		++prefetches_;
+	}
+	// overwriting the question in place, no temporary message
+	//! @todo replace query with the one from the question
+	//! or merge question and answer
+	ent.write_answer (msg, msg.header().id, static_cast <std::int32_t>
+		(ent.deadline - tnow));
+	return true;
 }
 
-template <typename T> inline void wrt (std::ostream &of, const T *d, std::size_t s)
+bool cache::retrieve_stale(query &msg)
 {
-	//! @todo numeric_cast
-	of.write (reinterpret_cast <const char*> (d), static_cast <std::streamsize> (s));
+	question_view q;
+	if (!msg.get_question (q))
+		return false;
+	const std::uint32_t i = this->lookup (q);
+	const std::time_t tnow = std::time (nullptr);
+	if (none == i)
+		return false;
+	const cache_entry &ent = entries_[i];
+	if (ent.deadline + static_cast <std::time_t> (stale_) <= tnow
+		|| ent.response_size() > msg.max_size)
+		return false;
+	ent.referenced_ = true;
+	const bool stale = ent.deadline <= tnow;
+	if (stale)
+		++stale_answers_;
+	ent.write_answer (msg, msg.header().id, stale ? defaults::stale_answer_ttl()
+		: static_cast <std::int32_t> (ent.deadline - tnow));
+	return true;
 }
 
-template <typename T> inline void wrt (std::ostream &of, const T &d)
+namespace {
+
+//! precedes records of the file
+struct file_header
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t byte_order;
+	std::uint64_t records; //!< of a snapshot, journals grow
+};
+
+//! followed by the name and the answer, padded to 8 bytes
+struct record_header
 {
-	of.write (reinterpret_cast <const char*> (&d), sizeof (T));
+	std::int64_t deadline;
+	std::uint16_t qtype, response_size;
+	std::uint8_t name_size, reserved[3];
+};
+
+static_assert (24u == sizeof (file_header) && 16u == sizeof (record_header),
+	"cache file layout");
+
+constexpr const std::uint32_t byte_order = 0x01020304u;
+constexpr const char snapshot_magic[8] = {'c', 'd', 'n', 's', 's', 'n', 'a', 'p'};
+constexpr const char journal_magic[8] = {'c', 'd', 'n', 's', 'j', 'r', 'n', 'l'};
+
+constexpr std::size_t padded (std::size_t size) noexcept
+{
+	return (size + 7u) & ~std::size_t {7u};
 }
 
-void cache::save_as (const std::string &filename) const
+template <typename T> inline void put_bytes (std::vector <std::uint8_t> &out,
+	const T &value)
 {
-	std::ofstream ofile (filename, std::ios::binary);
-	wrt (ofile, "mgck", 4);
-	constexpr const std::int32_t magick = 1'023'456'789;
-	wrt (ofile, magick);
-	wrt (ofile, "size", 4);
-	wrt (ofile, this->cache_entries_.size());
-	for (const auto & ent : this->cache_entries_)
-	{
-		wrt (ofile, "entr", 4);
-		wrt (ofile, ent.first.size());
-		wrt (ofile, ent.first.c_str(), ent.first.size()); // name
-		wrt (ofile, ent.second); // type
-		wrt (ofile, ent.deadline);
-		wrt (ofile, "dns:", 4);
-		wrt (ofile, ent.response.size());
-		//! @todo: assert (is_dns (ent.response));
-		wrt (ofile, ent.response.data(), ent.response.size());
-	}
-	if (!ofile)
-		throw std::runtime_error ("Failed to save DNS cache into: " + filename);
+	const auto *b = reinterpret_cast <const std::uint8_t *> (&value);
+	out.insert (out.end(), b, b + sizeof (T));
 }
 
-template <typename T> inline void rd (std::ifstream &ifile, T &d)
+} // namespace
+
+void cache::write_header (std::vector <std::uint8_t> &out, bool journal,
+	std::uint64_t records)
 {
-	ifile.read (reinterpret_cast <char *> (&d), sizeof (T));
+	file_header h;
+	std::memcpy (h.magic, journal ? journal_magic : snapshot_magic, sizeof (h.magic));
+	h.version = file_version;
+	h.byte_order = byte_order;
+	h.records = records;
+	put_bytes (out, h);
 }
 
-template <typename T> inline T crd (std::ifstream &ifile)
+void cache::write_record (std::vector <std::uint8_t> &out, const cache_entry &e)
 {
-	T d=0;
-	ifile.read (reinterpret_cast <char *> (&d), sizeof (T));
-	if (!ifile)
-		throw std::runtime_error ("wrong file");
-	return d;
+	record_header r;
+	std::memset (&r, 0, sizeof (r));
+	r.deadline = static_cast <std::int64_t> (e.deadline);
+	r.qtype = e.qtype_;
+	r.response_size = e.response_size_;
+	r.name_size = e.name_size_;
+	const std::size_t start = out.size();
+	put_bytes (out, r);
+	out.insert (out.end(), e.name(), e.name() + e.name_size());
+	out.insert (out.end(), e.response(), e.response() + e.response_size());
+	out.resize (start + padded (out.size() - start), 0u);
 }
 
-template <typename T> inline void crd (std::ifstream &ifile, T *d, std::size_t s)
+std::vector <std::uint8_t> cache::image() const
 {
-	//! @todo numeric_cast
-	ifile.read (reinterpret_cast <char *> (d), static_cast <std::streamsize> (s));
-	if (!ifile)
-		throw std::runtime_error ("wrong file");
+	std::vector <std::uint8_t> out;
+	out.reserve (sizeof (file_header) + size_ * (sizeof (record_header) + 128u));
+	write_header (out, false, size_);
+	for (const auto &e : entries_)
+		if (e.used_)
+			write_record (out, e);
+	return out;
 }
 
-template <std::uint8_t N> inline std::array <char, N> crd (std::istream &ifile)
+bool cache::image_slice (std::vector <std::uint8_t> &out, std::size_t &next,
+	std::size_t budget, std::uint64_t &records) const
 {
-	std::array <char, N> d;
-	ifile.read (&d[0], N);
-	if (!ifile && !ifile.eof())
-		throw std::runtime_error ("Can't read file");
-	return d;
+	for (; next < entries_.size(); ++next, --budget)
+	{
+		if (0u == budget)
+			return true;
+		const auto &e = entries_[next];
+		if (e.used_)
+		{
+			write_record (out, e);
+			++records;
+		}
+	}
+	return false;
 }
 
-typedef std::array <char, 4> key_t;
+void cache::set_records (std::vector <std::uint8_t> &out, std::uint64_t records)
+{
+	file_header h;
+	assert (sizeof (h) <= out.size());
+	std::memcpy (&h, out.data(), sizeof (h));
+	h.records = records;
+	std::memcpy (out.data(), &h, sizeof (h));
+}
 
-cache cache::load (const std::string &filename, unsigned short minttl)
+void cache::save_as (const std::string &filename) const
 {
-	std::ifstream ifile (filename, std::ios::binary);
-	if (crd<4> (ifile) != key_t{{'m', 'g', 'c', 'k'}})
+	const auto out = this->image();
+	std::ofstream ofile (filename, std::ios::binary);
+	ofile.write (reinterpret_cast <const char *> (out.data()), static_cast
+		<std::streamsize> (out.size()));
+	if (!ofile)
+		throw std::runtime_error ("Failed to save DNS cache into: " + filename);
+}
+
+std::size_t cache::merge (const std::uint8_t *bytes, std::size_t size,
+	const std::string &filename)
+{
+	file_header h;
+	if (sizeof (h) > size)
+		throw std::runtime_error ("Not a DNS cache (too short): " + filename);
+	std::memcpy (&h, bytes, sizeof (h));
+	const bool journal = 0 == std::memcmp (h.magic, journal_magic, sizeof (h.magic));
+	if (!journal && 0 != std::memcmp (h.magic, snapshot_magic, sizeof (h.magic)))
 		throw std::runtime_error ("Not a DNS cache (wrong magick): " + filename);
-	if (1023456789 != crd <std::int32_t> (ifile))
-		throw std::runtime_error ("Not a DNS cache (wrong byte order): "
-			+ filename);
-	if (crd<4> (ifile) != key_t{{'s','i','z','e'}})
-		throw std::runtime_error ("Not a DNS cache (no size): " + filename);
-	const auto nq = crd <std::size_t> (ifile);
-	std::size_t n=0;
-	cache result (minttl);
-	while (ifile)
+	if (byte_order != h.byte_order)
+		throw std::runtime_error ("Not a DNS cache (wrong byte order): " + filename);
+	if (file_version != h.version)
+		throw std::runtime_error ("Unsupported DNS cache version "
+			+ std::to_string (h.version) + ": " + filename);
+	std::size_t n = 0, off = sizeof (h);
+	while (off < size)
 	{
-		const key_t key = crd<4> (ifile);
-		if (ifile.eof())
+		record_header r;
+		if (size - off < sizeof (r))
+			break;
+		std::memcpy (&r, bytes + off, sizeof (r));
+		const std::size_t body = std::size_t {r.name_size} + r.response_size;
+		if (size - off - sizeof (r) < body)
 			break;
-		if (key != key_t{{'e','n','t','r'}})
-			throw std::runtime_error ("corrupt DNS cache file: " + filename);
-		auto l = crd <std::size_t> (ifile);
-		if (1u > l || 300u < l)
-			throw std::runtime_error ("corrupt DNS name in: " + filename);
-		std::string name(l, '\0');
-		crd (ifile, &name[0], name.size()); // name
-		const auto qtype = crd <unsigned short> (ifile);
-		const auto deadline = crd <std::time_t> (ifile);
-		if (crd<4> (ifile) != key_t {{'d','n','s',':'}})
-			throw std::runtime_error ("corrupt DNS entry in: " + filename);
-		l = crd <std::size_t> (ifile);
-		query msg;
-		if (12u > l || query::max_size < l || l > msg.reserved_size())
-			throw std::runtime_error ("invalid DNS message in: " + filename);
-		crd (ifile, msg.modify_bytes(), l);
-		msg.set_size (static_cast <query::size_type> (l));
+		if (0u == r.name_size || 12u > r.response_size)
+			throw std::runtime_error ("corrupt DNS cache entry in: " + filename);
+		const auto *name = reinterpret_cast <const char *> (bytes + off + sizeof (r));
+		this->put (name, r.name_size, r.qtype, bytes + off + sizeof (r) + r.name_size,
+			r.response_size, static_cast <std::time_t> (r.deadline));
 		++n;
-		if (n > nq)
-			throw std::runtime_error ("Too many entries in DNS cache: " + filename);
-		// assert (std::get <std::string> (msg.get_question()) == name);
-		cache_entry entry;
-		entry.first = std::move (name);
-		entry.second = qtype;
-		entry.response = std::vector <std::uint8_t> (msg.bytes(), msg.bytes()
-			+ msg.size());
-		entry.deadline = deadline;
-		result.cache_entries_.insert (std::move (entry));
+		off += padded (sizeof (r) + body);
 	}
-	if (result.size() < nq)
-		throw std::runtime_error ("too few entries");
+	// appending to a journal may have been cut short, snapshots are complete
+	if (off < size && !journal)
+		throw std::runtime_error ("Truncated DNS cache: " + filename);
+	if (!journal && n != h.records)
+		throw std::runtime_error ("Wrong number of entries in DNS cache: " + filename);
+	return n;
+}
+
+cache cache::load (const std::string &filename, unsigned short minttl,
+	const limits &lim)
+{
+	const sys::mapped_file file (filename);
+	cache result (minttl, lim);
+	result.merge (file.data(), file.size(), filename);
 	return result;
 }
 
-void cache::collect_garbage()
+bool cache::expire (std::time_t now, std::size_t budget)
 {
-	std::time_t tnow = std::time (nullptr);
-	for (auto e = cache_entries_.begin(); e != cache_entries_.end();)
+	const std::time_t before = now - static_cast <std::time_t> (stale_);
+	for (; !expiry_.empty() && entries_[expiry_.front()].deadline <= before; --budget)
 	{
-		if (e->deadline < tnow)
-			e = cache_entries_.erase (e);
-		else
-			e = std::next (e);
+		if (0u == budget)
+			return true;
+		this->erase (expiry_.front());
+		++expirations_;
 	}
+	return false;
+}
+
+std::time_t cache::next_expiry() const noexcept
+{
+	assert (!expiry_.empty());
+	return entries_[expiry_.front()].deadline + static_cast <std::time_t> (stale_);
+}
+
+void cache::collect_garbage()
+{
+	this->expire (std::time (nullptr), expiry_.size());
 }
 
 } // namespace dns
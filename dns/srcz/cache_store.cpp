@@ -0,0 +1,265 @@
+#include <cstdio>
+#include <cassert>
+#include <stdexcept>
+#include <system_error>
+#include <exception>
+
+#include "dns/cache_store.hxx"
+#include "dns/cache.hxx"
+#include "sys/mapped_file.hxx"
+#include "sys/logger.hxx"
+
+namespace dns {
+
+namespace log = process::log;
+
+namespace {
+
+void write_file (const std::string &file_name, const std::vector<std::uint8_t> &b)
+{
+	std::ofstream ofile (file_name, std::ios::binary | std::ios::trunc);
+	ofile.write (reinterpret_cast <const char *> (b.data()), static_cast
+		<std::streamsize> (b.size()));
+	ofile.close();
+	if (!ofile)
+		throw std::runtime_error ("Failed to write: " + file_name);
+}
+
+void move_file (const std::string &from, const std::string &to)
+{
+#ifdef _WIN32
+	std::remove (to.c_str()); // rename does not replace
+#endif
+	if (0 != std::rename (from.c_str(), to.c_str()))
+		throw std::runtime_error ("Failed to rename: " + from + " to: " + to);
+}
+
+//! complete file written aside, then replaces the snapshot
+void write_snapshot (const std::string &file_name,
+	const std::vector<std::uint8_t> &image)
+{
+	const std::string tmp = file_name + ".tmp";
+	write_file (tmp, image);
+	move_file (tmp, file_name);
+}
+
+std::size_t merge_file (cache &c, const std::string &file_name, bool &found)
+{
+	found = false;
+	try
+	{
+		const sys::mapped_file file (file_name);
+		found = true;
+		return c.merge (file.data(), file.size(), file_name);
+	}
+	catch (const std::system_error &e)
+	{
+		if (std::errc::no_such_file_or_directory != e.code())
+			throw;
+	}
+	return 0;
+}
+
+} // namespace
+
+cache_store::cache_store (const std::string &directory, ev::loop_ref loop) :
+	snapshot_ (directory + "/dnscache.bin"),
+	journal_ (directory + "/dnscache.journal"),
+	old_journal_ (directory + "/dnscache.journal.old")
+{
+	timer_.set (loop);
+	timer_.set <timer_callback>(); // ATTN! clears data
+	timer_.data = this; // ATTN! must be set after callback
+	slicer_.set (loop);
+	slicer_.set <slice_callback>();
+	slicer_.data = this;
+}
+
+cache_store::~cache_store()
+{
+	this->abandon_image();
+	this->join();
+	try
+	{
+		this->flush();
+	}
+	catch (const std::exception &e)
+	{
+		log::error ("Failed to write cache journal: ", e.what());
+	}
+}
+
+std::size_t cache_store::load (cache &c)
+{
+	assert (!journal_file_.is_open());
+	bool found = false;
+	std::size_t n = merge_file (c, snapshot_, found);
+	if (found)
+		log::notice ("Loaded ", n, " entries from cache: ", snapshot_);
+	std::size_t journaled = 0;
+	for (const auto *fn : {&old_journal_, &journal_})
+	{
+		journaled += merge_file (c, *fn, found);
+		if (found)
+			log::notice ("Replayed cache journal: ", *fn);
+	}
+	if (0u < journaled)
+		this->save (c); // appending after a torn record would be lost
+	else
+		this->open_journal();
+	return n + journaled;
+}
+
+void cache_store::open_journal()
+{
+	journal_file_.close();
+	journal_file_.clear();
+	journal_file_.open (journal_, std::ios::binary | std::ios::trunc);
+	if (!journal_file_)
+		throw std::runtime_error ("Failed to create cache journal: " + journal_);
+	batch_.clear();
+	cache::write_header (batch_, true, 0u);
+	journal_bytes_ = 0;
+	this->flush();
+}
+
+void cache_store::append (const cache_entry &e, const cache &c)
+{
+	if (!journal_file_.is_open())
+		return; // not loaded
+	const bool was_empty = batch_.empty();
+	cache::write_record (batch_, e);
+	if (batch_bytes <= batch_.size())
+		this->flush();
+	else if (was_empty)
+	{
+		timer_.stop();
+		timer_.start (batch_seconds);
+	}
+	if (min_journal_bytes < journal_bytes_ && snapshot_bytes_ < journal_bytes_
+		&& !this->compacting())
+		this->compact (c);
+}
+
+void cache_store::flush()
+{
+	timer_.stop();
+	if (batch_.empty() || !journal_file_.is_open())
+		return;
+	journal_file_.write (reinterpret_cast <const char *> (batch_.data()),
+		static_cast <std::streamsize> (batch_.size()));
+	journal_file_.flush();
+	if (!journal_file_)
+		throw std::runtime_error ("Failed to append to cache journal: " + journal_);
+	journal_bytes_ += batch_.size();
+	batch_.clear();
+}
+
+void cache_store::timer_callback (ev::timer &w, int)
+{
+	assert (nullptr != w.data);
+	auto *self = reinterpret_cast <cache_store *> (w.data);
+	try
+	{
+		self->flush();
+	}
+	catch (const std::exception &e)
+	{
+		log::error ("Failed to write cache journal: ", e.what());
+	}
+}
+
+void cache_store::slice_callback (ev::timer &w, int)
+{
+	assert (nullptr != w.data);
+	auto *self = reinterpret_cast <cache_store *> (w.data);
+	try
+	{
+		// unlike an idle watcher, runs while I/O is pending too
+		if (!self->write_slice())
+			w.start (0., 0.);
+	}
+	catch (const std::exception &e)
+	{
+		self->abandon_image();
+		log::error ("Failed to compact cache: ", e.what());
+	}
+}
+
+void cache_store::compact (const cache &c)
+{
+	this->join(); // previous one is long over by now
+	if (std::ifstream (old_journal_).is_open())
+	{
+		// the previous snapshot was not written, the old journal is still needed
+		log::warning ("Saving the whole cache, compaction failed: ", snapshot_);
+		this->save (c);
+		return;
+	}
+	this->flush();
+	journal_file_.close();
+	// entries journaled from now on are newer than the snapshot
+	move_file (journal_, old_journal_);
+	this->open_journal();
+	++compactions_;
+	// the whole cache at once would stall the loop, answers wait for slices only
+	image_.clear();
+	image_.reserve (c.bytes()); // about the image size, not copied as it grows
+	cache::write_header (image_, false, 0u);
+	image_next_ = 0;
+	image_records_ = 0;
+	imaged_ = &c;
+	slicer_.start (0., 0.);
+}
+
+bool cache_store::write_slice()
+{
+	assert (nullptr != imaged_);
+	if (imaged_->image_slice (image_, image_next_, slice_entries, image_records_))
+		return false;
+	imaged_ = nullptr;
+	cache::set_records (image_, image_records_);
+	snapshot_bytes_ = image_.size();
+	log::debug ("Compacting cache into: ", snapshot_, ", entries: ", image_records_);
+	std::vector<std::uint8_t> image;
+	image.swap (image_);
+	compactor_ = std::thread ([this] (std::vector<std::uint8_t> &&b)
+	{
+		try
+		{
+			write_snapshot (snapshot_, b);
+			std::remove (old_journal_.c_str());
+		}
+		catch (const std::exception &e)
+		{
+			log::error ("Failed to compact cache: ", e.what());
+		}
+	}, std::move (image));
+	return true;
+}
+
+void cache_store::abandon_image() noexcept
+{
+	slicer_.stop();
+	imaged_ = nullptr;
+	image_.clear();
+}
+
+void cache_store::join() noexcept
+{
+	if (compactor_.joinable())
+		compactor_.join();
+}
+
+void cache_store::save (const cache &c)
+{
+	this->abandon_image();
+	this->join();
+	const auto image = c.image();
+	write_snapshot (snapshot_, image);
+	snapshot_bytes_ = image.size();
+	std::remove (old_journal_.c_str());
+	this->open_journal();
+}
+
+} // namespace dns
@@ -9,6 +9,10 @@
 #include <type_traits>
 #include <sstream>
 #include <random>
+#include <thread>
+#include <future>
+#include <memory>
+#include <utility>
 
 #include "backtrace/backtrace.hxx"
 #include "dns/daemon.hxx"
@@ -17,6 +21,10 @@
 #include "dns/constants.hxx"
 #include "network/udp/listener.hxx"
 #include "network/tcp/listener.hxx"
+#include "network/udp/upstream_pool.hxx"
+#include "network/tcp/upstream_pool.hxx"
+#include "network/timer_wheel.hxx"
+#include "network/provider.hxx"
 #include "sys/logger.hxx"
 #include "sys/sysunix.hxx"
 
@@ -24,6 +32,10 @@
 
 #include "sys/preconfig.h"
 
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
 namespace dns {
 
 namespace log = process::log;
@@ -46,6 +58,8 @@ void daemon::start_listeners()
 	else
 		this->udp_listener_ = network::udp::listener::make_new(std::move(rc1),
 			this->address());
+	if (0u < this->options().udp_batch_size)
+		this->udp_listener_->set_batch_size (this->options().udp_batch_size);
 	auto rc2 = this->responder_ptr_;
 	if (0 <= this->tcp_listener_systemd_handle_ )
 	{
@@ -63,6 +77,167 @@ void daemon::start_listeners()
 #endif
 }
 
+struct daemon::worker
+{
+	// declared first, destroyed last: watchers below are attached to it
+	ev::dynamic_loop loop;
+	ev::async stop_event, reload_event;
+	std::shared_ptr<responder> responder_ptr;
+	//! taken by reload_event, swapped atomically from the main thread
+	std::shared_ptr<const responder_configuration> config;
+	std::shared_ptr<network::udp::udplistener> udp_listener;
+	std::shared_ptr<network::tcp::tcplistener> tcp_listener;
+	daemon *owner = nullptr;
+	unsigned id = 0;
+	std::thread thread;
+
+	//! counters of the responder and listeners, kept once they are released
+	struct totals
+	{
+		std::size_t requests = 0, processed = 0, blacklisted = 0, cached = 0,
+			upstream = 0, coalesced = 0;
+	} totals;
+
+	worker() : loop (ev::AUTO) {}
+
+	static void stop_callback (ev::async &w, int)
+	{
+		w.loop.break_loop (ev::ALL);
+	}
+
+	static void reload_callback (ev::async &, int);
+};
+
+void daemon::run_worker (worker &w)
+{
+	try
+	{
+		log::info ("Worker ", w.id, " started");
+		// upstream pools and timers of the loop belong to this thread
+		try
+		{
+			w.owner->start_responder (*w.responder_ptr);
+		}
+		catch (const std::exception &e)
+		{
+			log::error ("Worker ", w.id, " failed to start upstream: ", e.what());
+		}
+		w.loop.run();
+		log::info ("Worker ", w.id, " stopped");
+	}
+	catch (const std::exception &e)
+	{
+		log::critical ("Worker ", w.id, " failed: ", e.what());
+	}
+	// packets go back to the pool of this thread, which issued them
+	const auto &r = *w.responder_ptr;
+	w.totals.requests = w.udp_listener->count() + w.tcp_listener->count();
+	w.totals.processed = r.processed_count();
+	w.totals.blacklisted = r.blacklisted_count();
+	w.totals.cached = r.cached_count();
+	w.totals.upstream = r.upstream_count();
+	w.totals.coalesced = r.coalesced_count();
+	w.udp_listener.reset();
+	w.tcp_listener.reset();
+	w.responder_ptr.reset();
+}
+
+void daemon::worker::reload_callback (ev::async &w, int)
+{
+	assert (nullptr != w.data);
+	auto &wk = *reinterpret_cast<worker *> (w.data);
+	auto config = std::atomic_exchange (&wk.config,
+		std::shared_ptr<const responder_configuration>());
+	if (!config)
+		return; // taken by a previous event
+	try
+	{
+		wk.owner->reload_responder (*wk.responder_ptr, std::move (config));
+	}
+	catch (const std::exception &e)
+	{
+		log::error ("Worker ", wk.id, " failed to reload: ", e.what());
+	}
+}
+
+std::shared_ptr<responder> daemon::make_responder (ev::loop_ref loop)
+{
+	// cache file is loaded and saved by the main thread only
+	detail::options opts (this->options());
+	opts.cachedir.clear();
+	return std::make_shared<responder> (opts, loop);
+}
+
+void daemon::start_responder (responder &)
+{
+}
+
+void daemon::reload_responder (responder &r,
+	std::shared_ptr<const responder_configuration> config)
+{
+	r.reload (this->options(), std::move (config));
+}
+
+void daemon::start_workers()
+{
+	const unsigned n = this->options().workers;
+	if (1u >= n)
+		return;
+#ifndef __linux__
+	log::warning ("Workers need SO_REUSEPORT load balancing, using single thread");
+	return;
+#else
+	if (0 <= this->udp_listener_systemd_handle_)
+	{
+		log::warning ("Workers are not supported with systemd sockets");
+		return;
+	}
+	// listeners are bound here, before privileges are revoked
+	for (unsigned i = 1; i < n; ++i)
+	{
+		auto w = std::make_unique<worker>();
+		w->id = i;
+		w->owner = this;
+		w->responder_ptr = this->make_responder (w->loop);
+		assert (w->responder_ptr);
+		auto rc1 = w->responder_ptr;
+		w->udp_listener = network::udp::listener::make_new (std::move (rc1),
+			this->address());
+		if (0u < this->options().udp_batch_size)
+			w->udp_listener->set_batch_size (this->options().udp_batch_size);
+		auto rc2 = w->responder_ptr;
+		w->tcp_listener = network::tcp::listener::make_new (std::move (rc2),
+			this->address());
+		w->stop_event.set (w->loop);
+		w->stop_event.set<worker::stop_callback>();
+		w->stop_event.start();
+		w->reload_event.set (w->loop);
+		w->reload_event.set<worker::reload_callback>();
+		w->reload_event.data = w.get();
+		w->reload_event.start();
+		this->workers_.emplace_back (std::move (w));
+	}
+	// signals are handled by the main loop only
+	::sigset_t all, old;
+	sigfillset (&all);
+	::pthread_sigmask (SIG_BLOCK, &all, &old);
+	for (auto &w : this->workers_)
+		w->thread = std::thread (run_worker, std::ref (*w));
+	::pthread_sigmask (SIG_SETMASK, &old, nullptr);
+	log::notice ("Workers: ", n, " threads on ", this->address().ip_port());
+#endif
+}
+
+void daemon::stop_workers()
+{
+	for (auto &w : this->workers_)
+		if (w->thread.joinable())
+			w->stop_event.send();
+	for (auto &w : this->workers_)
+		if (w->thread.joinable())
+			w->thread.join();
+}
+
 void daemon::init_descriptors_from_systemd()
 {
 #ifdef HAVE_LIBSYSTEMD
@@ -82,7 +257,11 @@ void daemon::init_descriptors_from_systemd()
 daemon::~daemon()
 {
 	log::notice ("Stopping daemon ...");
+	if (this->reloading_.valid())
+		this->reloading_.wait();
+	this->stop_workers();
 	reload_.stop();
+	reloaded_.stop();
 #ifdef HAVE_LIBSYSTEMD
 	systemd_notify("STOPPING=1");
 #endif
@@ -106,12 +285,76 @@ void daemon::report_stats() const
 	if( this->responder_ptr() )
 	{
 		const auto &r = *(this->responder_ptr());
+		std::size_t processed = r.processed_count(), blacklisted
+			= r.blacklisted_count(), cached = r.cached_count();
+		std::size_t upstream = r.upstream_count(), coalesced = r.coalesced_count();
+		// running workers are not touched from this thread
+		for (const auto &w : this->workers_)
+		{
+			if (w->thread.joinable())
+				continue;
+			const auto &wt = w->totals;
+			log::info ("Worker ", w->id, " requests: ", wt.requests, ", processed: ",
+				wt.processed, ", blacklisted: ", wt.blacklisted, ", cached: ",
+				wt.cached);
+			recv_count += wt.requests;
+			processed += wt.processed;
+			blacklisted += wt.blacklisted;
+			cached += wt.cached;
+			upstream += wt.upstream;
+			coalesced += wt.coalesced;
+		}
 		log::notice ("Requests total: ", recv_count, ", processed: ",
-			r.processed_count(), ", blacklisted: ", r.blacklisted_count(), ","
-			" cached: ", r.cached_count());
+			processed, ", blacklisted: ", blacklisted, ","
+			" cached: ", cached);
+		if (0u < upstream)
+			log::info ("Upstream questions: ", upstream, ", coalesced: ", coalesced,
+				", ratio: ", static_cast <double> (upstream + coalesced)
+				/ static_cast <double> (upstream));
 		log::debug ("Requests still queued: ", reqcount, ", upstream: ",
 			this->responder_ptr()->q_count(), ", iterations: ", dl.iteration());
+		const auto &c = r.cache();
+		log::info ("Cache entries: ", c.size(), '/', c.size_limits().entries, ", bytes: ",
+			c.bytes(), '/', c.size_limits().bytes, ", evictions: ", c.evictions(),
+			", expirations: ", c.expirations());
+		log::info ("Negative cache entries: ", c.negative_size(), '/',
+			c.negative_limits().entries, ", bytes: ", c.negative_bytes(), '/',
+			c.negative_limits().bytes);
+		log::info ("Cache lookups: ", c.lookups(), ", hits: ", c.hits(),
+			", negative hits: ", c.negative_hits());
+		log::info ("Refreshed ahead: ", c.prefetches(), ", misses saved: ",
+			c.prefetch_hits(), ", stale answers: ", c.stale_answers());
+		// scores of the main thread responder, workers keep their own
+		for (const auto &p : r.providers())
+			if (0u < p->answers() + p->failures())
+				log::info ("Upstream ", p->address().ip_port(), " answers: ",
+					p->answers(), ", failures: ", p->failures(), ", rtt: ",
+					p->rtt() * 1e3, " ms, loss: ", p->loss() * 1e2, '%');
+	}
+	if (this->udp_listener_ && 1u < this->udp_listener().batch_size())
+	{
+		const auto &rb = this->udp_listener().received_batches();
+		const auto &sb = this->udp_listener().sent_batches();
+		log::info ("UDP receive batches: ", rb.batches(), " [", rb.to_string(), "]");
+		log::info ("UDP send batches: ", sb.batches(), " [", sb.to_string(), "]");
 	}
+	// pools of the main thread only, workers own theirs
+	const auto us = network::udp::pool::local_stats();
+	if (0u < us.opened)
+		log::info ("Upstream UDP sockets opened: ", us.opened, ", rotated: ",
+			us.rotated, ", sent: ", us.sent, ", answered: ", us.answered,
+			", unmatched: ", us.unmatched, ", failed: ", us.failed);
+	const auto ts = network::tcp::pool::local_stats();
+	if (0u < ts.opened)
+		log::info ("Upstream TCP connections opened: ", ts.opened, ", failed: ",
+			ts.connect_failures, ", closed: ", ts.closed, ", questions: ", ts.sent,
+			", reused: ", ts.reused, ", most on one: ", ts.max_reuse, ", answered: ",
+			ts.answered, ", unmatched: ", ts.unmatched, ", retried: ", ts.retried,
+			", failed questions: ", ts.failed);
+	const auto ds = network::timer_wheel::local_stats();
+	if (0u < ds.total())
+		log::info ("Timeouts: ", ds.total(), ", share of the deadline used: [",
+			ds.to_string(), "]");
 }
 
 void interrupt_signal(ev::sig &s, int)
@@ -122,16 +365,76 @@ void interrupt_signal(ev::sig &s, int)
 //! @todo: how much can one actually do during SIGHUP, can one output to syslog?
 void daemon::reload()
 {
+	if (this->reloading_.valid())
+	{
+		log::notice ("Reloading already, once more when done");
+		this->reload_again_ = true;
+		return;
+	}
 #ifdef HAVE_LIBSYSTEMD
 	sys::systemd_notify ("RELOADING=1");
 #endif
 	log::notice ("Reloading " PACKAGE_STRING " ...");
-	assert( responder_ptr_ );
-	responder_ptr_->reload (this->options());
-	this->report_stats();
+	// the loops go on answering with the old lists meanwhile
+	const responder::parameters params (this->options());
+	auto &done = this->reloaded_;
+	this->reloading_ = std::async (std::launch::async, [params, &done]
+	{
+		struct notify
+		{
+			ev::async &event;
+			~notify() {event.send();}
+		} n {done};
+		return responder::load_configuration (params);
+	});
+}
+
+void daemon::reloaded_callback (ev::async &w, int)
+{
+	assert (nullptr != w.data);
+	reinterpret_cast<daemon *> (w.data)->finish_reload();
+}
+
+void daemon::finish_reload()
+{
+	if (!this->reloading_.valid())
+		return;
+	std::shared_ptr<const responder_configuration> config;
+	try
+	{
+		config = this->reloading_.get(); // waits for the thread to return it
+	}
+	catch (const std::exception &e)
+	{
+		log::error ("Failed to reload, the old lists are kept: ", e.what());
+	}
+	if (config)
+	{
+		assert( responder_ptr_ );
+		// workers still get the lists, as after a failure in one of them
+		try
+		{
+			this->reload_responder (*responder_ptr_, config);
+		}
+		catch (const std::exception &e)
+		{
+			log::error ("Failed to reload: ", e.what());
+		}
+		for (auto &w : this->workers_)
+		{
+			std::atomic_store (&w->config, config);
+			w->reload_event.send();
+		}
+		this->report_stats();
+	}
 #ifdef HAVE_LIBSYSTEMD
 	sys::systemd_notify ("READY=1");
 #endif
+	if (this->reload_again_)
+	{
+		this->reload_again_ = false;
+		this->reload();
+	}
 }
 
 void reload_signal(ev::sig &s, int)
@@ -194,6 +497,10 @@ daemon::daemon(std::shared_ptr<detail::options> &&ops) : options_ptr_(std::move(
 	reload_.data = this; //! @todo is this safe?
 	reload_.priority = 0;
 	reload_.start(SIGHUP);
+	reloaded_.set (dl);
+	reloaded_.set<reloaded_callback>();
+	reloaded_.data = this;
+	reloaded_.start();
 
 	const char *t = std::getenv (PACKAGE "_TESTING_TIMEOUT");
 	if( nullptr != t )
@@ -275,6 +582,7 @@ void daemon::setup(std::shared_ptr<responder> &&_responder_ptr)
 #endif
 	// starting listeners here, so that all objects inside daemon are initialized
 	this->start_listeners();
+	this->start_workers();
 
 #ifndef _WIN32
 	// downgrading user from root, AFTER listeners had been started
@@ -288,16 +596,11 @@ void daemon::execute()
 	log::info ("  ... started");
 	auto dl = ev::get_default_loop();
 	dl.run();
+	this->stop_workers();
 	this->report_stats();
 	if (this->responder_ptr())
 	{
-		const auto &cr = *this->responder_ptr();
-		if (!cr.cache_dir().empty())
-		{
-			const std::string fn2 =  cr.cache_dir() + "/dnscache.bin";
-			cr.cache().save_as (fn2);
-			log::notice ("Saved cache: ", fn2);
-		}
+		this->responder_ptr()->save_cache();
 	}
 }
 
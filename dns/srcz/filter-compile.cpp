@@ -0,0 +1,27 @@
+#include <stdexcept>
+#include <iostream>
+#include <string>
+
+#include "dns/filter.hxx"
+#include "backtrace/catch.hxx"
+
+//! Compiles text filter lists, or images, into one image for the daemon
+void run (int argc, char *argv[])
+{
+	if (3 > argc)
+	{
+		std::cerr << "Usage: cdns-filter-compile OUTPUT LIST...\n";
+		throw std::runtime_error ("No lists to compile");
+	}
+	dns::filter result;
+	for (int i = 2; i < argc; ++i)
+		result.merge (dns::filter (argv[i]));
+	result.save_as (argv[1]);
+	std::cout << argv[1] << ": " << result.count() << " rules, "
+		<< result.image().size() << " bytes" << std::endl;
+}
+
+int main (int argc, char *argv[])
+{
+	return trace::catch_all_errors (run, argc, argv);
+}
@@ -1,11 +1,17 @@
 #include <cassert>
+#include <cstdio>
+#include <cstring>
 #include <stdexcept>
 #include <fstream>
 #include <algorithm>
+#include <iterator>
 #include <type_traits>
+#include <utility>
 
 #include "sys/str.hxx"
+#include "sys/mapped_file.hxx"
 #include "dns/filter.hxx"
+#include "dns/constants.hxx"
 
 namespace dns {
 
@@ -23,54 +29,76 @@ enum class filters : unsigned short
 
 constexpr const unsigned short MAX_QNAME_LENGTH = 1024;
 
-namespace detail {
+namespace {
+
+//! Sections of a compiled filter image
+enum section : unsigned
+{
+	trie_nodes,
+	trie_labels,
+	automaton,
+	substring_words, //!< each followed by a zero
+	prefix_words,
+	sections
+};
 
-template <typename Set> inline bool substr_match (const Set &subs,
-	const std::string &str)
+//! precedes the sections, each starts at a multiple of 8 bytes
+struct image_header
 {
-	return std::find_if (subs.cbegin(), subs.cend(), [&str] (const std::string &s)
-		{return str.length() >= s.length() && std::string::npos != str.find (s);})
-		!= subs.cend();
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t byte_order;
+	std::uint64_t size; //!< of the image
+	std::uint64_t checksum; //!< FNV-1a of what follows the header
+	std::uint64_t section[sections][2]; //!< offset and size
+};
+
+static_assert (112u == sizeof (image_header) && 12u == sizeof (label_trie::node),
+	"filter image layout");
+
+constexpr const char image_magic[8] = {'c', 'd', 'n', 's', 'f', 'i', 'l', 't'};
+constexpr const std::uint32_t image_version = 1u;
+constexpr const std::uint32_t byte_order = 0x01020304u;
+
+constexpr std::size_t padded (std::size_t size) noexcept
+{
+	return (size + 7u) & ~std::size_t {7u};
 }
 
-#if 1
-template <typename Set> void substr_insert (Set &subs, const std::string &w)
+std::uint64_t checksum (const std::uint8_t *bytes, std::size_t size) noexcept
 {
-	for (auto i = subs.cbegin(); i != subs.cend(); ++i)
+	std::uint64_t h = 14695981039346656037u;
+	for (std::size_t i = 0; i < size; ++i)
+		h = (h ^ bytes[i]) * 1099511628211u;
+	return h;
+}
+
+void put_words (std::vector<std::uint8_t> &out, const std::vector<std::string> &words)
+{
+	for (const auto &w : words)
 	{
-		if (std::string::npos != w.find (*i))
-			return;
-		if (std::string::npos != i->find (w))
-		{
-			for (auto j = subs.erase (i); j != subs.end();)
-			{
-				if (std::string::npos != j->find (w))
-					j = subs.erase (j);
-				else
-					++j;
-			}
-			subs.insert (w);
-			return;
-		}
+		out.insert (out.end(), w.cbegin(), w.cend());
+		out.push_back (0u);
 	}
-	subs.insert (w);
 }
-#else
-template <typename Set> void substr_insert (Set &subs, const std::string &w)
+
+std::vector<std::string> get_words (const char *bytes, std::size_t size)
 {
-	if (!substr_match (subs, w))
+	std::vector<std::string> words;
+	for (std::size_t i = 0; i < size;)
 	{
-		for (auto it = subs.begin(); it != subs.end();)
-		{
-			if (std::string::npos != it->find (w))
-				it = subs.erase (it);
-			else
-				++it;
-		}
-		subs.insert (w);
+		const void *zero = std::memchr (bytes + i, 0, size - i);
+		const std::size_t n = (nullptr == zero) ? size - i : static_cast <std::size_t>
+			(static_cast <const char *> (zero) - bytes) - i;
+		words.emplace_back (bytes + i, n);
+		i += n + 1u;
 	}
+	return words;
 }
-#endif
+
+} // namespace
+
+namespace detail {
 
 template <typename Comp>
 bool contains (const std::string &longer, const std::string &shorter);
@@ -82,21 +110,31 @@ inline bool contains <comp> (const std::string &longer, const std::string &short
 		(0, shorter.length(), shorter);
 }
 
-template <> inline bool contains <rev_comp> (const std::string &longer,
-	const std::string &shorter)
+inline bool contains (const folded_name &longer, const std::string &shorter) noexcept
 {
-	return shorter.length() <= longer.length() && 0 == longer.compare
-		(longer.length() - shorter.length(), shorter.length(), shorter);
+	if (longer.length() < shorter.length())
+		return false;
+	for (std::size_t i = 0; i < shorter.length(); ++i)
+		if (shorter[i] != longer[i])
+			return false;
+	return true;
 }
 
 template <typename Cmp> inline bool words_match (const std::set <std::string, Cmp>
 	&words, const std::string &str)
 {
-	// ATTN! performance, 'const char*' in upper_bound creates temporary std::string
 	const auto si = words.upper_bound (str);
 	return words.cbegin() != si && contains <Cmp> (str, *std::prev (si));
 }
 
+//! the comparator is transparent, the name is not copied
+template <typename Cmp> inline bool words_match (const std::set <std::string, Cmp>
+	&words, const folded_name &name) noexcept
+{
+	const auto si = words.upper_bound (name);
+	return words.cbegin() != si && contains (name, *std::prev (si));
+}
+
 template <typename Cmp> void words_insert (std::set <std::string, Cmp> &words,
 	const std::string &w)
 {
@@ -132,41 +170,49 @@ template <typename Cmp> void words_insert (std::set <std::string, Cmp> &words,
 
 } // namespace dns::detail
 
-bool filter::match (const std::string &hostname) const
+bool filter::match (const char *hostname, std::size_t len) const
 {
-	const std::size_t len = hostname.length();
 	if (len > MAX_QNAME_LENGTH) //! @todo this is after puny encoding?
-		throw std::runtime_error ("too long host name: " + hostname);
-	const auto end = (len > 1UL && '.' == hostname.back()) ?
-		std::prev (hostname.cend()) : hostname.cend();
-	if (hostname.cbegin() == end)
-		throw std::runtime_error ("too short host name: " + hostname);
-	// In C++11 string is local if it is shorter than 15 chars
-	std::string low (hostname.cbegin(), end);
-	sys::ascii_tolower (low); //! @todo libidn punycode?
-	if (exact_.end() != exact_.find (low))
-		return true;
-	if ('.' != low.front())
-		low.insert (low.begin(), '.');
-	assert ('.' == low.front());
-	if (detail::words_match (suffix_, low))
+		throw std::runtime_error ("too long host name: " + std::string (hostname, len));
+	if (len > 1UL && '.' == hostname[len - 1u])
+		--len;
+	if (0u == len)
+		throw std::runtime_error ("too short host name: " + std::string (hostname,
+			len));
+	//! @todo libidn punycode?
+	if (domains_.match (hostname, len))
 		return true;
-	if ('.' != low.back())
-		low.push_back ('.');
-	assert ('.' == low.front());
-	if (detail::substr_match (substrings_, low))
+	// '.name.', so that substrings may hold the dots around labels
+	if (substrings_.match_dotted (hostname, len))
 		return true;
-	if ('.' == low.front())
-		low.erase (low.begin());
-	assert ('.' != low.front());
-	assert ('.' == low.back());
-	return detail::words_match (prefix_, low);
+	// 'name.', prefixes end with a dot
+	const bool lead = '.' == hostname[0];
+	return detail::words_match (prefix_, folded_name {hostname + lead, len - lead,
+		'.' != hostname[len - 1u]});
+}
+
+bool filter::match_wire (const std::uint8_t *qname) const
+{
+	char text[max_host_name_length + 1u];
+	std::size_t len = 0;
+	for (std::size_t label = *qname; 0u != label; label = *qname)
+	{
+		if (64u <= label || max_host_name_length < len + label + 1u)
+			throw std::runtime_error ("Invalid host name in wire format");
+		if (0u != len)
+			text[len++] = '.';
+		std::memcpy (text + len, qname + 1, label);
+		len += label;
+		qname += label + 1u;
+	}
+	return this->match (text, len);
 }
 
 filter::filter (std::istream &&text_stream)
 {
 	std::string word; // local string (less than 15 chars), no malloc
 	word.reserve (127); // first allocation
+	std::vector<std::string> domains, words;
 	while (text_stream >> word)
 	{
 		assert (!word.empty());
@@ -208,15 +254,10 @@ filter::filter (std::istream &&text_stream)
 			continue;
 		sys::ascii_tolower (word_cstr); //! @todo punycode, libidn
 		word = word_cstr;
-		if (filters::exact == filter_type)
-		{
-			assert ('.' != word.front());
-			this->exact_.insert (word);
-		}
-		else if (filters::suffix == filter_type)
+		if (filters::exact == filter_type || filters::suffix == filter_type)
 		{
-			assert ('.' == word.front());
-			detail::words_insert (suffix_, word);
+			assert ((filters::suffix == filter_type) == ('.' == word.front()));
+			domains.push_back (word);
 		}
 		else if (filters::prefix == filter_type)
 		{
@@ -224,16 +265,36 @@ filter::filter (std::istream &&text_stream)
 		}
 		else if (filters::substring == filter_type)
 		{
-			detail::substr_insert (substrings_, word);
+			words.push_back (word);
 		}
 	}
-	this->optimize();
+	substrings_ = substring_automaton (std::move (words));
+	this->optimize (std::move (domains));
 }
 
-filter::filter (const std::string &file_name) : filter (std::ifstream (file_name)) {}
+filter::filter (const std::string &file_name)
+{
+	std::ifstream ifile (file_name, std::ios::binary);
+	char magic[sizeof (image_magic)];
+	if (ifile.read (magic, sizeof (magic)) && is_image (reinterpret_cast
+		<const std::uint8_t *> (magic), sizeof (magic)))
+	{
+		ifile.close();
+		this->map (std::make_shared <const sys::mapped_file> (file_name), file_name);
+		return;
+	}
+	ifile.clear();
+	ifile.seekg (0);
+	*this = filter (std::move (ifile));
+}
 
 void filter::merge (filter &&other)
 {
+	if (this->empty())
+	{
+		*this = std::move (other); // e.g. mapped, as it is
+		return;
+	}
 	if (prefix_.empty())
 		prefix_.swap (other.prefix_);
 	else
@@ -241,28 +302,21 @@ void filter::merge (filter &&other)
 		for (const auto &w : other.prefix_)
 			detail::words_insert (prefix_, w);
 	}
-	if (suffix_.empty())
-		suffix_.swap (other.suffix_);
-	else
-	{
-		for (const auto &w : other.suffix_)
-			detail::words_insert (suffix_, w);
-	}
 	if (substrings_.empty())
-		substrings_.swap (other.substrings_);
-	else
+		std::swap (substrings_, other.substrings_);
+	else if (!other.substrings_.empty())
 	{
-		for (const auto &w : other.substrings_)
-			detail::substr_insert (substrings_, w);
+		auto words = substrings_.words();
+		words.insert (words.end(), other.substrings_.words().cbegin(),
+			other.substrings_.words().cend());
+		substrings_ = substring_automaton (std::move (words));
 	}
-	if (exact_.empty())
-		exact_.swap (other.exact_);
-	else
-		exact_.insert (other.exact_.begin(), other.exact_.end());
-	//std::set_union (exact_.begin(), exact_.end(), other.exact_.begin(),
-	// other.exact_.end(), std::inserter (exact_, exact_.end()));
-	// std::merge
-	this->optimize();
+	auto domains = domains_.names();
+	auto other_domains = other.domains_.names();
+	other.domains_ = label_trie();
+	domains.insert (domains.end(), std::make_move_iterator (other_domains.begin()),
+		std::make_move_iterator (other_domains.end()));
+	this->optimize (std::move (domains));
 }
 
 void filter::write (std::ostream &text_stream) const
@@ -271,7 +325,7 @@ void filter::write (std::ostream &text_stream) const
 		text_stream << "\n# filter substring domains\n";
 	std::size_t line_len = 0;
 	constexpr const unsigned max_len = 85;
-	for (const auto &d : substrings_)
+	for (const auto &d : substrings_.words())
 	{
 		line_len += (d.length()+3);
 		if (line_len > max_len)
@@ -298,26 +352,30 @@ void filter::write (std::ostream &text_stream) const
 			text_stream << ' ';
 		text_stream << d << '*';
 	}
-	if (!suffix_.empty())
+	auto domains = domains_.names();
+	const auto exact_begin = std::stable_partition (domains.begin(), domains.end(),
+		[] (const std::string &d) {return '.' == d.front();});
+	if (domains.cbegin() != exact_begin)
 		text_stream << "\n\n# suffix domains\n";
 	line_len = 0;
-	for (const auto &d : suffix_)
+	for (auto d = domains.cbegin(); d != exact_begin; ++d)
 	{
-		line_len += (d.length() + 1);
+		line_len += (d->length() + 1);
 		if (line_len > max_len)
 		{
 			text_stream << '\n';
-			line_len = d.length();
+			line_len = d->length();
 		}
 		else
 			text_stream << ' ';
-		text_stream << d;
+		text_stream << *d;
 	}
-	if (!exact_.empty())
+	if (domains.cend() != exact_begin)
 		text_stream << "\n\n# exact hosts\n";
 	line_len = 0;
-	for (const auto &d : exact_)
+	for (auto ei = exact_begin; ei != domains.cend(); ++ei)
 	{
+		const auto &d = *ei;
 		line_len += (d.length() + 1);
 		if (line_len > max_len)
 		{
@@ -331,21 +389,33 @@ void filter::write (std::ostream &text_stream) const
 }
 
 void filter::optimize (void)
+{
+	this->optimize (domains_.names());
+}
+
+void filter::optimize (std::vector<std::string> &&domains)
 {
 	std::string str;
-	for (auto di = suffix_.begin(); di != suffix_.end();)
+	const auto covered = [this, &str] (const std::string &d)
 	{
-		const auto &d = *di;
-		assert ('.' == d.front());
+		assert (!d.empty());
 		str.clear();
+		if ('.' != d.front())
+			str.push_back ('.');
 		str.append (d);
 		if ('.' != str.back())
 			str.push_back ('.');
-		if (detail::substr_match (substrings_, str))
-			di = suffix_.erase (di);
-		else
-			++di;
-	}
+		if (substrings_.match (str))
+			return true;
+		if ('.' == d.front())
+			return false; // suffix
+		str.erase (str.begin());
+		return detail::words_match (prefix_, str);
+	};
+	domains.erase (std::remove_if (domains.begin(), domains.end(), covered),
+		domains.end());
+	// exact names and suffixes covered by suffixes are dropped by the trie
+	domains_ = label_trie (std::move (domains));
 	for (auto pi = prefix_.begin(); pi != prefix_.end();)
 	{
 		const auto &d = *pi;
@@ -354,37 +424,128 @@ void filter::optimize (void)
 			str.push_back ('.');
 		str.append (d);
 		assert ('.' == str.back());
-		if (detail::substr_match (substrings_, str))
+		if (substrings_.match (str))
 			pi = prefix_.erase (pi);
 		else
 			++pi;
 	}
-	for (auto ei = exact_.begin(); ei != exact_.end();)
+}
+
+std::vector<std::uint8_t> filter::image() const
+{
+	std::vector<std::uint8_t> out (sizeof (image_header), 0u);
+	image_header h;
+	std::memset (&h, 0, sizeof (h));
+	std::memcpy (h.magic, image_magic, sizeof (h.magic));
+	h.version = image_version;
+	h.byte_order = byte_order;
+	const auto begin = [&out, &h] (section s)
 	{
-		const auto &w = *ei;
-		str.clear();
-		if ('.' != w.front())
-			str.push_back ('.');
-		str.append (w);
-		if (detail::words_match (suffix_, str))
-			ei = exact_.erase (ei);
-		else
-		{
-			if ('.' != str.back())
-				str.push_back ('.');
-			if (detail::substr_match (substrings_, str))
-				ei = exact_.erase (ei);
-			else
-			{
-				if ('.' == str.front())
-					str.erase (str.begin());
-				if (detail::words_match (prefix_, str))
-					ei = exact_.erase (ei);
-				else
-					++ei;
-			}
-		}
+		out.resize (padded (out.size()), 0u);
+		h.section[s][0] = out.size();
+	};
+	const auto end = [&out, &h] (section s)
+	{
+		h.section[s][1] = out.size() - h.section[s][0];
+	};
+	const auto put = [&out, &begin, &end] (section s, const void *data,
+		std::size_t size)
+	{
+		begin (s);
+		const auto *b = static_cast <const std::uint8_t *> (data);
+		out.insert (out.end(), b, b + size);
+		end (s);
+	};
+	put (trie_nodes, domains_.nodes(), domains_.node_count()
+		* sizeof (label_trie::node));
+	put (trie_labels, domains_.labels(), domains_.labels_size());
+	put (automaton, substrings_.table(), substrings_.states()
+		* substring_automaton::symbols * sizeof (std::uint32_t));
+	begin (substring_words);
+	put_words (out, substrings_.words());
+	end (substring_words);
+	begin (prefix_words);
+	put_words (out, std::vector<std::string> (prefix_.cbegin(), prefix_.cend()));
+	end (prefix_words);
+	out.resize (padded (out.size()), 0u);
+	h.size = out.size();
+	h.checksum = checksum (out.data() + sizeof (h), out.size() - sizeof (h));
+	std::memcpy (out.data(), &h, sizeof (h));
+	return out;
+}
+
+void filter::save_as (const std::string &file_name) const
+{
+	const auto out = this->image();
+	// a daemon may have the file mapped
+	const std::string tmp = file_name + ".tmp";
+	std::ofstream ofile (tmp, std::ios::binary | std::ios::trunc);
+	ofile.write (reinterpret_cast <const char *> (out.data()), static_cast
+		<std::streamsize> (out.size()));
+	ofile.close();
+	if (!ofile)
+		throw std::runtime_error ("Failed to write filter: " + tmp);
+#ifdef _WIN32
+	std::remove (file_name.c_str()); // rename does not replace
+#endif
+	if (0 != std::rename (tmp.c_str(), file_name.c_str()))
+		throw std::runtime_error ("Failed to rename: " + tmp + " to: " + file_name);
+}
+
+bool filter::is_image (const std::uint8_t *bytes, std::size_t size) noexcept
+{
+	return sizeof (image_magic) <= size && 0 == std::memcmp (bytes, image_magic,
+		sizeof (image_magic));
+}
+
+void filter::map (std::shared_ptr<const sys::mapped_file> &&file,
+	const std::string &file_name)
+{
+	const std::uint8_t *const bytes = file->data();
+	const std::size_t size = file->size();
+	image_header h;
+	if (sizeof (h) > size || !is_image (bytes, size))
+		throw std::runtime_error ("Not a filter image: " + file_name);
+	std::memcpy (&h, bytes, sizeof (h));
+	if (byte_order != h.byte_order)
+		throw std::runtime_error ("Filter image of other byte order: " + file_name);
+	if (image_version != h.version)
+		throw std::runtime_error ("Unsupported filter image version "
+			+ std::to_string (h.version) + ": " + file_name);
+	if (size != h.size || h.checksum != checksum (bytes + sizeof (h), size
+		- sizeof (h)))
+		throw std::runtime_error ("Corrupt filter image: " + file_name);
+	for (const auto &s : h.section)
+		if (s[0] < sizeof (h) || size < s[0] || size - s[0] < s[1] || 0u != s[0] % 8u)
+			throw std::runtime_error ("Corrupt filter image: " + file_name);
+	const auto at = [bytes, &h] (section s) {return bytes + h.section[s][0];};
+	const std::size_t table_row = substring_automaton::symbols
+		* sizeof (std::uint32_t);
+	if (0u != h.section[trie_nodes][1] % sizeof (label_trie::node)
+		|| 0u != h.section[automaton][1] % table_row)
+		throw std::runtime_error ("Corrupt filter image: " + file_name);
+	for (auto s : {substring_words, prefix_words})
+		if (0u < h.section[s][1] && 0u != at (s)[h.section[s][1] - 1u])
+			throw std::runtime_error ("Corrupt filter image: " + file_name);
+	try
+	{
+		domains_ = label_trie (reinterpret_cast <const label_trie::node *> (at
+			(trie_nodes)), h.section[trie_nodes][1] / sizeof (label_trie::node),
+			reinterpret_cast <const char *> (at (trie_labels)),
+			h.section[trie_labels][1], std::shared_ptr<const void> (file));
+		substrings_ = substring_automaton (reinterpret_cast <const std::uint32_t *>
+			(at (automaton)), h.section[automaton][1] / table_row, get_words
+			(reinterpret_cast <const char *> (at (substring_words)),
+			h.section[substring_words][1]), std::move (file));
+	}
+	catch (const std::runtime_error &e)
+	{
+		throw std::runtime_error (std::string (e.what()) + ": " + file_name);
 	}
+	prefix_.clear();
+	for (auto &w : get_words (reinterpret_cast <const char *> (at (prefix_words)),
+		h.section[prefix_words][1]))
+		prefix_.emplace_hint (prefix_.end(), std::move (w)); // sorted already
 }
 
 } // namespace dns
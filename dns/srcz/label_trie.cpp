@@ -0,0 +1,251 @@
+#include <cassert>
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+
+#include "dns/label_trie.hxx"
+
+namespace dns {
+
+namespace {
+
+//! Labels of a name from the last one, each ends with a zero, so that the
+//! keys sort as the children of the nodes do
+struct key_entry
+{
+	std::string key;
+	std::size_t pos; //!< next label
+	std::uint8_t flag;
+};
+
+std::string reversed_key (const std::string &name, std::size_t from)
+{
+	std::string key;
+	key.reserve (name.size() - from + 1u);
+	std::size_t end = name.size();
+	for (;;)
+	{
+		const std::size_t dot = (from == end) ? std::string::npos : name.rfind ('.',
+			end - 1u);
+		const std::size_t begin = (std::string::npos == dot || dot < from) ? from
+			: dot + 1u;
+		key.append (name, begin, end - begin);
+		key.push_back ('\0');
+		if (begin == from)
+			break;
+		end = dot;
+	}
+	return key;
+}
+
+inline unsigned char lower (char c) noexcept
+{
+	const auto u = static_cast <unsigned char> (c);
+	return ('A' <= u && u <= 'Z') ? static_cast <unsigned char> (u + ('a' - 'A')) : u;
+}
+
+//! stored label against the one of the name, in any case
+int compare_label (const char *stored, std::size_t n, const char *label,
+	std::size_t size) noexcept
+{
+	const std::size_t m = std::min (n, size);
+	for (std::size_t i = 0; i < m; ++i)
+	{
+		const auto a = static_cast <unsigned char> (stored[i]);
+		const auto b = lower (label[i]);
+		if (a != b)
+			return (a < b) ? -1 : 1;
+	}
+	return (n < size) ? -1 : ((size < n) ? 1 : 0);
+}
+
+void collect (const label_trie::node *nodes, const char *labels, std::uint32_t i,
+	std::vector<std::uint32_t> &path, std::vector<std::string> &names)
+{
+	const auto &n = nodes[i];
+	path.push_back (i);
+	if (0u != n.flags)
+	{
+		std::string name;
+		for (auto p = path.crbegin(); p != path.crend() && 0u != *p; ++p)
+		{
+			if (0u != (n.flags & label_trie::suffix) || path.crbegin() != p)
+				name.push_back ('.');
+			name.append (labels + nodes[*p].label, nodes[*p].label_size);
+		}
+		names.emplace_back (std::move (name));
+	}
+	for (std::uint32_t c = n.first; c < nodes[i + 1u].first; ++c)
+		collect (nodes, labels, c, path, names);
+	path.pop_back();
+}
+
+//! nodes and labels of a trie built in memory
+struct built
+{
+	std::vector<label_trie::node> nodes;
+	std::string labels;
+};
+
+//! root and sentinel
+const label_trie::node no_nodes[2] = {{0u, 1u, 0u, 0u, 0u}, {0u, 1u, 0u, 0u, 0u}};
+
+} // namespace
+
+label_trie::label_trie() : nodes_ (no_nodes), node_count_ (2u), labels_ ("")
+{}
+
+label_trie::label_trie (std::vector<std::string> &&names) : label_trie()
+{
+	auto trie = std::make_shared <built>();
+	auto &nodes = trie->nodes;
+	auto &labels = trie->labels;
+	nodes.assign (1u, node {});
+	std::vector<key_entry> entries;
+	entries.reserve (names.size());
+	for (const auto &name : names)
+	{
+		const bool is_suffix = !name.empty() && '.' == name.front();
+		entries.push_back (key_entry {reversed_key (name, is_suffix ? 1u : 0u), 0u,
+			is_suffix ? suffix : exact});
+	}
+	names.clear();
+	names.shrink_to_fit();
+	std::sort (entries.begin(), entries.end(), [] (const key_entry &a,
+		const key_entry &b) {return a.key < b.key;});
+	// breadth first, so that the children of a node are added at once
+	struct span
+	{
+		std::size_t begin, end;
+	};
+	std::vector<span> spans {span {0u, entries.size()}};
+	for (std::size_t n = 0; n < nodes.size(); ++n)
+	{
+		span s = spans[n];
+		std::uint8_t flags = 0;
+		// keys ending here sort first
+		for (; s.begin < s.end && entries[s.begin].key.size() == entries[s.begin].pos;
+			++s.begin)
+			flags |= entries[s.begin].flag;
+		if (0u != (flags & suffix))
+		{
+			flags = suffix; // covers the name and its subdomains
+			s.begin = s.end;
+		}
+		if (0u != flags)
+			++size_;
+		nodes[n].flags = flags;
+		const std::size_t first = nodes.size();
+		while (s.begin < s.end)
+		{
+			const std::string &key = entries[s.begin].key;
+			const std::size_t pos = entries[s.begin].pos;
+			const std::size_t label_size = key.find ('\0', pos) - pos;
+			std::size_t last = s.begin + 1u;
+			while (last < s.end && 0 == entries[last].key.compare (pos, label_size + 1u,
+				key, pos, label_size + 1u))
+				++last;
+			if (std::numeric_limits <std::uint16_t>::max() < label_size)
+				throw std::length_error ("Too long label in: " + key);
+			if (std::numeric_limits <std::uint32_t>::max() <= nodes.size()
+				|| std::numeric_limits <std::uint32_t>::max() < labels.size())
+				throw std::length_error ("Too many names in the trie");
+			node c {};
+			c.label = static_cast <std::uint32_t> (labels.size());
+			c.label_size = static_cast <std::uint16_t> (label_size);
+			labels.append (key, pos, label_size);
+			for (std::size_t i = s.begin; i < last; ++i)
+				entries[i].pos += label_size + 1u;
+			nodes.push_back (c);
+			spans.push_back (span {s.begin, last});
+			s.begin = last;
+		}
+		nodes[n].first = static_cast <std::uint32_t> (first);
+	}
+	nodes.push_back (node {0u, static_cast <std::uint32_t> (nodes.size()), 0u, 0u,
+		0u});
+	nodes.shrink_to_fit();
+	labels.shrink_to_fit();
+	nodes_ = nodes.data();
+	node_count_ = nodes.size();
+	labels_ = labels.data();
+	labels_size_ = labels.size();
+	storage_ = std::move (trie);
+}
+
+label_trie::label_trie (const node *nodes, std::size_t node_count,
+	const char *labels, std::size_t labels_size, std::shared_ptr<const void> &&storage)
+	: nodes_ (nodes), node_count_ (node_count), labels_ (labels),
+	labels_size_ (labels_size), storage_ (std::move (storage))
+{
+	// children after their parent, within the nodes, labels within the labels
+	if (2u > node_count || 1u != nodes[0].first
+		|| node_count - 1u != nodes[node_count - 1u].first)
+		throw std::runtime_error ("Not a trie of labels");
+	for (std::size_t i = 0; i + 1u < node_count; ++i)
+	{
+		const node &n = nodes[i];
+		if (n.first > nodes[i + 1u].first || (n.first != nodes[i + 1u].first
+			&& n.first <= i) || 3u < n.flags || labels_size < n.label
+			|| labels_size - n.label < n.label_size)
+			throw std::runtime_error ("Not a trie of labels");
+		if (0u != n.flags)
+			++size_;
+	}
+}
+
+const label_trie::node *label_trie::find (const node &parent, const char *label,
+	std::size_t size) const noexcept
+{
+	const node *lo = nodes_ + parent.first;
+	std::size_t count = (&parent)[1].first - parent.first;
+	while (0u < count)
+	{
+		const std::size_t half = count / 2u;
+		const node *mid = lo + half;
+		const int c = compare_label (labels_ + mid->label, mid->label_size,
+			label, size);
+		if (0 == c)
+			return mid;
+		if (0 > c)
+		{
+			lo = mid + 1;
+			count -= half + 1u;
+		}
+		else
+			count = half;
+	}
+	return nullptr;
+}
+
+bool label_trie::match (const char *name, std::size_t size) const noexcept
+{
+	assert (1u < node_count_);
+	const node *n = nodes_;
+	std::size_t end = size;
+	for (;;)
+	{
+		std::size_t begin = end;
+		while (0u < begin && '.' != name[begin - 1u])
+			--begin;
+		n = this->find (*n, name + begin, end - begin);
+		if (nullptr == n)
+			return false;
+		if (0u != (n->flags & suffix))
+			return true;
+		if (0u == begin)
+			return 0u != (n->flags & exact);
+		end = begin - 1u;
+	}
+}
+
+std::vector<std::string> label_trie::names() const
+{
+	std::vector<std::string> result;
+	result.reserve (size_);
+	std::vector<std::uint32_t> path;
+	collect (nodes_, labels_, 0u, path, result);
+	return result;
+}
+
+} // namespace dns
@@ -9,6 +9,8 @@
 #include <vector>
 
 #include "dns/options.hxx"
+#include "dns/cache.hxx"
+#include "network/socket.hxx"
 #include "sys/logger.hxx"
 #include "sys/str.hxx"
 
@@ -55,15 +57,24 @@ static const struct option _long_options_[] = {
 	{ "hosts", 1, nullptr, 'H' },
 	{ "timeout", 1, nullptr, 'T'},
 	{ "cachedir", 1, nullptr, 'E'},
+	{ "udp-batch", 1, nullptr, 'b'},
+	{ "workers", 1, nullptr, 'w'},
+	{ "cache-entries", 1, nullptr, 'c'},
+	{ "cache-memory", 1, nullptr, 'k'},
+	{ "negative-entries", 1, nullptr, 'N'},
+	{ "prefetch-hits", 1, nullptr, 'p'},
+	{ "prefetch-ttl", 1, nullptr, 'r'},
+	{ "serve-stale", 1, nullptr, 'g'},
+	{ "stale-wait", 1, nullptr, 'G'},
 
 	{ "version", 0, NULL, 'V' },
 	{ "help", 0, NULL, 'h' },
 	{ NULL, 0, NULL, 0 }
 };
 #ifndef _WIN32
-static const char _options_str_[] = "a:dhL:l:m:n:su:tVxM:O:6B:W:H:T:E:";
+static const char _options_str_[] = "a:dhL:l:m:n:su:tVxM:O:6B:W:H:T:E:b:w:c:k:N:p:r:g:G:";
 #else
-static const char _options_str_[] = "a:hL:l:m:n:u:tVxM:O:6B:W:H:T:E:";
+static const char _options_str_[] = "a:hL:l:m:n:u:tVxM:O:6B:W:H:T:E:b:w:c:k:N:p:r:g:G:";
 #endif
 
 void normalize(std::string &word)
@@ -173,6 +184,8 @@ options::options()
 	this->log_file.clear();
 	this->max_log_level = static_cast <int> (process::log::severity::info);
 	this->connections_count_max = 250u; //! @todo unused
+	this->udp_batch_size = 0u;
+	this->workers = 1u;
 	this->listener_ip = "127.0.0.1:53";
 	this->log_file.clear();
 	this->resolvers = DEFAULT_RESOLVERS_LIST;
@@ -180,6 +193,13 @@ options::options()
 	this->daemonize = false;
 	this->net_proto = network::proto::udp;
 	this->min_ttl = 60; // seconds
+	this->cache_entries = cache::defaults::max_entries();
+	this->cache_bytes = cache::defaults::max_bytes();
+	this->negative_entries = cache::defaults::max_negative_entries();
+	this->prefetch_hits = cache::defaults::prefetch_hits();
+	this->prefetch_percent = cache::defaults::prefetch_percent();
+	this->stale_period = 0u;
+	this->stale_wait = 1.8; // seconds, RFC 8767
 	this->timeout = 7.5; // seconds
 	flags_ptr_ = std::make_shared<flags>();
 }
@@ -322,6 +342,88 @@ bool options::apply_option(int opt_flag, const char *optarg)
 		this->connections_count_max = static_cast <unsigned int> (connections_max);
 		break;
 	}
+	case 'b': {
+		char *endptr;
+		const unsigned long batch = strtoul(optarg, &endptr, 10);
+
+		if (*optarg == 0 || *endptr != 0 || batch <= 0U ||
+			batch > network::udp::max_batch_size)
+			throw std::runtime_error("Invalid UDP batch size");
+		this->udp_batch_size = static_cast <unsigned int> (batch);
+		break;
+	}
+	case 'w': {
+		char *endptr;
+		const unsigned long nworkers = strtoul(optarg, &endptr, 10);
+
+		if (*optarg == 0 || *endptr != 0 || nworkers <= 0U || nworkers > 256U)
+			throw std::runtime_error("Invalid number of workers");
+		this->workers = static_cast <unsigned int> (nworkers);
+		break;
+	}
+	case 'c': {
+		char *endptr;
+		const unsigned long entries = strtoul(optarg, &endptr, 10);
+
+		if (*optarg == 0 || *endptr != 0 || entries <= 0U)
+			throw std::runtime_error("Invalid number of cache entries");
+		this->cache_entries = static_cast <std::size_t> (entries);
+		break;
+	}
+	case 'k': {
+		char *endptr;
+		const unsigned long mbytes = strtoul(optarg, &endptr, 10);
+
+		if (*optarg == 0 || *endptr != 0 || mbytes <= 0U || mbytes > (1UL << 20))
+			throw std::runtime_error("Invalid cache memory, megabytes");
+		this->cache_bytes = static_cast <std::size_t> (mbytes) << 20;
+		break;
+	}
+	case 'N': {
+		char *endptr;
+		const unsigned long entries = strtoul(optarg, &endptr, 10);
+
+		if (*optarg == 0 || *endptr != 0 || entries <= 0U)
+			throw std::runtime_error("Invalid number of negative cache entries");
+		this->negative_entries = static_cast <std::size_t> (entries);
+		break;
+	}
+	case 'p': {
+		char *endptr;
+		const unsigned long hits = strtoul(optarg, &endptr, 10);
+
+		if (*optarg == 0 || *endptr != 0 || hits > 0xffffU)
+			throw std::runtime_error("Invalid number of hits to refresh ahead");
+		this->prefetch_hits = static_cast <unsigned> (hits);
+		break;
+	}
+	case 'r': {
+		char *endptr;
+		const unsigned long percent = strtoul(optarg, &endptr, 10);
+
+		if (*optarg == 0 || *endptr != 0 || percent > 100U)
+			throw std::runtime_error("Invalid TTL percent to refresh ahead");
+		this->prefetch_percent = static_cast <unsigned> (percent);
+		break;
+	}
+	case 'g': {
+		char *endptr;
+		const unsigned long seconds = strtoul(optarg, &endptr, 10);
+
+		if (*optarg == 0 || *endptr != 0 || seconds > 7UL * 86400UL)
+			throw std::runtime_error("Invalid period to serve stale answers");
+		this->stale_period = static_cast <unsigned> (seconds);
+		break;
+	}
+	case 'G': {
+		char *endptr;
+		const unsigned long ms = strtoul(optarg, &endptr, 10);
+
+		if (*optarg == 0 || *endptr != 0 || ms <= 0U || ms > 60000U)
+			throw std::runtime_error("Invalid wait for stale answers, milliseconds");
+		this->stale_wait = static_cast <double> (ms) / 1000.;
+		break;
+	}
 	case 'u': {
 		this->user_name = optarg;
 		break;
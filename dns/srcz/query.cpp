@@ -1,4 +1,5 @@
 #include <vector>
+#include <algorithm>
 #include <limits>
 #include <tuple>
 #include <fstream>
@@ -90,6 +91,27 @@ void query::mark_truncated()
 	this->flag (pkt_flag::qr, true);
 }
 
+query::size_type query::question_size() const
+{
+	const auto head = this->header();
+	rr_header rr;
+	unsigned short off = sizeof (dns::message_header);
+	std::string owner;
+	for (unsigned jq = 0; jq < head.qdcount; ++jq)
+		off = this->get_rr_question (off, rr, owner);
+	assert (off <= this->size());
+	return off;
+}
+
+void query::truncate_to_question()
+{
+	const size_type qsize = this->question_size();
+	auto head = this->header();
+	head.ancount = head.nscount = head.arcount = 0;
+	this->set_header (head);
+	this->set_size (qsize);
+}
+
 bool query::has_flags_tc() const
 {
 	return this->header().tc;
@@ -659,6 +681,57 @@ std::tuple <std::string, rr_class, rr_type> query::get_question() const
 	return std::make_tuple (owner, c, t);
 }
 
+bool query::get_question (question_view &q) const noexcept
+{
+	const std::uint8_t *const pkt = this->bytes();
+	const std::size_t len = this->size();
+	if (sizeof (message_header) + 5u > len || 0 != pkt[4] || 1 != pkt[5])
+		return false; // not a single question
+	q = question_view();
+	std::size_t off = sizeof (message_header);
+	q.qname = pkt + off;
+	for (std::size_t label = pkt[off]; 0u != label; label = pkt[off])
+	{
+		// same names as get_rr_name accepts, except compressed ones
+		if (64u <= label || len <= off + label + 1u)
+			return false;
+		for (std::size_t i = off + 1u; i <= off + label; ++i)
+		{
+			const std::uint8_t c = pkt[i];
+			if (!(('0' <= c && c <= '9') || ('a' <= (c | 0x20) && (c | 0x20) <= 'z')
+				|| '-' == c))
+				return false;
+			q.hash.add (c);
+		}
+		q.hash.add ('.');
+		q.text_size += label + 1u;
+		off += label + 1u;
+	}
+	if (max_host_name_length < q.text_size || len < off + 5u)
+		return false;
+	q.type = static_cast <rr_type> ((pkt[off + 1u] << 8) | pkt[off + 2u]);
+	q.class_ = static_cast <rr_class> ((pkt[off + 3u] << 8) | pkt[off + 4u]);
+	return true;
+}
+
+std::size_t query::skip_name (std::size_t off) const
+{
+	const std::uint8_t *const pkt = this->bytes();
+	const std::size_t len = this->size();
+	while (off < len)
+	{
+		const unsigned label = pkt[off];
+		if (0u == label)
+			return off + 1u;
+		if (192u <= label) // pointer ends the name
+			return off + 2u;
+		if (64u <= label)
+			break;
+		off += label + 1u;
+	}
+	throw std::runtime_error ("DNS name is outside of message bounds");
+}
+
 std::int32_t query::answer_min_ttl() const
 {
 	const auto head = this->header();
@@ -695,42 +768,114 @@ std::int32_t query::answer_min_ttl() const
 	return min_ttl;
 }
 
-//! @todo: also adjust owner name?
-void query::adjust_id_and_ttl (const std::uint16_t tid, const std::int32_t ttl)
+bool query::is_negative() const
 {
-	auto head = this->header();
+	const auto head = this->header();
+	return head.qr && (pkt_rcode::nxdomain == this->rcode()
+		|| (pkt_rcode::noerror == this->rcode() && 0 == head.ancount));
+}
+
+std::int32_t query::negative_ttl() const
+{
+	const auto head = this->header();
 	assert (1 == head.qdcount);
-	head.id = tid;
-	this->set_header (head);
+	if (head.tc || !this->is_negative())
+		return -1;
 	rr_header rr;
-	// skip questions
 	unsigned short off = sizeof (dns::message_header);
 	std::string owner;
 	for (unsigned jq = 0; jq < head.qdcount; ++jq)
-	{
 		off = this->get_rr_question (off, rr, owner);
+	std::vector <std::uint8_t> rr_data;
+	// CNAME chain of NXDOMAIN precedes the authority section
+	for (std::size_t ja = 0; ja < head.ancount; ++ja)
+		off = this->get_rr (off, rr, owner, rr_data);
+	for (std::size_t jn = 0; jn < head.nscount; ++jn)
+	{
+		off = this->get_rr (off, rr, owner, rr_data);
+		// MINIMUM ends SOA data, after names and four other 32 bit fields
+		if (rr_type::soa != rr.type || rr_data.size() < 2u + 4u * 5u)
+			continue;
+		const std::uint8_t *const m = &rr_data[rr_data.size() - 4u];
+		const auto minimum = static_cast <std::int32_t> ((std::uint32_t {m[0]} << 24)
+			| (std::uint32_t {m[1]} << 16) | (std::uint32_t {m[2]} << 8) | m[3]);
+		return std::max (0, std::min (rr.ttl, minimum));
 	}
-	assert (off <= this->size());
+	return -1;
+}
+
+//! @todo: also adjust owner name?
+void query::adjust_id_and_ttl (const std::uint16_t tid, const std::int32_t ttl)
+{
+	auto head = this->header();
+	assert (1 == head.qdcount);
+	head.id = tid;
+	this->set_header (head);
+	// walked in place, answering from the cache allocates nothing
+	std::uint8_t *const pkt = this->modify_bytes();
+	const std::size_t len = this->size();
+	std::size_t off = sizeof (dns::message_header);
+	for (unsigned jq = 0; jq < head.qdcount; ++jq)
+		off = this->skip_name (off) + sizeof (dns::rr_question_header);
 	const std::size_t na = head.ancount + static_cast <std::size_t> (head.arcount)
 		+ head.nscount;
-	std::vector <std::uint8_t> rr_data;
+	const auto t = static_cast <std::uint32_t> (ttl);
 	for (std::size_t ja = 0; ja < na; ++ja)
 	{
-		off = this->get_rr (off, rr, owner, rr_data);
-		if (rr_type::opt != rr.type)
+		off = this->skip_name (off);
+		if (off + sizeof (dns::rr_header) > len)
+			throw std::runtime_error ("no rr, pkt size: " + std::to_string (len)
+				+ ", expected: " + std::to_string (off + sizeof (dns::rr_header)));
+		// type, class, TTL, data length
+		std::uint8_t *const rr = pkt + off;
+		if (static_cast <std::uint16_t> (rr_type::opt) != ((rr[0] << 8) | rr[1]))
 		{
-			const long rr_off_l = off - static_cast <long> (rr_data.size()) -
-				static_cast <unsigned short> (sizeof (rr_header));
-			assert (rr_off_l > 12 && rr_off_l < off);
-			const auto rr_off = static_cast <unsigned short> (rr_off_l);
-			assert (rr_off >= sizeof (message_header));
-			auto &rrr = *reinterpret_cast <rr_header*>
-				(&(this->modify_bytes()[rr_off]));
-			rrr.ttl = static_cast <std::int32_t> (htonl (static_cast <std::uint32_t>
-				(ttl)));
+			rr[4] = static_cast <std::uint8_t> (t >> 24);
+			rr[5] = static_cast <std::uint8_t> (t >> 16);
+			rr[6] = static_cast <std::uint8_t> (t >> 8);
+			rr[7] = static_cast <std::uint8_t> (t);
 		}
+		off += sizeof (dns::rr_header) + ((rr[8] << 8) | rr[9]);
+		if (off > len)
+			throw std::runtime_error ("Too long DNS record data");
 	}
-	assert (off <= this->size());
+}
+
+bool query::ttl_offsets (const std::uint8_t *pkt, std::size_t len,
+	std::vector <std::uint16_t> &offsets)
+{
+	offsets.clear();
+	if (sizeof (message_header) > len || tcp_max_size < len)
+		return false;
+	const auto count = [pkt] (std::size_t i)
+	{
+		return static_cast <std::size_t> ((pkt[i] << 8) | pkt[i + 1u]);
+	};
+	const auto skip_name = [pkt, len] (std::size_t off)
+	{
+		while (off < len && 0u != pkt[off])
+		{
+			if (192u <= pkt[off]) // pointer ends the name
+				return off + 2u;
+			if (64u <= pkt[off])
+				return len;
+			off += pkt[off] + 1u;
+		}
+		return off + 1u;
+	};
+	std::size_t off = sizeof (message_header);
+	for (std::size_t jq = count (4); 0u < jq; --jq)
+		off = skip_name (off) + sizeof (rr_question_header);
+	for (std::size_t ja = count (6) + count (8) + count (10); 0u < ja; --ja)
+	{
+		off = skip_name (off);
+		if (off + sizeof (rr_header) > len)
+			return false;
+		if (static_cast <std::size_t> (rr_type::opt) != count (off))
+			offsets.push_back (static_cast <std::uint16_t> (off + 4u));
+		off += sizeof (rr_header) + count (off + 8u);
+	}
+	return off <= len;
 }
 
 void query::print (std::ostream &text_stream) const
@@ -1,6 +1,7 @@
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <array>
 
 #include "network/net_error.hxx"
 #include "network/provider.hxx"
@@ -8,104 +9,215 @@
 #include "dns/query.hxx"
 #include "dns/filter.hxx"
 #include "dns/cache.hxx"
+#include "dns/cache_store.hxx"
 #include "dns/hosts.hxx"
 #include "dns/constants.hxx"
 #include "network/udp/upstream.hxx"
 #include "network/tcp/upstream.hxx"
 #include "network/incoming.hxx"
 #include "sys/logger.hxx"
+#include "sys/str.hxx"
 #include "network/listener.hxx"
+#include "network/timer_wheel.hxx"
 #include "dns/responder_parameters.hxx"
 
-namespace log = process::log;
-
 namespace dns {
 
-responder::responder() : network::responder(7.5), blacklisted_count_(0),
+namespace log = process::log;
+
+responder::responder() : network::responder (7.5, ev::get_default_loop()),
+	selector_ (this->timeout_seconds()), blacklisted_count_(0),
 	processed_count_(0), cached_count_(0)
 {
 	this->cache_ptr_ = std::make_shared <class cache> (cache::defaults::min_ttl());
 	this->whitelist_ptr_ = std::make_shared<filter>();
 	this->blacklist_ptr_ = std::make_shared<filter>();
 	this->hosts_ptr_ = std::make_shared<::dns::hosts>();
+	this->init_expiry();
 }
 
-responder::responder (const responder::parameters &params)
-	: network::responder (params.timeout), blacklisted_count_(0),
+responder::responder (const responder::parameters &params, ev::loop_ref loop)
+	: network::responder (params.timeout, loop), selector_ (params.timeout),
+	blacklisted_count_(0),
 	processed_count_(0), cached_count_(0), cache_dir_ (params.cachedir),
 	noipv6_ (params.noipv6)
 {
-	bool has_cache = false;
+	this->cache_ptr_ = std::make_shared<class cache> (params.min_ttl,
+		cache::limits {params.cache_entries, params.cache_bytes});
+	this->cache_ptr_->set_negative_limits (cache::limits {params.negative_entries,
+		cache::defaults::max_negative_bytes()});
 	if (!this->cache_dir().empty())
 	{
-		const std::string fn = this->cache_dir() + "/dnscache.bin";
+		store_ptr_ = std::make_unique <cache_store> (this->cache_dir(), loop);
 		try
 		{
-			this->cache_ptr_ = std::make_shared <class cache> (dns::cache::load (fn,
-				params.min_ttl));
+			store_ptr_->load (*cache_ptr_);
 			log::debug ("Cache entries: ", this->cache().size());
-			this->cache_ptr_->collect_garbage();
-			has_cache = true;
-			log::notice ("Loaded ", this->cache().size(), " entries from cache: ",
-				fn);
 		}
 		catch (const std::runtime_error &e)
 		{
 			log::error ("Failed to load cache: ", e.what());
+			// starts over, the unreadable files are replaced
+			this->cache_ptr_ = std::make_shared<class cache> (params.min_ttl,
+				cache::limits {params.cache_entries, params.cache_bytes});
+			this->cache_ptr_->set_negative_limits (cache::limits
+				{params.negative_entries, cache::defaults::max_negative_bytes()});
+			store_ptr_->save (*cache_ptr_);
 		}
 	}
-	if (!has_cache)
-		this->cache_ptr_ = std::make_shared<class cache> (params.min_ttl);
 	assert (this->cache_ptr_);
+	this->init_expiry();
+	// stale loaded entries go away from the event loop, not all at once here
+	this->schedule_expiry();
 	this->reload (params);
 }
 
+responder::~responder() = default;
+
+void responder::init_expiry()
+{
+	const auto loop = this->event_loop();
+	expiry_timer_.set (loop);
+	expiry_timer_.set <expiry_callback>(); // ATTN! clears data
+	expiry_timer_.data = this; // ATTN! must be set after callback
+	sweep_.set (loop);
+	sweep_.set <sweep_callback>();
+	sweep_.data = this;
+}
+
+void responder::schedule_expiry()
+{
+	if (sweep_.is_active())
+		return; // re-armed once the sweep is over
+	if (0u == cache_ptr_->size())
+	{
+		expiry_timer_.stop(); // does not keep the loop running
+		return;
+	}
+	const std::time_t at = cache_ptr_->next_expiry();
+	if (expiry_timer_.is_active() && expiry_at_ <= at)
+		return;
+	expiry_at_ = at;
+	expiry_timer_.stop();
+	expiry_timer_.start (static_cast <ev::tstamp> (std::max <std::time_t> (0,
+		at - std::time (nullptr))));
+}
+
+void responder::expiry_callback (ev::timer &w, int)
+{
+	assert (nullptr != w.data);
+	auto *self = reinterpret_cast <responder *> (w.data);
+	self->sweep_.start();
+}
+
+void responder::sweep_callback (ev::idle &w, int)
+{
+	assert (nullptr != w.data);
+	auto *self = reinterpret_cast <responder *> (w.data);
+	// small slices keep answering latency flat
+	constexpr const std::size_t slice = 64u;
+	if (self->cache_ptr_->expire (std::time (nullptr), slice))
+		return;
+	w.stop();
+	self->schedule_expiry();
+}
+
 std::unique_ptr <network::packet> responder::new_packet() const
 {
 	return std::make_unique<query>();
 }
 
-void responder::reload (const parameters &params)
+std::shared_ptr<const responder::configuration> responder::load_configuration
+	(const parameters &params)
 {
+	auto config = std::make_shared <configuration>();
 	try
 	{
 		log::info ("TCPonly: ", static_cast<int>(params.net_proto), ", noIPV6: ",
 			 params.noipv6);
 		log::info ("DNS resolvers from: ", params.resolvers);
 		std::ifstream dnsf (params.resolvers);
-		auto rslvs = responder::from_file (dnsf, params.noipv6, params.net_proto);
-		this->dns_providers_.clear();
-		this->dns_providers_.reserve (rslvs.size());
-		for( auto &p : rslvs )
-			this->dns_providers_.emplace_back (std::make_shared <network::provider>
-				(std::move(p)));
+		config->providers = responder::from_file (dnsf, params.noipv6,
+			params.net_proto);
 	}
 	catch(std::runtime_error &e) //! @todo only ignore file operations
 	{
 		log::warning (e.what());
+		config->providers_failed = true;
 	}
-	this->noipv6_ = params.noipv6;
-
-	this->whitelist_ptr_ = std::make_shared<filter>();
+	auto white = std::make_shared<filter>();
 	for (const auto &fn : params.whitelists)
-		whitelist_ptr_->merge (filter (fn));
-	this->blacklist_ptr_ = std::make_shared <filter>();
+		white->merge (filter (fn));
+	config->whitelist = std::move (white);
+	auto black = std::make_shared <filter>();
 	for (const auto &fn : params.blacklists )
-		this->blacklist_ptr_->merge (filter (fn));
+		black->merge (filter (fn));
+	config->blacklist = std::move (black);
+	if( !params.hosts.empty() )
+		config->known_hosts = std::make_shared<::dns::hosts>(params.hosts.c_str(),
+			params.noipv6);
+	else
+		config->known_hosts = std::make_shared<::dns::hosts>();
+	return config;
+}
+
+void responder::reload (const parameters &params,
+	std::shared_ptr<const configuration> &&config)
+{
+	assert (config);
+	// everything which can throw comes first, nothing is changed on failure
+	if (!(0. < params.stale_wait))
+		throw std::runtime_error ("Stale answer wait must be positive");
+	const cache::limits size_limits {params.cache_entries, params.cache_bytes};
+	const cache::limits negative_limits {params.negative_entries,
+		cache::defaults::max_negative_bytes()};
+	const cache::prefetch prefetch_policy {params.prefetch_hits,
+		params.prefetch_percent};
+	cache::check (size_limits);
+	cache::check (negative_limits);
+	cache::check (prefetch_policy);
+	std::shared_ptr<network::provider> onion;
 	if( !params.onion.empty() )
 	{
 		network::address onion_addr (params.onion, 5353);
 		// Tor DNS does not support TCP ?
-		this->onion_provider_ptr_ = std::make_shared <network::provider> (onion_addr,
-			network::proto::udp);
+		onion = std::make_shared <network::provider> (onion_addr, network::proto::udp);
 	}
-	else
-		this->onion_provider_ptr_.reset();
-	if( !params.hosts.empty() )
-		this->hosts_ptr_ = std::make_shared<::dns::hosts>(params.hosts.c_str(),
-			params.noipv6);
-	else
-		this->hosts_ptr_ = std::make_shared<::dns::hosts>();
+	std::vector< std::shared_ptr<network::provider> > providers;
+	if (!config->providers_failed)
+	{
+		// providers kept over reload keep their scores
+		const auto &old = this->dns_providers_;
+		providers.reserve (config->providers.size());
+		for (const auto &p : config->providers)
+		{
+			const auto it = std::find_if (old.begin(), old.end(), [&p]
+				(const std::shared_ptr<network::provider> &o)
+				{
+					return o->net_proto() == p.net_proto()
+						&& o->address().ip_port() == p.address().ip_port();
+				});
+			if (old.end() != it)
+				providers.emplace_back (*it);
+			else
+				providers.emplace_back (std::make_shared <network::provider> (p));
+		}
+		this->dns_providers_.swap (providers);
+	}
+	this->noipv6_ = params.noipv6;
+	this->stale_wait_ = params.stale_wait;
+	if (this->cache_ptr_)
+	{
+		this->cache_ptr_->set_limits (size_limits);
+		this->cache_ptr_->set_negative_limits (negative_limits);
+		this->cache_ptr_->set_prefetch (prefetch_policy);
+		this->cache_ptr_->set_stale_period (params.stale_period);
+	}
+	// the lists are only read while a question is handled, in this thread
+	this->whitelist_ptr_ = config->whitelist;
+	this->blacklist_ptr_ = config->blacklist;
+	this->hosts_ptr_ = config->known_hosts;
+	this->onion_provider_ptr_ = std::move (onion);
 	log::info ("DNS resolvers: ", dns_providers_.size(), ", Blacklist: ",
 		blacklist_ptr_->count(), ", Whitelist: ", whitelist_ptr_->count(),
 		", Onion: ", params.onion, ", Hosts: ", hosts_ptr_->count(),
@@ -145,34 +257,85 @@ std::vector<network::provider> responder::from_file (std::istream &f,
 	return result;
 }
 
+namespace {
+
+//! dotted name without the trailing dot, of a validated wire format name
+std::string dotted_owner (const std::uint8_t *qname)
+{
+	std::string owner;
+	for (std::size_t label = *qname; 0u != label; label = *qname)
+	{
+		if (!owner.empty())
+			owner += '.';
+		owner.append (reinterpret_cast <const char *> (qname + 1), label);
+		qname += label + 1u;
+	}
+	return owner;
+}
+
+} // namespace
+
 short responder::pre_filter (query &dns_query)
 {
-	auto q = dns_query.get_question();
-	std::string &owner = std::get <std::string> (q);
-	if (!owner.empty() && '.' == owner.back())
-		owner.pop_back();
+	// the name is matched in place, its text is built only to be logged, looked
+	// up in the hosts or refreshed, names the view rejects are parsed as before
+	question_view view;
+	const bool in_place = dns_query.get_question (view);
+	std::string owner;
+	rr_class qclass = view.class_;
+	rr_type qtype = view.type;
+	if (!in_place)
+	{
+		auto q = dns_query.get_question();
+		owner = std::move (std::get <std::string> (q));
+		if (!owner.empty() && '.' == owner.back())
+			owner.pop_back();
+		qclass = std::get <rr_class> (q);
+		qtype = std::get <rr_type> (q);
+	}
+	const auto match = [in_place, &view, &owner] (const filter &f)
+	{
+		return in_place ? f.match_wire (view.qname) : f.match (owner);
+	};
+	const auto text = [in_place, &view, &owner] () -> const std::string &
+	{
+		if (in_place && owner.empty())
+			owner = dotted_owner (view.qname);
+		return owner;
+	};
+	const bool logged = log::severity::info <= log::get_severity();
 	const bool pass = (!this->whitelist_ptr_ || this->whitelist_ptr_->empty()
-		|| this->whitelist_ptr_->match (owner))
-		&& !this->blacklist_ptr_->match (owner)
-		&& (!(this->noipv6_ && (rr_type::aaaa == std::get <rr_type> (q))));
-	const char *const msgt = pass ? "Query: [" : "Blacklisted: [";
-	log::info (msgt, std::get <rr_class> (q), ' ', std::get <rr_type> (q),
-		"] ", owner, '.');
+		|| match (*this->whitelist_ptr_))
+		&& !match (*this->blacklist_ptr_)
+		&& (!(this->noipv6_ && (rr_type::aaaa == qtype)));
+	if (logged)
+		log::info (pass ? "Query: [" : "Blacklisted: [", qclass, ' ', qtype, "] ",
+			text(), '.');
 	if (!pass)
 	{
 		++blacklisted_count_;
 		dns_query.mark_refused();
 		return 1; // respond directly, no caching
 	}
-	const bool cr = this->cache_ptr_->retrieve(dns_query);
+	cache::hint hint;
+	const bool cr = this->cache_ptr_->retrieve (dns_query, hint);
+	stale_ = hint.stale;
 	if( cr )
 	{
-		log::info ("Cached: ", owner);
+		if (logged)
+			log::info ("Cached: ", text());
+		if (hint.refresh)
+		{
+			refresh_owner_ = text();
+			refresh_type_ = qtype;
+		}
 		++cached_count_;
 		return 1; // response must be sent to the 'incoming' peer directly
 	}
 	// parse hosts database
-	std::string ip = this->hosts_ptr_->response(owner);
+	if (this->hosts_ptr_->empty())
+		return 0;
+	std::string ip = this->hosts_ptr_->response (text());
 	if( !ip.empty() )
 	{
 		log::info ("Hosts: ", owner, " = ", ip);
@@ -182,17 +345,42 @@ short responder::pre_filter (query &dns_query)
 	return 0; // ask for answer upstream
 }
 
+bool responder::retrieve_stale (query &msg)
+{
+	return this->cache_ptr_->retrieve_stale (msg);
+}
+
 void responder::store(const query &msg)
 {
-	this->cache_ptr_->store (msg);
-	if (!this->cache_dir().empty() && 0 == (this->cache().size() % 16))
+	const cache_entry *e = this->cache_ptr_->store (msg);
+	this->schedule_expiry();
+	if (nullptr != e && store_ptr_)
 	{
-		std::string cfn = this->cache_dir() + "/dnscache.bin";
-		log::debug ("saving cache into: ", cfn);
-		this->cache().save_as (cfn);
+		try
+		{
+			store_ptr_->append (*e, *cache_ptr_);
+		}
+		catch (const std::runtime_error &err)
+		{
+			log::error ("Failed to journal cache entry: ", err.what());
+		}
 	}
 }
 
+void responder::flush_cache()
+{
+	if (store_ptr_)
+		store_ptr_->flush();
+}
+
+void responder::save_cache()
+{
+	if (!store_ptr_)
+		return;
+	store_ptr_->save (*cache_ptr_);
+	log::notice ("Saved cache: ", store_ptr_->snapshot_name());
+}
+
 void responder::respond(std::shared_ptr<network::incoming> &req)
 {
 	req->respond(req->message());
@@ -206,25 +394,95 @@ class _upstream_incoming_ : public std::conditional< static_cast<bool>(TCP),
 		network::tcp::upstream, network::udp::out>::type base_t;
 public:
 
-	_upstream_incoming_ (std::shared_ptr<network::provider> &p,
-		std::shared_ptr <network::incoming> &&inptr, double tsec)
-		: base_t (std::shared_ptr <network::provider> (p), p->adapt_message
-			(inptr->message_ptr()), tsec), inptr_ (std::move(inptr))
+	_upstream_incoming_ (responder &r, std::shared_ptr<network::provider> &p,
+		std::shared_ptr <network::incoming> &&inptr)
+		: base_t (r.event_loop(), std::shared_ptr <network::provider> (p),
+			p->adapt_message (inptr->release_message()), r.timeout_seconds()),
+		inptr_ (std::move(inptr)), responder_ (r)
 	{}
 
+	//! without a client, the answer only goes to the cache
+	_upstream_incoming_ (responder &r, std::shared_ptr<network::provider> &p,
+		std::unique_ptr <network::packet> &&question)
+		: base_t (r.event_loop(), std::shared_ptr <network::provider> (p),
+			p->adapt_message (std::move (question)), r.timeout_seconds()),
+		responder_ (r)
+	{}
+
+	//! sends the question, the responder keeps the request until it is closed
+	//! @param stale question to answer from the stale cache, if upstream is slow
+	//! @param flight key of the clients waiting for the same answer
+	//! @return false if failed right away
+	template <class Source>
+	static bool start (responder &r, std::shared_ptr<network::provider> &p,
+		Source &&source, std::unique_ptr <query> &&stale = nullptr,
+		const std::string &flight = std::string())
+	{
+		auto up = std::make_shared <_upstream_incoming_> (r, p, std::move (source));
+		if (!up->is_active())
+			return false;
+		auto *u = up.get();
+		u->handle_ = r.track_upstream (std::move (up));
+		u->flight_ = flight;
+		if (stale)
+		{
+			u->stale_ = std::move (stale);
+			network::timer_wheel::local (r.event_loop()).arm (u->stale_timer_,
+				r.stale_wait());
+		}
+		return true;
+	}
+
+	void close() override
+	{
+		stale_timer_.cancel();
+		this->base_t::close();
+		// failed, expired or not passed down, the others must not wait for it
+		if (!this->answer_follows())
+			this->land (nullptr);
+		if (handle_.valid())
+		{
+			const auto h = handle_;
+			handle_ = network::slab_handle();
+			responder_.release_upstream (h);
+		}
+	}
+
+	//! no answer in time, the client may still get the stale one
+	void expired() override
+	{
+		this->base_t::expired();
+		this->serve_stale();
+	}
+
 	void pass_answer_downstream() override
 	{
+		if (!inptr_)
+		{
+			// refreshed ahead, or the client got a stale answer already
+			const auto answer = this->release_message();
+			const query &a = dynamic_cast <const query&> (*answer);
+			log::info ("Refreshed: ", a.short_info(), "; From: ",
+				this->address().ip_port());
+			if (pkt_rcode::noerror == a.rcode() || pkt_rcode::nxdomain == a.rcode())
+				responder_.store (a);
+			this->land (&a);
+			return;
+		}
 		auto r = std::dynamic_pointer_cast<responder>(
 			inptr_->listener_ptr()->responder_ptr());
 		assert( r );
-		inptr_->replace_message (this->message_ptr()->clone());
-		assert (this->message_ptr());
-		assert (typeid (*this->message_ptr()).before (typeid (query))
-			|| typeid (*this->message_ptr()) == typeid (query));
+		// the same buffer goes back to the client, upstream is done with it
+		inptr_->replace_message (this->release_message());
+		assert (typeid (inptr_->message()).before (typeid (query))
+			|| typeid (inptr_->message()) == typeid (query));
 
-		const query &answer = dynamic_cast <const query&> (*this->message_ptr());
+		const query &answer = dynamic_cast <const query&> (inptr_->message());
 		log::info ("Reply: ", answer.short_info(), "; From: ",
 			this->address().ip_port());
+		this->land (&answer);
+		if (pkt_rcode::servfail == answer.rcode() && this->serve_stale())
+			return;
 		if (pkt_rcode::noerror == answer.rcode()
 			|| pkt_rcode::nxdomain == answer.rcode())
 		{
@@ -237,35 +495,127 @@ public:
 
 private:
 
+	//! the others waiting for the answer get it too, once
+	void land (const query *answer)
+	{
+		if (flight_.empty())
+			return;
+		const std::string key = std::move (flight_);
+		flight_.clear();
+		responder_.land_flight (key, answer);
+	}
+
+	static void stale_wait_over (network::timer_wheel::entry &e)
+	{
+		reinterpret_cast <_upstream_incoming_ *> (e.data)->serve_stale();
+	}
+
+	//! answers the client from the stale cache, the answer still goes to the cache
+	//! @return true if answered
+	bool serve_stale()
+	{
+		stale_timer_.cancel();
+		if (!stale_ || !inptr_)
+			return false;
+		auto msg = std::move (stale_);
+		if (!responder_.retrieve_stale (*msg))
+			return false;
+		log::info ("Stale: ", msg->short_info());
+		inptr_->replace_message (std::move (msg));
+		responder_.respond (inptr_);
+		inptr_.reset();
+		return true;
+	}
+
 	std::shared_ptr<network::incoming> inptr_;
+	responder &responder_;
+	network::slab_handle handle_;
+	std::unique_ptr <query> stale_;
+	network::timer_wheel::entry stale_timer_ {&stale_wait_over, this};
+	std::string flight_;
 };
 
-//! @todo: code duplication, see network::abs_listener::on_message
-void responder::collect_garbage()
+std::string responder::flight_key (const query &msg)
 {
-	auto &reqs = this->upstream_requests_;
-	if (!reqs.empty())
+	std::string key (reinterpret_cast <const char *> (msg.bytes())
+		+ sizeof (message_header), msg.question_size() - sizeof (message_header));
+	sys::ascii_tolower (key);
+	// answers to questions with EDNS may be too large for the others
+	key.push_back (0u != msg.header().arcount ? 'e' : '-');
+	// recursion desired and checking disabled change what upstream answers
+	key.push_back (static_cast <char> ((msg.bytes()[2] & 0x01u) | (msg.bytes()[3]
+		& 0x10u)));
+	return key;
+}
+
+void responder::land_flight (const std::string &key, const query *answer)
+{
+	const auto f = flights_.find (key);
+	if (flights_.end() == f)
+		return;
+	auto waiters = std::move (f->second);
+	flights_.erase (f);
+	const bool failed = nullptr == answer || pkt_rcode::servfail == answer->rcode();
+	query::size_type answer_question = 0; //!< as long as the waiters' ones
+	if (nullptr != answer && 1u == answer->header().qdcount)
+	{
+		try
+		{
+			answer_question = answer->question_size();
+		}
+		catch (const std::runtime_error &e)
+		{
+			log::warning ("Answer question: ", e.what());
+		}
+	}
+	for (auto &w : waiters)
 	{
-		// clean up requests
-		std::size_t last = 0;
-		for (std::size_t i=0; i<reqs.size(); ++i)
+		if (w->is_closed())
+			continue;
+		query &msg = dynamic_cast <query&> (w->modify_message());
+		if (failed && 0u < cache_ptr_->stale_period() && this->retrieve_stale (msg))
+			log::info ("Stale: ", msg.short_info());
+		else if (nullptr == answer)
+			continue; // dropped, as the one which asked first
+		else
 		{
-			auto &qreq = reqs[i];
-			if( qreq && !qreq->is_active() ) // is_closed
-			{
-				qreq.reset();
-				reqs.erase(reqs.begin() + static_cast <::ssize_t> (i));
-			}
-			else
-				last = i + 1U;
+			// answer copied over the question, only the ID and the case of the
+			// name differ, e.g. with 0x20 randomization, the size is the same
+			const std::uint16_t id = msg.header().id;
+			std::array <std::uint8_t, query::max_question_size> question;
+			const query::size_type q_size = msg.question_size();
+			assert (q_size <= question.size());
+			std::copy_n (msg.bytes(), q_size, question.begin());
+			msg.set_size (0);
+			msg.append (answer->bytes(), answer->size());
+			if (answer_question == q_size)
+				std::copy (question.begin() + sizeof (message_header),
+					question.begin() + q_size, msg.modify_bytes()
+					+ sizeof (message_header));
+			auto head = msg.header();
+			head.id = id;
+			msg.set_header (head);
 		}
-		reqs.resize(last);
+		this->respond (w);
 	}
+}
+
+network::slab_handle responder::track_upstream (std::shared_ptr<network::upstream> &&u)
+{
+	assert (u && u->is_active());
+	auto &reqs = this->upstream_requests_;
 	if (reqs.size() > 2U)
 	{
 		log::debug ("active requests: ", reqs.size(), ", capacity: ",
 			reqs.capacity(), ", total: ", this->processed_count_);
 	}
+	return reqs.insert (std::move (u));
+}
+
+void responder::release_upstream (network::slab_handle h)
+{
+	// kept alive until collect_garbage, close is called from its own callbacks
+	retired_upstream_.emplace_back (upstream_requests_.release (h));
 }
 
 void responder::process (std::shared_ptr<network::incoming> &&req)
@@ -275,16 +625,15 @@ void responder::process (std::shared_ptr<network::incoming> &&req)
 
 	assert (typeid (*req->message_ptr()).before (typeid (dns::query))
 		|| typeid (*(req->message_ptr())) == typeid (dns::query));
-	const query &origmsg = dynamic_cast <const query&> (*(req->message_ptr()));
-	if( !origmsg.is_dns() )
+	// filtered in place, the buffer travels upstream and back to the client
+	query &msg = dynamic_cast <query&> (req->modify_message());
+	if( !msg.is_dns() )
 	{
 		req->close(); // silently drop bad connections
 		return;
 	}
 	++(this->processed_count_);
-	auto resp = req->message_ptr()->clone(); // original unfolded message
-	auto fmsg = std::make_unique <query> (origmsg); // filtered DNS message
-	short fr = this->pre_filter (*fmsg);
+	short fr = this->pre_filter (msg);
 	if( 0 == processed_count_ % 1000 ) //! @todo parameter
 		log::notice ("Queries: ", processed_count_, ", blacklisted: ",
 			blacklisted_count_, ", from cache: ", cached_count_, ", cache size: ",
@@ -292,44 +641,72 @@ void responder::process (std::shared_ptr<network::incoming> &&req)
 	if( 1==fr )
 	{
 		// no need to create upstream request or post-filter or cache
-		req->replace_message (std::move (fmsg));
 		this->respond(req); // respond directly no caching
+		if (!refresh_owner_.empty())
+		{
+			this->refresh_ahead (refresh_owner_, refresh_type_);
+			refresh_owner_.clear();
+		}
 		return;
 	}
 	else if( 2==fr )
 	{
 		// no need to create upstream request
-		this->store (*fmsg); // store in cache
-		req->replace_message (std::move (fmsg));
+		this->store (msg); // store in cache
 		this->respond (req);
 		return;
 	}
-	auto prov = this->random_provider (origmsg);
+	// the same question already in flight, its answer will do
+	std::string key = flight_key (msg);
+	const auto flight = flights_.find (key);
+	if (flights_.end() != flight)
+	{
+		flight->second.emplace_back (std::move (req));
+		++coalesced_count_;
+		return;
+	}
+	auto prov = this->random_provider (msg);
 	if( prov )
 	{
 		this->collect_garbage();
+		// message is handed over to upstream, keep header and question for SERVFAIL
+		std::array <std::uint8_t, query::max_question_size> head_question;
+		const query::size_type hq_size = msg.question_size();
+		assert (hq_size <= head_question.size());
+		std::copy_n (msg.bytes(), hq_size, head_question.begin());
+		std::unique_ptr <query> stale;
+		if (stale_)
+			stale = std::make_unique <query> (head_question.data(), hq_size);
 		try
 		{
+			++upstream_count_;
+			bool sent = false;
 			if( network::proto::tcp == prov->net_proto() )
 			{
-				this->upstream_requests_.emplace_back(
-					std::make_shared<_upstream_incoming_ <network::proto::tcp>>
-					(prov, std::move (req), this->timeout_seconds()));
+				sent = _upstream_incoming_ <network::proto::tcp>::start (*this, prov,
+					std::move (req), std::move (stale), key);
 				assert( !req );
 			}
 			else
 			{
 				assert( req && prov );
-				this->upstream_requests_.emplace_back(
-					std::make_shared<_upstream_incoming_<network::proto::udp> >
-					(prov, std::move(req), this->timeout_seconds()) );
+				sent = _upstream_incoming_ <network::proto::udp>::start (*this, prov,
+					std::move (req), std::move (stale), key);
 			}
+			if (sent) // others asking meanwhile wait for it
+				flights_.emplace (std::move (key), std::vector <std::shared_ptr
+					<network::incoming>>());
 		}
 		catch(network::error &e)
 		{
 			assert( prov );
 			const auto addr = prov->address();
-			resp->mark_servfail(); // failing original unfolded message
+			auto resp = std::make_unique <query> (head_question.data(), hq_size);
+			if (!stale_ || !this->retrieve_stale (*resp))
+			{
+				resp->truncate_to_question();
+				resp->mark_servfail();
+			}
 			assert( req );
 			req->replace_message (std::move (resp));
 			//! @todo: try another povider
@@ -343,23 +720,41 @@ void responder::process (std::shared_ptr<network::incoming> &&req)
 	else
 	{
 		assert (req);
-		resp->mark_servfail(); // failing original unfolded message
-		log::error ("no resolvers: ", resp->size());
-		req->replace_message (std::move (resp));
+		msg.mark_servfail(); // message was not modified by pre_filter
+		log::error ("no resolvers: ", msg.size());
 		this->respond (req);
 	}
 }
 
-void responder::select_random_provider() const
+void responder::refresh_ahead (const std::string &owner, const rr_type qtype)
 {
-	const auto &providers = this->dns_providers_;
-	unsigned mx = static_cast<unsigned>(providers.size());
-	if( mx > RAND_MAX )
-		mx = RAND_MAX;
-	if( 0==mx )
-		mx = 1;
-	this->random_provider_ = static_cast<unsigned>(std::rand())%mx;
-	log::debug ("Random provider: ", random_provider_, '/', providers.size());
+	std::shared_ptr <network::provider> prov;
+	try
+	{
+		auto q = std::make_unique <query> (owner, qtype);
+		q->flag (pkt_flag::rd, true);
+		prov = this->random_provider (*q);
+		if (!prov)
+			return;
+		log::debug ("Refreshing ahead: ", owner, ", ", qtype);
+		std::unique_ptr <network::packet> question (std::move (q));
+		if (network::proto::tcp == prov->net_proto())
+			_upstream_incoming_ <network::proto::tcp>::start (*this, prov,
+				std::move (question));
+		else
+			_upstream_incoming_ <network::proto::udp>::start (*this, prov,
+				std::move (question));
+	}
+	catch (network::error &e)
+	{
+		assert (prov);
+		prov->increment_failures();
+		log::warning ("Refresh of: ", owner, " failed: ", e.what());
+	}
+	catch (std::runtime_error &e)
+	{
+		log::warning ("Can not refresh: ", owner, ", ", e.what());
+	}
 }
 
 std::shared_ptr <network::provider> responder::zone_provider (const query &dns_query)
@@ -393,10 +788,9 @@ std::shared_ptr<network::provider> responder::random_provider(const query &dns_q
 	}
 	if( dns_providers_.empty() )
 		return std::shared_ptr<network::provider>(nullptr);
-	this->select_random_provider();
-	if( this->random_provider_>= this->dns_providers_.size() )
-		throw std::logic_error("random DNS provider is not in the list");
-	return this->dns_providers_.at(this->random_provider_);
+	const std::size_t i = this->selector_.pick (this->dns_providers_);
+	log::debug ("Provider: ", i, '/', dns_providers_.size());
+	return this->dns_providers_.at (i);
 }
 
 } // namespace dns
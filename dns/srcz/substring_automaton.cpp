@@ -0,0 +1,203 @@
+#include <cassert>
+#include <array>
+#include <stdexcept>
+#include <algorithm>
+
+#include "dns/substring_automaton.hxx"
+
+namespace dns {
+
+namespace {
+
+//! bytes to symbols, in any case
+struct symbol_table
+{
+	symbol_table()
+	{
+		of.fill (0u);
+		std::uint8_t s = 1u;
+		for (char c = 'a'; c <= 'z'; ++c, ++s)
+			of[static_cast <unsigned char> (c)] = of[static_cast <unsigned char> (c
+				- 'a' + 'A')] = s;
+		for (char c = '0'; c <= '9'; ++c, ++s)
+			of[static_cast <unsigned char> (c)] = s;
+		for (char c : {'-', '.', '_'})
+			of[static_cast <unsigned char> (c)] = s++;
+		assert (substring_automaton::symbols == s);
+	}
+
+	std::array <std::uint8_t, 256> of;
+};
+
+const symbol_table table;
+
+inline unsigned symbol (char c) noexcept
+{
+	return table.of[static_cast <unsigned char> (c)];
+}
+
+inline char lower (char c) noexcept
+{
+	return ('A' <= c && c <= 'Z') ? static_cast <char> (c - 'A' + 'a') : c;
+}
+
+//! transitions of the root only
+const std::uint32_t no_words[substring_automaton::symbols] = {};
+
+inline bool is_plain (const std::string &w) noexcept
+{
+	return std::all_of (w.cbegin(), w.cend(), [] (char c) {return 0u != symbol (c);});
+}
+
+} // namespace
+
+constexpr const unsigned substring_automaton::symbols;
+
+substring_automaton::substring_automaton() : next_ (no_words)
+{}
+
+substring_automaton::substring_automaton (std::vector<std::string> &&words)
+	: substring_automaton()
+{
+	auto table = std::make_shared <std::vector<std::uint32_t>> (symbols, 0u);
+	auto &next = *table;
+	words.erase (std::remove_if (words.begin(), words.end(), [] (const std::string
+		&w) {return w.empty();}), words.end());
+	std::sort (words.begin(), words.end());
+	words.erase (std::unique (words.begin(), words.end()), words.end());
+	std::vector<std::string> plain;
+	for (auto &w : words)
+		(is_plain (w) ? plain : others_).push_back (std::move (w));
+	words.clear();
+	// trie of the words, transitions into the root are missing ones
+	std::vector<std::uint8_t> out (1u, 0u); //!< a word ends here or at a suffix
+	for (const auto &w : plain)
+	{
+		std::uint32_t s = 0;
+		for (char c : w)
+		{
+			const std::size_t t = s * symbols + symbol (c);
+			if (0u == next[t])
+			{
+				if (accept <= out.size())
+					throw std::length_error ("Too many substring filters");
+				next[t] = static_cast <std::uint32_t> (out.size());
+				next.resize (next.size() + symbols, 0u);
+				out.push_back (0u);
+			}
+			s = next[t];
+		}
+		out[s] = 1u;
+	}
+	// breadth first, missing transitions go where the failure links do
+	std::vector<std::uint32_t> fail (out.size(), 0u), queue;
+	queue.reserve (out.size());
+	for (unsigned c = 0; c < symbols; ++c)
+		if (0u != next[c])
+			queue.push_back (next[c]);
+	for (std::size_t q = 0; q < queue.size(); ++q)
+	{
+		const std::uint32_t s = queue[q];
+		out[s] |= out[fail[s]];
+		for (unsigned c = 0; c < symbols; ++c)
+		{
+			auto &t = next[s * symbols + c];
+			const std::uint32_t f = next[fail[s] * symbols + c];
+			if (0u == t)
+				t = f;
+			else
+			{
+				fail[t] = f;
+				queue.push_back (t);
+			}
+		}
+	}
+	// words containing other words are not needed
+	const auto covered = [&next, &out, &fail] (const std::string &w, bool itself)
+	{
+		std::uint32_t s = 0;
+		for (std::size_t i = 0; i < w.size(); ++i)
+		{
+			s = next[s * symbols + symbol (w[i])];
+			// the state of the last byte is the word itself, its suffixes count
+			if (0u != out[(itself && i + 1u == w.size()) ? fail[s] : s])
+				return true;
+		}
+		return false;
+	};
+	std::vector<std::string> kept;
+	for (auto &w : plain)
+		if (!covered (w, true))
+			kept.push_back (std::move (w));
+	for (const auto &o : others_)
+		if (!covered (o, false) && std::none_of (others_.cbegin(), others_.cend(),
+			[&o] (const std::string &w) {return w != o && std::string::npos
+			!= o.find (w);}))
+			kept.push_back (o);
+	if (kept.size() != plain.size() + others_.size())
+	{
+		*this = substring_automaton (std::move (kept));
+		return;
+	}
+	for (auto &t : next)
+		if (0u != out[t])
+			t |= accept;
+	next_ = next.data();
+	states_ = out.size();
+	storage_ = std::move (table);
+	words_ = std::move (kept);
+	std::sort (words_.begin(), words_.end());
+}
+
+substring_automaton::substring_automaton (const std::uint32_t *table,
+	std::size_t states, std::vector<std::string> &&words,
+	std::shared_ptr<const void> &&storage) : next_ (table), states_ (states),
+	storage_ (std::move (storage)), words_ (std::move (words))
+{
+	if (0u == states || accept <= states)
+		throw std::runtime_error ("Not a substring automaton");
+	for (std::size_t i = 0; i < states * symbols; ++i)
+		if (states <= (table[i] & ~accept))
+			throw std::runtime_error ("Not a substring automaton");
+	for (const auto &w : words_)
+		if (w.empty())
+			throw std::runtime_error ("Empty substring filter");
+		else if (!is_plain (w))
+			others_.push_back (w);
+}
+
+bool substring_automaton::scan (const char *text, std::size_t size, bool dot_before,
+	bool dot_after) const noexcept
+{
+	const std::uint32_t *const dot = next_ + symbol ('.');
+	std::uint32_t s = dot_before ? dot[0] : 0u;
+	if (0u != (s & accept))
+		return true;
+	for (std::size_t i = 0; i < size; ++i)
+	{
+		s = next_[s * symbols + symbol (text[i])];
+		if (0u != (s & accept))
+			return true;
+	}
+	if (dot_after && 0u != (dot[s * symbols] & accept))
+		return true;
+	// the dots are not in the text, bytes are taken one by one
+	const std::size_t n = size + dot_before + dot_after;
+	const auto at = [text, n, dot_before, dot_after] (std::size_t i) noexcept
+	{
+		return (dot_before && 0u == i) || (dot_after && n == i + 1u) ? '.'
+			: lower (text[i - dot_before]);
+	};
+	for (const auto &o : others_)
+		for (std::size_t i = 0; i + o.size() <= n; ++i)
+		{
+			std::size_t j = 0;
+			while (j < o.size() && at (i + j) == o[j])
+				++j;
+			if (o.size() == j)
+				return true;
+		}
+	return false;
+}
+
+} // namespace dns
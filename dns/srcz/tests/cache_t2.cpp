@@ -0,0 +1,339 @@
+#undef NDEBUG
+
+#include <iostream>
+#include <cassert>
+#include <string>
+#include <vector>
+#include <map>
+#include <ctime>
+#include <cstdlib>
+#include <new>
+#include <cstring>
+
+#include "backtrace/catch.hxx"
+#include "dns/cache.hxx"
+#include "dns/constants.hxx"
+#include "dns/query.hxx"
+#include "sys/str.hxx"
+#include "sys/logger.hxx"
+
+static std::size_t allocations = 0;
+
+void *operator new (std::size_t n)
+{
+	++allocations;
+	if (void *p = std::malloc (0u < n ? n : 1u))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete (void *p) noexcept
+{
+	std::free (p);
+}
+
+void operator delete (void *p, std::size_t) noexcept
+{
+	std::free (p);
+}
+
+//! index stays consistent through growth, eviction and expiry
+static void table()
+{
+	dns::cache c (60u, dns::cache::limits {3000u, 64u << 20});
+	std::map <std::string, std::size_t> expect;
+	for (unsigned i = 0; i < 10000u; ++i)
+	{
+		const std::string n = "h" + std::to_string ((i * 7919u) % 5000u) + ".Example.ORG";
+		// answers above the inline size take a separate block
+		const std::size_t size = 20u + (i % 7u) * 60u;
+		// not looking like a response, so not negative
+		c.replace_entry (n, std::vector <std::uint8_t> (size, static_cast
+			<std::uint8_t> (i & 0x7fu)), (0u == i % 11u) ? -1 : 300,
+			dns::rr_type::aaaa);
+		expect[sys::ascii_tolower_copy (n)] = size;
+	}
+	assert (3000u == c.size());
+	std::size_t found = 0;
+	for (const auto &e : expect)
+	{
+		const dns::cache_entry *ent = c.find (e.first, dns::rr_type::aaaa);
+		assert (nullptr == c.find (e.first, dns::rr_type::a));
+		if (nullptr == ent)
+			continue;
+		++found;
+		assert (e.second == ent->response_size());
+		assert (std::string (ent->name(), ent->name_size()) == e.first);
+		assert (dns::rr_type::aaaa == ent->type());
+	}
+	assert (3000u == found);
+	// case does not matter
+	const std::string any = "H" + std::to_string (7919u % 5000u) + ".example.org";
+	assert (c.find (any, dns::rr_type::aaaa) == c.find (sys::ascii_tolower_copy (any),
+		dns::rr_type::aaaa));
+	c.collect_garbage();
+	assert (3000u > c.size() && 0u < c.expirations());
+	found = 0;
+	for (const auto &e : expect)
+		if (nullptr != c.find (e.first, dns::rr_type::aaaa))
+			++found;
+	assert (c.size() == found);
+}
+
+//! expired entries go earliest first, in slices
+static void expiry()
+{
+	dns::cache c (60u);
+	const std::vector <std::uint8_t> answer (50u, 0u);
+	for (int i = 0; i < 300; ++i)
+		c.replace_entry ("e" + std::to_string (i) + ".org", answer, (i * 37) % 300 - 150,
+			dns::rr_type::a);
+	// moved to the future
+	c.replace_entry ("e0.org", answer, 600, dns::rr_type::a);
+	const std::time_t now = std::time (nullptr);
+	std::time_t last = 0;
+	std::size_t n = 0;
+	while (c.expire (now, 10u))
+	{
+		assert (last <= c.next_expiry());
+		last = c.next_expiry();
+		n += 10u;
+		assert (300u - n == c.size() && n == c.expirations());
+	}
+	assert (now < c.next_expiry());
+	assert (150u <= c.expirations() && c.expirations() <= 151u);
+	assert (nullptr != c.find ("e0.org", dns::rr_type::a));
+	assert (!c.expire (now + 1000, 300u) && 0u == c.size());
+}
+
+//! popular entries are refreshed ahead once, near the end of their TTL
+static void prefetch()
+{
+	dns::cache c (0u);
+	c.set_prefetch (dns::cache::prefetch {2u, 10u});
+	const std::vector <std::uint8_t> ip {10u, 0u, 0u, 1u};
+	const auto put = [&c, &ip] (const char *n)
+	{
+		dns::query answer (n, dns::rr_type::a);
+		answer.add_answer (ip, dns::rr_type::a, 100);
+		c.store (answer);
+	};
+	const auto ask = [&c] (const char *n)
+	{
+		dns::query q (n, dns::rr_type::a);
+		dns::cache::hint h;
+		h.refresh = true;
+		const bool hit = c.retrieve (q, h);
+		assert (hit && !h.stale);
+		return h.refresh;
+	};
+	put ("a.org");
+	put ("b.org");
+	// popular, but most of the TTL is left
+	assert (!ask ("a.org") && !ask ("a.org") && !ask ("a.org"));
+	c.set_prefetch (dns::cache::prefetch {2u, 100u});
+	assert (ask ("a.org") && !ask ("a.org") && 1u == c.prefetches());
+	assert (!ask ("b.org") && ask ("b.org") && 2u == c.prefetches());
+	// the refreshed answer starts over
+	put ("a.org");
+	assert (!ask ("a.org") && ask ("a.org") && 3u == c.prefetches());
+	assert (0u == c.prefetch_hits());
+	c.set_prefetch (dns::cache::prefetch {0u, 100u});
+	put ("b.org");
+	assert (!ask ("b.org") && !ask ("b.org"));
+}
+
+//! expired entries are kept for the stale period, only served stale
+static void stale()
+{
+	dns::cache c (0u);
+	c.set_stale_period (60u);
+	const std::vector <std::uint8_t> ip {10u, 0u, 0u, 1u};
+	dns::query answer ("old.org", dns::rr_type::a);
+	answer.add_answer (ip, dns::rr_type::a, 0);
+	c.store (answer);
+	dns::query q ("old.org", dns::rr_type::a);
+	const std::uint16_t id = q.header().id;
+	dns::cache::hint h;
+	assert (!c.retrieve (q, h) && h.stale && 1u == c.size());
+	assert (!c.expire (std::time (nullptr), 10u) && 1u == c.size());
+	assert (c.retrieve_stale (q) && 1u == c.stale_answers());
+	assert (id == q.header().id && 30 == q.answer_min_ttl());
+	// removed after the stale period
+	assert (!c.expire (c.next_expiry(), 10u) && 0u == c.size());
+	dns::query q2 ("old.org", dns::rr_type::a);
+	assert (!c.retrieve_stale (q2) && 1u == c.expirations());
+}
+
+//! NXDOMAIN or NODATA answer, with an authority SOA if soa_ttl is not negative
+static dns::query negative_answer (const char *n, dns::pkt_rcode rcode,
+	std::int32_t soa_ttl, std::uint32_t minimum)
+{
+	const dns::query question (n, dns::rr_type::a);
+	std::vector <std::uint8_t> b (question.bytes(), question.bytes()
+		+ question.size());
+	b[2] |= 0x80; // response
+	b[3] = static_cast <std::uint8_t> ((b[3] & 0xf0) | static_cast <std::uint8_t>
+		(rcode));
+	if (0 <= soa_ttl)
+	{
+		b[9] = 1u; // authority
+		const auto t = static_cast <std::uint32_t> (soa_ttl);
+		const std::uint8_t rr[] = {0xc0, 0x0c, 0, 6, 0, 1, std::uint8_t (t >> 24),
+			std::uint8_t (t >> 16), std::uint8_t (t >> 8), std::uint8_t (t), 0, 22,
+			0, 0, // root names
+			0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 3, 0, 0, 0, 4,
+			std::uint8_t (minimum >> 24), std::uint8_t (minimum >> 16),
+			std::uint8_t (minimum >> 8), std::uint8_t (minimum)};
+		b.insert (b.end(), rr, rr + sizeof (rr));
+	}
+	return dns::query (b.data(), static_cast <dns::query::size_type> (b.size()));
+}
+
+//! negative answers live as long as the SOA says, in a partition of their own
+static void negative()
+{
+	dns::cache c (600u, dns::cache::limits {2u, 1u << 20});
+	const auto nx = negative_answer ("nx.org", dns::pkt_rcode::nxdomain, 3600, 900u);
+	assert (nx.is_negative() && 900 == nx.negative_ttl());
+	const dns::cache_entry *e = c.store (nx);
+	assert (nullptr != e && e->negative());
+	// not raised to the minimum TTL for answers
+	const std::time_t now = std::time (nullptr);
+	assert (now + 899 <= e->deadline && e->deadline <= now + 901);
+	const auto nodata = negative_answer ("nodata.org", dns::pkt_rcode::noerror, 120,
+		86400u);
+	assert (nodata.is_negative() && 120 == nodata.negative_ttl());
+	assert (nullptr != c.store (nodata));
+	// not cached without SOA
+	const auto bare = negative_answer ("bare.org", dns::pkt_rcode::nxdomain, -1, 0u);
+	assert (bare.is_negative() && -1 == bare.negative_ttl());
+	assert (nullptr == c.store (bare));
+	assert (2u == c.size() && 2u == c.negative_size());
+	// negatives do not push answers out, nor the other way round
+	const std::vector <std::uint8_t> ip {10u, 0u, 0u, 1u};
+	for (const char *n : {"a.org", "b.org", "c.org"})
+	{
+		dns::query answer (n, dns::rr_type::a);
+		answer.add_answer (ip, dns::rr_type::a, 100);
+		assert (!answer.is_negative());
+		c.store (answer);
+	}
+	assert (4u == c.size() && 2u == c.negative_size() && 1u == c.evictions());
+	c.set_negative_limits (dns::cache::limits {1u, 1u << 20});
+	assert (3u == c.size() && 1u == c.negative_size() && 2u == c.evictions());
+	const bool nx_kept = nullptr != c.find ("nx.org", dns::rr_type::a);
+	dns::query q (nx_kept ? "nx.org" : "nodata.org", dns::rr_type::a);
+	assert (c.retrieve (q) && q.is_negative());
+	dns::query q2 ("c.org", dns::rr_type::a);
+	assert (c.retrieve (q2));
+	dns::query q3 ("missing.org", dns::rr_type::a);
+	assert (!c.retrieve (q3));
+	assert (3u == c.lookups() && 1u == c.hits() && 1u == c.negative_hits());
+}
+
+//! hits are found by the name as sent, in any case, without allocations
+static void wire()
+{
+	dns::cache c (0u);
+	const std::vector <std::uint8_t> ip {10u, 0u, 0u, 1u};
+	dns::query answer ("Www.Example.ORG", dns::rr_type::a);
+	answer.add_answer (ip, dns::rr_type::a, 100);
+	assert (nullptr != c.store (answer));
+	dns::query q ("wWW.example.org", dns::rr_type::a);
+	dns::question_view v;
+	assert (q.get_question (v) && 16u == v.text_size && dns::rr_type::a == v.type);
+	const auto text = q.get_question();
+	const std::string &n = std::get <std::string> (text);
+	assert (v.text_size == n.size() && nullptr != c.find (n, dns::rr_type::a));
+	const std::uint16_t id = q.header().id;
+	const auto severity = process::log::get_severity();
+	process::log::set_severity (process::log::severity::notice);
+	const std::size_t before = allocations;
+	dns::cache::hint h;
+	const bool hit = c.retrieve (q, h);
+	const std::size_t used = allocations - before;
+	process::log::set_severity (severity);
+	assert (hit && 0u == used);
+	assert (id == q.header().id && 100 >= q.answer_min_ttl());
+	// other names and types miss, even with the same length
+	dns::query q2 ("www.example.com", dns::rr_type::a);
+	dns::query q3 ("www.example.org", dns::rr_type::aaaa);
+	dns::query q4 ("www.examplE.org.x", dns::rr_type::a);
+	assert (!c.retrieve (q2) && !c.retrieve (q3) && !c.retrieve (q4));
+}
+
+//! hits patch the TTLs found when stored, same as walking the answer
+static void compiled()
+{
+	dns::cache c (0u);
+	for (unsigned n : {1u, 40u}) // in the entry and in a block of its own
+	{
+		const std::string name = "r" + std::to_string (n) + ".example.org";
+		dns::query answer (name, dns::rr_type::a);
+		for (unsigned i = 0; i < n; ++i)
+			answer.add_answer (std::vector <std::uint8_t> {10u, 0u, 0u,
+				static_cast <std::uint8_t> (i)}, dns::rr_type::a, static_cast
+				<std::int32_t> (100u + i));
+		const dns::cache_entry *e = c.store (answer);
+		assert (nullptr != e);
+		dns::query q (name, dns::rr_type::a, 4321u);
+		assert (c.retrieve (q) && 4321u == q.header().id);
+		const std::int32_t ttl = q.answer_min_ttl();
+		assert (0 < ttl && ttl <= 100);
+		dns::query walked (e->response(), static_cast <dns::query::size_type>
+			(e->response_size()));
+		walked.adjust_id_and_ttl (4321u, ttl);
+		assert (walked.size() == q.size());
+		assert (0 == std::memcmp (walked.bytes(), q.bytes(), q.size()));
+	}
+}
+
+static void run()
+{
+	table();
+	expiry();
+	prefetch();
+	stale();
+	negative();
+	wire();
+	compiled();
+
+	const std::vector <std::uint8_t> answer (100u, 0u);
+	dns::cache c (60u, dns::cache::limits {4u, 1u << 20});
+	for (const char *n : {"a.org", "b.org", "c.org", "d.org"})
+		c.replace_entry (n, answer, 300, dns::rr_type::a);
+	assert (4u == c.size() && 0u == c.evictions());
+	// recently used entries get a second chance
+	assert (nullptr != c.find ("a.org", dns::rr_type::a));
+	c.replace_entry ("e.org", answer, 300, dns::rr_type::a);
+	assert (4u == c.size() && 1u == c.evictions());
+	assert (nullptr != c.find ("a.org", dns::rr_type::a));
+	assert (nullptr == c.find ("b.org", dns::rr_type::a));
+	assert (nullptr != c.find ("e.org", dns::rr_type::a));
+
+	// names and answers count against the memory budget
+	const std::size_t per_entry = c.bytes() / c.size();
+	assert (answer.size() + 5u < per_entry);
+	c.set_limits (dns::cache::limits {100u, 2u * per_entry});
+	assert (2u == c.size() && 3u == c.evictions() && c.bytes() <= 2u * per_entry);
+	c.replace_entry ("large.org", std::vector <std::uint8_t> (4u * per_entry, 0u),
+		300, dns::rr_type::a);
+	assert (c.bytes() <= 2u * per_entry);
+
+	// expired entries are counted apart
+	c.set_limits (dns::cache::limits {100u, 1u << 20});
+	const std::size_t before = c.evictions();
+	c.replace_entry ("old.org", answer, -10, dns::rr_type::a);
+	c.replace_entry ("old.org", answer, -10, dns::rr_type::aaaa);
+	const std::size_t n = c.size();
+	c.collect_garbage();
+	assert (n - 2u == c.size() && 2u == c.expirations() && before == c.evictions());
+	std::cout << "Cache entries: " << c.size() << ", bytes: " << c.bytes()
+		<< ", evictions: " << c.evictions() << std::endl;
+}
+
+int main()
+{
+	return trace::catch_all_errors (run);
+}
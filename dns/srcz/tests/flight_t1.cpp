@@ -0,0 +1,308 @@
+#undef NDEBUG
+
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+
+#include <ev++.h>
+
+#include "backtrace/catch.hxx"
+#include "network/socket.hxx"
+#include "network/address.hxx"
+#include "network/packet.hxx"
+#include "network/provider.hxx"
+#include "network/udp/listener.hxx"
+#include "dns/responder.hxx"
+#include "dns/options.hxx"
+
+using bytes = std::vector <std::uint8_t>;
+
+namespace {
+
+constexpr const unsigned clients = 5u;
+
+//! header and question, the name as given, without EDNS
+bytes question (std::uint16_t id, const std::string &name)
+{
+	bytes q {static_cast <std::uint8_t> (id >> 8), static_cast <std::uint8_t>
+		(id & 0xffu), 0x01u, 0u, 0u, 1u, 0u, 0u, 0u, 0u, 0u, 0u};
+	for (std::size_t begin = 0; begin <= name.size();)
+	{
+		const std::size_t end = std::min (name.find ('.', begin), name.size());
+		q.push_back (static_cast <std::uint8_t> (end - begin));
+		q.insert (q.end(), name.data() + begin, name.data() + end);
+		begin = end + 1u;
+	}
+	q.insert (q.end(), {0u, 0u, 1u, 0u, 1u}); // A, IN
+	return q;
+}
+
+//! Answers the questions it got after a while, with an A record of zero TTL,
+//! stale at once, or with the rcode
+struct server
+{
+	network::udp::socket_t sock {network::inet::ipv4};
+	ev::io read_event;
+	ev::timer reply_timer;
+	std::vector <std::pair <bytes, network::address>> pending;
+	unsigned got = 0;
+	std::uint8_t rcode = 0u;
+
+	server()
+	{
+		network::bind_listener (sock, network::address ("127.0.0.1", 0));
+		sock.unblock();
+		read_event.set <server, &server::on_read> (this);
+		read_event.start (sock.file_descriptor(), ev::READ);
+		reply_timer.set <server, &server::on_timer> (this);
+	}
+
+	void on_read (ev::io &, int)
+	{
+		std::uint8_t buf[512];
+		network::address from;
+		const auto n = network::udp::receive_from (sock, buf, sizeof (buf), 0, &from);
+		if (0 >= n)
+			return;
+		++got;
+		pending.emplace_back (bytes (buf, buf + n), from);
+		if (!reply_timer.is_active())
+			reply_timer.start (0.05, 0.);
+	}
+
+	void on_timer (ev::timer &, int)
+	{
+		for (auto &p : pending)
+		{
+			bytes a = p.first;
+			a[2] |= 0x80u; // QR
+			a[3] = static_cast <std::uint8_t> (0x80u | rcode);
+			if (0u == rcode)
+			{
+				a[7] = 1u;
+				a.insert (a.end(), {0xc0u, 12u, 0u, 1u, 0u, 1u, 0u, 0u, 0u, 0u, 0u, 4u,
+					10u, 0u, 0u, 1u});
+			}
+			network::udp::send_to (sock, a.data(), static_cast <unsigned short>
+				(a.size()), 0, p.second);
+		}
+		pending.clear();
+	}
+};
+
+struct client
+{
+	network::udp::socket_t sock {network::inet::ipv4};
+	ev::io read_event;
+	bytes asked, reply;
+
+	client()
+	{
+		network::bind_listener (sock, network::address ("127.0.0.1", 0));
+		sock.unblock();
+		read_event.set <client, &client::on_read> (this);
+		read_event.start (sock.file_descriptor(), ev::READ);
+	}
+
+	void ask (const network::address &to, std::uint16_t id, const std::string &name)
+	{
+		asked = question (id, name);
+		reply.clear();
+		network::udp::send_to (sock, asked.data(), static_cast <unsigned short>
+			(asked.size()), 0, to);
+	}
+
+	void on_read (ev::io &, int)
+	{
+		std::uint8_t buf[512];
+		network::address from;
+		const auto n = network::udp::receive_from (sock, buf, sizeof (buf), 0, &from);
+		if (0 < n)
+			reply.assign (buf, buf + n);
+	}
+
+	unsigned rcode() const {return reply.at (3) & 0x0fu;}
+
+	unsigned answers() const {return reply.at (7);}
+
+	//! its own ID and question, in the case it was asked
+	bool own_question() const
+	{
+		return asked.size() <= reply.size() && 0 == std::memcmp (asked.data(),
+			reply.data(), 2u) && 0 == std::memcmp (asked.data() + 12, reply.data()
+			+ 12, asked.size() - 12u);
+	}
+};
+
+void stop_loop (ev::timer &w, int)
+{
+	w.loop.break_loop (ev::ALL);
+}
+
+void run_for (double seconds)
+{
+	ev::timer stop;
+	stop.set <stop_loop>();
+	stop.start (seconds, 0.);
+	ev::get_default_loop().run();
+}
+
+//! Folds questions so that they are not DNS any more, as DNSCrypt does
+class folding_provider : public network::provider
+{
+public:
+
+	using network::provider::provider;
+
+	void fold (network::packet &p) override
+	{
+		p.modify_bytes()[4] ^= 0x80u;
+	}
+};
+
+struct fixture
+{
+	std::shared_ptr <dns::responder> responder;
+	std::shared_ptr <network::udp::udplistener> listener;
+	network::address address;
+	std::vector <std::unique_ptr <client>> clients;
+
+	explicit fixture (std::shared_ptr <network::provider> &&p)
+	{
+		dns::detail::options opts;
+		opts.resolvers = "none"; // the provider is added
+		opts.min_ttl = 0u;
+		opts.stale_period = 60u;
+		responder = std::make_shared <dns::responder> (opts);
+		responder->add_provider (std::move (p));
+		std::weak_ptr <network::responder> w (responder);
+		listener = network::udp::listener::make_new (std::move (w),
+			network::address ("127.0.0.1", 0));
+		address = listener->udp_socket().get_address();
+		for (unsigned i = 0; i < ::clients; ++i)
+			clients.emplace_back (new client());
+	}
+
+	//! the same name in different case, as 0x20 randomization does
+	void ask_all (std::uint16_t id, const std::string &name)
+	{
+		for (unsigned i = 0; i < clients.size(); ++i)
+		{
+			std::string n = name;
+			n[i % n.size()] = static_cast <char> (n[i % n.size()] ^ 0x20);
+			clients[i]->ask (address, static_cast <std::uint16_t> (id + i), n);
+		}
+	}
+};
+
+//! one question upstream, the answer fans out to all with their IDs
+void coalesced()
+{
+	server srv;
+	fixture f (std::make_shared <network::provider> (srv.sock.get_address(),
+		network::proto::udp));
+	f.ask_all (100u, "flight.example.org");
+	run_for (0.2);
+	assert (1u == srv.got);
+	for (const auto &c : f.clients)
+		assert (c->own_question() && 0u == c->rcode() && 1u == c->answers());
+	auto &r = *f.responder;
+	assert (1u == r.upstream_count() && clients - 1u == r.coalesced_count());
+	assert (0u == r.flights_count());
+
+	// expired already, upstream fails, all get the stale answer
+	srv.rcode = 2u; // SERVFAIL
+	f.ask_all (200u, "flight.example.org");
+	run_for (0.2);
+	assert (2u == srv.got);
+	for (const auto &c : f.clients)
+		assert (c->own_question() && 0u == c->rcode() && 1u == c->answers());
+
+	// nothing stale, all get the failure
+	f.ask_all (300u, "fresh.example.org");
+	run_for (0.2);
+	assert (3u == srv.got);
+	for (const auto &c : f.clients)
+		assert (c->own_question() && 2u == c->rcode());
+	assert (3u == r.upstream_count() && 3u * (clients - 1u) == r.coalesced_count());
+	assert (0u == r.flights_count());
+	std::cout << "Upstream: " << r.upstream_count() << ", coalesced: "
+		<< r.coalesced_count() << std::endl;
+}
+
+//! Takes TCP connections and closes each one once a question comes, the
+//! folded question is failed after the retry
+struct hanging_server
+{
+	network::tcp::socket_t listener {network::inet::ipv4};
+	std::vector <network::tcp::socket_t> conns;
+	std::vector <std::unique_ptr <ev::io>> read_events;
+	ev::io accept_event;
+	unsigned got = 0;
+
+	hanging_server()
+	{
+		network::bind_listener (listener, network::address ("127.0.0.1", 0));
+		network::tcp::listen (listener, 8);
+		accept_event.set <hanging_server, &hanging_server::on_accept> (this);
+		accept_event.start (listener.file_descriptor(), ev::READ);
+	}
+
+	void on_accept (ev::io &, int)
+	{
+		conns.emplace_back (network::tcp::accept_new (listener).first);
+		read_events.emplace_back (new ev::io());
+		auto &e = *read_events.back();
+		e.set <hanging_server, &hanging_server::on_read> (this);
+		e.start (conns.back().file_descriptor(), ev::READ);
+	}
+
+	void on_read (ev::io &w, int)
+	{
+		w.stop();
+		auto &conn = *std::find_if (conns.begin(), conns.end(),
+			[&w] (const network::tcp::socket_t &c) {return w.fd == c.file_descriptor();});
+		std::uint8_t buf[512];
+		if (0 < network::tcp::receive (conn, buf, sizeof (buf), 0))
+			++got;
+		conn.close();
+	}
+};
+
+//! folded question fails without an answer passed down, the flight is over
+void failed()
+{
+	hanging_server srv;
+	fixture f (std::make_shared <folding_provider> (srv.listener.get_address(),
+		network::proto::tcp));
+	f.ask_all (400u, "failed.example.org");
+	run_for (0.2);
+	assert (2u == srv.got); // retried once
+	auto &r = *f.responder;
+	assert (1u == r.upstream_count() && clients - 1u == r.coalesced_count());
+	assert (0u == r.flights_count());
+	// asked again, not waiting for the failed one
+	f.clients[0]->ask (f.address, 500u, "failed.example.org");
+	run_for (0.2);
+	assert (4u == srv.got);
+	assert (2u == r.upstream_count() && clients - 1u == r.coalesced_count());
+	assert (0u == r.flights_count());
+}
+
+} // namespace
+
+void run()
+{
+	coalesced();
+	failed();
+}
+
+int main()
+{
+	return trace::catch_all_errors (run);
+}
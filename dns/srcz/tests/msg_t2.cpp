@@ -87,10 +87,33 @@ void tst_1()
 	assert (!hn.empty() && 'a' == hn.front());
 }
 
+void tst_2()
+{
+	cout << "\n==== Testing SERVFAIL from question" << endl;
+	const char hn0[] = "failing.host.name";
+	dns::query msg(hn0);
+	const auto qsize = msg.question_size();
+	assert (qsize == msg.size());
+	msg.set_answer("failing.host.name", "0.0.0.1");
+	assert (qsize < msg.size());
+	assert (1 == msg.header().ancount);
+	assert (qsize == msg.question_size());
+	dns::query fail (msg.bytes(), qsize); // header and question only
+	fail.truncate_to_question();
+	fail.mark_servfail();
+	assert (qsize == fail.size());
+	assert (0 == fail.header().ancount);
+	assert (dns::pkt_rcode::servfail == fail.rcode());
+	assert (fail.header().qr);
+	assert (msg.header().id == fail.header().id);
+	assert (std::string (hn0) == fail.hostname());
+}
+
 void run()
 {
 	tst_0();
 	tst_1();
+	tst_2();
 }
 
 int main()
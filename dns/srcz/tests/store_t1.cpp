@@ -0,0 +1,163 @@
+#undef NDEBUG
+
+#include <iostream>
+#include <fstream>
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include <ev++.h>
+
+#include "backtrace/catch.hxx"
+#include "dns/cache.hxx"
+#include "dns/cache_store.hxx"
+#include "dns/constants.hxx"
+
+namespace {
+
+const char dir[] = ".";
+
+void remove_files (const dns::cache_store &s)
+{
+	std::remove (s.snapshot_name().c_str());
+	std::remove (s.journal_name().c_str());
+	std::remove ((s.journal_name() + ".old").c_str());
+}
+
+//! never reads, so the loop always has an event pending
+void busy_callback (ev::io &, int)
+{
+}
+
+std::string name (unsigned i)
+{
+	return "h" + std::to_string (i) + ".example.org";
+}
+
+//! stores and journals entries with answers of the size
+void add (dns::cache &c, dns::cache_store &s, unsigned from, unsigned to,
+	std::size_t size)
+{
+	for (unsigned i = from; i < to; ++i)
+	{
+		c.replace_entry (name (i), std::vector <std::uint8_t> (size, static_cast
+			<std::uint8_t> (i)), 3600, dns::rr_type::a);
+		const dns::cache_entry *e = c.find (name (i), dns::rr_type::a);
+		assert (nullptr != e);
+		s.append (*e, c);
+	}
+}
+
+void check (const dns::cache &c, unsigned from, unsigned to, std::size_t size)
+{
+	for (unsigned i = from; i < to; ++i)
+	{
+		const dns::cache_entry *e = c.find (name (i), dns::rr_type::a);
+		assert (nullptr != e && size == e->response_size());
+		assert (static_cast <std::uint8_t> (i) == e->response()[size - 1u]);
+	}
+}
+
+} // namespace
+
+void run()
+{
+	ev::dynamic_loop loop (ev::AUTO);
+	{
+		dns::cache c (0u);
+		dns::cache_store s (dir, loop);
+		remove_files (s);
+		assert (0u == s.load (c));
+		add (c, s, 0u, 100u, 40u);
+		// one batch of updates, later records win
+		add (c, s, 0u, 10u, 50u);
+		s.flush();
+		assert (0u < s.journal_bytes());
+	}
+	{
+		dns::cache c (0u);
+		dns::cache_store s (dir, loop);
+		assert (110u == s.load (c));
+		assert (100u == c.size());
+		check (c, 0u, 10u, 50u);
+		check (c, 10u, 100u, 40u);
+		// replayed journal went into the snapshot
+		assert (24u == s.journal_bytes());
+		add (c, s, 100u, 120u, 40u);
+	}
+	// record cut short by a crash
+	{
+		std::ofstream j (dns::cache_store (dir, loop).journal_name(), std::ios::binary
+			| std::ios::app);
+		const char torn[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17};
+		j.write (torn, sizeof (torn));
+	}
+	{
+		dns::cache c (0u);
+		dns::cache_store s (dir, loop);
+		assert (120u == s.load (c));
+		check (c, 0u, 10u, 50u);
+		check (c, 10u, 120u, 40u);
+		// outgrows the snapshot and the minimum
+		add (c, s, 1000u, 3000u, 600u);
+		assert (1u == s.compactions() && s.compacting());
+		// the image is built in slices by the loop, busy as it is
+		int fds[2];
+		assert (0 == ::pipe (fds));
+		assert (1 == ::write (fds[1], "x", 1));
+		ev::io busy (loop);
+		busy.set <busy_callback>();
+		busy.start (fds[0], ev::READ);
+		unsigned iterations = 0;
+		for (; s.compacting() && 100u > iterations; ++iterations)
+			loop.run (ev::NOWAIT);
+		assert (!s.compacting());
+		assert (1u < iterations);
+		busy.stop();
+		::close (fds[0]);
+		::close (fds[1]);
+		std::cout << "journal after compaction: " << s.journal_bytes()
+			<< ", slices: " << iterations << std::endl;
+	}
+	// all stored before the slices were built
+	assert (2120u == dns::cache::load (dns::cache_store (dir, loop)
+		.snapshot_name(), 0u).size());
+	{
+		dns::cache c (0u);
+		dns::cache_store s (dir, loop);
+		s.load (c);
+		assert (2120u == c.size());
+		check (c, 1000u, 3000u, 600u);
+		check (c, 10u, 120u, 40u);
+		s.save (c);
+		assert (24u == s.journal_bytes());
+		assert (2120u == dns::cache::load (s.snapshot_name(), 0u).size());
+		remove_files (s);
+	}
+	// files of the previous format are refused
+	{
+		std::ofstream old ("tst-tmp-old-cache.bin", std::ios::binary);
+		old << "mgck " << 1023456789 << "\nsize 0\n";
+	}
+	bool refused = false;
+	try
+	{
+		dns::cache::load ("tst-tmp-old-cache.bin", 0u);
+	}
+	catch (const std::runtime_error &e)
+	{
+		std::cout << "refused: " << e.what() << std::endl;
+		refused = true;
+	}
+	assert (refused);
+	std::remove ("tst-tmp-old-cache.bin");
+}
+
+int main()
+{
+	return trace::catch_all_errors (run);
+}
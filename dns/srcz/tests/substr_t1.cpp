@@ -0,0 +1,74 @@
+#undef NDEBUG
+
+#include <iostream>
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include "backtrace/catch.hxx"
+#include "dns/substring_automaton.hxx"
+
+static void small()
+{
+	const dns::substring_automaton a ({"telemetry", "----", "ads.", ".ad.",
+		"xads.", "mytelemetryx", "she", "he", "hers", "ads.", "", "a+b", "a+bc",
+		"c+d", "tel"});
+	// containing other words, repeated or empty
+	assert (7u == a.size());
+	const std::vector <std::string> expect {"----", ".ad.", "a+b", "ads.", "c+d",
+		"he", "tel"};
+	assert (expect == a.words());
+	assert (a.match (".www.TELemetry.com.") && a.match ("x.tel"));
+	assert (a.match (".google----xx.com.") && !a.match (".google---xx.com."));
+	assert (a.match (".ads.com.") && a.match (".xads.com."));
+	assert (a.match (".AD.com.") && !a.match (".bad.com."));
+	assert (a.match ("ushers") && a.match ("xhe") && !a.match ("shx"));
+	// out of the alphabet, searched for apart
+	assert (a.match ("xA+Bx") && a.match ("c+d") && !a.match ("a+c"));
+	assert (!a.match ("") && !a.match (".com."));
+	// dots around the name where it has none
+	assert (a.match_dotted ("ad.com", 6u) && a.match_dotted (".Ad.com", 7u));
+	assert (!a.match ("ad.com") && !a.match_dotted ("bad.com", 7u));
+	assert (a.match_dotted ("x.ads", 5u) && a.match_dotted ("x.ads.", 6u));
+	const dns::substring_automaton o ({".a+b", "c+d."});
+	assert (o.match_dotted ("A+b.com", 7u) && !o.match_dotted ("xa+b.com", 8u));
+	assert (o.match_dotted ("x.c+D", 5u) && !o.match_dotted ("x.c+dx", 6u));
+	assert (!o.match ("a+b.com") && !o.match_dotted ("", 0u));
+}
+
+static void empty()
+{
+	const dns::substring_automaton a;
+	assert (a.empty() && 1u == a.states());
+	assert (!a.match ("anything") && !a.match (""));
+	const dns::substring_automaton b (std::vector <std::string> {"", ""});
+	assert (b.empty() && !b.match ("x"));
+}
+
+//! many words, matched in one pass
+static void many()
+{
+	std::vector <std::string> words;
+	for (unsigned i = 0; i < 5000u; ++i)
+		words.push_back ("w" + std::to_string (i * 7u) + "-");
+	const dns::substring_automaton a (std::move (words));
+	assert (5000u == a.size());
+	for (unsigned i = 0; i < 5000u; ++i)
+	{
+		assert (a.match ("x.w" + std::to_string (i * 7u) + "-y.com"));
+		assert (!a.match ("x.w" + std::to_string (i * 7u + 1u) + "-y.com"));
+	}
+	std::cout << "words: " << a.size() << ", states: " << a.states() << std::endl;
+}
+
+void run()
+{
+	small();
+	empty();
+	many();
+}
+
+int main()
+{
+	return trace::catch_all_errors (run);
+}
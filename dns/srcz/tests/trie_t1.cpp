@@ -0,0 +1,86 @@
+#undef NDEBUG
+
+#include <iostream>
+#include <cassert>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "backtrace/catch.hxx"
+#include "dns/label_trie.hxx"
+
+static void small()
+{
+	dns::label_trie t ({"ads.com", ".doubleclick.net", "x.ads.com",
+		"a.b.tracker.org", ".b.tracker.org", ".tracker.org.", "a-b.com", "a.com",
+		"ab.com", ".c.doubleclick.net", "ads.com"});
+	// covered by suffixes, or repeated
+	assert (8u == t.size());
+	assert (t.match ("ads.com") && t.match ("ADS.Com"));
+	assert (!t.match ("www.ads.com") && !t.match (".ads.com") && !t.match ("ds.com"));
+	assert (t.match ("x.ads.com") && !t.match ("y.x.ads.com"));
+	assert (t.match ("doubleclick.net") && t.match ("a.b.DoubleClick.net"));
+	assert (t.match (".doubleclick.net") && !t.match ("adoubleclick.net"));
+	assert (!t.match ("net") && !t.match ("doubleclick.ne"));
+	assert (t.match ("a.com") && t.match ("a-b.com") && t.match ("ab.com"));
+	assert (!t.match ("b.com") && !t.match ("a-c.com") && !t.match ("com"));
+	assert (t.match ("b.tracker.org") && t.match ("a.b.tracker.org"));
+	// a trailing dot is an empty label, the caller strips it
+	assert (t.match ("tracker.org.") && t.match ("x.tracker.org."));
+	assert (!t.match ("tracker.org") && !t.match ("c.tracker.org"));
+	assert (!t.match ("") && !t.match (".") && !t.match (".."));
+
+	auto names = t.names();
+	std::sort (names.begin(), names.end());
+	const std::vector <std::string> expect {".b.tracker.org", ".doubleclick.net",
+		".tracker.org.", "a-b.com", "a.com", "ab.com", "ads.com", "x.ads.com"};
+	assert (expect == names);
+	// built again from its names
+	assert (8u == dns::label_trie (t.names()).size());
+}
+
+static void empty()
+{
+	const dns::label_trie t;
+	assert (t.empty() && 0u == t.size() && t.names().empty());
+	assert (!t.match ("com") && !t.match (""));
+	const dns::label_trie u (std::vector <std::string> {});
+	assert (u.empty() && !u.match ("a.b"));
+}
+
+//! many siblings under a few parents
+static void wide()
+{
+	std::vector <std::string> names;
+	for (unsigned i = 0; i < 20000u; ++i)
+		names.push_back (((0u == i % 3u) ? ".h" : "h") + std::to_string (i) + ".z"
+			+ std::to_string (i % 4u) + ".com");
+	std::size_t text = 0;
+	for (const auto &n : names)
+		text += n.size() + 1u;
+	dns::label_trie t (std::move (names));
+	assert (20000u == t.size());
+	for (unsigned i = 0; i < 20000u; ++i)
+	{
+		const std::string n = "h" + std::to_string (i) + ".z" + std::to_string (i % 4u)
+			+ ".com";
+		assert (t.match (n));
+		assert ((0u == i % 3u) == t.match ("w." + n));
+		assert (!t.match ("h" + std::to_string (i) + ".z" + std::to_string ((i + 1u)
+			% 4u) + ".com"));
+	}
+	std::cout << "names: " << t.size() << ", text: " << text << ", trie: "
+		<< t.memory() << std::endl;
+}
+
+void run()
+{
+	small();
+	empty();
+	wide();
+}
+
+int main()
+{
+	return trace::catch_all_errors (run);
+}
@@ -0,0 +1,84 @@
+#ifndef DNS_SUBSTRING_AUTOMATON_HXX_
+#define DNS_SUBSTRING_AUTOMATON_HXX_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include <dns/dll.hxx>
+
+namespace dns {
+
+//! Words found anywhere in a name, by an Aho-Corasick automaton. Transitions
+//! of all states are in one flat table over the letters, digits, '-', '.'
+//! and '_', so that matching takes one lookup per byte of the name. Words
+//! with other bytes are rare and searched for one by one. The table is
+//! immutable, built or mapped from a file, and shared by copies.
+class DNS_API substring_automaton
+{
+public:
+
+	//! other bytes, then the letters, digits, '-', '.', '_'
+	static constexpr const unsigned symbols = 40u;
+
+	substring_automaton();
+
+	//! Words in lower case. Words containing other words, or repeated, are
+	//! dropped.
+	explicit substring_automaton (std::vector<std::string> &&words);
+
+	//! Transitions kept by the storage, e.g. a mapped file, as written from
+	//! table(), for the words. Throws std::runtime_error if they go astray.
+	substring_automaton (const std::uint32_t *table, std::size_t states,
+		std::vector<std::string> &&words, std::shared_ptr<const void> &&storage);
+
+	//! text in any case contains one of the words
+	bool match (const char *text, std::size_t size) const noexcept
+	{
+		return this->scan (text, size, false, false);
+	}
+
+	bool match (const std::string &text) const noexcept
+	{
+		return this->match (text.data(), text.size());
+	}
+
+	//! name in any case, as if between dots, where it does not start or end
+	//! with one: '.name.'
+	bool match_dotted (const char *name, std::size_t size) const noexcept
+	{
+		return this->scan (name, size, 0u == size || '.' != name[0], 0u == size
+			|| '.' != name[size - 1u]);
+	}
+
+	const std::vector<std::string> &words() const noexcept {return words_;}
+
+	std::size_t size() const noexcept {return words_.size();}
+
+	bool empty() const noexcept {return words_.empty();}
+
+	std::size_t states() const noexcept {return states_;}
+
+	//! transitions, states by symbols
+	const std::uint32_t *table() const noexcept {return next_;}
+
+private:
+
+	//! text with a dot before and after it, as asked for
+	bool scan (const char *text, std::size_t size, bool dot_before, bool dot_after)
+		const noexcept;
+
+	//! set on transitions into states where a word ends
+	static constexpr const std::uint32_t accept = 1u << 31;
+
+	const std::uint32_t *next_; //!< states by symbols, the root first
+	std::size_t states_ = 1u;
+	std::shared_ptr<const void> storage_; //!< of the transitions
+	std::vector<std::string> words_;
+	std::vector<std::string> others_; //!< words with bytes out of the symbols
+};
+
+} // namespace dns
+#endif
@@ -27,10 +27,6 @@ public:
 
 	abs_connection (const abs_connection &) = delete;
 
-	virtual void send (const packet &) const = 0;
-
-	virtual void receive (packet &) const = 0;
-
 	// for libev
 	int file_descriptor () const
 	{
@@ -95,10 +91,6 @@ public:
 
 	void udp_send_to (const packet &message, const class address &) const;
 
-	void send (const packet &msg) const override {this->udp_send (msg);}
-
-	void receive (packet &m) const override {this->udp_receive (m);}
-
 protected:
 
 	explicit udp_connection (const class address &a)
@@ -142,16 +134,6 @@ protected:
 
 	void tcp_connect() const;
 
-	void send (const packet &msg) const override {this->tcp_send (msg);}
-
-	void receive (packet &m) const override {this->tcp_receive (m);}
-
-	//! @todo buffered multi-transmission messages
-	void tcp_send(const packet &message) const;
-
-	//! @todo buffered multi-transmission messages
-	void tcp_receive (packet &message) const;
-
 public:
 
 	const system::socket &sys_socket() const override final {return sock_;}
@@ -6,19 +6,21 @@
 
 #include <network/timeout.hxx>
 #include <network/packet.hxx>
-
+#include <network/slab.hxx>
+#include <network/dll.hxx>
 
 namespace network {
 
 class abs_listener;
 
-class incoming : public timeout
+class NETWORK_API incoming : public timeout
 {
 public:
 
 	virtual void respond(const packet &) = 0;
 
-	virtual void close() { this->timeout::stop(); assert( this->is_closed() ); }
+	//! stops waiting, the listener forgets the request
+	virtual void close();
 
 	// Call to virtual function during destruction will not dispatch to derived class
 	virtual ~incoming() {this->incoming::close();}
@@ -35,6 +37,13 @@ public:
 		message_ptr_ = std::move(q);
 	}
 
+	//! hands the message over, e.g. to upstream, until replace_message
+	std::unique_ptr<packet> release_message()
+	{
+		assert(message_ptr_);
+		return std::move(message_ptr_);
+	}
+
 	bool is_closed() { return !this->timeout::is_active(); }
 
 	std::shared_ptr<class abs_listener> listener_ptr() const
@@ -47,9 +56,17 @@ protected:
 
 	explicit incoming (std::weak_ptr<class abs_listener> &&);
 
+	incoming (std::weak_ptr<class abs_listener> &&, std::unique_ptr<packet> &&);
+
 	std::unique_ptr<packet> message_ptr_;
 
 	std::weak_ptr<class abs_listener> listener_ptr_;
+
+private:
+
+	friend class abs_listener;
+
+	slab_handle handle_; //!< slot in the listener table, while queued
 };
 
 } // namespace network
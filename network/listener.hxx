@@ -8,6 +8,7 @@
 #include <ev++.h>
 
 #include <network/fwd.hxx>
+#include <network/slab.hxx>
 #include <network/dll.hxx>
 
 namespace network {
@@ -22,8 +23,11 @@ public:
 	//! Queued incoming requests count
 	std::size_t q_count() const {return requests_.size();}
 
-	//! @todo: use smart pointer
-	void create_response(incoming *); // used by incoming
+	//! queues the request and passes it to the responder
+	void create_response (std::shared_ptr<incoming> &&);
+
+	//! forgets a closed request, used by incoming
+	void release (slab_handle);
 
 	void start(int sock) {event_.start(sock, ev::READ);}
 
@@ -39,7 +43,13 @@ protected:
 
 	virtual ~abs_listener() = default; // because of virtual functions
 
-	std::vector< std::shared_ptr<incoming> > requests_;
+	//! several requests received on a single wakeup
+	void count_extra (std::size_t n) noexcept {count_ += n;}
+
+	//! destroys requests released since the last call, outside of their callbacks
+	void forget_closed() noexcept {retired_.clear();}
+
+	slab< std::shared_ptr<incoming> > requests_;
 
 private:
 
@@ -49,6 +59,8 @@ private:
 
 	void on_message();
 
+	std::vector< std::shared_ptr<incoming> > retired_;
+
 	std::size_t count_;
 	ev::io event_;
 
@@ -3,6 +3,8 @@
 
 #include <cinttypes>
 #include <cassert>
+#include <cstddef>
+#include <array>
 #include <vector>
 #include <memory>
 
@@ -10,6 +12,92 @@
 
 namespace network {
 
+//! Per-thread free lists of packet buffers, grouped in size classes
+//! Buffers are never zero-filled, they are recycled on packet destruction
+class NETWORK_API packet_pool
+{
+public:
+
+	enum class size_class : std::uint8_t
+	{
+		udp = 0, //!< plain DNS over UDP, 512 bytes
+		edns = 1, //!< typical EDNS0 payload, 4096 bytes
+		tcp = 2, //!< anything up to 64 KiB, TCP or large EDNS0
+		none = 0xff
+	};
+
+	static constexpr const std::size_t class_count = 3u;
+
+	static constexpr std::size_t capacity (size_class c) noexcept
+	{
+		return size_class::udp == c ? 512u : (size_class::edns == c ? 4096u
+			: (size_class::tcp == c ? 65536u : 0u));
+	}
+
+	static constexpr size_class class_for (std::size_t n) noexcept
+	{
+		return 0u == n ? size_class::none : (n <= capacity (size_class::udp)
+			? size_class::udp : (n <= capacity (size_class::edns) ? size_class::edns
+				: size_class::tcp));
+	}
+
+	struct counters
+	{
+		std::uint64_t allocated = 0; //!< heap allocations
+		std::uint64_t reused = 0; //!< served from the free list
+		std::uint64_t recycled = 0; //!< returned into the free list
+		std::uint64_t freed = 0; //!< returned to heap, free list was full
+		std::uint64_t in_use = 0; //!< currently owned by packets
+		std::size_t idle = 0; //!< currently in the free list
+	};
+
+	typedef std::unique_ptr <std::uint8_t[]> buffer;
+
+	//! pool of the calling thread, nullptr during thread shutdown
+	static packet_pool *local() noexcept;
+
+	buffer acquire (size_class);
+
+	//! `issuer` is id() of the pool which acquired the buffer, buffers of
+	//! other pools, e.g. of another thread, are returned to heap
+	void release (size_class, buffer &&, std::uint32_t issuer) noexcept;
+
+	//! unique over all threads, never 0
+	std::uint32_t id() const noexcept {return id_;}
+
+	const counters &stats (size_class c) const
+	{
+		assert (static_cast <std::size_t> (c) < class_count);
+		return stats_[static_cast <std::size_t> (c)];
+	}
+
+	//! sum of heap allocations over all size classes
+	std::uint64_t allocations() const noexcept;
+
+	//! how many buffers of a class to keep in the free list
+	void set_max_idle (size_class, std::size_t);
+
+	//! returns all idle buffers to heap
+	void trim() noexcept;
+
+	packet_pool();
+
+	~packet_pool();
+
+	packet_pool (const packet_pool &) = delete;
+	packet_pool &operator= (const packet_pool &) = delete;
+
+private:
+
+	const std::uint32_t id_;
+
+	std::array <std::vector <buffer>, class_count> free_;
+
+	std::array <std::size_t, class_count> max_idle_;
+
+	std::array <counters, class_count> stats_;
+};
+
 class NETWORK_API packet
 {
 public:
@@ -27,40 +115,50 @@ private:
 
 	size_type size_;
 
-	std::vector <std::uint8_t> bytes_;
+	size_type reserved_;
+
+	packet_pool::size_class class_;
+
+	std::uint32_t pool_; //!< id of the pool which issued the buffer, or 0
+
+	packet_pool::buffer bytes_;
+
+	std::size_t capacity() const noexcept {return packet_pool::capacity (class_);}
+
+	void release() noexcept;
 
 public:
 
-	size_type reserved_size() const noexcept
-	{
-		assert (bytes_.size() < 65536u);
-		return static_cast <size_type> (bytes_.size());
-	}
+	size_type reserved_size() const noexcept {return reserved_;}
+
+	const std::uint8_t *bytes() const noexcept {return bytes_.get();}
 
-	const std::uint8_t *bytes() const noexcept {return bytes_.data();}
+	std::uint8_t *modify_bytes() noexcept {return bytes_.get();}
 
-	std::uint8_t *modify_bytes() noexcept {return bytes_.data();}
+	size_type size() const {assert (reserved_ >= size_); return size_;}
 
-	size_type size() const {assert (this->bytes_.size() >= size_); return size_;}
+	packet() noexcept : size_(0U), reserved_(0U), class_(packet_pool::size_class::none),
+		pool_(0U), bytes_() {}
 
-	packet() noexcept : size_(0UL), bytes_() {}
+	packet (const std::uint8_t *b, size_type l) : packet (b, l, l) {}
 
-	packet (const std::uint8_t *b, size_type l) : size_(l), bytes_(b, b+l) {}
+	//! copies `l` bytes into buffer with at least `reserve` bytes
+	packet (const std::uint8_t *b, size_type l, size_type reserve);
 
 	// for nothrow_move_assignable/constructable
-	packet (packet &&) = default;
-	packet & operator= (packet &&) = default;
-	packet (const packet &) = default;
-	packet & operator= (const packet &) = default;
+	packet (packet &&) noexcept;
+	packet & operator= (packet &&) noexcept;
+	packet (const packet &);
+	packet & operator= (const packet &);
 
 	void append(const packet &other);
 
 	void append(const std::uint8_t *buf, size_type n);
 
-	void set_size (size_type s) {assert (this->bytes_.size() >=s); size_ = s;}
+	void set_size (size_type s) {assert (reserved_ >= s); size_ = s;}
 
-	//! @todo this is inefficient
-	void reserve (size_type s) {bytes_.resize (s);}
+	//! grows buffer on demand, does not initialize new bytes
+	void reserve (size_type s);
 
 	//! @todo remove
 	bool is_dns() const noexcept
@@ -79,7 +177,7 @@ public:
 	//! @todo: remove?
 	virtual void mark_servfail() {}
 
-	virtual ~packet() = default; // because of virtual functions
+	virtual ~packet(); // because of virtual functions
 
 };
 
@@ -36,18 +36,42 @@ public:
 
 	virtual void unfold(packet &) {}
 
-	virtual std::unique_ptr <packet> adapt_message (const std::unique_ptr <packet> &)
+	//! takes over the message buffer, does not copy it
+	virtual std::unique_ptr <packet> adapt_message (std::unique_ptr <packet> &&)
 		const;
 
-	void increment_failures() noexcept {++failures_;}
+	//! Bytes of folded question, which are repeated in the answer before unfold.
+	//! Used to pair answers with questions on a shared UDP socket.
+	struct echo_field
+	{
+		unsigned short question_offset, answer_offset, size;
+		bool randomize; //!< e.g. DNS ID, replaced on send and restored on receive
+	};
+
+	virtual echo_field echo() const noexcept {return {0u, 0u, 2u, true};}
+
+	//! failed or timed out question, counts as lost
+	void increment_failures() noexcept;
 
 	std::size_t failures() const noexcept {return failures_;}
 
+	//! answered question, seconds since it was sent
+	void add_answer (double seconds) noexcept;
+
+	std::size_t answers() const noexcept {return answers_;}
+
+	//! smoothed answer time, seconds
+	double rtt() const noexcept {return rtt_;}
+
+	//! smoothed share of questions without answer
+	double loss() const noexcept {return loss_;}
+
 private:
 
 	class address address_;
 	proto tcp_;
-	std::size_t failures_ = 0;
+	std::size_t failures_ = 0, answers_ = 0;
+	double rtt_ = 0., loss_ = 0.;
 };
 
 } // namespace network
@@ -3,6 +3,8 @@
 
 #include <memory>
 
+#include <ev++.h>
+
 #include <network/fwd.hxx>
 #include <network/dll.hxx>
 
@@ -19,16 +21,20 @@ public:
 	virtual void respond (std::shared_ptr<incoming> &) = 0;
 	double timeout_seconds() const {return timeout_seconds_;}
 
+	//! loop of the thread, which owns this responder, its listeners and upstreams
+	ev::loop_ref event_loop() const noexcept {return loop_;}
+
 	virtual std::unique_ptr <packet> new_packet() const = 0;
 
 protected:
 
-	explicit responder (double t) : timeout_seconds_(t) {}
+	responder (double t, ev::loop_ref l) : timeout_seconds_(t), loop_ (l) {}
 
 	virtual ~responder() = default; // because of virtual functions
 
 private:
 	double timeout_seconds_ = 7.5;
+	ev::loop_ref loop_;
 };
 
 } // namespace network
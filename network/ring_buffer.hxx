@@ -0,0 +1,67 @@
+#ifndef NETWORK_RING_BUFFER_HXX_
+#define NETWORK_RING_BUFFER_HXX_
+
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include <network/dll.hxx>
+
+namespace network {
+
+//! Byte queue in a circular buffer, for partial socket reads and writes.
+//! Data and free space are handed out as contiguous spans, which wrap around
+//! the end of the buffer.
+class NETWORK_API ring_buffer
+{
+public:
+
+	struct span
+	{
+		std::uint8_t *bytes;
+		std::size_t size;
+	};
+
+	explicit ring_buffer (std::size_t capacity);
+
+	ring_buffer (const ring_buffer &) = delete;
+	ring_buffer &operator= (const ring_buffer &) = delete;
+
+	std::size_t size() const noexcept {return size_;}
+
+	std::size_t capacity() const noexcept {return capacity_;}
+
+	std::size_t room() const noexcept {return capacity_ - size_;}
+
+	bool empty() const noexcept {return 0u == size_;}
+
+	//! contiguous free space after the data, see commit
+	span free_span() noexcept;
+
+	//! adds n bytes written into free_span
+	void commit (std::size_t n) noexcept;
+
+	//! contiguous data at the front, see consume
+	span data_span() noexcept;
+
+	//! drops n bytes from the front
+	void consume (std::size_t n) noexcept;
+
+	//! copies n bytes from offset into out, across the end of the buffer
+	void peek (std::size_t offset, std::uint8_t *out, std::size_t n) const noexcept;
+
+	//! appends n bytes, grows the buffer if there is no room
+	void push (const std::uint8_t *bytes, std::size_t n);
+
+private:
+
+	//! moves data into a larger buffer, starting at its front
+	void grow (std::size_t min_capacity);
+
+	std::unique_ptr <std::uint8_t[]> bytes_;
+	std::size_t capacity_, head_ = 0, size_ = 0;
+};
+
+} // namespace network
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef NETWORK_SELECTOR_HXX_
+#define NETWORK_SELECTOR_HXX_
+
+#include <vector>
+#include <memory>
+#include <random>
+
+#include <network/fwd.hxx>
+#include <network/dll.hxx>
+
+namespace network {
+
+//! Chooses upstream providers by their smoothed answer time and loss. Takes
+//! the better of two random candidates (power of two choices), so the load
+//! still spreads, and now and then a random one to keep estimates fresh.
+class NETWORK_API provider_selector
+{
+public:
+
+	//! share of random choices
+	static constexpr const double explore = .05;
+
+	//! penalty is the cost of a lost question, e.g. the timeout in seconds
+	explicit provider_selector (double penalty);
+
+	//! expected seconds to an answer, unmeasured providers cost nothing
+	double cost (const provider &) const noexcept;
+
+	//! index of the chosen provider, the list must not be empty
+	std::size_t pick (const std::vector <std::shared_ptr <provider>> &);
+
+	void set_penalty (double seconds);
+
+private:
+
+	double penalty_;
+	std::mt19937 random_;
+};
+
+} // namespace network
+
+#endif
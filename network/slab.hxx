@@ -0,0 +1,116 @@
+#ifndef NETWORK_SLAB_HXX_
+#define NETWORK_SLAB_HXX_
+
+#include <deque>
+#include <cstdint>
+#include <cassert>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+namespace network {
+
+//! Stable reference into a slab, stale once the slot is released
+struct slab_handle
+{
+	static constexpr const std::uint32_t none = std::numeric_limits <std::uint32_t>
+		::max();
+
+	std::uint32_t index = none;
+	std::uint32_t generation = 0;
+
+	bool valid() const noexcept {return none != index;}
+};
+
+//! Table of values with O(1) insert, lookup and release.
+//! Slots are allocated in chunks and never move, released ones are chained in
+//! an intrusive free list and reused first. Every release bumps the slot
+//! generation, so a handle of a released value finds nothing.
+template <class T>
+class slab
+{
+public:
+
+	slab_handle insert (T &&value)
+	{
+		std::uint32_t i = free_;
+		if (slab_handle::none != i)
+		{
+			free_ = slots_[i].next_free;
+			slots_[i].value = std::move (value);
+		}
+		else
+		{
+			if (slab_handle::none - 1u <= slots_.size())
+				throw std::length_error ("slab is full");
+			i = static_cast <std::uint32_t> (slots_.size());
+			slots_.emplace_back (std::move (value));
+		}
+		auto &s = slots_[i];
+		s.used = true;
+		s.next_free = slab_handle::none;
+		++size_;
+		return slab_handle {i, s.generation};
+	}
+
+	T *find (slab_handle h) noexcept
+	{
+		if (h.index >= slots_.size())
+			return nullptr;
+		auto &s = slots_[h.index];
+		return (s.used && s.generation == h.generation) ? &s.value : nullptr;
+	}
+
+	//! moves the value out, the slot goes to the free list
+	T release (slab_handle h)
+	{
+		T *v = this->find (h);
+		if (nullptr == v)
+			throw std::logic_error ("stale slab handle");
+		auto &s = slots_[h.index];
+		T result = std::move (s.value);
+		s.value = T();
+		s.used = false;
+		++s.generation;
+		s.next_free = free_;
+		free_ = h.index;
+		assert (0u < size_);
+		--size_;
+		return result;
+	}
+
+	std::size_t size() const noexcept {return size_;}
+
+	//! slots, used and free
+	std::size_t capacity() const noexcept {return slots_.size();}
+
+	bool empty() const noexcept {return 0u == size_;}
+
+	template <class F>
+	void for_each (F &&f) const
+	{
+		for (const auto &s : slots_)
+			if (s.used)
+				f (s.value);
+	}
+
+private:
+
+	struct slot
+	{
+		explicit slot (T &&v) : value (std::move (v)) {}
+
+		T value;
+		std::uint32_t generation = 0;
+		std::uint32_t next_free = slab_handle::none;
+		bool used = false;
+	};
+
+	std::deque <slot> slots_;
+	std::uint32_t free_ = slab_handle::none;
+	std::size_t size_ = 0;
+};
+
+} // namespace network
+
+#endif
@@ -108,6 +108,41 @@ ssize_t NETWORK_API send_to (const socket_t&, const std::uint8_t *msg,
 ssize_t NETWORK_API receive_from (const socket_t&, std::uint8_t *buf,
 	unsigned short bufsize, int flags, address *);
 
+//! to the address of the connected socket
+ssize_t NETWORK_API send (const socket_t&, const std::uint8_t *msg,
+	unsigned short msglen, int flags);
+
+//! fixes peer address, datagrams from other addresses are discarded by the system
+void NETWORK_API connect (const socket_t&, const address &);
+
+//! one datagram of a receive_many batch
+struct datagram
+{
+	std::uint8_t *bytes;
+	unsigned short size; //!< buffer size on input, datagram size on output
+	address *peer;
+};
+
+//! one datagram of a send_many batch
+struct const_datagram
+{
+	const std::uint8_t *bytes;
+	unsigned short size;
+	const address *peer; //!< nullptr for connected socket
+};
+
+//! maximum number of datagrams passed to the system at once
+constexpr const unsigned max_batch_size = 64u;
+
+//! receives up to n datagrams, with a single recvmmsg where available
+//! @returns number of datagrams received, or -1 with errno set
+int NETWORK_API receive_many (const socket_t&, datagram *, unsigned n, int flags);
+
+//! sends up to n datagrams, with a single sendmmsg where available
+//! @returns number of datagrams sent, or -1 with errno set
+int NETWORK_API send_many (const socket_t&, const const_datagram *, unsigned n,
+	int flags);
+
 } // namespace network::udp
 
 namespace tcp
@@ -77,96 +77,6 @@ void udp_connection::udp_receive (packet &message, class address *_address) cons
 #endif
 }
 
-void tcp_connection::tcp_send(const packet &message) const
-{
-	assert (0u < message.size());
-	packet q;
-	// prepending TCP message with its total size, because it could be delivered
-	// in pieces. The receiver needs to know how many pieces to wait for.
-	// See tcp_receive
-	//! @todo fix message size type, use numeric_cast
-	const std::uint16_t sz = htons(static_cast<std::uint16_t>(message.size()));
-	q.append(reinterpret_cast<const std::uint8_t *>(&sz), 2U);
-	q.append(message);
-	assert (q.size() == 2u + message.size());
-	constexpr const int flags =
-#if defined (__linux__) || defined (MSG_NOSIGNAL)
-		MSG_NOSIGNAL; // | MSG_EOR; // do not trigger SIGPIPE;
-#else
-		0; // Windows has MSG_INTERRUPT, MSG_PARTIAL
-#endif
-	const ::ssize_t n = tcp::send (this->tcp_socket(), q.bytes(), q.size(), flags);
-	if( n < 0L )
-	{
-		const auto sock_err = get_errno();
-		std::ostringstream ostr;
-		ostr << "Failed to TCP-send: " << message.size() << " bytes, on socket: "
-			<< this->sys_socket().to_string();
-		throw net_error (sock_err, ostr.str());
-	}
-	if (0 == n)
-		throw net_error (0, "connection[TCP,send] reset by peer?");
-	// can't shutdown here
-	//! @todo implement bufferred send
-	if( q.size() != static_cast <std::size_t> (n) )
-		throw std::logic_error("buffered TCP is not supported");
-}
-
-void tcp_connection::tcp_receive(packet &message) const
-{
-	assert( 0U == message.size() );
-	assert (0u < message.reserved_size());
-	packet q;
-	q.reserve (message.reserved_size());
-	//! @todo implement bufferred receive
-	constexpr const int flags = 0; // MSG_WAITALL; // MSG_PEEK;
-	::ssize_t n = tcp::receive (this->tcp_socket(), q.modify_bytes(),
-		q.reserved_size(), flags);
-	if( n < 0L )
-		throw net_error (get_errno(), "Failed to receive[TCP]");
-	if (0L == n)
-		// socket may be a listener, so can't shutdown here
-		throw net_error (this->self_error_code(), "No data in TCP stream");
-	if( n < 2L )
-		throw std::runtime_error("not enough data in TCP message");
-	// first two bytes contain total TCP message size, introduced by tcp_send
-	const auto *sz = reinterpret_cast <const std::uint16_t *>(q.bytes());
-	const std::uint16_t msg_size = ntohs (*sz);
-	if (0 == msg_size)
-		throw std::runtime_error ("zero length TCP message");
-	const unsigned pkt_size = msg_size + 2U;
-	if (std::numeric_limits <packet::size_type>::max() < pkt_size)
-		throw std::runtime_error ("Too large TCP message");
-	const auto tcp_n = static_cast <packet::size_type> (pkt_size);
-	if (tcp_n > q.reserved_size())
-		throw std::runtime_error ("too long TCP message");
-	//! @todo implement bufferred input, to allow for other events between ::recv
-	while (n < tcp_n)
-	{
-		//! @todo numeric_cast
-		ssize_t n2 = tcp::receive (this->tcp_socket(), q.modify_bytes() + n,
-			static_cast <packet::size_type> (q.reserved_size() - static_cast
-				<std::size_t> (n)), flags);
-		//! @todo error could be because socket is not ready to rceive
-		//! @todo !!! implement bufferred input
-		if( n2 <= 0)
-			throw net_error (get_errno(), "tcp receive failure");
-		n += n2;
-		process::log::debug ("recv again: ", n2, ", expected: ", tcp_n, ", total: ",
-			n);
-	}
-	if (tcp_n != n)
-	{
-		std::ostringstream ostr;
-		ostr << "TCP message size mismatch, received: " << n << " != " << tcp_n;
-		throw std::logic_error (ostr.str());
-	}
-	assert (std::numeric_limits <packet::size_type>::max() >= n);
-	q.set_size (static_cast <packet::size_type> (n));
-	//! @todo fix size type, use numeric_cast?
-	message.append (q.bytes()+2L, static_cast <packet::size_type> (q.size()-2U));
-}
-
 void tcp_connection::tcp_connect() const
 {
 	tcp::connect (this->tcp_socket(), this->address());
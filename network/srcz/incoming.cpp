@@ -1,4 +1,5 @@
 #include <typeinfo>
+#include <algorithm>
 
 #include "network/net_error.hxx"
 #include "network/packet.hxx"
@@ -13,6 +14,14 @@
 
 #include <ev++.h>
 
+#include "network/preconfig.h"
+// for MSG_NOSIGNAL
+#if defined (HAVE_ARPA_INET_H)
+#include <arpa/inet.h>
+#elif defined (HAVE_WINSOCK2_H)
+#include <winsock2.h>
+#endif
+
 namespace network {
 
 namespace log = process::log;
@@ -63,7 +72,8 @@ own_sock
 */
 
 incoming::incoming (std::weak_ptr<class abs_listener> &&l)
-	: timeout (l.lock()->responder_ptr()->timeout_seconds()),
+	: timeout (l.lock()->responder_ptr()->event_loop(),
+		l.lock()->responder_ptr()->timeout_seconds()),
 	listener_ptr_(std::move(l))
 {
 	assert( !listener_ptr_.expired() );
@@ -72,6 +82,30 @@ incoming::incoming (std::weak_ptr<class abs_listener> &&l)
 	this->message_ptr_ = r->new_packet();
 }
 
+incoming::incoming (std::weak_ptr<class abs_listener> &&l, std::unique_ptr<packet> &&m)
+	: timeout (l.lock()->responder_ptr()->event_loop(),
+		l.lock()->responder_ptr()->timeout_seconds()), message_ptr_ (std::move
+		(m)), listener_ptr_(std::move(l))
+{
+	assert( !listener_ptr_.expired() );
+	assert (message_ptr_);
+}
+
+void incoming::close()
+{
+	this->timeout::stop();
+	assert (this->is_closed());
+	if (handle_.valid())
+	{
+		const slab_handle h = handle_;
+		handle_ = slab_handle();
+		// destroyed along with the listener otherwise
+		const auto l = listener_ptr_.lock();
+		if (l)
+			l->release (h);
+	}
+}
+
 namespace udp {
 
 in::in (std::weak_ptr<class udplistener> &&_listener)
@@ -84,11 +118,20 @@ in::in (std::weak_ptr<class udplistener> &&_listener)
 		address_.ip_port());
 }
 
+in::in (std::weak_ptr<class udplistener> &&_listener, std::unique_ptr<packet> &&m,
+	class address &&a) : network::incoming (std::move(_listener), std::move (m)),
+	address_ (std::move (a))
+{
+	log::debug ("packet[UDP]: ", this->message().size(), " from: ",
+		address_.ip_port());
+}
+
 void in::respond(const packet &message)
 {
 	try
 	{
-		this->listener_ptr()->udp_send_to(message, this->address());
+		this->listener_ptr()->udp_reply (message, this->address(), &message
+			== &this->message());
 		log::debug ("response[UDP]: ", message.size(), " to client: ",
 			this->address().ip_port());
 		this->close();
@@ -110,73 +153,282 @@ std::shared_ptr<class udplistener> in::listener_ptr() const
 
 namespace tcp {
 
-void in::respond(const packet &message)
+namespace {
+
+constexpr const int send_flags =
+#if defined (__linux__) || defined (MSG_NOSIGNAL)
+	MSG_NOSIGNAL; // do not trigger SIGPIPE
+#else
+	0;
+#endif
+
+bool would_block (int err) noexcept
 {
+	return EAGAIN == err || EWOULDBLOCK == err || EINTR == err;
+}
+
+} // namespace
+
+session::session (std::weak_ptr <tcplistener> &&l, double idle_timeout)
+	: network::tcp_connection (*l.lock()), listener_ptr_ (std::move (l)),
+	input_ (2u + 0xffffu), output_ (4096u), idle_timeout_ (idle_timeout)
+{
+	assert (!listener_ptr_.expired());
+	if (0. >= idle_timeout_)
+		throw std::logic_error ("TCP idle timeout must be positive");
+	this->unblock();
+	const auto loop = listener_ptr_.lock()->responder_ptr()->event_loop();
+	last_activity_ = loop.now();
+	read_event_.set (loop);
+	read_event_.set <read_callback>(); // ATTN! clears data
+	read_event_.data = this; // ATTN! must be set after callback
+	write_event_.set (loop);
+	write_event_.set <write_callback>();
+	write_event_.data = this;
+	idle_.set (loop);
+	idle_.set <idle_callback>();
+	idle_.data = this;
+	idle_.set (idle_timeout_, idle_timeout_);
+	idle_.start();
+	read_event_.start (this->file_descriptor(), ev::READ);
+	log::debug ("connection[TCP] from: ", this->to_string());
+}
+
+session::~session()
+{
+	this->close();
+}
+
+void session::close() noexcept
+{
+	if (closed_)
+		return;
+	closed_ = true;
+	read_event_.stop();
+	write_event_.stop();
+	idle_.stop();
+	log::debug ("connection[TCP] closed, questions: ", questions_, ", from: ",
+		this->address().ip_port());
 	try
 	{
-		this->tcp_send(message);
-		log::debug ("response[TCP]: ", message.size(), " to client: ",
-			this->address().ip_port());
-		this->close(); // done responding
+		this->tcp_connection::close();
 	}
-	catch(net_error &e)
+	catch (std::exception &e)
 	{
-		log::alert ("failed responding[TCP]: ", e.what());
-		this->close();
+		log::warning ("Failed to close[TCP]: ", e.what());
 	}
+	// may drop the last reference, callers keep their own
+	if (const auto lstn = listener_ptr_.lock())
+		lstn->drop (handle_);
 }
 
-in::in (std::weak_ptr<class tcplistener> &&_listener)
-	: network::incoming (std::move (_listener)),
-	network::tcp_connection (*this->listener_ptr())
+void session::update_events() noexcept
 {
-	this->unblock();
-	receive_event_.set (ev::get_default_loop());
-	receive_event_.set<receive_callback>(); // ATTN! clears event_.data
-	receive_event_.data = this; // ATTN! must be set after callback
-	receive_event_.start(this->file_descriptor(), ev::READ );
+	if (closed_)
+		return;
+	const bool can_read = !peer_done_ && pending_ < max_pipelined
+		&& output_.size() < output_limit;
+	const int fd = this->sys_socket().file_descriptor();
+	if (can_read && !read_event_.is_active())
+	{
+		read_event_.start (fd, ev::READ);
+		if (2u <= input_.size())
+			read_event_.feed_event (ev::READ); // questions read before the pause
+	}
+	else if (!can_read)
+		read_event_.stop();
+	if (!output_.empty() && !write_event_.is_active())
+		write_event_.start (fd, ev::WRITE);
+	else if (output_.empty())
+		write_event_.stop();
+	if (peer_done_ && 0u == pending_ && output_.empty())
+		this->close(); // everything answered
 }
 
-void in::receive_callback(ev::io &w, int
-#ifndef NDEBUG
-	revents
-#endif
-)
+void session::read_callback (ev::io &w, int)
 {
-	assert( 0 == (ev::WRITE & revents ) );
-	assert( 0 != (ev::READ & revents) );
-	in *self = reinterpret_cast<in *>(w.data);
-	assert (nullptr != self);
-	self->on_receive();
+	assert (nullptr != w.data);
+	reinterpret_cast <session *> (w.data)->on_read();
 }
 
-void in::on_receive()
+void session::write_callback (ev::io &w, int)
 {
-	try
+	assert (nullptr != w.data);
+	const auto self = reinterpret_cast <session *> (w.data)->shared_from_this();
+	self->on_write();
+}
+
+void session::idle_callback (ev::timer &w, int)
+{
+	assert (nullptr != w.data);
+	const auto self = reinterpret_cast <session *> (w.data)->shared_from_this();
+	self->on_idle();
+}
+
+void session::on_read()
+{
+	// questions answered right away may drop the last reference
+	const auto self = this->shared_from_this();
+	if (!this->take_questions())
+		return;
+	this->update_events();
+	while (!closed_ && read_event_.is_active())
 	{
-		this->tcp_receive(this->modify_message());
-		log::debug ("packet[TCP]: ", this->message().size(), " from: ",
-			this->address().ip_port());
-		this->receive_event_.stop();
-		this->listener_ptr()->create_response(this);
-		// not closing this connection, waiting for response
+		const auto s = input_.free_span();
+		assert (0u < s.size); // a whole message fits
+		const auto want = static_cast <unsigned short> (std::min <std::size_t>
+			(s.size, 0xffffu));
+		const ssize_t n = receive (this->tcp_socket(), s.bytes, want, 0);
+		if (0 > n)
+		{
+			const int err = get_errno();
+			if (!would_block (err))
+			{
+				log::warning (net_error (err, "Failed to receive[TCP] from: "
+					+ this->address().ip_port()).what());
+				this->close();
+			}
+			return;
+		}
+		last_activity_ = read_event_.loop.now();
+		if (0 == n)
+		{
+			// answers to the questions already read are still sent
+			peer_done_ = true;
+			this->update_events();
+			return;
+		}
+		input_.commit (static_cast <std::size_t> (n));
+		if (!this->take_questions())
+			return;
+		this->update_events();
+		if (static_cast <std::size_t> (n) < want)
+			return;
 	}
-	catch(net_error &e)
+}
+
+bool session::take_questions()
+{
+	while (2u <= input_.size() && pending_ < max_pipelined)
 	{
-		log::alert ("Failed to receive incoming request[TCP]: ", e.what());
-		//! @todo: should we try to receive again, depending on the error type?
-		this->close();
+		std::uint8_t prefix[2];
+		input_.peek (0u, prefix, 2u);
+		const unsigned size = (static_cast <unsigned> (prefix[0]) << 8) | prefix[1];
+		if (0u == size)
+		{
+			log::warning ("Zero length question[TCP] from: ",
+				this->address().ip_port());
+			this->close();
+			return false;
+		}
+		if (input_.size() < 2u + size)
+			break;
+		const auto lstn = listener_ptr_.lock();
+		if (!lstn)
+		{
+			this->close();
+			return false;
+		}
+		auto msg = lstn->responder_ptr()->new_packet();
+		const auto sz = static_cast <packet::size_type> (size);
+		// new_packet() reserves enough for the answer as well, do not shrink it
+		if (sz > msg->reserved_size())
+			msg->reserve (sz);
+		input_.peek (2u, msg->modify_bytes(), size);
+		msg->set_size (sz);
+		input_.consume (2u + size);
+		++pending_;
+		++questions_;
+		log::debug ("packet[TCP]: ", size, " from: ", this->address().ip_port());
+		lstn->on_question (this->shared_from_this(), std::move (msg));
+		if (closed_)
+			return false;
 	}
-#ifndef NDEBUG
-	if( this->receive_event_.loop.iteration() > 1000 )
-		throw std::logic_error("DEVELOPMENT LIMIT: too many loop iterations");
-#endif
+	return true;
 }
 
-std::shared_ptr<class tcplistener> in::listener_ptr() const
+void session::reply (const packet &message)
 {
-	assert( !listener_ptr_.expired() );
-	return std::dynamic_pointer_cast< class tcplistener >( listener_ptr_.lock() );
+	if (closed_)
+	{
+		log::debug ("connection[TCP] closed, dropping answer: ", message.size());
+		return;
+	}
+	assert (0u < message.size());
+	const std::uint8_t prefix[2] = {static_cast <std::uint8_t> (message.size() >> 8),
+		static_cast <std::uint8_t> (message.size() & 0xffu)};
+	output_.push (prefix, 2u);
+	output_.push (message.bytes(), message.size());
+	log::debug ("response[TCP]: ", message.size(), " to client: ",
+		this->address().ip_port());
+	if (!write_event_.is_active())
+		this->on_write(); // most answers fit into the socket buffer right away
+}
+
+void session::on_write()
+{
+	while (!closed_ && !output_.empty())
+	{
+		const auto s = output_.data_span();
+		const auto n = send (this->tcp_socket(), s.bytes, static_cast <unsigned short>
+			(std::min <std::size_t> (s.size, 0xffffu)), send_flags);
+		if (0 > n)
+		{
+			const int err = get_errno();
+			if (would_block (err))
+				break;
+			log::alert ("failed responding[TCP]: ", net_error (err, "to: "
+				+ this->address().ip_port()).what());
+			this->close();
+			return;
+		}
+		if (0 == n)
+			break;
+		output_.consume (static_cast <std::size_t> (n));
+		last_activity_ = write_event_.loop.now();
+	}
+	this->update_events();
+}
+
+void session::finished() noexcept
+{
+	assert (0u < pending_);
+	--pending_;
+	this->update_events();
+}
+
+void session::on_idle()
+{
+	// waiting for upstream answers is not idle
+	if (0u < pending_)
+		return;
+	if (idle_.loop.now() - last_activity_ < idle_timeout_)
+		return;
+	log::debug ("connection[TCP] idle, from: ", this->address().ip_port());
+	this->close();
+}
+
+in::in (std::weak_ptr <class tcplistener> &&l, std::shared_ptr <session> &&s,
+	std::unique_ptr <packet> &&m) : network::incoming (std::move (l), std::move (m)),
+	session_ (std::move (s))
+{
+	assert (session_);
+}
+
+void in::respond (const packet &message)
+{
+	session_->reply (message);
+	this->close(); // done responding
+}
+
+void in::close()
+{
+	if (!finished_)
+	{
+		finished_ = true;
+		session_->finished();
+	}
+	this->incoming::close();
 }
 
 } // namespace tcp
@@ -1,8 +1,11 @@
 #include <sstream>
 #include <algorithm>
 #include <chrono>
+#include <array>
 
 #include "network/address.hxx"
+#include "network/net_error.hxx"
+#include "network/preconfig.h"
 #include "network/udp/incoming.hxx"
 #include "network/tcp/incoming.hxx"
 #include "network/udp/listener.hxx"
@@ -20,7 +23,7 @@ abs_listener::abs_listener(std::weak_ptr<network::responder> &&r) : count_(0UL),
 	responder_ptr_(std::move(r)), t0_(std::chrono::high_resolution_clock::now())
 {
 	assert( ! responder_ptr_.expired() );
-	event_.set(ev::get_default_loop());
+	event_.set (responder_ptr_.lock()->event_loop());
 	event_.set<callback>();
 	event_.data = this;
 }
@@ -39,24 +42,7 @@ void abs_listener::on_message()
 		if( rate > 32. )
 			log::notice ("Message rate: ", rate, "/sec, count: ", count_);
 	}
-	//! @todo: code duplication, see dns::responder::collect_garbage
-	if( !requests_.empty() )
-	{
-		// clean up requests
-		std::size_t last = 0;
-		for(std::size_t i=0; i<requests_.size(); ++i)
-		{
-			auto &qreq = requests_[i];
-			if( qreq && qreq->is_closed() )
-			{
-				qreq.reset();
-				requests_.erase(requests_.begin() + static_cast <::ssize_t> (i));
-			}
-			else
-				last = i + 1U;
-		}
-		requests_.resize(last);
-	}
+	this->forget_closed();
 	if (requests_.size() > 8U)
 	{
 		log::debug ("active requests: ", this->requests_.size(), ", capacity: ",
@@ -65,20 +51,20 @@ void abs_listener::on_message()
 	this->make_incoming();
 }
 
-//! @todo replace raw pointer with smart one
-//! @todo pointers are not reliable for comparision, use some sort of id?
-void abs_listener::create_response(incoming *inreq)
+void abs_listener::create_response (std::shared_ptr<incoming> &&req)
 {
-	assert( nullptr != inreq );
-	auto itr = std::find_if(requests_.begin(), requests_.end(),
-		[inreq] (const auto &p) { return &*p == inreq; });
-	if( requests_.end() == itr )
-		throw std::logic_error("Creating response for non-queued incoming request");
-	std::shared_ptr<incoming> req = *itr;
+	assert (req && !req->handle_.valid());
+	req->handle_ = requests_.insert (std::shared_ptr<incoming> (req));
 	assert( ! responder_ptr_.expired() );
 	this->responder_ptr_.lock()->process(std::move(req));
 }
 
+void abs_listener::release (slab_handle h)
+{
+	// kept alive until forget_closed, close is called from its own callbacks
+	retired_.emplace_back (requests_.release (h));
+}
+
 void abs_listener::callback (ev::io &w, int )
 {
 	auto *self = reinterpret_cast<abs_listener *>( w.data );
@@ -87,8 +73,47 @@ void abs_listener::callback (ev::io &w, int )
 
 namespace udp {
 
+#if defined (HAVE_RECVMMSG) && defined (HAVE_SENDMMSG)
+constexpr const unsigned default_batch_size = 32u;
+#else
+constexpr const unsigned default_batch_size = 1u;
+#endif
+
+void batch_histogram::add (unsigned n) noexcept
+{
+	assert (0u < n);
+	unsigned b = 0;
+	while (b + 1u < buckets && (2u << b) <= n)
+		++b;
+	++counts_[b];
+	++batches_;
+	datagrams_ += n;
+}
+
+std::string batch_histogram::to_string() const
+{
+	std::ostringstream ostr;
+	for (unsigned b = 0; b < buckets; ++b)
+	{
+		if (0u < b)
+			ostr << ", ";
+		ostr << (1u << b);
+		if (b + 1u == buckets)
+			ostr << "+";
+		else if (1u < (1u << b))
+			ostr << '-' << ((2u << b) - 1u);
+		ostr << ": " << counts_[b];
+	}
+	return ostr.str();
+}
+
 void udplistener::make_incoming()
 {
+	if (1u < this->batch_size_)
+	{
+		this->receive_batch();
+		return;
+	}
 	// shared_from_this() throws if 'this' is not shared_ptr
 	std::weak_ptr<udplistener> self(this->shared_from_this());
 	assert( !self.expired() );
@@ -96,15 +121,133 @@ void udplistener::make_incoming()
 	std::shared_ptr <incoming> req (new udp::in (std::move(self)));
 	if( !req->is_closed() )
 	{
-		this->requests_.emplace_back( std::move(req) );
 		// UDP, so asking for response from upstream provider
-		this->create_response(&*requests_.back());
+		this->create_response (std::move (req));
 	}
 }
 
+void udplistener::receive_batch()
+{
+	const unsigned n = this->batch_size_;
+	assert (1u < n && n <= max_batch_size);
+	if (this->spare_.size() < n)
+	{
+		const auto r = this->responder_ptr();
+		while (this->spare_.size() < n)
+			this->spare_.emplace_back (r->new_packet());
+	}
+	this->peers_.resize (n);
+	std::array <datagram, max_batch_size> dgs;
+	for (unsigned i = 0; i < n; ++i)
+	{
+		auto &pkt = *this->spare_[i];
+		pkt.set_size (0);
+		assert (0u < pkt.reserved_size());
+		dgs[i] = datagram {pkt.modify_bytes(), pkt.reserved_size(), &this->peers_[i]};
+	}
+	const int nr = receive_many (this->udp_socket(), dgs.data(), n, 0);
+	if (0 >= nr)
+	{
+		const int err = get_errno();
+		if (0 > nr)
+			log::warning (net_error (err, "Failed to receive[UDP]").what());
+		return;
+	}
+	const auto nrecv = static_cast <unsigned> (nr);
+	this->received_.add (nrecv);
+	this->count_extra (nrecv - 1u);
+	std::array <std::unique_ptr <packet>, max_batch_size> batch;
+	std::move (this->spare_.begin(), this->spare_.begin() + nr, batch.begin());
+	this->spare_.erase (this->spare_.begin(), this->spare_.begin() + nr);
+
+	// responses produced synchronously, e.g. from cache or blacklist, are queued
+	this->batching_ = true;
+	try
+	{
+		for (unsigned i = 0; i < nrecv; ++i)
+		{
+			batch[i]->set_size (dgs[i].size);
+			std::weak_ptr<udplistener> self (this->shared_from_this());
+			std::shared_ptr <incoming> req (new udp::in (std::move (self),
+				std::move (batch[i]), std::move (this->peers_[i])));
+			this->create_response (std::move (req));
+		}
+	}
+	catch (...)
+	{
+		this->batching_ = false;
+		this->flush_replies();
+		throw;
+	}
+	this->batching_ = false;
+	this->flush_replies();
+}
+
+void udplistener::udp_reply (const packet &message, const class address &peer,
+	bool owned)
+{
+	if (!this->batching_)
+	{
+		this->udp_send_to (message, peer);
+		return;
+	}
+	this->replies_.emplace_back();
+	auto &r = this->replies_.back();
+	r.peer = peer;
+	if (owned)
+		r.message = &message;
+	else
+	{
+		r.message = nullptr;
+		r.copy = message;
+	}
+}
+
+void udplistener::flush_replies()
+{
+	auto &rs = this->replies_;
+	std::size_t done = 0;
+	while (done < rs.size())
+	{
+		const auto n = static_cast <unsigned> (std::min <std::size_t> (rs.size()
+			- done, max_batch_size));
+		std::array <const_datagram, max_batch_size> dgs;
+		for (unsigned i = 0; i < n; ++i)
+		{
+			const reply &r = rs[done + i];
+			const packet &m = (nullptr == r.message) ? r.copy : *r.message;
+			dgs[i] = const_datagram {m.bytes(), m.size(), &r.peer};
+		}
+		const int ns = send_many (this->udp_socket(), dgs.data(), n, 0);
+		if (0 >= ns)
+		{
+			// skip the failing datagram, send the rest
+			log::alert ("Failed to respond[UDP]: ", net_error (get_errno(),
+				"to: " + rs[done].peer.ip_port()).what());
+			++done;
+		}
+		else
+		{
+			this->sent_.add (static_cast <unsigned> (ns));
+			done += static_cast <std::size_t> (ns);
+		}
+	}
+	rs.clear();
+}
+
+void udplistener::set_batch_size (unsigned n)
+{
+	if (0u == n || max_batch_size < n)
+		throw std::runtime_error ("UDP batch size must be within 1 and "
+			+ std::to_string (max_batch_size));
+	this->batch_size_ = n;
+	log::info ("UDP batch size: ", n);
+}
+
 // see daemon::udp_listener_bind
 udplistener::udplistener(std::weak_ptr<network::responder> &&r,
-	const class address &a) : abs_listener(std::move(r)), udp_connection (a)
+	const class address &a) : abs_listener(std::move(r)), udp_connection (a),
+	batch_size_ (default_batch_size)
 {
 	this->init (true); // do bind
 }
@@ -112,7 +255,7 @@ udplistener::udplistener(std::weak_ptr<network::responder> &&r,
 // Use created and bound systemd socket
 udplistener::udplistener (std::weak_ptr<network::responder> &&r,
 	socket_t &&systemd_bound_socket) : abs_listener (std::move (r)), udp_connection
-	(std::move (systemd_bound_socket))
+	(std::move (systemd_bound_socket)), batch_size_ (default_batch_size)
 {
 	this->init (false); // do not bind
 }
@@ -138,9 +281,34 @@ void tcplistener::make_incoming()
 	// shared_from_this() throws if 'this' is not shared_ptr
 	std::weak_ptr<tcplistener> self(this->shared_from_this());
 	assert( !self.expired() );
-	auto req = std::make_shared<tcp::in> (std::move (self));
-	if( !req->is_closed() )
-		this->requests_.emplace_back( std::move(req) );
+	auto s = std::make_shared <session> (std::move (self), this->idle_timeout_);
+	auto &ref = *s;
+	ref.set_handle (sessions_.insert (std::move (s)));
+}
+
+void tcplistener::drop (slab_handle h) noexcept
+{
+	if (nullptr != sessions_.find (h))
+		sessions_.release (h); // session goes with the returned reference
+}
+
+void tcplistener::on_question (std::shared_ptr <session> &&s,
+	std::unique_ptr <packet> &&message)
+{
+	// the connection is counted by the listener event, further questions here
+	if (1u < s->questions())
+		this->count_extra (1u);
+	this->forget_closed();
+	std::weak_ptr<tcplistener> self (this->shared_from_this());
+	this->create_response (std::make_shared <tcp::in> (std::move (self),
+		std::move (s), std::move (message)));
+}
+
+void tcplistener::set_idle_timeout (double seconds)
+{
+	if (0. >= seconds)
+		throw std::runtime_error ("TCP idle timeout must be positive");
+	this->idle_timeout_ = seconds;
 }
 
 tcplistener::tcplistener (std::weak_ptr<network::responder> &&r,
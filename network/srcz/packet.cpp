@@ -1,6 +1,10 @@
 #include <algorithm>
+#include <atomic>
 #include <type_traits>
 #include <limits>
+#include <cstring>
+#include <utility>
+#include <stdexcept>
 
 #include "network/packet.hxx"
 
@@ -8,47 +12,256 @@ namespace network {
 
 static_assert (std::is_move_constructible <packet>::value, "move");
 static_assert (std::is_move_assignable <packet>::value, "move");
-static_assert (std::is_nothrow_move_constructible <std::vector
-	<std::uint8_t>>::value, "move");
-static_assert (std::is_nothrow_move_assignable <std::vector <std::uint8_t>>::value,
-	"move");
 static_assert (std::is_nothrow_move_constructible <packet>::value, "move");
 static_assert (std::is_nothrow_move_assignable <packet>::value, "move");
+static_assert (packet_pool::capacity (packet_pool::size_class::tcp)
+	> std::numeric_limits <packet::size_type>::max(), "size");
+static_assert (packet_pool::size_class::udp == packet_pool::class_for (512u), "size");
+static_assert (packet_pool::size_class::edns == packet_pool::class_for (513u), "size");
+static_assert (packet_pool::size_class::tcp == packet_pool::class_for (65535u),
+	"size");
 
-void packet::append (const packet &other)
+namespace {
+
+// packets may outlive thread_local pool, e.g. when owned by static objects
+thread_local bool pool_destroyed = false;
+
+std::atomic <std::uint32_t> last_pool_id {0u};
+
+struct pool_holder
+{
+	packet_pool pool;
+	~pool_holder() {pool_destroyed = true;}
+};
+
+} // namespace
+
+packet_pool *packet_pool::local() noexcept
 {
-	const std::size_t new_size = static_cast <std::size_t> (this->size())
-		+ other.size();
-	assert (new_size >= this->size());
-	bytes_.reserve (new_size);
-	assert (bytes_.size() >= this->size());
-	if (bytes_.size() == this->size())
+	if (pool_destroyed)
+		return nullptr;
+	static thread_local pool_holder holder;
+	return &holder.pool;
+}
+
+packet_pool::packet_pool() : id_(++last_pool_id), free_(),
+	max_idle_ {{1024u, 512u, 128u}}, stats_()
+{}
+
+packet_pool::~packet_pool() = default;
+
+packet_pool::buffer packet_pool::acquire (size_class c)
+{
+	const auto jc = static_cast <std::size_t> (c);
+	assert (jc < class_count);
+	auto &st = stats_[jc];
+	auto &fl = free_[jc];
+	++st.in_use;
+	if (!fl.empty())
 	{
-		//! @todo numeric_cast
-		bytes_.insert (bytes_.end(), other.bytes_.cbegin(), other.bytes_.cbegin()
-			+ static_cast <std::ptrdiff_t> (other.size()));
-		assert (bytes_.size() == new_size);
+		buffer result = std::move (fl.back());
+		fl.pop_back();
+		++st.reused;
+		st.idle = fl.size();
+		return result;
 	}
-	else
+	++st.allocated;
+	// default-initialized, not zero-filled
+	return buffer (new std::uint8_t [capacity (c)]);
+}
+
+void packet_pool::release (size_class c, buffer &&b, std::uint32_t issuer) noexcept
+{
+	const auto jc = static_cast <std::size_t> (c);
+	assert (jc < class_count);
+	assert (b);
+	auto &st = stats_[jc];
+	auto &fl = free_[jc];
+	if (id_ != issuer)
+	{
+		++st.freed;
+		b.reset();
+		return;
+	}
+	assert (0u < st.in_use);
+	--st.in_use;
+	if (fl.size() < max_idle_[jc])
 	{
-		assert (bytes_.size() > this->size());
-		const auto sz = std::min (bytes_.size() - this->size(), other.bytes_.size());
-		std::copy_n (other.bytes_.cbegin(), sz, bytes_.begin()
-			+ static_cast <decltype(bytes_)::difference_type> (this->size()));
-		if (other.bytes_.size() > sz)
+		try
 		{
-			bytes_.insert (bytes_.end(), other.bytes_.cbegin()
-				+ static_cast <decltype (bytes_)::difference_type> (sz),
-				other.bytes_.cend());
+			fl.push_back (std::move (b));
+			++st.recycled;
+			st.idle = fl.size();
+			return;
 		}
+		catch (...) {} // bad_alloc, just free the buffer
 	}
-	assert (new_size <= std::numeric_limits <size_type>::max());
-	this->size_ = static_cast <size_type> (new_size);
+	++st.freed;
+	b.reset();
+}
+
+std::uint64_t packet_pool::allocations() const noexcept
+{
+	std::uint64_t result = 0;
+	for (const auto &st : stats_)
+		result += st.allocated;
+	return result;
+}
+
+void packet_pool::set_max_idle (size_class c, std::size_t n)
+{
+	const auto jc = static_cast <std::size_t> (c);
+	if (jc >= class_count)
+		throw std::logic_error ("invalid packet size class");
+	max_idle_[jc] = n;
+	auto &fl = free_[jc];
+	if (fl.size() > n)
+	{
+		stats_[jc].freed += fl.size() - n;
+		fl.resize (n);
+	}
+	fl.reserve (n);
+	stats_[jc].idle = fl.size();
+}
+
+void packet_pool::trim() noexcept
+{
+	for (std::size_t jc = 0; jc < class_count; ++jc)
+	{
+		stats_[jc].freed += free_[jc].size();
+		free_[jc].clear();
+		stats_[jc].idle = 0;
+	}
+}
+
+inline packet_pool::buffer acquire_buffer (packet_pool::size_class c,
+	std::uint32_t &issuer)
+{
+	packet_pool *pool = packet_pool::local();
+	if (nullptr == pool)
+	{
+		issuer = 0U;
+		return packet_pool::buffer (new std::uint8_t [packet_pool::capacity (c)]);
+	}
+	issuer = pool->id();
+	return pool->acquire (c);
+}
+
+void packet::release() noexcept
+{
+	if (bytes_)
+	{
+		packet_pool *pool = packet_pool::local();
+		if (nullptr == pool)
+			bytes_.reset();
+		else
+			pool->release (class_, std::move (bytes_), pool_);
+	}
+	class_ = packet_pool::size_class::none;
+	pool_ = 0U;
+	size_ = reserved_ = 0U;
+}
+
+packet::~packet()
+{
+	this->release();
+}
+
+packet::packet (const std::uint8_t *b, size_type l, size_type r) : packet()
+{
+	this->reserve (std::max (l, r));
+	if (0U < l)
+		std::memcpy (bytes_.get(), b, l);
+	size_ = l;
+}
+
+packet::packet (packet &&other) noexcept : size_(other.size_),
+	reserved_(other.reserved_), class_(other.class_), pool_(other.pool_),
+	bytes_(std::move (other.bytes_))
+{
+	other.size_ = other.reserved_ = 0U;
+	other.class_ = packet_pool::size_class::none;
+	other.pool_ = 0U;
+}
+
+packet &packet::operator= (packet &&other) noexcept
+{
+	if (this != &other)
+	{
+		this->release();
+		size_ = other.size_;
+		reserved_ = other.reserved_;
+		class_ = other.class_;
+		pool_ = other.pool_;
+		bytes_ = std::move (other.bytes_);
+		other.size_ = other.reserved_ = 0U;
+		other.class_ = packet_pool::size_class::none;
+		other.pool_ = 0U;
+	}
+	return *this;
+}
+
+// only the payload is copied, the rest of reserved space is left uninitialized
+packet::packet (const packet &other) : packet (other.bytes(), other.size(),
+	other.reserved_size())
+{}
+
+packet &packet::operator= (const packet &other)
+{
+	if (this != &other)
+	{
+		size_ = 0U;
+		this->reserve (other.reserved_size());
+		if (0U < other.size())
+			std::memcpy (bytes_.get(), other.bytes(), other.size());
+		size_ = other.size();
+	}
+	return *this;
+}
+
+void packet::reserve (size_type s)
+{
+	if (s > this->capacity())
+	{
+		const auto c = packet_pool::class_for (s);
+		std::uint32_t issuer = 0U;
+		packet_pool::buffer b = acquire_buffer (c, issuer);
+		// keep previously reserved content, like std::vector::resize does
+		if (0U < reserved_)
+			std::memcpy (b.get(), bytes_.get(), reserved_);
+		const size_type sz = size_;
+		this->release();
+		bytes_ = std::move (b);
+		class_ = c;
+		pool_ = issuer;
+		size_ = sz;
+	}
+	reserved_ = s;
+	if (size_ > reserved_)
+		size_ = reserved_;
 }
 
 void packet::append (const std::uint8_t *buf, packet::size_type n)
 {
-	this->append (packet (buf, n)); //! @todo inefficient
+	const std::size_t new_size = static_cast <std::size_t> (this->size()) + n;
+	if (new_size > std::numeric_limits <size_type>::max())
+		throw std::length_error ("too large network packet");
+	if (new_size > reserved_)
+		this->reserve (static_cast <size_type> (new_size));
+	if (0U < n)
+		std::memcpy (bytes_.get() + size_, buf, n);
+	this->size_ = static_cast <size_type> (new_size);
+}
+
+void packet::append (const packet &other)
+{
+	if (this == &other)
+	{
+		const packet self (other);
+		this->append (self.bytes(), self.size());
+	}
+	else
+		this->append (other.bytes(), other.size());
 }
 
 } // namespace network
@@ -3,11 +3,31 @@
 
 namespace network {
 
-std::unique_ptr<packet> provider::adapt_message (const std::unique_ptr<packet> &other)
+namespace {
+
+//! weights of the newest sample
+constexpr const double rtt_weight = .2, loss_weight = .1;
+
+} // namespace
+
+void provider::increment_failures() noexcept
+{
+	++failures_;
+	loss_ += loss_weight * (1. - loss_);
+}
+
+void provider::add_answer (double seconds) noexcept
+{
+	rtt_ = (0u == answers_) ? seconds : rtt_ + rtt_weight * (seconds - rtt_);
+	loss_ -= loss_weight * loss_;
+	++answers_;
+}
+
+std::unique_ptr<packet> provider::adapt_message (std::unique_ptr<packet> &&other)
 	const
 {
 	assert (other);
-	return other->clone();
+	return std::move (other);
 }
 
 }
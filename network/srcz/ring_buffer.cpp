@@ -0,0 +1,81 @@
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include "network/ring_buffer.hxx"
+
+namespace network {
+
+ring_buffer::ring_buffer (std::size_t capacity) : capacity_ (capacity)
+{
+	if (0u == capacity_)
+		throw std::logic_error ("empty ring buffer");
+	bytes_.reset (new std::uint8_t[capacity_]);
+}
+
+ring_buffer::span ring_buffer::free_span() noexcept
+{
+	const std::size_t tail = (head_ + size_) % capacity_;
+	const std::size_t n = (tail < head_ || (tail == head_ && 0u < size_))
+		? head_ - tail : capacity_ - tail;
+	return span {bytes_.get() + tail, std::min (n, this->room())};
+}
+
+void ring_buffer::commit (std::size_t n) noexcept
+{
+	assert (n <= this->room());
+	size_ += n;
+}
+
+ring_buffer::span ring_buffer::data_span() noexcept
+{
+	return span {bytes_.get() + head_, std::min (size_, capacity_ - head_)};
+}
+
+void ring_buffer::consume (std::size_t n) noexcept
+{
+	assert (n <= size_);
+	size_ -= n;
+	head_ = (0u == size_) ? 0u : (head_ + n) % capacity_;
+}
+
+void ring_buffer::peek (std::size_t offset, std::uint8_t *out, std::size_t n) const
+	noexcept
+{
+	assert (offset + n <= size_);
+	const std::size_t from = (head_ + offset) % capacity_;
+	const std::size_t first = std::min (n, capacity_ - from);
+	std::memcpy (out, bytes_.get() + from, first);
+	std::memcpy (out + first, bytes_.get(), n - first);
+}
+
+void ring_buffer::push (const std::uint8_t *bytes, std::size_t n)
+{
+	if (this->room() < n)
+		this->grow (size_ + n);
+	while (0u < n)
+	{
+		const auto s = this->free_span();
+		assert (0u < s.size);
+		const std::size_t k = std::min (n, s.size);
+		std::memcpy (s.bytes, bytes, k);
+		this->commit (k);
+		bytes += k;
+		n -= k;
+	}
+}
+
+void ring_buffer::grow (std::size_t min_capacity)
+{
+	std::size_t c = capacity_;
+	while (c < min_capacity)
+		c *= 2u;
+	std::unique_ptr <std::uint8_t[]> b (new std::uint8_t[c]);
+	this->peek (0u, b.get(), size_);
+	bytes_ = std::move (b);
+	capacity_ = c;
+	head_ = 0;
+}
+
+} // namespace network
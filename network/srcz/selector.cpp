@@ -0,0 +1,47 @@
+#include <cassert>
+#include <stdexcept>
+
+#include "network/selector.hxx"
+#include "network/provider.hxx"
+
+namespace network {
+
+provider_selector::provider_selector (double penalty) : penalty_ (penalty),
+	random_ (std::random_device{}())
+{
+	this->set_penalty (penalty);
+}
+
+void provider_selector::set_penalty (double seconds)
+{
+	if (!(0. < seconds))
+		throw std::logic_error ("Provider loss penalty must be positive");
+	penalty_ = seconds;
+}
+
+double provider_selector::cost (const provider &p) const noexcept
+{
+	return p.rtt() + p.loss() * penalty_;
+}
+
+std::size_t provider_selector::pick (const std::vector <std::shared_ptr <provider>>
+	&providers)
+{
+	const std::size_t n = providers.size();
+	if (0u == n)
+		throw std::logic_error ("No providers to choose from");
+	if (1u == n)
+		return 0;
+	std::uniform_int_distribution <std::size_t> any (0, n - 1u);
+	const std::size_t a = any (random_);
+	if (std::bernoulli_distribution (explore) (random_))
+		return a;
+	// second candidate differs from the first
+	std::size_t b = std::uniform_int_distribution <std::size_t> (0, n - 2u) (random_);
+	if (a <= b)
+		++b;
+	assert (providers[a] && providers[b]);
+	return (this->cost (*providers[b]) < this->cost (*providers[a])) ? b : a;
+}
+
+} // namespace network
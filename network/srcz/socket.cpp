@@ -1,5 +1,8 @@
 #include <string>
 #include <cassert>
+#include <cstring>
+#include <array>
+#include <algorithm>
 
 #include "network/socket.hxx"
 #include "network/address.hxx"
@@ -369,6 +372,27 @@ ssize_t send_to (const socket <proto::udp> &s, const std::uint8_t *msg,
 		msglen, flags, a.addr(), a.len());
 }
 
+ssize_t send (const socket <proto::udp> &s, const std::uint8_t *msg,
+	unsigned short msglen, int flags)
+{
+	assert (0u < msglen);
+	assert (detail::is_valid (detail::c_cast (s).socket_));
+	return ::send (detail::c_cast (s).socket_,
+#ifdef _WIN32
+		reinterpret_cast <const char*> (msg),
+#else
+		msg,
+#endif
+		msglen, flags);
+}
+
+void connect (const socket <proto::udp> &s, const address &a)
+{
+	assert (detail::is_valid (detail::c_cast (s).socket_));
+	if (0 != ::connect (detail::c_cast (s).socket_, a.addr(), a.len()))
+		throw net_error (get_errno(), "Failed to connect[UDP] to " + a.ip_port());
+}
+
 ssize_t receive_from (const socket <proto::udp> &s, std::uint8_t *buf,
 	unsigned short bufsize, int flags, address *_address)
 {
@@ -393,6 +417,120 @@ ssize_t receive_from (const socket <proto::udp> &s, std::uint8_t *buf,
 	}
 	return n;
 }
+
+#if defined (HAVE_RECVMMSG) && defined (HAVE_SENDMMSG)
+
+int receive_many (const socket <proto::udp> &s, datagram *dgs, unsigned n,
+	int flags)
+{
+	assert (0u < n);
+	assert (detail::is_valid (detail::c_cast (s).socket_));
+	n = std::min (n, max_batch_size);
+	std::array <struct ::mmsghdr, max_batch_size> hdrs;
+	std::array <struct ::iovec, max_batch_size> iovs;
+	std::array <struct sockaddr_storage, max_batch_size> peers;
+	for (unsigned i = 0; i < n; ++i)
+	{
+		assert (0u < dgs[i].size);
+		iovs[i].iov_base = dgs[i].bytes;
+		iovs[i].iov_len = dgs[i].size;
+		std::memset (&hdrs[i], 0, sizeof hdrs[i]);
+		hdrs[i].msg_hdr.msg_name = &peers[i];
+		hdrs[i].msg_hdr.msg_namelen = sizeof peers[i];
+		hdrs[i].msg_hdr.msg_iov = &iovs[i];
+		hdrs[i].msg_hdr.msg_iovlen = 1;
+	}
+	const int r = ::recvmmsg (detail::c_cast (s).socket_, hdrs.data(), n, flags,
+		nullptr);
+	for (int i = 0; i < r; ++i)
+	{
+		const auto &h = hdrs[static_cast <unsigned> (i)];
+		auto &dg = dgs[i];
+		assert (h.msg_len <= dg.size);
+		dg.size = static_cast <unsigned short> (h.msg_len);
+		if (nullptr != dg.peer)
+		{
+			if (0 < h.msg_hdr.msg_namelen)
+				*dg.peer = address (static_cast <const sockaddr_storage*>
+					(h.msg_hdr.msg_name), static_cast <unsigned short>
+						(h.msg_hdr.msg_namelen));
+			else
+				throw std::logic_error ("UDP address not received");
+		}
+	}
+	return r;
+}
+
+int send_many (const socket <proto::udp> &s, const const_datagram *dgs, unsigned n,
+	int flags)
+{
+	assert (0u < n);
+	assert (detail::is_valid (detail::c_cast (s).socket_));
+	n = std::min (n, max_batch_size);
+	std::array <struct ::mmsghdr, max_batch_size> hdrs;
+	std::array <struct ::iovec, max_batch_size> iovs;
+	for (unsigned i = 0; i < n; ++i)
+	{
+		assert (0u < dgs[i].size);
+		iovs[i].iov_base = const_cast <std::uint8_t*> (dgs[i].bytes);
+		iovs[i].iov_len = dgs[i].size;
+		std::memset (&hdrs[i], 0, sizeof hdrs[i]);
+		if (nullptr != dgs[i].peer)
+		{
+			hdrs[i].msg_hdr.msg_name = const_cast <sockaddr*> (dgs[i].peer->addr());
+			hdrs[i].msg_hdr.msg_namelen = dgs[i].peer->len();
+		}
+		hdrs[i].msg_hdr.msg_iov = &iovs[i];
+		hdrs[i].msg_hdr.msg_iovlen = 1;
+	}
+	return ::sendmmsg (detail::c_cast (s).socket_, hdrs.data(), n, flags);
+}
+
+#else // one system call per datagram
+
+int receive_many (const socket <proto::udp> &s, datagram *dgs, unsigned n,
+	int flags)
+{
+	assert (0u < n);
+	n = std::min (n, max_batch_size);
+	unsigned i = 0;
+	for (; i < n; ++i)
+	{
+		const ssize_t r = receive_from (s, dgs[i].bytes, dgs[i].size, flags,
+			dgs[i].peer);
+		if (0 >= r)
+		{
+			if (0u == i)
+				return static_cast <int> (r);
+			break;
+		}
+		dgs[i].size = static_cast <unsigned short> (r);
+	}
+	return static_cast <int> (i);
+}
+
+int send_many (const socket <proto::udp> &s, const const_datagram *dgs, unsigned n,
+	int flags)
+{
+	assert (0u < n);
+	n = std::min (n, max_batch_size);
+	unsigned i = 0;
+	for (; i < n; ++i)
+	{
+		const ssize_t r = (nullptr == dgs[i].peer) ? send (s, dgs[i].bytes,
+			dgs[i].size, flags) : send_to (s, dgs[i].bytes, dgs[i].size, flags,
+				*dgs[i].peer);
+		if (0 >= r)
+		{
+			if (0u == i)
+				return -1;
+			break;
+		}
+	}
+	return static_cast <int> (i);
+}
+
+#endif
 } // namespace network::udp
 
 namespace tcp
@@ -0,0 +1,94 @@
+#undef NDEBUG
+#include <cassert>
+#include <iostream>
+#include <cstring>
+#include <array>
+
+#include "network/socket.hxx"
+#include "network/net_error.hxx"
+#include "network/address.hxx"
+#include "network/udp/listener.hxx"
+#include "backtrace/catch.hxx"
+
+using network::udp::datagram;
+using network::udp::const_datagram;
+
+void histogram_run()
+{
+	network::udp::batch_histogram h;
+	for (unsigned n : {1u, 2u, 3u, 4u, 63u, 64u, 200u})
+		h.add (n);
+	assert (7u == h.batches());
+	assert (337u == h.datagrams());
+	assert (1u == h.count (0));
+	assert (2u == h.count (1));
+	assert (1u == h.count (2));
+	assert (1u == h.count (5));
+	assert (2u == h.count (6));
+	std::cout << "Histogram: " << h.to_string() << std::endl;
+	assert ("1: 1, 2-3: 2, 4-7: 1, 8-15: 0, 16-31: 0, 32-63: 1, 64+: 2"
+		== h.to_string());
+}
+
+void loopback_run()
+{
+	network::socket <network::proto::udp> rsock (network::inet::ipv4);
+	network::socket <network::proto::udp> ssock (network::inet::ipv4);
+	network::bind_listener (rsock, network::address ("127.0.0.1", 0));
+	network::bind_listener (ssock, network::address ("127.0.0.1", 0));
+	const network::address raddr = rsock.get_address();
+	const network::address saddr = ssock.get_address();
+	std::cout << "UDP receiver: " << raddr.ip_port() << ", sender: "
+		<< saddr.ip_port() << std::endl;
+
+	constexpr const unsigned n = 5u;
+	std::array <std::array <std::uint8_t, 64u>, n> out, in;
+	std::array <const_datagram, n> sent;
+	for (unsigned i = 0; i < n; ++i)
+	{
+		std::memset (out[i].data(), static_cast <int> ('a' + i), out[i].size());
+		sent[i] = const_datagram {out[i].data(), static_cast <unsigned short> (10u + i),
+			&raddr};
+	}
+	const int ns = network::udp::send_many (ssock, sent.data(), n, 0);
+	std::cout << "Sent: " << ns << std::endl;
+	assert (static_cast <int> (n) == ns);
+
+	rsock.unblock();
+	std::array <network::address, n + 1u> peers;
+	std::array <datagram, n + 1u> recvd;
+	std::array <std::uint8_t, 64u> extra;
+	for (unsigned i = 0; i < n; ++i)
+		recvd[i] = datagram {in[i].data(), 64u, &peers[i]};
+	recvd[n] = datagram {extra.data(), 64u, &peers[n]};
+	int nr = 0;
+	// loopback delivery is immediate, but be tolerant to partial batches
+	for (unsigned tries = 0; nr < static_cast <int> (n) && tries < 1000u; ++tries)
+	{
+		const int r = network::udp::receive_many (rsock, recvd.data() + nr,
+			n + 1u - static_cast <unsigned> (nr), 0);
+		if (0 < r)
+			nr += r;
+	}
+	std::cout << "Received: " << nr << std::endl;
+	assert (static_cast <int> (n) == nr);
+	for (unsigned i = 0; i < n; ++i)
+	{
+		assert (10u + i == recvd[i].size);
+		assert ('a' + i == in[i][0]);
+		assert (peers[i] == saddr);
+	}
+	// nothing left, non-blocking socket
+	assert (0 > network::udp::receive_many (rsock, recvd.data(), 1u, 0));
+}
+
+void run()
+{
+	histogram_run();
+	loopback_run();
+}
+
+int main()
+{
+	return trace::catch_all_errors (run);
+}
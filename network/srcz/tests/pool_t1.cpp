@@ -0,0 +1,81 @@
+#undef NDEBUG
+#include <cassert>
+#include <memory>
+#include <thread>
+
+#include "network/packet.hxx"
+#include "backtrace/catch.hxx"
+
+using network::packet;
+using network::packet_pool;
+
+void run()
+{
+	packet_pool *pool = packet_pool::local();
+	assert (nullptr != pool);
+	const std::uint8_t buf[600] = {1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16};
+	{
+		packet pkt (buf, 16);
+		assert (16 == pkt.size());
+		assert (1 == pool->stats (packet_pool::size_class::udp).in_use);
+		pkt.reserve (600);
+		assert (600 == pkt.reserved_size());
+		assert (16 == pkt.size());
+		assert (13 == pkt.bytes()[12]);
+		assert (0 == pool->stats (packet_pool::size_class::udp).in_use);
+		assert (1 == pool->stats (packet_pool::size_class::edns).in_use);
+		pkt.reserve (60000);
+		assert (9 == pkt.bytes()[8]);
+		assert (1 == pool->stats (packet_pool::size_class::tcp).in_use);
+	}
+	for (const auto c : {packet_pool::size_class::udp, packet_pool::size_class::edns,
+		packet_pool::size_class::tcp})
+	{
+		assert (0 == pool->stats (c).in_use);
+		assert (1 == pool->stats (c).idle);
+	}
+	// steady state: no more heap allocations
+	auto nalloc = pool->allocations();
+	for (unsigned j = 0; j < 1000; ++j)
+	{
+		if (1 == j) // after warm-up
+			nalloc = pool->allocations();
+		packet big (buf, 16, 60000);
+		packet copy (big);
+		assert (60000 == copy.reserved_size());
+		assert (16 == copy.size());
+		assert (16 == copy.bytes()[15]);
+		packet moved (std::move (copy));
+		assert (0 == copy.reserved_size());
+		assert (nullptr == copy.bytes());
+		auto cln = moved.clone();
+		cln->append (buf, 100);
+		assert (116 == cln->size());
+		packet small (buf, sizeof buf);
+		small = moved;
+		assert (60000 == small.reserved_size());
+	}
+	assert (nalloc == pool->allocations());
+	assert (0 == pool->stats (packet_pool::size_class::tcp).in_use);
+	pool->trim();
+	assert (0 == pool->stats (packet_pool::size_class::tcp).idle);
+	// buffers of another thread are not taken into this pool
+	std::unique_ptr <packet> foreign;
+	std::thread other ([&foreign, &buf]
+	{
+		foreign = std::make_unique <packet> (buf, 16);
+		assert (1 == packet_pool::local()->stats (packet_pool::size_class::udp).in_use);
+	});
+	other.join();
+	const auto &st = pool->stats (packet_pool::size_class::udp);
+	const auto freed = st.freed, idle = st.idle;
+	foreign.reset();
+	assert (freed + 1 == st.freed);
+	assert (idle == st.idle);
+	assert (0 == st.in_use);
+}
+
+int main()
+{
+	return trace::catch_all_errors (run);
+}
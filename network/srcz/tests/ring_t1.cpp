@@ -0,0 +1,51 @@
+#undef NDEBUG
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "network/ring_buffer.hxx"
+#include "backtrace/catch.hxx"
+
+using network::ring_buffer;
+
+void run()
+{
+	ring_buffer r (8u);
+	assert (r.empty() && 8u == r.room());
+	const std::uint8_t abc[] = {'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j'};
+	r.push (abc, 6u);
+	assert (6u == r.size() && 2u == r.room());
+	r.consume (4u);
+	// free space wraps: 2 bytes at the end, then 4 at the front
+	auto f = r.free_span();
+	assert (2u == f.size);
+	std::memcpy (f.bytes, abc + 6, 2u);
+	r.commit (2u);
+	f = r.free_span();
+	assert (4u == f.size);
+	r.push (abc, 3u);
+	assert (7u == r.size());
+	std::uint8_t out[16] = {0};
+	r.peek (0u, out, 7u);
+	assert (0 == std::memcmp (out, "efghabc", 7u));
+	// data wraps too
+	auto d = r.data_span();
+	assert (4u == d.size && 'e' == d.bytes[0]);
+	r.consume (d.size);
+	d = r.data_span();
+	assert (3u == d.size && 'a' == d.bytes[0]);
+	// growing keeps order
+	r.push (abc, 10u);
+	assert (13u == r.size() && 16u == r.capacity());
+	r.peek (0u, out, 13u);
+	assert (0 == std::memcmp (out, "abcabcdefghij", 13u));
+	r.consume (13u);
+	assert (r.empty() && 16u == r.free_span().size);
+	std::cout << "ring buffer capacity: " << r.capacity() << std::endl;
+}
+
+int main()
+{
+	return trace::catch_all_errors (run);
+}
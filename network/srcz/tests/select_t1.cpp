@@ -0,0 +1,58 @@
+#undef NDEBUG
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "network/selector.hxx"
+#include "network/provider.hxx"
+#include "network/address.hxx"
+#include "backtrace/catch.hxx"
+
+using network::provider;
+
+void run()
+{
+	std::vector <std::shared_ptr <provider>> ps;
+	for (unsigned short port = 53; port < 56; ++port)
+		ps.emplace_back (std::make_shared <provider> (network::address ("127.0.0.1",
+			port), network::proto::udp));
+	// smoothed answer time and loss
+	ps[0]->add_answer (0.005);
+	assert (std::abs (ps[0]->rtt() - 0.005) < 1e-9 && ps[0]->loss() <= 0.);
+	for (unsigned i = 0; i < 20u; ++i)
+		ps[1]->add_answer (0.2);
+	ps[1]->add_answer (1.2);
+	assert (0.2 < ps[1]->rtt() && ps[1]->rtt() < 0.5);
+	ps[2]->add_answer (0.005);
+	for (unsigned i = 0; i < 5u; ++i)
+		ps[2]->increment_failures(); // lost questions cost the timeout
+	assert (0.3 < ps[2]->loss() && ps[2]->loss() < 1. && 5u == ps[2]->failures());
+
+	network::provider_selector sel (7.5);
+	assert (sel.cost (*ps[0]) < sel.cost (*ps[1]) && sel.cost (*ps[1])
+		< sel.cost (*ps[2]));
+	std::vector <unsigned> picks (ps.size(), 0u);
+	constexpr const unsigned n = 30000u;
+	for (unsigned i = 0; i < n; ++i)
+		++picks.at (sel.pick (ps));
+	std::cout << "picks: " << picks[0] << ' ' << picks[1] << ' ' << picks[2]
+		<< std::endl;
+	// the best wins whenever it is a candidate, the worst only when exploring
+	assert (picks[0] > n * 6u / 10u);
+	assert (0u < picks[2] && picks[2] < n * 3u / 100u);
+	assert (picks[1] > picks[2]);
+
+	// unmeasured providers are tried first
+	ps.emplace_back (std::make_shared <provider> (network::address ("127.0.0.2", 53),
+		network::proto::udp));
+	assert (sel.cost (*ps.back()) <= 0.);
+	std::vector <std::shared_ptr <provider>> one (1u, ps[1]);
+	assert (0u == sel.pick (one));
+}
+
+int main()
+{
+	return trace::catch_all_errors (run);
+}
@@ -0,0 +1,57 @@
+#undef NDEBUG
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "network/slab.hxx"
+#include "backtrace/catch.hxx"
+
+using network::slab;
+using network::slab_handle;
+
+void run()
+{
+	slab <std::unique_ptr <int>> s;
+	assert (s.empty() && !slab_handle().valid());
+	std::vector <slab_handle> hs;
+	for (int i = 0; i < 100; ++i)
+		hs.emplace_back (s.insert (std::make_unique <int> (i)));
+	assert (100u == s.size() && 100u == s.capacity());
+	assert (nullptr != s.find (hs[42]) && 42 == **s.find (hs[42]));
+	// released in any order, the value is moved out
+	auto v = s.release (hs[42]);
+	assert (v && 42 == *v && 99u == s.size());
+	assert (nullptr == s.find (hs[42]));
+	bool thrown = false;
+	try
+	{
+		s.release (hs[42]);
+	}
+	catch (std::logic_error &)
+	{
+		thrown = true;
+	}
+	assert (thrown);
+	// the slot is reused, the stale handle does not see the new value
+	const auto h = s.insert (std::make_unique <int> (1000));
+	assert (42u == h.index && hs[42].generation != h.generation);
+	assert (nullptr == s.find (hs[42]) && 1000 == **s.find (h));
+	assert (100u == s.capacity());
+	for (int i = 0; i < 100; ++i)
+		if (42 != i)
+			s.release (hs[static_cast <std::size_t> (i)]);
+	std::size_t n = 0;
+	s.for_each ([&n] (const std::unique_ptr <int> &p) {assert (1000 == *p); ++n;});
+	assert (1u == n && 1u == s.size());
+	s.release (h);
+	assert (s.empty() && 100u == s.capacity());
+	assert (nullptr == s.find (slab_handle()));
+	std::cout << "slab capacity: " << s.capacity() << std::endl;
+}
+
+int main()
+{
+	return trace::catch_all_errors (run);
+}
@@ -0,0 +1,213 @@
+#undef NDEBUG
+#include <cassert>
+#include <iostream>
+#include <cstring>
+#include <vector>
+#include <memory>
+
+#include <ev++.h>
+
+#include "network/socket.hxx"
+#include "network/net_error.hxx"
+#include "network/address.hxx"
+#include "network/tcp/upstream.hxx"
+#include "backtrace/catch.hxx"
+
+using network::tcp::pool;
+
+namespace {
+
+//! Collects pipelined questions, answers them in reverse order,
+//! or closes the connection without answers
+struct server
+{
+	network::tcp::socket_t listener {network::inet::ipv4};
+	std::vector <std::pair <network::tcp::socket_t, network::address>> conns;
+	std::vector <std::uint8_t> input;
+	unsigned expected = 0, answered = 0;
+	bool hang_up = false;
+	ev::io accept_event, read_event;
+
+	server()
+	{
+		network::bind_listener (listener, network::address ("127.0.0.1", 0));
+		network::tcp::listen (listener, 8);
+		accept_event.set <server, &server::on_accept> (this);
+		accept_event.start (listener.file_descriptor(), ev::READ);
+	}
+
+	void on_accept (ev::io &, int)
+	{
+		conns.emplace_back (network::tcp::accept_new (listener));
+		input.clear();
+		read_event.stop();
+		read_event.set <server, &server::on_read> (this);
+		read_event.start (conns.back().first.file_descriptor(), ev::READ);
+	}
+
+	void on_read (ev::io &w, int)
+	{
+		std::uint8_t buf[512];
+		const auto n = network::tcp::receive (conns.back().first, buf, sizeof (buf), 0);
+		if (0 >= n)
+		{
+			w.stop();
+			return;
+		}
+		input.insert (input.end(), buf, buf + n);
+		std::vector <std::pair <std::size_t, std::size_t>> frames;
+		for (std::size_t pos = 0; pos + 2u <= input.size();)
+		{
+			const std::size_t sz = (std::size_t (input[pos]) << 8) | input[pos + 1];
+			if (pos + 2u + sz > input.size())
+				return;
+			frames.emplace_back (pos, 2u + sz);
+			pos += 2u + sz;
+		}
+		if (frames.size() < expected)
+			return;
+		w.stop();
+		if (hang_up)
+		{
+			hang_up = false;
+			conns.back().first.close();
+			return;
+		}
+		for (auto it = frames.rbegin(); it != frames.rend(); ++it)
+		{
+			const auto sent = network::tcp::send (conns.back().first, input.data()
+				+ it->first, static_cast <unsigned short> (it->second), 0);
+			assert (static_cast <ssize_t> (it->second) == sent);
+			++answered;
+		}
+		input.clear();
+		read_event.start (conns.back().first.file_descriptor(), ev::READ);
+	}
+};
+
+class question : public network::tcp::upstream
+{
+public:
+
+	question (ev::loop_ref loop, const std::shared_ptr <network::provider> &p,
+		std::uint8_t id, std::uint8_t fill) : network::tcp::upstream (loop,
+		std::shared_ptr <network::provider> (p), make_packet (id, fill), 2.)
+	{
+		++outstanding;
+	}
+
+	// the test server keeps the loop running
+	void pass_answer_downstream() override
+	{
+		done = true;
+		if (0u == --outstanding)
+			this->event_loop().break_loop (ev::ALL);
+	}
+
+	static unsigned outstanding;
+
+	bool done = false;
+
+private:
+
+	static std::unique_ptr <network::packet> make_packet (std::uint8_t id,
+		std::uint8_t fill)
+	{
+		std::uint8_t q[20];
+		std::memset (q, fill, sizeof (q));
+		q[0] = 0;
+		q[1] = id;
+		return std::make_unique <network::packet> (q, sizeof (q));
+	}
+};
+
+unsigned question::outstanding = 0;
+
+void check_answer (const question &q, std::uint8_t id, std::uint8_t fill)
+{
+	assert (q.done);
+	assert (!q.is_active());
+	assert (20u == q.message().size());
+	assert (0u == q.message().bytes()[0]);
+	assert (id == q.message().bytes()[1]); // original ID restored
+	assert (fill == q.message().bytes()[19]);
+}
+
+void pipeline_run()
+{
+	auto loop = ev::get_default_loop();
+	server srv;
+	srv.expected = 3u;
+	auto prov = std::make_shared <network::provider> (srv.listener.get_address(),
+		network::proto::tcp);
+	// the same DNS ID three times, replaced on the connection
+	auto q1 = std::make_unique <question> (loop, prov, 7u, 'a');
+	auto q2 = std::make_unique <question> (loop, prov, 7u, 'b');
+	auto q3 = std::make_unique <question> (loop, prov, 7u, 'c');
+	assert (&q1->tcp_channel() == &q2->tcp_channel());
+	assert (&q1->tcp_channel() == &q3->tcp_channel());
+	loop.run();
+	check_answer (*q1, 7u, 'a');
+	check_answer (*q2, 7u, 'b');
+	check_answer (*q3, 7u, 'c');
+	assert (3u == srv.answered);
+	assert (1u == srv.conns.size());
+	auto st = pool::local (loop, *prov).stats();
+	std::cout << "TCP opened: " << st.opened << ", sent: " << st.sent
+		<< ", reused: " << st.reused << ", answered: " << st.answered << std::endl;
+	assert (1u == st.opened && 3u == st.sent && 2u == st.reused);
+	assert (3u == st.answered && 0u == st.unmatched);
+
+	// connection is kept open, closed by peer, and the question is sent again
+	srv.expected = 1u;
+	srv.hang_up = true;
+	auto q4 = std::make_unique <question> (loop, prov, 9u, 'd');
+	assert (&q1->tcp_channel() == &q4->tcp_channel());
+	loop.run();
+	check_answer (*q4, 9u, 'd');
+	assert (2u == srv.conns.size());
+	st = pool::local (loop, *prov).stats();
+	assert (2u == st.opened && 1u == st.retried && 0u == st.failed);
+}
+
+void backoff_run()
+{
+	auto loop = ev::get_default_loop();
+	network::address closed_addr;
+	{
+		network::tcp::socket_t s {network::inet::ipv4};
+		network::bind_listener (s, network::address ("127.0.0.1", 0));
+		closed_addr = s.get_address(); // nobody listens on it
+	}
+	auto prov = std::make_shared <network::provider> (closed_addr,
+		network::proto::tcp);
+	auto q = std::make_unique <question> (loop, prov, 1u, 'x');
+	loop.run();
+	assert (!q->done && !q->is_active());
+	const auto &st = pool::local (loop, *prov).stats();
+	assert (1u == st.connect_failures);
+	bool thrown = false;
+	try
+	{
+		question q2 (loop, prov, 2u, 'y');
+	}
+	catch (network::net_error &e)
+	{
+		std::cout << "Backoff: " << e.what() << std::endl;
+		thrown = true;
+	}
+	assert (thrown);
+}
+
+void run()
+{
+	pipeline_run();
+	backoff_run();
+}
+
+} // namespace
+
+int main()
+{
+	return trace::catch_all_errors (run);
+}
@@ -0,0 +1,84 @@
+#undef NDEBUG
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <ev++.h>
+
+#include "network/timer_wheel.hxx"
+#include "backtrace/catch.hxx"
+
+using network::timer_wheel;
+
+namespace {
+
+struct job
+{
+	job (ev::loop_ref l, double s) : entry (&expired, this), loop (l), seconds (s),
+		start (l.now())
+	{}
+
+	static void expired (timer_wheel::entry &e)
+	{
+		auto &j = *reinterpret_cast <job *> (e.data);
+		const double late = j.loop.now() - j.start - j.seconds;
+		// never early, at most a tick or so late
+		assert (-1e-6 < late && late < 3. * timer_wheel::tick + 0.05);
+		++j.fired;
+	}
+
+	timer_wheel::entry entry;
+	ev::loop_ref loop;
+	double seconds;
+	ev::tstamp start;
+	unsigned fired = 0;
+};
+
+} // namespace
+
+void run()
+{
+	ev::dynamic_loop loop (ev::AUTO);
+	auto &wheel = timer_wheel::local (loop);
+	assert (&wheel == &timer_wheel::local (loop));
+	std::vector <std::unique_ptr <job>> jobs;
+	for (unsigned i = 0; i < 200u; ++i)
+		jobs.emplace_back (std::make_unique <job> (loop, 0.01 + 0.002 * (i % 100u)));
+	jobs.emplace_back (std::make_unique <job> (loop, 1.2)); // above the bottom level
+	jobs.emplace_back (std::make_unique <job> (loop, 3600.)); // cancelled below
+	for (auto &j : jobs)
+		wheel.arm (j->entry, j->seconds);
+	assert (jobs.size() == wheel.size());
+	// cancelled and destroyed ones never fire
+	for (unsigned i = 0; i < 200u; i += 2u)
+		jobs[i]->entry.cancel();
+	jobs[1].reset();
+	jobs.back()->entry.cancel();
+	assert (99u + 1u == wheel.size());
+	// re-arming moves the deadline
+	jobs[3]->seconds = 0.5;
+	wheel.arm (jobs[3]->entry, jobs[3]->seconds);
+	assert (100u == wheel.size());
+	// the loop ends when nothing is armed
+	loop.run();
+	assert (0u == wheel.size());
+	unsigned fired = 0;
+	for (unsigned i = 0; i < jobs.size(); ++i)
+	{
+		if (!jobs[i])
+			continue;
+		const bool expect = (1u == i % 2u && i < 200u) || 200u == i;
+		assert ((expect ? 1u : 0u) == jobs[i]->fired);
+		fired += jobs[i]->fired;
+	}
+	assert (100u == fired);
+	const auto &d = wheel.deadlines();
+	assert (100u == d.expired() && 202u == d.total());
+	std::cout << "deadlines: " << d.to_string() << std::endl;
+}
+
+int main()
+{
+	return trace::catch_all_errors (run);
+}
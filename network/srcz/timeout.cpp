@@ -6,28 +6,23 @@
 
 namespace network {
 
-void timeout::callback (ev::timer &w, int)
+void timeout::callback (timer_wheel::entry &e)
 {
-	process::log::debug ("timeout, at: ", w.at, ", repeat: ", w.repeat,
-		", remaining: ", w.remaining());
-	reinterpret_cast<timeout *>( w.data )->close();
-	w.stop();
-	assert( !w.is_active() );
+	process::log::debug ("timeout, at: ", reinterpret_cast<timeout *>( e.data )
+		->loop_.now());
+	assert( !e.is_armed() );
+	reinterpret_cast<timeout *>( e.data )->expired();
 }
 
-timeout::timeout(double secs)
+timeout::timeout (ev::loop_ref loop, double secs) : loop_ (loop),
+	entry_ (&callback, this)
 {
 	if( 1.E-6 > secs )
 		throw std::logic_error ("Too low timeout: " + std::to_string(secs)
 			+ " seconds");
 	// simple non-repeating timeout
-	timeout_.set(ev::get_default_loop());
-	timeout_.set<callback>();
-	timeout_.data = this; // ATTN! must be set after callback
-	ev::tstamp after = secs; // seconds
-	timeout_.set(after);
-	timeout_.start();
-	assert( timeout_.is_active() );
+	timer_wheel::local (loop).arm (entry_, secs);
+	assert( entry_.is_armed() );
 }
 
 }
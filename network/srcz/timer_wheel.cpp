@@ -0,0 +1,318 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <vector>
+#include <sstream>
+#include <exception>
+#include <stdexcept>
+
+#include "network/timer_wheel.hxx"
+#include "sys/logger.hxx"
+
+namespace network {
+
+namespace log = process::log;
+
+namespace {
+
+constexpr const std::uint64_t slot_mask = timer_wheel::slots - 1u;
+
+//! ticks reachable by the top level, later deadlines wait in its last slot
+constexpr const std::uint64_t span = std::uint64_t {1} << (timer_wheel::slot_bits
+	* timer_wheel::levels);
+
+//! Wheels of the calling thread
+struct registry
+{
+	std::vector <std::unique_ptr <timer_wheel>> wheels;
+
+	static registry &local()
+	{
+		static thread_local registry reg;
+		return reg;
+	}
+};
+
+std::uint64_t tick_floor (ev::tstamp t) noexcept
+{
+	return static_cast <std::uint64_t> (t / timer_wheel::tick);
+}
+
+std::uint64_t tick_ceil (ev::tstamp t) noexcept
+{
+	return static_cast <std::uint64_t> (std::ceil (t / timer_wheel::tick));
+}
+
+} // namespace
+
+void deadline_histogram::add (double used) noexcept
+{
+	const double limits[buckets - 1u] = {.1, .25, .5, .75, .9, 1.};
+	unsigned b = 0;
+	while (b + 2u < buckets && limits[b] < used)
+		++b;
+	++counts_[b];
+}
+
+std::size_t deadline_histogram::total() const noexcept
+{
+	std::size_t n = 0;
+	for (auto c : counts_)
+		n += c;
+	return n;
+}
+
+deadline_histogram &deadline_histogram::operator+= (const deadline_histogram &o)
+	noexcept
+{
+	for (unsigned b = 0; b < buckets; ++b)
+		counts_[b] += o.counts_[b];
+	return *this;
+}
+
+std::string deadline_histogram::to_string() const
+{
+	const char *const names[buckets] = {"10%", "25%", "50%", "75%", "90%", "100%",
+		"expired"};
+	std::ostringstream ostr;
+	for (unsigned b = 0; b < buckets; ++b)
+	{
+		if (0u < b)
+			ostr << ", ";
+		ostr << names[b] << ": " << counts_[b];
+	}
+	return ostr.str();
+}
+
+timer_wheel::entry::entry (callback_type cb, void *d) noexcept : data (d),
+	callback_ (cb)
+{
+	assert (nullptr != callback_);
+}
+
+void timer_wheel::entry::cancel() noexcept
+{
+	if (nullptr == wheel_)
+		return;
+	auto &w = *wheel_;
+	w.unlink (*this);
+	const ev::tstamp used = w.timer_.loop.now() - armed_at_;
+	w.deadlines_.add (used / seconds_);
+}
+
+timer_wheel::timer_wheel (ev::loop_ref loop)
+{
+	for (auto &h : heads_)
+		h.prev = h.next = &h;
+	timer_.set (loop);
+	timer_.set <callback>(); // ATTN! clears data
+	timer_.data = this; // ATTN! must be set after callback
+	current_ = tick_floor (loop.now()) + 1u;
+}
+
+timer_wheel::~timer_wheel()
+{
+	for (auto &h : heads_)
+		while (h.next != &h)
+			this->unlink (*static_cast <entry *> (h.next));
+	assert (0u == size_);
+}
+
+void timer_wheel::arm (entry &e, double seconds)
+{
+	if (!(0. < seconds))
+		throw std::logic_error ("Too low timeout: " + std::to_string (seconds)
+			+ " seconds");
+	if (e.is_armed())
+		e.wheel_->unlink (e); // moved, not counted as cancelled
+	const ev::tstamp now = timer_.loop.now();
+	if (0u == size_)
+		current_ = std::max (current_, tick_floor (now) + 1u); // catches up
+	std::uint64_t d = tick_ceil (now + seconds);
+	if (d < current_)
+		d = current_;
+	e.deadline_ = d;
+	e.armed_at_ = now;
+	e.seconds_ = seconds;
+	e.wheel_ = this;
+	const std::uint64_t due = this->place (e);
+	++size_;
+	// mostly the same timeouts, so the timer rarely moves
+	if (1u == size_ || due < scheduled_)
+		this->schedule (due);
+}
+
+std::uint64_t timer_wheel::place (entry &e) noexcept
+{
+	assert (current_ <= e.deadline_);
+	const std::uint64_t delta = e.deadline_ - current_;
+	unsigned level = 0;
+	while (level + 1u < levels && (std::uint64_t {1} << (slot_bits * (level + 1u)))
+		<= delta)
+		++level;
+	// too far, re-placed when the top level slot cascades
+	const std::uint64_t at = (delta < span) ? e.deadline_ : current_ + span - 1u;
+	const unsigned shift = slot_bits * level;
+	hook &head = heads_[level * slots + ((at >> shift) & slot_mask)];
+	e.prev = head.prev;
+	e.next = &head;
+	head.prev->next = &e;
+	head.prev = &e;
+	return (at >> shift) << shift;
+}
+
+void timer_wheel::unlink (entry &e) noexcept
+{
+	assert (this == e.wheel_ && nullptr != e.prev && nullptr != e.next);
+	e.prev->next = e.next;
+	e.next->prev = e.prev;
+	e.prev = e.next = nullptr;
+	e.wheel_ = nullptr;
+	assert (0u < size_);
+	if (0u == --size_)
+		timer_.stop(); // does not keep the loop running
+}
+
+std::uint64_t timer_wheel::next_tick() const noexcept
+{
+	assert (0u < size_);
+	// bottom level holds deadlines of the next slots ticks
+	std::uint64_t next = std::numeric_limits <std::uint64_t>::max();
+	for (std::uint64_t i = 0; i < slots; ++i)
+	{
+		const hook &h = heads_[(current_ + i) & slot_mask];
+		if (h.next != &h)
+		{
+			next = current_ + i;
+			break;
+		}
+	}
+	for (unsigned level = 1u; level < levels; ++level)
+	{
+		const unsigned shift = slot_bits * level;
+		// first cascade of the level at or after the current tick
+		const std::uint64_t m0 = (current_ + (std::uint64_t {1} << shift) - 1u) >> shift;
+		for (std::uint64_t k = 0; k < slots && ((m0 + k) << shift) < next; ++k)
+		{
+			const hook &h = heads_[level * slots + ((m0 + k) & slot_mask)];
+			if (h.next != &h)
+			{
+				next = (m0 + k) << shift;
+				break;
+			}
+		}
+	}
+	return next;
+}
+
+void timer_wheel::schedule (std::uint64_t t) noexcept
+{
+	scheduled_ = t;
+	const ev::tstamp after = static_cast <ev::tstamp> (t) * tick
+		- timer_.loop.now();
+	timer_.stop();
+	timer_.start (0. < after ? after : 0.);
+}
+
+void timer_wheel::cascade (unsigned level, std::uint64_t slot)
+{
+	hook &head = heads_[level * slots + slot];
+	if (head.next == &head)
+		return;
+	// detached first, entries may land in the same slot again
+	hook list;
+	list.next = head.next;
+	list.prev = head.prev;
+	list.next->prev = list.prev->next = &list;
+	head.prev = head.next = &head;
+	while (list.next != &list)
+	{
+		auto &e = *static_cast <entry *> (list.next);
+		list.next = e.next;
+		e.next->prev = &list;
+		this->place (e);
+	}
+}
+
+void timer_wheel::advance (std::uint64_t to)
+{
+	while (0u < size_)
+	{
+		// ticks without anything due are skipped
+		const std::uint64_t t = this->next_tick();
+		if (to < t)
+			break;
+		current_ = t;
+		for (unsigned level = 1u; level < levels; ++level)
+		{
+			if (0u != ((t >> (slot_bits * (level - 1u))) & slot_mask))
+				break;
+			this->cascade (level, (t >> (slot_bits * level)) & slot_mask);
+		}
+		hook &head = heads_[t & slot_mask];
+		++current_; // entries armed by callbacks go to later ticks
+		if (head.next == &head)
+			continue;
+		hook list;
+		list.next = head.next;
+		list.prev = head.prev;
+		list.next->prev = list.prev->next = &list;
+		head.prev = head.next = &head;
+		while (list.next != &list)
+		{
+			auto &e = *static_cast <entry *> (list.next);
+			if (t < e.deadline_)
+			{
+				list.next = e.next;
+				e.next->prev = &list;
+				this->place (e);
+				continue;
+			}
+			// callback may cancel other entries of the list or destroy this one
+			this->unlink (e);
+			deadlines_.add_expired();
+			try
+			{
+				e.callback_ (e);
+			}
+			catch (std::exception &err)
+			{
+				log::error ("Timeout failed: ", err.what());
+			}
+		}
+	}
+	if (current_ <= to)
+		current_ = to + 1u;
+}
+
+void timer_wheel::callback (ev::timer &w, int)
+{
+	assert (nullptr != w.data);
+	auto *self = reinterpret_cast <timer_wheel *> (w.data);
+	// fired at the scheduled tick, despite rounding
+	self->advance (std::max (tick_floor (w.loop.now()), self->scheduled_));
+	if (0u < self->size_)
+		self->schedule (self->next_tick());
+}
+
+timer_wheel &timer_wheel::local (ev::loop_ref loop)
+{
+	auto &wheels = registry::local().wheels;
+	for (auto &w : wheels)
+		if (w->serves (loop))
+			return *w;
+	wheels.emplace_back (std::make_unique <timer_wheel> (loop));
+	return *wheels.back();
+}
+
+deadline_histogram timer_wheel::local_stats()
+{
+	deadline_histogram result;
+	for (const auto &w : registry::local().wheels)
+		result += w->deadlines();
+	return result;
+}
+
+} // namespace network
@@ -1,6 +1,9 @@
+#include <algorithm>
+
 #include "network/udp/upstream.hxx"
 #include "network/tcp/upstream.hxx"
 #include "network/net_error.hxx"
+#include "network/udp/upstream_pool.hxx"
 #include "sys/logger.hxx"
 
 namespace network {
@@ -9,10 +12,13 @@ namespace log = process::log;
 
 void upstream::pass_failure_downstream()
 {
-	this->close();
 	// question here could be folded/encrypted
 	//! @todo what if expecting encrypted answer?
-	if( this->question().size() > 0u && this->question().is_dns() )
+	const bool passed = this->question().size() > 0u && this->question().is_dns();
+	answer_follows_ = passed;
+	this->close();
+	answer_follows_ = false;
+	if (passed)
 	{
 		this->question_mod().mark_servfail();
 		assert (this->provider_ptr_);
@@ -26,188 +32,127 @@ void upstream::pass_failure_downstream()
 		log::error ("not passing failure  down: ", this->question().size());
 }
 
-void upstream::start(int sock)
+void upstream::close()
 {
-	this->event_.start(sock, ev::READ);
+	this->timeout::stop();
 }
 
-void upstream::receive_callback (ev::io &w, int
-#ifndef NDEBUG
-	revs
-#endif
-)
+void upstream::expired()
 {
-	assert( 0 != (ev::READ & revs) );
-	assert( 0 == (ev::WRITE & revs) );
-	assert( nullptr != w.data );
-	reinterpret_cast<upstream *>( w.data )->on_receive();
+	this->provider_ptr_->increment_failures();
+	log::debug ("no answer from: ", this->address().ip_port(), ", failures: ",
+		this->provider_ptr_->failures());
+	this->close();
 }
 
-void upstream::send_callback (ev::io &w, int
-#ifndef NDEBUG
-	revents
-#endif
-)
+upstream::upstream (ev::loop_ref loop, std::shared_ptr <provider> &&p,
+	std::unique_ptr <packet> &&pkt, double tsec) : timeout (loop, tsec),
+	question_ptr_ (std::move (pkt)),
+	provider_ptr_(std::move(p)), started_ (loop.now())
 {
-	assert( 0 == (revents & ev::READ) );
-	assert( 0 != (revents&ev::WRITE) );
-	auto *self = reinterpret_cast<upstream *>( w.data );
-	assert (nullptr != self);
-	self->on_send();
+	assert( provider_ptr_ );
+	assert( question_ptr_ );
+	assert (0 < this->question().size());
 }
 
-void upstream::close()
+void upstream::fold_once (const provider::echo_field &e)
 {
-	event_.stop();
-	event_send_.stop();
-	this->timeout::stop();
+	if (folded_)
+		return;
+	auto &q = this->question_mod();
+	this->provider_ptr_->fold (q);
+	folded_ = true;
+	if (e.randomize && q.size() >= e.question_offset + original_id_.size())
+		std::copy_n (q.bytes() + e.question_offset, original_id_.size(),
+			original_id_.begin());
 }
 
-upstream::upstream (std::shared_ptr <provider> &&p, std::unique_ptr <packet> &&pkt,
-	double tsec) : timeout (tsec), question_ptr_ (std::move (pkt)),
-	provider_ptr_(std::move(p))
+void upstream::restore_echo (const provider::echo_field &e, std::uint8_t *field) const
+	noexcept
 {
-	assert( provider_ptr_ );
-	assert( question_ptr_ );
-	assert (0 < this->question().size());
-	event_.set(ev::get_default_loop());
-	event_.set<receive_callback>(); // ATTN! clears event_.data
-	event_.data = this; // ATTN! must be set after callback
-
-	event_send_.set(ev::get_default_loop());
-	event_send_.set<send_callback> (this); // also sets event_.data = 0
-	assert (this == event_send_.data);
-	event_send_.data = this;
+	if (e.randomize && folded_)
+		std::copy_n (original_id_.begin(), original_id_.size(), field);
 }
 
-void upstream::on_send()
+void upstream::on_answer (const std::uint8_t *bytes, unsigned short size,
+	const provider::echo_field &e, const char *proto)
 {
-	const auto &conn = dynamic_cast <abs_connection &> (*this);
-	const auto *tcp_up = dynamic_cast <tcp::upstream *> (this);
-	const bool is_tcp = (nullptr != tcp_up);
-	const char *const proto = is_tcp ? "TCP" : "UDP";
+	auto &m = this->message_mod();
+	m.set_size (0);
+	m.append (bytes, size);
+	this->restore_echo (e, m.modify_bytes() + e.answer_offset);
+	log::debug ("response[", proto, "]: ", size, " from ",
+		this->provider_ptr_->address().ip_port());
 	try
 	{
-		const bool connected = (!is_tcp) || tcp_up->is_connected();
-		if (connected)
-		{
-
-			if( this->question().size() > 0U )
-			{
-				try
-				{
-					log::debug ("sending[", proto, "]: ", this->question().size(),
-						" to: ", conn.address().ip_port());
-					this->provider_ptr()->fold(this->question_mod());
-					conn.send (this->question());
-					// ATTN! shutdown(SHUT_WR) only works on local 127.0.0.1
-					// addresses. It causes subsequent ::recv return 0 (connection
-					// reset by peer) on the external addresses
-					//! @todo keep question for failed responses?
-					this->question_mod().set_size(0);
-				}
-				catch(net_error &e)
-				{
-					log::warning ("Network failure: ", e.what());
-					this->pass_failure_downstream();
-				}
-
-				if( this->question().size() <= 0U ) // done sending
-				{
-					this->start (conn.file_descriptor()); // start receiving
-					this->event_send_.stop(); // stop sending
-				}
-			}
-			else
-				this->event_send_.stop();
-		}
+		answer_follows_ = true;
+		this->close();
+		answer_follows_ = false;
+		this->unfold();
+		this->provider_ptr_->add_answer (this->event_loop().now() - started_);
+		this->pass_answer_downstream();
 	}
-	catch (net_error &e)
+	catch (net_error &err)
 	{
-		log::error ("SEND[", proto, "] to: ", conn.address().ip_port(),
-			", not connected: " , e.what());
+		log::error ("Failed[", proto, "]: ", err.what());
 		this->pass_failure_downstream();
 	}
-#ifndef NDEBUG
-	if( this->event_send_.loop.iteration() > 1000 )
-	{
-		this->event_send_.stop();
-		log::alert ("DEVELOPMENT INTERACTIONS LIMIT");
-		this->event_send_.loop.break_loop (ev::ALL);
-	}
-#endif
 }
 
-
 namespace udp {
 
-//! @todo this socket can be global
-out::out (std::shared_ptr <provider> &&p, std::unique_ptr <packet> &&q, double tsec)
-	: network::upstream (std::move(p), std::move (q), tsec),
-	udp_connection (this->provider_ptr()->address())
+out::out (ev::loop_ref loop, std::shared_ptr <provider> &&p,
+	std::unique_ptr <packet> &&q, double tsec)
+	: network::upstream (loop, std::move(p), std::move (q), tsec),
+	channel_ (pool::local (loop, *this->provider_ptr()).acquire())
+{
+	channel_->enqueue (*this);
+}
+
+void out::close()
 {
-	this->unblock();
-	event_send_.start (this->file_descriptor(), ev::WRITE);
+	this->network::upstream::close();
+	if (channel_)
+		channel_->remove (*this);
 }
 
 } // network::udp
 
 namespace tcp {
 
-void upstream::close()
+upstream::upstream (ev::loop_ref loop, std::shared_ptr<provider> &&p,
+	std::unique_ptr <packet> &&q, double tsec) : network::upstream (loop, std::move(p),
+	std::move (q), tsec),
+	channel_ (pool::local (loop, *this->provider_ptr()).acquire())
 {
-	this->network::upstream::close();
-	this->tcp_connection::close();
+	channel_->enqueue (*this);
 }
 
-upstream::upstream (std::shared_ptr<provider> &&p, std::unique_ptr <packet> &&q,
-	double tsec) : network::upstream (std::move(p), std::move (q), tsec),
-	tcp_connection (this->provider_ptr()->address())
+void upstream::close()
 {
-	this->unblock();
-	event_send_.start(this->file_descriptor(), ev::WRITE);
-	this->tcp_connect();
+	this->network::upstream::close();
+	if (channel_)
+		channel_->remove (*this);
 }
 
-} // namespace network::tcp
-
-void upstream::on_receive()
+bool upstream::retry()
 {
-	const auto &conn = dynamic_cast <abs_connection &> (*this);
-	const auto *tcp_up = dynamic_cast <tcp::upstream *> (this);
-	const char *const proto = (nullptr != tcp_up) ? "TCP" : "UDP";
+	if (retried_ || !this->is_active())
+		return false;
+	retried_ = true;
 	try
 	{
-		if ((nullptr == tcp_up) || tcp_up->is_connected())
-		{
-			try
-			{
-				this->question_mod().set_size(0); // clearing question
-				conn.receive (this->question_mod());
-				log::debug ("response[", proto, "]: ", this->question().size(),
-					" from ", conn.address().ip_port());
-				this->close();
-				this->unfold();
-				this->pass_answer_downstream();
-			}
-			catch(net_error &e)
-			{
-				log::error ("Failed[", proto, "]: ", e.what());
-				this->pass_failure_downstream();
-			}
-		}
-		else
-		{
-			//! @todo max times to try
-			log::debug ("upstream ", proto, " not connected on recv: ",
-				conn.to_string());
-		}
+		channel_ = pool::local (this->event_loop(), *this->provider_ptr()).acquire();
+		channel_->enqueue (*this);
 	}
-	catch(net_error &e)
+	catch (net_error &e)
 	{
-		log::error ("RECV upstream[", proto, "] not connected: ", e.what());
-		this->pass_failure_downstream();
+		log::warning ("Can not retry[TCP]: ", e.what());
+		return false;
 	}
+	return true;
 }
 
+} // namespace network::tcp
+
 } // namespace network
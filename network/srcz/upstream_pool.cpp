@@ -0,0 +1,366 @@
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <limits>
+#include <array>
+
+#include "network/udp/upstream_pool.hxx"
+#include "network/udp/upstream.hxx"
+#include "network/net_error.hxx"
+#include "network/packet.hxx"
+#include "sys/logger.hxx"
+
+namespace network { namespace udp {
+
+namespace log = process::log;
+
+pool_counters &pool_counters::operator+= (const pool_counters &o) noexcept
+{
+	opened += o.opened;
+	rotated += o.rotated;
+	sent += o.sent;
+	answered += o.answered;
+	unmatched += o.unmatched;
+	failed += o.failed;
+	return *this;
+}
+
+namespace {
+
+constexpr const unsigned receive_batch = 8u;
+
+//! Pools and receive buffers of the calling thread
+struct registry
+{
+	std::vector <std::unique_ptr <pool>> pools;
+	pool::limits limits;
+	std::vector <packet> buffers;
+	std::mt19937 random;
+
+	registry() : buffers (receive_batch), random (std::random_device{}())
+	{
+		for (auto &b : buffers)
+			b.reserve (std::numeric_limits <packet::size_type>::max());
+	}
+
+	static registry &local()
+	{
+		static thread_local registry reg;
+		return reg;
+	}
+};
+
+} // namespace
+
+channel::channel (ev::loop_ref loop, const class address &a,
+	const provider::echo_field &e, std::shared_ptr <pool_counters> st)
+	: address_ (a), echo_ (e), sock_ (a.inet()), stats_ (std::move (st)),
+	created_ (loop.now())
+{
+	assert (stats_);
+	if (8u < echo_.size || 0u == echo_.size || (echo_.randomize && 2u != echo_.size))
+		throw std::logic_error ("unsupported provider echo field");
+	sock_.unblock();
+	connect (sock_, address_);
+	++stats_->opened;
+	send_event_.set (loop);
+	send_event_.set <send_callback>(); // ATTN! clears data
+	send_event_.data = this;
+	receive_event_.set (loop);
+	receive_event_.set <receive_callback>();
+	receive_event_.data = this;
+	log::debug ("upstream[UDP] socket: ", sock_.to_string(), " to: ",
+		address_.ip_port());
+}
+
+channel::~channel()
+{
+	assert (queue_.empty() && waiting_.empty());
+	send_event_.stop();
+	receive_event_.stop();
+}
+
+std::uint64_t channel::key (const std::uint8_t *field) const noexcept
+{
+	std::uint64_t result = 0;
+	std::memcpy (&result, field, echo_.size);
+	return result;
+}
+
+void channel::enqueue (out &o)
+{
+	assert (!o.waiting_);
+	queue_.push_back (&o);
+	++uses_;
+	if (!send_event_.is_active())
+		send_event_.start (sock_.file_descriptor(), ev::WRITE);
+	if (!receive_event_.is_active())
+		receive_event_.start (sock_.file_descriptor(), ev::READ);
+}
+
+void channel::stop_if_idle() noexcept
+{
+	if (queue_.empty())
+		send_event_.stop();
+	// idle pooled sockets must not keep the event loop running
+	if (queue_.empty() && waiting_.empty())
+		receive_event_.stop();
+}
+
+void channel::remove (out &o) noexcept
+{
+	auto it = std::find (queue_.begin(), queue_.end(), &o);
+	if (queue_.end() != it)
+		queue_.erase (it);
+	if (o.waiting_)
+	{
+		auto wit = waiting_.find (o.key_);
+		if (waiting_.end() != wit && &o == wit->second)
+			waiting_.erase (wit);
+		o.waiting_ = false;
+	}
+	this->stop_if_idle();
+}
+
+bool channel::prepare (out &o)
+{
+	o.fold_once (echo_);
+	auto &q = o.question_mod();
+	const unsigned end = echo_.question_offset + echo_.size;
+	if (q.size() < end)
+		return false;
+	std::uint8_t *const field = q.modify_bytes() + echo_.question_offset;
+	if (echo_.randomize)
+	{
+		auto &rnd = registry::local().random;
+		std::uniform_int_distribution <unsigned> dist (0u, 0xffffu);
+		// at most 65536 questions wait on a socket, see pool::limits::max_uses
+		do
+		{
+			const unsigned id = dist (rnd);
+			field[0] = static_cast <std::uint8_t> (id >> 8);
+			field[1] = static_cast <std::uint8_t> (id & 0xffu);
+		}
+		while (waiting_.end() != waiting_.find (this->key (field)));
+	}
+	o.key_ = this->key (field);
+	if (!waiting_.emplace (o.key_, &o).second)
+		return false; // the same nonce twice
+	o.waiting_ = true;
+	return true;
+}
+
+void channel::fail (out &o, const char *what)
+{
+	++stats_->failed;
+	this->remove (o);
+	auto &q = o.question_mod();
+	if (q.size() >= echo_.question_offset + echo_.size)
+		o.restore_echo (echo_, q.modify_bytes() + echo_.question_offset);
+	log::warning ("Network failure[UDP] to: ", address_.ip_port(), ", ", what);
+	o.pass_failure_downstream();
+}
+
+void channel::send_callback (ev::io &w, int)
+{
+	assert (nullptr != w.data);
+	reinterpret_cast <channel *> (w.data)->on_send();
+}
+
+void channel::receive_callback (ev::io &w, int)
+{
+	assert (nullptr != w.data);
+	reinterpret_cast <channel *> (w.data)->on_receive();
+}
+
+void channel::on_send()
+{
+	// failures are passed downstream, which may release the last reference
+	const auto self = this->shared_from_this();
+	while (!queue_.empty())
+	{
+		std::array <out*, max_batch_size> batch;
+		const auto n = static_cast <unsigned> (std::min <std::size_t> (queue_.size(),
+			batch.size()));
+		std::copy_n (queue_.begin(), n, batch.begin());
+		queue_.erase (queue_.begin(), queue_.begin() + n);
+		std::array <const_datagram, max_batch_size> dgs;
+		unsigned ready = 0;
+		for (unsigned i = 0; i < n; ++i)
+		{
+			out &o = *batch[i];
+			if (!this->prepare (o))
+			{
+				this->fail (o, "bad question");
+				continue;
+			}
+			batch[ready] = &o;
+			dgs[ready] = const_datagram {o.question().bytes(), o.question().size(),
+				nullptr};
+			++ready;
+		}
+		unsigned done = 0;
+		while (done < ready)
+		{
+			const int r = send_many (sock_, dgs.data() + done, ready - done, 0);
+			if (0 < r)
+			{
+				for (unsigned i = done; i < done + static_cast <unsigned> (r); ++i)
+				{
+					log::debug ("sending[UDP]: ", dgs[i].size, " to: ",
+						address_.ip_port());
+					batch[i]->question_mod().set_size (0);
+				}
+				stats_->sent += static_cast <unsigned> (r);
+				done += static_cast <unsigned> (r);
+				continue;
+			}
+			const int err = get_errno();
+			if (EAGAIN == err || EWOULDBLOCK == err)
+			{
+				// send the rest when the socket is writable again
+				queue_.insert (queue_.begin(), batch.begin() + done, batch.begin()
+					+ ready);
+				for (unsigned i = done; i < ready; ++i)
+				{
+					auto wit = waiting_.find (batch[i]->key_);
+					assert (waiting_.end() != wit);
+					waiting_.erase (wit);
+					batch[i]->waiting_ = false;
+				}
+				return;
+			}
+			this->fail (*batch[done], net_error (err, "send").what());
+			++done;
+		}
+	}
+	this->stop_if_idle();
+}
+
+void channel::answer (const std::uint8_t *bytes, unsigned short size)
+{
+	if (size < echo_.answer_offset + echo_.size)
+	{
+		++stats_->unmatched;
+		return;
+	}
+	auto it = waiting_.find (this->key (bytes + echo_.answer_offset));
+	if (waiting_.end() == it)
+	{
+		++stats_->unmatched;
+		log::debug ("unmatched answer[UDP]: ", size, " from: ", address_.ip_port());
+		return;
+	}
+	out &o = *it->second;
+	waiting_.erase (it);
+	o.waiting_ = false;
+	++stats_->answered;
+	this->stop_if_idle();
+	o.on_answer (bytes, size, echo_, "UDP");
+}
+
+void channel::on_receive()
+{
+	// answers are passed downstream, which may release the last reference
+	const auto self = this->shared_from_this();
+	auto &buffers = registry::local().buffers;
+	assert (receive_batch == buffers.size());
+	std::array <class address, receive_batch> peers;
+	std::array <datagram, receive_batch> dgs;
+	for (;;)
+	{
+		for (unsigned i = 0; i < receive_batch; ++i)
+			dgs[i] = datagram {buffers[i].modify_bytes(), buffers[i].reserved_size(),
+				&peers[i]};
+		const int r = receive_many (sock_, dgs.data(), receive_batch, 0);
+		if (0 >= r)
+		{
+			const int err = get_errno();
+			if (0 > r && EAGAIN != err && EWOULDBLOCK != err)
+				log::warning ("Failed to receive[UDP] from: ", address_.ip_port(),
+					", ", net_error (err, "receive").what());
+			return;
+		}
+		for (unsigned i = 0; i < static_cast <unsigned> (r); ++i)
+		{
+			if (peers[i] == address_)
+				this->answer (dgs[i].bytes, dgs[i].size);
+			else
+				++stats_->unmatched;
+		}
+		if (static_cast <unsigned> (r) < receive_batch)
+			return;
+	}
+}
+
+pool::pool (ev::loop_ref loop, const provider &p) : loop_ (loop),
+	address_ (p.address()), echo_ (p.echo()), limits_ (registry::local().limits),
+	stats_ (std::make_shared <pool_counters>())
+{
+	this->set_limits (limits_);
+}
+
+void pool::set_limits (const limits &l)
+{
+	if (0u == l.sockets || 0u == l.max_uses || 0xffffu < l.max_uses
+		|| 0. >= l.max_age)
+		throw std::logic_error ("invalid upstream UDP pool limits");
+	limits_ = l;
+	channels_.resize (l.sockets);
+	next_ %= l.sockets;
+}
+
+bool pool::serves (ev::loop_ref loop, const provider &p) const noexcept
+{
+	const auto e = p.echo();
+	return loop.raw_loop == loop_.raw_loop && p.address() == address_
+		&& e.question_offset == echo_.question_offset
+		&& e.answer_offset == echo_.answer_offset && e.size == echo_.size
+		&& e.randomize == echo_.randomize;
+}
+
+std::shared_ptr <channel> pool::acquire()
+{
+	auto &ch = channels_[next_];
+	next_ = (next_ + 1u) % limits_.sockets;
+	if (ch && (ch->uses() >= limits_.max_uses || loop_.now() - ch->created()
+		>= limits_.max_age))
+	{
+		// new source port, the old socket lives until its questions are answered
+		ch.reset();
+		++stats_->rotated;
+	}
+	if (!ch)
+		ch = std::make_shared <channel> (loop_, address_, echo_, stats_);
+	return ch;
+}
+
+pool &pool::local (ev::loop_ref loop, const provider &p)
+{
+	auto &pools = registry::local().pools;
+	for (auto &pl : pools)
+		if (pl->serves (loop, p))
+			return *pl;
+	pools.emplace_back (std::make_unique <pool> (loop, p));
+	return *pools.back();
+}
+
+pool_counters pool::local_stats()
+{
+	pool_counters result;
+	for (const auto &pl : registry::local().pools)
+		result += pl->stats();
+	return result;
+}
+
+void pool::set_local_limits (const limits &l)
+{
+	auto &reg = registry::local();
+	for (auto &pl : reg.pools)
+		pl->set_limits (l);
+	reg.limits = l;
+}
+
+}} // namespace network::udp
@@ -0,0 +1,534 @@
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <limits>
+#include <string>
+#include <system_error>
+
+#include "network/tcp/upstream_pool.hxx"
+#include "network/tcp/upstream.hxx"
+#include "network/net_error.hxx"
+#include "network/packet.hxx"
+#include "sys/logger.hxx"
+
+#include "network/preconfig.h"
+// for MSG_NOSIGNAL
+#if defined (HAVE_ARPA_INET_H)
+#include <arpa/inet.h>
+#elif defined (HAVE_WINSOCK2_H)
+#include <winsock2.h>
+#endif
+
+namespace network { namespace tcp {
+
+namespace log = process::log;
+
+pool_counters &pool_counters::operator+= (const pool_counters &o) noexcept
+{
+	opened += o.opened;
+	connect_failures += o.connect_failures;
+	closed += o.closed;
+	sent += o.sent;
+	reused += o.reused;
+	max_reuse = std::max (max_reuse, o.max_reuse);
+	answered += o.answered;
+	unmatched += o.unmatched;
+	retried += o.retried;
+	failed += o.failed;
+	return *this;
+}
+
+void backoff::fail (ev::tstamp now) noexcept
+{
+	delay_ = (0. >= delay_) ? min_ : std::min (2. * delay_, max_);
+	retry_at_ = now + delay_;
+}
+
+namespace {
+
+// length prefix and the largest DNS message
+constexpr const std::size_t max_frame = 2u + 0xffffu;
+
+constexpr const int send_flags =
+#if defined (__linux__) || defined (MSG_NOSIGNAL)
+	MSG_NOSIGNAL; // do not trigger SIGPIPE
+#else
+	0;
+#endif
+
+//! Pools of the calling thread
+struct registry
+{
+	std::vector <std::unique_ptr <pool>> pools;
+	pool::limits limits;
+	std::mt19937 random;
+
+	registry() : random (std::random_device{}()) {}
+
+	static registry &local()
+	{
+		static thread_local registry reg;
+		return reg;
+	}
+};
+
+bool would_block (int err) noexcept
+{
+	return EAGAIN == err || EWOULDBLOCK == err || EINTR == err;
+}
+
+} // namespace
+
+channel::channel (ev::loop_ref loop, const class address &a,
+	const provider::echo_field &e, unsigned max_inflight,
+	std::shared_ptr <pool_counters> st, std::shared_ptr <class backoff> b)
+	: address_ (a), echo_ (e), max_inflight_ (max_inflight), sock_ (a.inet()),
+	input_ (max_frame), stats_ (std::move (st)), backoff_ (std::move (b)),
+	last_used_ (loop.now())
+{
+	assert (stats_ && backoff_);
+	if (8u < echo_.size || 0u == echo_.size || (echo_.randomize && 2u != echo_.size))
+		throw std::logic_error ("unsupported provider echo field");
+	if (0u == max_inflight_)
+		throw std::logic_error ("no questions allowed on upstream connection");
+	sock_.unblock();
+	connect (sock_, address_); // in progress
+	++stats_->opened;
+	send_event_.set (loop);
+	send_event_.set <send_callback>(); // ATTN! clears data
+	send_event_.data = this;
+	receive_event_.set (loop);
+	receive_event_.set <receive_callback>();
+	receive_event_.data = this;
+	log::debug ("upstream[TCP] connection: ", sock_.to_string(), " to: ",
+		address_.ip_port());
+}
+
+channel::~channel()
+{
+	assert (queue_.empty() && waiting_.empty());
+	send_event_.stop();
+	receive_event_.stop();
+	if (0u < uses_)
+		log::debug ("upstream[TCP] connection to: ", address_.ip_port(),
+			" done, questions: ", uses_);
+}
+
+std::uint64_t channel::key (const std::uint8_t *field) const noexcept
+{
+	std::uint64_t result = 0;
+	std::memcpy (&result, field, echo_.size);
+	return result;
+}
+
+void channel::enqueue (upstream &o)
+{
+	assert (!o.waiting_);
+	if (state::closed == state_)
+		throw net_error (ENOTCONN, "upstream[TCP] connection is closed");
+	queue_.push_back (&o);
+	if (0u < uses_++)
+		++stats_->reused;
+	stats_->max_reuse = std::max <std::uint64_t> (stats_->max_reuse, uses_);
+	last_used_ = send_event_.loop.now();
+	if (!send_event_.is_active())
+		send_event_.start (sock_.file_descriptor(), ev::WRITE);
+	if (state::open == state_ && !receive_event_.is_active())
+		receive_event_.start (sock_.file_descriptor(), ev::READ);
+}
+
+void channel::remove (upstream &o) noexcept
+{
+	auto it = std::find (queue_.begin(), queue_.end(), &o);
+	if (queue_.end() != it)
+		queue_.erase (it);
+	if (o.waiting_)
+	{
+		auto wit = waiting_.find (o.key_);
+		if (waiting_.end() != wit && &o == wit->second)
+			waiting_.erase (wit);
+		o.waiting_ = false;
+	}
+	this->stop_if_idle();
+}
+
+void channel::stop_if_idle() noexcept
+{
+	if (output_sent_ == output_.size() && (queue_.empty()
+		|| waiting_.size() >= max_inflight_) && state::connecting != state_)
+		send_event_.stop();
+	// idle connections must not keep the event loop running, closing by peer is
+	// noticed when the connection is used again
+	if (queue_.empty() && waiting_.empty())
+	{
+		send_event_.stop();
+		receive_event_.stop();
+	}
+}
+
+void channel::close() noexcept
+{
+	assert (0u == this->pending());
+	if (state::closed == state_)
+		return;
+	state_ = state::closed;
+	send_event_.stop();
+	receive_event_.stop();
+	try
+	{
+		sock_.close();
+	}
+	catch (std::system_error &e)
+	{
+		log::warning ("Failed to close[TCP] connection to: ", address_.ip_port(),
+			", ", e.what());
+	}
+	++stats_->closed;
+}
+
+bool channel::prepare (upstream &o)
+{
+	o.fold_once (echo_);
+	auto &q = o.question_mod();
+	const unsigned end = echo_.question_offset + echo_.size;
+	if (q.size() < end)
+		return false;
+	std::uint8_t *const field = q.modify_bytes() + echo_.question_offset;
+	if (echo_.randomize)
+	{
+		auto &rnd = registry::local().random;
+		std::uniform_int_distribution <unsigned> dist (0u, 0xffffu);
+		// at most max_inflight questions wait on a connection
+		do
+		{
+			const unsigned id = dist (rnd);
+			field[0] = static_cast <std::uint8_t> (id >> 8);
+			field[1] = static_cast <std::uint8_t> (id & 0xffu);
+		}
+		while (waiting_.end() != waiting_.find (this->key (field)));
+	}
+	o.key_ = this->key (field);
+	if (!waiting_.emplace (o.key_, &o).second)
+		return false; // the same nonce twice
+	o.waiting_ = true;
+	// length prefix, see RFC 7766
+	output_.push_back (static_cast <std::uint8_t> (q.size() >> 8));
+	output_.push_back (static_cast <std::uint8_t> (q.size() & 0xffu));
+	output_.insert (output_.end(), q.bytes(), q.bytes() + q.size());
+	++stats_->sent;
+	log::debug ("sending[TCP]: ", q.size(), " to: ", address_.ip_port());
+	return true;
+}
+
+void channel::fail (upstream &o, const char *what)
+{
+	++stats_->failed;
+	this->remove (o);
+	auto &q = o.question_mod();
+	if (q.size() >= echo_.question_offset + echo_.size)
+		o.restore_echo (echo_, q.modify_bytes() + echo_.question_offset);
+	log::warning ("Network failure[TCP] to: ", address_.ip_port(), ", ", what);
+	o.pass_failure_downstream();
+}
+
+void channel::broken (const char *what)
+{
+	if (state::closed == state_)
+		return;
+	if (state::connecting == state_)
+	{
+		++stats_->connect_failures;
+		backoff_->fail (send_event_.loop.now());
+	}
+	state_ = state::closed;
+	send_event_.stop();
+	receive_event_.stop();
+	try
+	{
+		sock_.close();
+	}
+	catch (std::system_error &)
+	{
+	}
+	++stats_->closed;
+	log::warning ("Connection[TCP] to: ", address_.ip_port(), " closed: ", what,
+		", questions: ", uses_, ", unanswered: ", this->pending());
+	// questions are failed or moved one by one, any of them may be removed
+	// meanwhile, when another one is passed downstream
+	while (!queue_.empty() || !waiting_.empty())
+	{
+		upstream *o = nullptr;
+		if (!queue_.empty())
+		{
+			o = queue_.front();
+			queue_.pop_front();
+		}
+		else
+		{
+			o = waiting_.begin()->second;
+			waiting_.erase (waiting_.begin());
+			o->waiting_ = false;
+		}
+		auto &q = o->question_mod();
+		if (q.size() >= echo_.question_offset + echo_.size)
+			o->restore_echo (echo_, q.modify_bytes() + echo_.question_offset);
+		if (o->retry())
+			++stats_->retried;
+		else
+			this->fail (*o, what);
+	}
+}
+
+void channel::send_callback (ev::io &w, int)
+{
+	assert (nullptr != w.data);
+	reinterpret_cast <channel *> (w.data)->on_send();
+}
+
+void channel::receive_callback (ev::io &w, int)
+{
+	assert (nullptr != w.data);
+	reinterpret_cast <channel *> (w.data)->on_receive();
+}
+
+void channel::on_send()
+{
+	// failures are passed downstream, which may release the last reference
+	const auto self = this->shared_from_this();
+	if (state::connecting == state_)
+	{
+		int err = 0;
+		try
+		{
+			err = sock_.self_error_code();
+		}
+		catch (std::system_error &e)
+		{
+			err = e.code().value();
+		}
+		if (EINPROGRESS == err || EINTR == err)
+			return;
+		if (0 != err)
+		{
+			this->broken (net_error (err, "connect").what());
+			return;
+		}
+		state_ = state::open;
+		backoff_->succeed();
+		log::debug ("upstream[TCP] connected: ", sock_.to_string(), " to: ",
+			address_.ip_port());
+		if (0u < this->pending())
+			receive_event_.start (sock_.file_descriptor(), ev::READ);
+	}
+	for (;;)
+	{
+		if (output_sent_ == output_.size())
+		{
+			output_.clear();
+			output_sent_ = 0;
+			while (!queue_.empty() && waiting_.size() < max_inflight_)
+			{
+				upstream &o = *queue_.front();
+				queue_.pop_front();
+				if (!this->prepare (o))
+					this->fail (o, "bad question");
+			}
+			if (output_.empty())
+				break;
+		}
+		while (output_sent_ < output_.size())
+		{
+			const auto chunk = static_cast <unsigned short> (std::min <std::size_t>
+				(output_.size() - output_sent_, 0xffffu));
+			const ssize_t n = send (sock_, output_.data() + output_sent_, chunk,
+				send_flags);
+			if (0 < n)
+			{
+				output_sent_ += static_cast <std::size_t> (n);
+				continue;
+			}
+			const int err = get_errno();
+			if (0 > n && would_block (err))
+				return; // the rest when the connection is writable again
+			this->broken (net_error (err, "send").what());
+			return;
+		}
+	}
+	this->stop_if_idle();
+}
+
+void channel::answer (const std::uint8_t *bytes, unsigned short size)
+{
+	if (size < echo_.answer_offset + echo_.size)
+	{
+		++stats_->unmatched;
+		return;
+	}
+	auto it = waiting_.find (this->key (bytes + echo_.answer_offset));
+	if (waiting_.end() == it)
+	{
+		++stats_->unmatched;
+		log::debug ("unmatched answer[TCP]: ", size, " from: ", address_.ip_port());
+		return;
+	}
+	upstream &o = *it->second;
+	waiting_.erase (it);
+	o.waiting_ = false;
+	++stats_->answered;
+	// room for more pipelined questions
+	if (!queue_.empty() && !send_event_.is_active())
+		send_event_.start (sock_.file_descriptor(), ev::WRITE);
+	this->stop_if_idle();
+	o.on_answer (bytes, size, echo_, "TCP");
+}
+
+void channel::on_receive()
+{
+	// answers are passed downstream, which may release the last reference
+	const auto self = this->shared_from_this();
+	assert (max_frame == input_.size());
+	while (state::open == state_)
+	{
+		const auto room = static_cast <unsigned short> (std::min <std::size_t>
+			(input_.size() - input_size_, 0xffffu));
+		assert (0u < room);
+		const ssize_t n = receive (sock_, input_.data() + input_size_, room, 0);
+		if (0 > n)
+		{
+			const int err = get_errno();
+			if (!would_block (err))
+				this->broken (net_error (err, "receive").what());
+			return;
+		}
+		if (0 == n)
+		{
+			this->broken ("closed by peer");
+			return;
+		}
+		input_size_ += static_cast <std::size_t> (n);
+		// answers may be split or several in one read
+		std::size_t pos = 0;
+		while (2u <= input_size_ - pos && state::open == state_)
+		{
+			const unsigned size = (static_cast <unsigned> (input_[pos]) << 8)
+				| input_[pos + 1u];
+			if (0u == size)
+			{
+				this->broken ("zero length answer");
+				return;
+			}
+			if (input_size_ - pos < 2u + size)
+				break;
+			this->answer (input_.data() + pos + 2u, static_cast <unsigned short> (size));
+			pos += 2u + size;
+		}
+		if (state::open != state_)
+			return;
+		if (0u < pos)
+		{
+			std::memmove (input_.data(), input_.data() + pos, input_size_ - pos);
+			input_size_ -= pos;
+		}
+		if (static_cast <std::size_t> (n) < room)
+			return;
+	}
+}
+
+pool::pool (ev::loop_ref loop, const provider &p) : loop_ (loop),
+	address_ (p.address()), echo_ (p.echo()), limits_ (registry::local().limits),
+	stats_ (std::make_shared <pool_counters>()),
+	backoff_ (std::make_shared <backoff> (limits_.min_backoff, limits_.max_backoff))
+{
+	this->set_limits (limits_);
+}
+
+void pool::set_limits (const limits &l)
+{
+	if (0u == l.connections || 0u == l.max_inflight || 0xffffu < l.max_inflight
+		|| 0. >= l.idle_timeout || 0. >= l.min_backoff || l.min_backoff > l.max_backoff)
+		throw std::logic_error ("invalid upstream TCP pool limits");
+	limits_ = l;
+	backoff_->set_limits (l.min_backoff, l.max_backoff);
+}
+
+bool pool::serves (ev::loop_ref loop, const provider &p) const noexcept
+{
+	const auto e = p.echo();
+	return loop.raw_loop == loop_.raw_loop && p.address() == address_
+		&& e.question_offset == echo_.question_offset
+		&& e.answer_offset == echo_.answer_offset && e.size == echo_.size
+		&& e.randomize == echo_.randomize;
+}
+
+std::shared_ptr <channel> pool::acquire()
+{
+	const auto now = loop_.now();
+	// forget closed connections, close idle ones
+	for (auto &ch : channels_)
+		if (ch->is_open() && 0u == ch->pending()
+			&& now - ch->last_used() >= limits_.idle_timeout)
+			ch->close();
+	channels_.erase (std::remove_if (channels_.begin(), channels_.end(),
+		[](const std::shared_ptr <channel> &ch) {return !ch->is_open();}),
+		channels_.end());
+	std::shared_ptr <channel> best;
+	for (const auto &ch : channels_)
+		if (!best || ch->pending() < best->pending())
+			best = ch;
+	if (best && best->pending() < limits_.max_inflight)
+		return best;
+	if (channels_.size() < limits_.connections)
+	{
+		if (!backoff_->allows (now))
+		{
+			if (best)
+				return best;
+			throw net_error (EAGAIN, "upstream[TCP] " + address_.ip_port()
+				+ " reconnecting in: " + std::to_string (backoff_->delay()) + "s");
+		}
+		try
+		{
+			channels_.emplace_back (std::make_shared <channel> (loop_, address_, echo_,
+				limits_.max_inflight, stats_, backoff_));
+		}
+		catch (net_error &)
+		{
+			++stats_->connect_failures;
+			backoff_->fail (now);
+			throw;
+		}
+		return channels_.back();
+	}
+	assert (best);
+	return best; // all connections are busy, questions wait in the queue
+}
+
+pool &pool::local (ev::loop_ref loop, const provider &p)
+{
+	auto &pools = registry::local().pools;
+	for (auto &pl : pools)
+		if (pl->serves (loop, p))
+			return *pl;
+	pools.emplace_back (std::make_unique <pool> (loop, p));
+	return *pools.back();
+}
+
+pool_counters pool::local_stats()
+{
+	pool_counters result;
+	for (const auto &pl : registry::local().pools)
+		result += pl->stats();
+	return result;
+}
+
+void pool::set_local_limits (const limits &l)
+{
+	auto &reg = registry::local();
+	for (auto &pl : reg.pools)
+		pl->set_limits (l);
+	reg.limits = l;
+}
+
+}} // namespace network::tcp
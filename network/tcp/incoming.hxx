@@ -1,36 +1,112 @@
 #ifndef NETWORK_TCP_INCOMING_HXX
 #define NETWORK_TCP_INCOMING_HXX
 
+#include <memory>
+
+#include <ev++.h>
+
 #include <network/incoming.hxx>
 #include <network/connection.hxx>
+#include <network/ring_buffer.hxx>
+#include <network/slab.hxx>
 #include <network/dll.hxx>
 
 namespace network {
 
 namespace tcp {
 
-class NETWORK_API in : public network::incoming, public network::tcp_connection
+class tcplistener;
+
+//! Client connection. Reads pipelined length prefixed questions and writes
+//! answers as they complete, in any order (RFC 7766), without waiting for
+//! the peer. Reading pauses while too many questions or answers are pending.
+class NETWORK_API session : public network::tcp_connection,
+	public std::enable_shared_from_this <session>
 {
 public:
 
-	explicit in (std::weak_ptr<class tcplistener> &&);
+	//! questions of one connection, processed at the same time
+	static constexpr const unsigned max_pipelined = 32u;
 
-	// Call to virtual function during destruction will not dispatch to derived class
-	~in() override {this->in::close();}
+	//! answers, not taken by the peer yet, pause reading
+	static constexpr const std::size_t output_limit = 2u * (2u + 0xffffu);
+
+	session (std::weak_ptr <tcplistener> &&, double idle_timeout);
+
+	~session();
+
+	session (const session &) = delete;
+	session &operator= (const session &) = delete;
 
-	void respond(const packet &) override;
+	//! answer is copied, sent as soon as the peer takes it
+	void reply (const packet &);
 
-	void close() override {receive_event_.stop(); this->incoming::close();}
+	//! question is answered or dropped
+	void finished() noexcept;
+
+	void close() noexcept;
+
+	bool is_closed() const noexcept {return closed_;}
+
+	//! in the sessions of the listener, dropped from them on close
+	void set_handle (slab_handle h) noexcept {handle_ = h;}
+
+	std::size_t questions() const noexcept {return questions_;}
 
 private:
 
-	void on_receive();
+	static void read_callback (ev::io &, int);
+
+	static void write_callback (ev::io &, int);
+
+	static void idle_callback (ev::timer &, int);
+
+	void on_read();
+
+	void on_write();
 
-	std::shared_ptr<class tcplistener> listener_ptr() const;
+	void on_idle();
 
-	static void receive_callback(ev::io &w, int revents);
+	//! passes complete questions to listener
+	bool take_questions();
+
+	//! reading and writing according to what is pending
+	void update_events() noexcept;
+
+	std::weak_ptr <tcplistener> listener_ptr_;
+	slab_handle handle_;
+	ring_buffer input_, output_;
+	ev::io read_event_, write_event_;
+	ev::timer idle_;
+	double idle_timeout_;
+	ev::tstamp last_activity_;
+	unsigned pending_ = 0; //!< questions without answer
+	std::size_t questions_ = 0;
+	bool peer_done_ = false; //!< peer shut down sending
+	bool closed_ = false;
+};
+
+//! One question of a client connection
+class NETWORK_API in : public network::incoming
+{
+public:
+
+	in (std::weak_ptr <class tcplistener> &&, std::shared_ptr <session> &&,
+		std::unique_ptr <packet> &&);
+
+	// Call to virtual function during destruction will not dispatch to derived class
+	~in() override {this->in::close();}
+
+	void respond (const packet &) override;
+
+	void close() override;
+
+	const class address &address() const noexcept {return session_->address();}
+
+private:
 
-	ev::io receive_event_;
+	std::shared_ptr <session> session_;
+	bool finished_ = false;
 };
 
 }} // namespace network::tcp
@@ -1,18 +1,38 @@
 #ifndef NETWORK_TCP_LISTENER_HXX
 #define NETWORK_TCP_LISTENER_HXX
 
+#include <vector>
+#include <memory>
+
 #include <network/listener.hxx>
 #include <network/connection.hxx>
+#include <network/slab.hxx>
 #include <network/dll.hxx>
 
 namespace network { namespace tcp {
 
+class session;
+
 class NETWORK_API tcplistener : public network::abs_listener, public tcp_connection,
 	public std::enable_shared_from_this<class tcplistener>
 {
 public:
 	virtual ~tcplistener() = default;
 
+	//! complete question of a client connection, used by session
+	void on_question (std::shared_ptr <session> &&, std::unique_ptr <packet> &&);
+
+	//! closed client connection, used by session
+	void drop (slab_handle) noexcept;
+
+	//! seconds without questions or answers, before a client connection is closed
+	double idle_timeout() const noexcept {return idle_timeout_;}
+
+	void set_idle_timeout (double seconds);
+
+	//! open client connections
+	std::size_t sessions_count() const noexcept {return sessions_.size();}
+
 	static std::shared_ptr<class tcplistener> make_new(
 		std::weak_ptr<network::responder> &&r, const class address &a)
 	{
@@ -38,6 +58,9 @@ private:
 	tcplistener (std::weak_ptr<network::responder> &&, socket_t &&systemd_bound);
 
 	void init (bool do_bind);
+
+	slab <std::shared_ptr <session>> sessions_;
+	double idle_timeout_ = 10.;
 };
 
 using listener = tcplistener;
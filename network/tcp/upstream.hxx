@@ -1,25 +1,40 @@
 #ifndef NETWORK_TCP_UPSTREAM_HXX_
-#define NETWORK_TCP_UPSTREAM_HXX_ 2
+#define NETWORK_TCP_UPSTREAM_HXX_ 3
 
 #include <memory>
 
-#include <network/connection.hxx>
 #include <network/upstream.hxx>
+#include <network/tcp/upstream_pool.hxx>
 #include <network/dll.hxx>
 
 namespace network { namespace tcp {
 
-class NETWORK_API upstream : public ::network::upstream, public tcp_connection
+//! Question pipelined over a connection shared with other questions to the same
+//! provider
+class NETWORK_API upstream : public ::network::upstream
 {
 public:
 
-	upstream (std::shared_ptr <provider> &&p, std::unique_ptr <packet> &&pkt,
-		double tsec);
+	upstream (ev::loop_ref, std::shared_ptr <provider> &&p,
+		std::unique_ptr <packet> &&pkt, double tsec);
 
 	// Call to virtual function during destruction will not dispatch to derived class
 	~upstream() override {this->upstream::close();}
 
 	void close() override;
+
+	const channel &tcp_channel() const {assert (channel_); return *channel_;}
+
+private:
+
+	friend class channel;
+
+	//! sends the question once more over another connection, after the first one
+	//! was closed before the answer
+	bool retry();
+
+	std::shared_ptr <channel> channel_;
+	bool retried_ = false;
 };
 
 }} // namespace network::tcp
@@ -0,0 +1,198 @@
+#ifndef NETWORK_TCP_UPSTREAM_POOL_HXX_
+#define NETWORK_TCP_UPSTREAM_POOL_HXX_
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+#include <ev++.h>
+
+#include <network/address.hxx>
+#include <network/provider.hxx>
+#include <network/socket.hxx>
+#include <network/dll.hxx>
+
+namespace network { namespace tcp {
+
+class upstream;
+
+//! Upstream connection statistics, shared by pool and its channels
+struct pool_counters
+{
+	std::uint64_t opened = 0; //!< connections
+	std::uint64_t connect_failures = 0;
+	std::uint64_t closed = 0; //!< by peer, on failure or when idle
+	std::uint64_t sent = 0; //!< questions
+	std::uint64_t reused = 0; //!< questions sent over an already used connection
+	std::uint64_t max_reuse = 0; //!< most questions sent over one connection
+	std::uint64_t answered = 0; //!< answers paired with questions
+	std::uint64_t unmatched = 0; //!< late or unknown answers
+	std::uint64_t retried = 0; //!< questions moved to another connection
+	std::uint64_t failed = 0; //!< questions failed on connection errors
+
+	pool_counters &operator+= (const pool_counters &) noexcept;
+};
+
+//! Reconnect delay after failed connections, doubled on every failure
+class NETWORK_API backoff
+{
+public:
+
+	backoff (double min_delay, double max_delay) noexcept : min_ (min_delay),
+		max_ (max_delay) {}
+
+	bool allows (ev::tstamp now) const noexcept {return now >= retry_at_;}
+
+	void fail (ev::tstamp now) noexcept;
+
+	void succeed() noexcept {delay_ = 0.; retry_at_ = 0.;}
+
+	double delay() const noexcept {return delay_;}
+
+	void set_limits (double min_delay, double max_delay) noexcept
+	{
+		min_ = min_delay;
+		max_ = max_delay;
+	}
+
+private:
+
+	double min_, max_, delay_ = 0.;
+	ev::tstamp retry_at_ = 0.;
+};
+
+//! Persistent connection to provider, shared by many upstream questions.
+//! Length prefixed questions are pipelined (RFC 7766), answers may come in any
+//! order and are paired with questions by the provider echo field.
+class NETWORK_API channel : public std::enable_shared_from_this <channel>
+{
+public:
+
+	//! @throws net_error if the connection can not be started
+	channel (ev::loop_ref, const class address &, const provider::echo_field &,
+		unsigned max_inflight, std::shared_ptr <pool_counters>,
+		std::shared_ptr <backoff>);
+
+	~channel();
+
+	channel (const channel &) = delete;
+	channel &operator= (const channel &) = delete;
+
+	//! question is folded and written when the connection is ready
+	void enqueue (upstream &);
+
+	//! forgets question, e.g. after timeout, late answer is dropped
+	void remove (upstream &) noexcept;
+
+	//! closes idle connection, it is not used any more
+	void close() noexcept;
+
+	bool is_open() const noexcept {return state::closed != state_;}
+
+	std::size_t pending() const noexcept {return queue_.size() + waiting_.size();}
+
+	std::size_t uses() const noexcept {return uses_;}
+
+	ev::tstamp last_used() const noexcept {return last_used_;}
+
+	const socket_t &tcp_socket() const noexcept {return sock_;}
+
+	int file_descriptor() const noexcept {return sock_.file_descriptor();}
+
+	const class address &address() const noexcept {return address_;}
+
+	const provider::echo_field &echo() const noexcept {return echo_;}
+
+private:
+
+	enum class state {connecting, open, closed};
+
+	static void send_callback (ev::io &, int);
+
+	static void receive_callback (ev::io &, int);
+
+	void on_send();
+
+	void on_receive();
+
+	//! folds question, registers it for the answer and appends it to output
+	bool prepare (upstream &);
+
+	void answer (const std::uint8_t *bytes, unsigned short size);
+
+	//! connection failed or was closed by peer, questions are retried once
+	void broken (const char *what);
+
+	void fail (upstream &, const char *what);
+
+	void stop_if_idle() noexcept;
+
+	std::uint64_t key (const std::uint8_t *field) const noexcept;
+
+	class address address_;
+	provider::echo_field echo_;
+	unsigned max_inflight_;
+	socket_t sock_;
+	ev::io send_event_, receive_event_;
+	state state_ = state::connecting;
+	std::deque <upstream*> queue_;
+	std::unordered_map <std::uint64_t, upstream*> waiting_;
+	std::vector <std::uint8_t> output_, input_;
+	std::size_t output_sent_ = 0, input_size_ = 0;
+	std::shared_ptr <pool_counters> stats_;
+	std::shared_ptr <backoff> backoff_;
+	std::size_t uses_ = 0;
+	ev::tstamp last_used_;
+};
+
+//! Few persistent connections per provider and thread.
+//! Questions go to the least busy connection, new connections are opened up to
+//! the limit, and after failed connections only when the backoff delay is over.
+class NETWORK_API pool
+{
+public:
+
+	struct limits
+	{
+		unsigned connections = 2u;
+		unsigned max_inflight = 64u; //!< pipelined questions per connection
+		double idle_timeout = 10.; // seconds
+		double min_backoff = .5, max_backoff = 30.; // seconds
+	};
+
+	//! pool of the calling thread for the provider address and echo field
+	static pool &local (ev::loop_ref, const provider &);
+
+	//! sum over pools of the calling thread
+	static pool_counters local_stats();
+
+	//! limits for the pools of the calling thread
+	static void set_local_limits (const limits &);
+
+	pool (ev::loop_ref, const provider &);
+
+	//! @throws net_error while reconnecting is backed off, or connect fails
+	std::shared_ptr <channel> acquire();
+
+	const pool_counters &stats() const noexcept {return *stats_;}
+
+	void set_limits (const limits &);
+
+	bool serves (ev::loop_ref, const provider &) const noexcept;
+
+private:
+
+	ev::loop_ref loop_;
+	class address address_;
+	provider::echo_field echo_;
+	limits limits_;
+	std::vector <std::shared_ptr <channel>> channels_;
+	std::shared_ptr <pool_counters> stats_;
+	std::shared_ptr <backoff> backoff_;
+};
+
+}} // namespace network::tcp
+
+#endif
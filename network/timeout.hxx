@@ -1,11 +1,15 @@
 #ifndef NETWORK_TIMEOUT_HXX
 #define NETWORK_TIMEOUT_HXX
 
+#include <cassert>
+
 #include <ev++.h>
+#include <network/timer_wheel.hxx>
 #include <network/dll.hxx>
 
 namespace network {
 
+//! Closes the object when the time is up, armed on the timer wheel of the loop
 // dllexport is needed here for VPTR.
 // It is not enough to mark just the virtual functions dllexport.
 // This issue is only caught with -fsanitize.
@@ -13,23 +17,30 @@ class NETWORK_API timeout
 {
 public:
 
-	explicit timeout (double seconds);
+	timeout (ev::loop_ref, double seconds);
 
 	virtual ~timeout() = default; // because of virtual functions
 
 	virtual void close() = 0; // {}
 
-	void stop() {timeout_.stop(); assert(!timeout_.is_active());}
+	//! the time is up, closes by default
+	virtual void expired() {this->close();}
+
+	void stop() {entry_.cancel(); assert(!entry_.is_armed());}
 
-	bool is_active() const {return timeout_.is_active();}
+	bool is_active() const {return entry_.is_armed();}
 
-	void *event_loop_handle() const noexcept {return timeout_.loop.raw_loop;}
+	void *event_loop_handle() const noexcept {return loop_.raw_loop;}
+
+	ev::loop_ref event_loop() const noexcept {return loop_;}
 
 private:
 
-	ev::timer timeout_;
+	ev::loop_ref loop_;
+
+	timer_wheel::entry entry_;
 
-	static void callback (ev::timer &, int);
+	static void callback (timer_wheel::entry &);
 };
 
 } // namespace network
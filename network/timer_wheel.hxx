@@ -0,0 +1,154 @@
+#ifndef NETWORK_TIMER_WHEEL_HXX_
+#define NETWORK_TIMER_WHEEL_HXX_
+
+#include <array>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include <ev++.h>
+
+#include <network/dll.hxx>
+
+namespace network {
+
+//! How much of their timeout requests used, counted when they are cancelled
+class NETWORK_API deadline_histogram
+{
+public:
+
+	//! up to 10%, 25%, 50%, 75%, 90%, 100% of the timeout, expired
+	static constexpr const unsigned buckets = 7u;
+
+	//! used is the elapsed part of the timeout
+	void add (double used) noexcept;
+
+	void add_expired() noexcept {++counts_[buckets - 1u];}
+
+	std::size_t expired() const noexcept {return counts_[buckets - 1u];}
+
+	std::size_t total() const noexcept;
+
+	deadline_histogram &operator+= (const deadline_histogram &) noexcept;
+
+	std::string to_string() const;
+
+private:
+
+	std::array <std::size_t, buckets> counts_ {{}};
+};
+
+//! Timeouts of one event loop, in a hierarchical wheel of coarse ticks.
+//! Arming and cancelling are O(1). A single libev timer wakes the wheel for
+//! the next tick with something to expire or to cascade, and only while
+//! something is armed. Deadlines are rounded up to the next tick.
+class NETWORK_API timer_wheel
+{
+public:
+
+	static constexpr const unsigned slot_bits = 6u, levels = 4u;
+
+	static constexpr const unsigned slots = 1u << slot_bits;
+
+	//! seconds
+	static constexpr const double tick = 1. / 64.;
+
+private:
+
+	struct hook
+	{
+		hook *prev = nullptr, *next = nullptr;
+	};
+
+public:
+
+	//! Handle of one timeout, cancelled when destroyed
+	class NETWORK_API entry : private hook
+	{
+	public:
+
+		typedef void (*callback_type) (entry &);
+
+		entry (callback_type, void *data) noexcept;
+
+		~entry() {this->cancel();}
+
+		entry (const entry &) = delete;
+		entry &operator= (const entry &) = delete;
+
+		bool is_armed() const noexcept {return nullptr != wheel_;}
+
+		void cancel() noexcept;
+
+		void *data;
+
+	private:
+
+		friend class timer_wheel;
+
+		callback_type callback_;
+		timer_wheel *wheel_ = nullptr;
+		std::uint64_t deadline_ = 0; //!< tick
+		ev::tstamp armed_at_ = 0.;
+		double seconds_ = 0.;
+	};
+
+	explicit timer_wheel (ev::loop_ref);
+
+	//! armed entries are left unarmed
+	~timer_wheel();
+
+	timer_wheel (const timer_wheel &) = delete;
+	timer_wheel &operator= (const timer_wheel &) = delete;
+
+	//! re-arms an armed entry, its callback is called once after seconds
+	void arm (entry &, double seconds);
+
+	//! armed entries
+	std::size_t size() const noexcept {return size_;}
+
+	const deadline_histogram &deadlines() const noexcept {return deadlines_;}
+
+	bool serves (ev::loop_ref loop) const noexcept
+	{
+		return loop.raw_loop == timer_.loop.raw_loop;
+	}
+
+	//! wheel of the calling thread for the loop
+	static timer_wheel &local (ev::loop_ref);
+
+	//! deadlines of all wheels of the calling thread
+	static deadline_histogram local_stats();
+
+private:
+
+	static void callback (ev::timer &, int);
+
+	//! expires entries up to and including the tick
+	void advance (std::uint64_t to);
+
+	//! moves entries of a higher level slot closer to the bottom
+	void cascade (unsigned level, std::uint64_t slot);
+
+	//! links into the slot for the deadline, returns the tick the slot is due
+	std::uint64_t place (entry &) noexcept;
+
+	//! first tick with a slot to expire or cascade
+	std::uint64_t next_tick() const noexcept;
+
+	//! wakes up at the tick
+	void schedule (std::uint64_t at) noexcept;
+
+	void unlink (entry &) noexcept;
+
+	std::array <hook, levels * slots> heads_;
+	ev::timer timer_;
+	std::uint64_t current_ = 0; //!< next tick to expire
+	std::uint64_t scheduled_ = 0; //!< tick of the libev timer
+	std::size_t size_ = 0;
+	deadline_histogram deadlines_;
+};
+
+} // namespace network
+
+#endif
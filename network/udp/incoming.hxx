@@ -13,6 +13,10 @@ public:
 
 	explicit in (std::weak_ptr<class udplistener> &&);
 
+	//! for datagram already received in a batch
+	in (std::weak_ptr<class udplistener> &&, std::unique_ptr<packet> &&,
+		class address &&);
+
 	~in() override {}
 
 	void respond(const packet &) override;
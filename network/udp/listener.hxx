@@ -1,12 +1,43 @@
 #ifndef NETWORK_UDP_LISTENER_HXX
 #define NETWORK_UDP_LISTENER_HXX
 
+#include <array>
+#include <string>
+#include <cstdint>
+
 #include <network/listener.hxx>
 #include <network/connection.hxx>
+#include <network/packet.hxx>
 #include <network/dll.hxx>
 
 namespace network { namespace udp {
 
+//! Distribution of datagram counts per system call, in power of two buckets:
+//! 1, 2-3, 4-7, ..., 64 and more
+class NETWORK_API batch_histogram
+{
+public:
+
+	static constexpr const unsigned buckets = 7u;
+
+	void add (unsigned n) noexcept;
+
+	std::uint64_t count (unsigned bucket) const {return counts_.at (bucket);}
+
+	//! number of system calls
+	std::uint64_t batches() const noexcept {return batches_;}
+
+	//! number of datagrams
+	std::uint64_t datagrams() const noexcept {return datagrams_;}
+
+	std::string to_string() const;
+
+private:
+
+	std::array <std::uint64_t, buckets> counts_ {{}};
+	std::uint64_t batches_ = 0, datagrams_ = 0;
+};
+
 class NETWORK_API udplistener : public network::abs_listener, public udp_connection,
 	public std::enable_shared_from_this<udplistener>
 {
@@ -27,16 +58,47 @@ public:
 				std::move (s)));
 	}
 
+	//! Datagrams to drain per wakeup, 1 disables batching
+	void set_batch_size (unsigned);
+
+	unsigned batch_size() const noexcept {return batch_size_;}
+
+	const batch_histogram &received_batches() const noexcept {return received_;}
+
+	const batch_histogram &sent_batches() const noexcept {return sent_;}
+
+	//! Sends at once, or queues until the end of the current batch.
+	//! @param owned message belongs to an incoming request, which outlives the batch
+	void udp_reply (const packet &message, const class address &, bool owned);
+
 private:
 
 	void make_incoming() override;
 
+	void receive_batch();
+
+	void flush_replies();
+
 	udplistener(std::weak_ptr<network::responder> &&, const class address &);
 
 	// Use created and bound systemd socket
 	udplistener (std::weak_ptr<network::responder> &&, socket_t &&systemd_bound);
 
 	void init (bool do_bind);
+
+	struct reply
+	{
+		const packet *message; // nullptr for copied message
+		packet copy;
+		class address peer;
+	};
+
+	unsigned batch_size_;
+	bool batching_ = false;
+	std::vector <std::unique_ptr <packet>> spare_; // buffers for the next batch
+	std::vector <class address> peers_;
+	std::vector <reply> replies_;
+	batch_histogram received_, sent_;
 };
 
 using listener = udplistener;
@@ -1,22 +1,34 @@
 #ifndef NETWORK_UDP_UPSTREAM_HXX_
-#define NETWORK_UDP_UPSTREAM_HXX_ 2
+#define NETWORK_UDP_UPSTREAM_HXX_ 3
+
+#include <memory>
 
-#include <network/connection.hxx>
 #include <network/upstream.hxx>
+#include <network/udp/upstream_pool.hxx>
 #include <network/dll.hxx>
 
 namespace network { namespace udp {
 
-class NETWORK_API out : public ::network::upstream, public network::udp_connection
+//! Question sent over a socket shared with other questions to the same provider
+class NETWORK_API out : public ::network::upstream
 {
 public:
 
-	out (std::shared_ptr <provider> &&p, std::unique_ptr <packet> &&pkt,
+	out (ev::loop_ref, std::shared_ptr <provider> &&p, std::unique_ptr <packet> &&pkt,
 		double tsec);
 
-	virtual ~out() = default; // because of virtual functions
+	// Call to virtual function during destruction will not dispatch to derived class
+	~out() override {this->out::close();}
+
+	void close() override;
+
+	const channel &udp_channel() const {assert (channel_); return *channel_;}
+
+private:
+
+	friend class channel;
 
-	void close() override {this->upstream::close(); this->udp_connection::close();}
+	std::shared_ptr <channel> channel_;
 };
 
 }} // namespace network::udp
@@ -0,0 +1,146 @@
+#ifndef NETWORK_UDP_UPSTREAM_POOL_HXX_
+#define NETWORK_UDP_UPSTREAM_POOL_HXX_
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+#include <ev++.h>
+
+#include <network/address.hxx>
+#include <network/provider.hxx>
+#include <network/socket.hxx>
+#include <network/dll.hxx>
+
+namespace network { namespace udp {
+
+class out;
+
+//! Upstream socket statistics, shared by pool and its channels
+struct pool_counters
+{
+	std::uint64_t opened = 0; //!< sockets created
+	std::uint64_t rotated = 0; //!< sockets replaced after max uses or max age
+	std::uint64_t sent = 0; //!< questions
+	std::uint64_t answered = 0; //!< answers paired with questions
+	std::uint64_t unmatched = 0; //!< late, duplicate or spoofed answers
+	std::uint64_t failed = 0; //!< send failures
+
+	pool_counters &operator+= (const pool_counters &) noexcept;
+};
+
+//! Long-lived connected UDP socket, shared by many upstream questions.
+//! Questions are sent in batches, answers are paired with questions by the
+//! provider echo field, see network::provider::echo
+class NETWORK_API channel : public std::enable_shared_from_this <channel>
+{
+public:
+
+	channel (ev::loop_ref, const class address &, const provider::echo_field &,
+		std::shared_ptr <pool_counters>);
+
+	~channel();
+
+	channel (const channel &) = delete;
+	channel &operator= (const channel &) = delete;
+
+	//! question is folded and sent in the next loop iteration
+	void enqueue (out &);
+
+	//! forgets question, e.g. after timeout, late answer is dropped
+	void remove (out &) noexcept;
+
+	std::size_t pending() const noexcept {return queue_.size() + waiting_.size();}
+
+	std::size_t uses() const noexcept {return uses_;}
+
+	ev::tstamp created() const noexcept {return created_;}
+
+	const socket_t &udp_socket() const noexcept {return sock_;}
+
+	int file_descriptor() const noexcept {return sock_.file_descriptor();}
+
+	const class address &address() const noexcept {return address_;}
+
+	const provider::echo_field &echo() const noexcept {return echo_;}
+
+private:
+
+	static void send_callback (ev::io &, int);
+
+	static void receive_callback (ev::io &, int);
+
+	void on_send();
+
+	void on_receive();
+
+	//! folds question and registers it for the answer
+	bool prepare (out &);
+
+	void answer (const std::uint8_t *bytes, unsigned short size);
+
+	void fail (out &, const char *what);
+
+	void stop_if_idle() noexcept;
+
+	std::uint64_t key (const std::uint8_t *field) const noexcept;
+
+	class address address_;
+	provider::echo_field echo_;
+	socket_t sock_;
+	ev::io send_event_, receive_event_;
+	std::vector <out*> queue_;
+	std::unordered_map <std::uint64_t, out*> waiting_;
+	std::shared_ptr <pool_counters> stats_;
+	std::size_t uses_ = 0;
+	ev::tstamp created_;
+};
+
+//! Few channels per provider and thread, used in turn.
+//! Channels are replaced after a number of questions or seconds to change
+//! the source port, and closed when the last question is answered.
+class NETWORK_API pool
+{
+public:
+
+	struct limits
+	{
+		unsigned sockets = 4u;
+		std::size_t max_uses = 4096u;
+		double max_age = 300.; // seconds
+	};
+
+	//! pool of the calling thread for the provider address and echo field
+	static pool &local (ev::loop_ref, const provider &);
+
+	//! sum over pools of the calling thread
+	static pool_counters local_stats();
+
+	//! limits for the pools of the calling thread
+	static void set_local_limits (const limits &);
+
+	pool (ev::loop_ref, const provider &);
+
+	std::shared_ptr <channel> acquire();
+
+	const pool_counters &stats() const noexcept {return *stats_;}
+
+	void set_limits (const limits &);
+
+	bool serves (ev::loop_ref, const provider &) const noexcept;
+
+private:
+
+	ev::loop_ref loop_;
+	class address address_;
+	provider::echo_field echo_;
+	limits limits_;
+	std::vector <std::shared_ptr <channel>> channels_;
+	unsigned next_ = 0;
+	std::shared_ptr <pool_counters> stats_;
+};
+
+}} // namespace network::udp
+
+#endif
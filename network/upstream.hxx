@@ -1,7 +1,9 @@
 #ifndef NETWORK_UPSTREAM_HXX
 #define NETWORK_UPSTREAM_HXX
 
+#include <array>
 #include <cassert>
+#include <cstdint>
 
 #include <network/packet.hxx>
 #include <network/timeout.hxx>
@@ -28,18 +30,31 @@ public:
 	//! @todo: obsolete
 	const packet &question() const {assert( question_ptr_); return *question_ptr_;}
 
+	//! hands the answer over downstream, without copying it
+	std::unique_ptr <packet> release_message()
+	{
+		assert (question_ptr_);
+		return std::move (question_ptr_);
+	}
+
 	virtual void pass_answer_downstream() {}
 
 	virtual void close();
 
+	//! no answer in time, counts as a provider failure
+	void expired() override;
+
 	void unfold() { this->provider_ptr_->unfold(this->message_mod()); }
 
-protected:
+	const class address &address() const noexcept
+	{
+		return this->provider_ptr_->address();
+	}
 
-	upstream (std::shared_ptr <provider> &&p, std::unique_ptr <packet> &&pkt,
-		double tsec);
+protected:
 
-	void start(int sock);
+	upstream (ev::loop_ref, std::shared_ptr <provider> &&p,
+		std::unique_ptr <packet> &&pkt, double tsec);
 
 	void pass_failure_downstream();
 
@@ -49,23 +64,37 @@ protected:
 
 	const std::shared_ptr<provider> & provider_ptr() const {return provider_ptr_;}
 
-	ev::io event_send_;
+	//! folds the question only once, keeps the echo field for restore_echo
+	void fold_once (const provider::echo_field &);
 
-private:
+	//! puts the original echo field back into the folded question or the answer
+	void restore_echo (const provider::echo_field &, std::uint8_t *field) const
+		noexcept;
 
-	static void receive_callback (ev::io &, int );
+	//! copies the answer of a shared upstream socket into the message buffer
+	void on_answer (const std::uint8_t *bytes, unsigned short size,
+		const provider::echo_field &, const char *proto);
 
-	virtual void on_receive();
+	//! close() is followed by pass_answer_downstream(), with an answer or a
+	//! failure; any other close ends the question without one
+	bool answer_follows() const noexcept {return answer_follows_;}
 
-	ev::io event_;
+	std::uint64_t key_ = 0; //!< echo field as sent, see provider::echo
+	bool waiting_ = false; //!< registered for the answer
+
+private:
 
 	std::unique_ptr <packet> question_ptr_;
 
 	std::shared_ptr<provider> provider_ptr_;
 
-	virtual void on_send();
+	std::array <std::uint8_t, 2> original_id_ {{0u, 0u}};
+
+	ev::tstamp started_; //!< for the provider answer time
+
+	bool folded_ = false;
 
-	static void send_callback(ev::io &, int);
+	bool answer_follows_ = false;
 };
 
 } // namespace network
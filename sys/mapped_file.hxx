@@ -0,0 +1,46 @@
+#ifndef _SYS_MAPPED_FILE_HXX
+#define _SYS_MAPPED_FILE_HXX
+
+#include <sys/dll.hxx>
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace sys
+{
+
+//! Read only view of a whole file, memory mapped where the system allows,
+//! read in one go otherwise
+class SYS_API mapped_file
+{
+public:
+
+	//! throws std::runtime_error if the file can not be read
+	explicit mapped_file (const std::string &file_name);
+
+	~mapped_file();
+
+	mapped_file (mapped_file &&) noexcept;
+	mapped_file &operator= (mapped_file &&) noexcept;
+
+	mapped_file (const mapped_file &) = delete;
+	mapped_file &operator= (const mapped_file &) = delete;
+
+	const std::uint8_t *data() const noexcept {return data_;}
+
+	std::size_t size() const noexcept {return size_;}
+
+private:
+
+	void unmap() noexcept;
+
+	const std::uint8_t *data_ = nullptr;
+	std::size_t size_ = 0;
+	bool mapped_ = false;
+	std::vector <std::uint8_t> copy_; //!< without mmap
+};
+
+} // namespace sys
+#endif
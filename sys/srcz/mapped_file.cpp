@@ -0,0 +1,114 @@
+#include <stdexcept>
+#include <system_error>
+#include <fstream>
+#include <utility>
+#include <cerrno>
+
+#include "sys/mapped_file.hxx"
+#include "sys/preconfig.h"
+
+#if defined (HAVE_SYS_MMAN_H) && defined (HAVE_UNISTD_H) && defined (HAVE_FCNTL_H) \
+	&& defined (HAVE_SYS_STAT_H)
+#  define SYS_MMAP 1
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+namespace sys
+{
+
+namespace {
+
+[[noreturn]] void fail (const std::string &what, const std::string &file_name)
+{
+	throw std::system_error (errno, std::system_category(), what + ": "
+		+ file_name);
+}
+
+} // namespace
+
+mapped_file::mapped_file (const std::string &file_name)
+{
+#ifdef SYS_MMAP
+	const int fd = ::open (file_name.c_str(), O_RDONLY);
+	if (0 > fd)
+		fail ("Failed to open", file_name);
+	struct stat st;
+	if (0 != ::fstat (fd, &st))
+	{
+		const int e = errno;
+		::close (fd);
+		errno = e;
+		fail ("Failed to stat", file_name);
+	}
+	size_ = static_cast <std::size_t> (st.st_size);
+	if (0u < size_)
+	{
+		void *const p = ::mmap (nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (MAP_FAILED == p)
+		{
+			const int e = errno;
+			::close (fd);
+			errno = e;
+			fail ("Failed to map", file_name);
+		}
+		data_ = static_cast <const std::uint8_t *> (p);
+		mapped_ = true;
+	}
+	::close (fd); // the mapping stays
+#else
+	std::ifstream ifile (file_name, std::ios::binary | std::ios::ate);
+	if (!ifile)
+		throw std::runtime_error ("Failed to open: " + file_name);
+	copy_.resize (static_cast <std::size_t> (ifile.tellg()));
+	ifile.seekg (0);
+	ifile.read (reinterpret_cast <char *> (copy_.data()), static_cast
+		<std::streamsize> (copy_.size()));
+	if (!ifile)
+		throw std::runtime_error ("Failed to read: " + file_name);
+	data_ = copy_.data();
+	size_ = copy_.size();
+#endif
+}
+
+mapped_file::~mapped_file()
+{
+	this->unmap();
+}
+
+mapped_file::mapped_file (mapped_file &&o) noexcept : data_ (o.data_),
+	size_ (o.size_), mapped_ (o.mapped_), copy_ (std::move (o.copy_))
+{
+	o.data_ = nullptr;
+	o.size_ = 0;
+	o.mapped_ = false;
+}
+
+mapped_file &mapped_file::operator= (mapped_file &&o) noexcept
+{
+	if (this != &o)
+	{
+		this->unmap();
+		std::swap (data_, o.data_);
+		std::swap (size_, o.size_);
+		std::swap (mapped_, o.mapped_);
+		copy_.swap (o.copy_);
+	}
+	return *this;
+}
+
+void mapped_file::unmap() noexcept
+{
+#ifdef SYS_MMAP
+	if (mapped_)
+		::munmap (const_cast <std::uint8_t *> (data_), size_);
+#endif
+	mapped_ = false;
+	data_ = nullptr;
+	size_ = 0;
+	copy_.clear();
+}
+
+} // namespace sys
@@ -0,0 +1,46 @@
+#undef NDEBUG
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include "backtrace/catch.hxx"
+#include "sys/mapped_file.hxx"
+
+void run()
+{
+	const char fn[] = "tst-tmp-mapped.bin";
+	{
+		std::ofstream ofile (fn, std::ios::binary);
+		ofile << "mapped file contents";
+	}
+	sys::mapped_file m (fn);
+	assert (20u == m.size() && 0 == std::memcmp (m.data(), "mapped file contents",
+		m.size()));
+	sys::mapped_file moved (std::move (m));
+	assert (0u == m.size() && nullptr == m.data() && 20u == moved.size());
+	std::remove (fn);
+	// still mapped after the file is gone
+	assert ('m' == moved.data()[0]);
+	bool thrown = false;
+	try
+	{
+		sys::mapped_file missing (fn);
+	}
+	catch (std::runtime_error &e)
+	{
+		std::cout << "expected: " << e.what() << std::endl;
+		thrown = true;
+	}
+	assert (thrown);
+	std::ofstream (fn, std::ios::binary).close();
+	assert (0u == sys::mapped_file (fn).size());
+	std::remove (fn);
+}
+
+int main()
+{
+	return trace::catch_all_errors (run);
+}